@@ -0,0 +1,237 @@
+#include <cstdint>
+#include <cstring>
+
+#include "common/utils.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AG_ASCII_CASE_SSE2 1
+#include <emmintrin.h>
+// AVX2 is used only if the CPU supports it, which is checked in runtime
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(_WIN32)
+#define AG_ASCII_CASE_AVX2 1
+#include <immintrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define AG_ASCII_CASE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace ag::utils::detail {
+
+static constexpr uint64_t SWAR_ONES = 0x0101010101010101ULL;
+static constexpr uint64_t SWAR_HIGH_BITS = 0x8080808080808080ULL;
+
+static inline uint64_t load64(const char *p) {
+    uint64_t x;
+    std::memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+// Lower-case the ASCII letters of 8 bytes at once, leaving the other bytes intact
+static inline uint64_t swar_fold(uint64_t x) {
+    uint64_t heptets = x & ~SWAR_HIGH_BITS;
+    uint64_t ge_a = heptets + (0x80 - 'A') * SWAR_ONES;
+    uint64_t gt_z = heptets + (0x80 - 'Z' - 1) * SWAR_ONES;
+    uint64_t is_upper = ge_a & ~gt_z & ~x & SWAR_HIGH_BITS;
+    return x | (is_upper >> 2);
+}
+
+static inline bool scalar_iequals(const char *lhs, const char *rhs, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        if (ascii_to_lower(lhs[i]) != ascii_to_lower(rhs[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Compare the strings shorter than a vector register
+static inline bool short_iequals(const char *lhs, const char *rhs, size_t length) {
+    if (length >= 8) {
+        // Two overlapping words cover 8..16 bytes
+        return (swar_fold(load64(lhs)) == swar_fold(load64(rhs)))
+                && (swar_fold(load64(lhs + length - 8)) == swar_fold(load64(rhs + length - 8)));
+    }
+    return scalar_iequals(lhs, rhs, length);
+}
+
+static inline int count_trailing_zeros(uint32_t x) {
+#ifdef _MSC_VER
+    unsigned long index; // NOLINT(*-runtime-int)
+    _BitScanForward(&index, x);
+    return int(index);
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+#ifdef AG_ASCII_CASE_SSE2
+
+static inline __m128i sse2_fold(__m128i v) {
+    // Move 'A'..'Z' to the bottom of the signed range to detect them with a single signed comparison
+    __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8(char(0x80 - 'A')));
+    __m128i is_upper = _mm_cmplt_epi8(shifted, _mm_set1_epi8(char(0x80 + 26)));
+    return _mm_or_si128(v, _mm_and_si128(is_upper, _mm_set1_epi8(0x20)));
+}
+
+static inline bool sse2_equal16(const char *lhs, const char *rhs) {
+    __m128i l = sse2_fold(_mm_loadu_si128((const __m128i *) lhs));
+    __m128i r = sse2_fold(_mm_loadu_si128((const __m128i *) rhs));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(l, r)) == 0xffff;
+}
+
+static bool sse2_iequals(const char *lhs, const char *rhs, size_t length) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        if (!sse2_equal16(lhs + i, rhs + i)) {
+            return false;
+        }
+    }
+    // Overlap the last block with the previous ones
+    return i == length || sse2_equal16(lhs + length - 16, rhs + length - 16);
+}
+
+// Bit mask of the positions in 16 bytes at `p` equal to `c` ignoring case
+static inline uint32_t sse2_match16(const char *p, __m128i c) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(sse2_fold(_mm_loadu_si128((const __m128i *) p)), c));
+}
+
+#endif // AG_ASCII_CASE_SSE2
+
+#ifdef AG_ASCII_CASE_AVX2
+
+__attribute__((target("avx2"))) static inline __m256i avx2_fold(__m256i v) {
+    __m256i shifted = _mm256_add_epi8(v, _mm256_set1_epi8(char(0x80 - 'A')));
+    __m256i is_upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(char(0x80 + 26)), shifted);
+    return _mm256_or_si256(v, _mm256_and_si256(is_upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2"))) static bool avx2_iequals(const char *lhs, const char *rhs, size_t length) {
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i l = avx2_fold(_mm256_loadu_si256((const __m256i *) (lhs + i)));
+        __m256i r = avx2_fold(_mm256_loadu_si256((const __m256i *) (rhs + i)));
+        if (uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(l, r))) != UINT32_MAX) {
+            return false;
+        }
+    }
+    // Overlap the last block with the previous ones
+    return i == length || avx2_iequals(lhs + length - 32, rhs + length - 32, 32);
+}
+
+static bool has_avx2() {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+#endif // AG_ASCII_CASE_AVX2
+
+#ifdef AG_ASCII_CASE_NEON
+
+static inline uint8x16_t neon_fold(uint8x16_t v) {
+    uint8x16_t is_upper = vcltq_u8(vsubq_u8(v, vdupq_n_u8('A')), vdupq_n_u8(26));
+    return vorrq_u8(v, vandq_u8(is_upper, vdupq_n_u8(0x20)));
+}
+
+static inline bool neon_equal16(const char *lhs, const char *rhs) {
+    uint8x16_t l = neon_fold(vld1q_u8((const uint8_t *) lhs));
+    uint8x16_t r = neon_fold(vld1q_u8((const uint8_t *) rhs));
+    return vminvq_u8(vceqq_u8(l, r)) == UINT8_MAX;
+}
+
+static bool neon_iequals(const char *lhs, const char *rhs, size_t length) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        if (!neon_equal16(lhs + i, rhs + i)) {
+            return false;
+        }
+    }
+    return i == length || neon_equal16(lhs + length - 16, rhs + length - 16);
+}
+
+// Bit mask of the positions in 16 bytes at `p` equal to `c` ignoring case
+static inline uint32_t neon_match16(const char *p, uint8x16_t c) {
+    uint8x16_t eq = vceqq_u8(neon_fold(vld1q_u8((const uint8_t *) p)), c);
+    // Gather the lowest bit of each byte into a 16-bit mask
+    static constexpr uint8_t BITS[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t masked = vandq_u8(eq, vld1q_u8(BITS));
+    return vaddv_u8(vget_low_u8(masked)) | (uint32_t(vaddv_u8(vget_high_u8(masked))) << 8);
+}
+
+#endif // AG_ASCII_CASE_NEON
+
+bool ascii_iequals(const char *lhs, const char *rhs, size_t length) {
+    if (length < 16) {
+        return short_iequals(lhs, rhs, length);
+    }
+#if defined(AG_ASCII_CASE_AVX2)
+    if (length >= 32 && has_avx2()) {
+        return avx2_iequals(lhs, rhs, length);
+    }
+    return sse2_iequals(lhs, rhs, length);
+#elif defined(AG_ASCII_CASE_SSE2)
+    return sse2_iequals(lhs, rhs, length);
+#elif defined(AG_ASCII_CASE_NEON)
+    return neon_iequals(lhs, rhs, length);
+#else
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        if (swar_fold(load64(lhs + i)) != swar_fold(load64(rhs + i))) {
+            return false;
+        }
+    }
+    return i == length || swar_fold(load64(lhs + length - 8)) == swar_fold(load64(rhs + length - 8));
+#endif
+}
+
+size_t ascii_ifind(std::string_view haystack, std::string_view needle) {
+    if (needle.empty()) {
+        return 0;
+    }
+    if (haystack.size() < needle.size()) {
+        return std::string_view::npos;
+    }
+
+    char first = ascii_to_lower(needle.front());
+    std::string_view rest = needle.substr(1);
+    // Positions where the needle may start
+    size_t candidates = haystack.size() - needle.size() + 1;
+    size_t pos = 0;
+
+#if defined(AG_ASCII_CASE_SSE2) || defined(AG_ASCII_CASE_NEON)
+#ifdef AG_ASCII_CASE_SSE2
+    __m128i c = _mm_set1_epi8(first);
+#else
+    uint8x16_t c = vdupq_n_u8(first);
+#endif
+    // Scan for the first character of the needle 16 positions at a time
+    for (; pos + 16 <= candidates; pos += 16) {
+#ifdef AG_ASCII_CASE_SSE2
+        uint32_t mask = sse2_match16(haystack.data() + pos, c);
+#else
+        uint32_t mask = neon_match16(haystack.data() + pos, c);
+#endif
+        while (mask != 0) {
+            size_t candidate = pos + count_trailing_zeros(mask);
+            if (ascii_iequals(haystack.data() + candidate + 1, rest.data(), rest.size())) {
+                return candidate;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; pos < candidates; ++pos) {
+        if (ascii_to_lower(haystack[pos]) == first
+                && ascii_iequals(haystack.data() + pos + 1, rest.data(), rest.size())) {
+            return pos;
+        }
+    }
+    return std::string_view::npos;
+}
+
+} // namespace ag::utils::detail
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include "common/file.h"
+#include "common/logger.h"
+
+namespace ag {
+
+/**
+ * Logger callback keeping the most recent log records in a fixed-size in-memory ring ("flight recorder"),
+ * so that a detailed history is available when something goes wrong without writing it to disk all the time.
+ *
+ * Recording is lock-free: writers reserve ring slots with an atomic increment and never wait for each other.
+ * The oldest records are overwritten once the ring is full. If a writer laps another one which is still writing
+ * the same slot, the newer fragment is dropped rather than mixed with the older one.
+ *
+ * Intended usage is to set the global log level to the most verbose one needed in the recorder
+ * and pass the records of the levels that are actually wanted in the persistent log to `next`:
+ * ```
+ * auto recorder = std::make_shared<ag::LogFlightRecorder>(4 * 1024 * 1024, ag::Logger::LOG_TO_STDERR);
+ * ag::Logger::set_log_level(ag::LOG_LEVEL_DEBUG);
+ * ag::Logger::set_callback([recorder](ag::LogLevel level, std::string_view message) {
+ *     (*recorder)(level, message);
+ * });
+ * ...
+ * recorder->dump("crash.log");
+ * ```
+ */
+class LogFlightRecorder {
+public:
+    /** Size of a ring slot. A record longer than a slot occupies several consecutive slots. */
+    static constexpr size_t SLOT_SIZE = 256;
+
+    /**
+     * @param capacity_bytes Memory occupied by the ring, rounded up to a whole number of slots
+     * @param next Callback to pass the records of the `next_max_level` or more important levels to, may be empty
+     * @param next_max_level Least important level passed to `next`
+     */
+    explicit LogFlightRecorder(
+            size_t capacity_bytes, LoggerCallback next = nullptr, LogLevel next_max_level = LOG_LEVEL_INFO);
+
+    ~LogFlightRecorder();
+
+    LogFlightRecorder(const LogFlightRecorder &) = delete;
+    LogFlightRecorder(LogFlightRecorder &&) = delete;
+    LogFlightRecorder &operator=(const LogFlightRecorder &) = delete;
+    LogFlightRecorder &operator=(LogFlightRecorder &&) = delete;
+
+    /**
+     * Record a message and pass it to the next callback if its level is enabled for it
+     * @param level Log level
+     * @param message Formatted message
+     */
+    void operator()(LogLevel level, std::string_view message);
+
+    /**
+     * Write the recorded messages, oldest first, to the file.
+     * Doesn't allocate memory, doesn't take locks and writes with plain `write()` calls, so it may be used
+     * as the last resort in a fatal error handler. Records being overwritten concurrently are skipped.
+     * Timestamps are in UTC.
+     * @param file Opened file handle
+     * @return True if successful
+     */
+    bool dump(file::Handle file) const;
+
+    /**
+     * Write the recorded messages, oldest first, to the file replacing its contents
+     * @param path Path to the file
+     * @return True if successful
+     */
+    bool dump(const char *path) const;
+
+private:
+    struct Slot;
+
+    size_t m_slots_count;
+    std::unique_ptr<Slot[]> m_slots;
+    std::atomic<uint64_t> m_next_slot{0};
+    LoggerCallback m_next;
+    LogLevel m_next_max_level;
+};
+
+} // namespace ag
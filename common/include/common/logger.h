@@ -1,9 +1,16 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <cstdint>
 #include <functional>
+#include <initializer_list>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
+#include <variant>
 
 #include <fmt/chrono.h>
 #include <fmt/format.h>
@@ -26,6 +33,166 @@ enum LogLevel {
  */
 using LoggerCallback = std::function<void(LogLevel level, std::string_view formatted_message)>;
 
+/**
+ * Typed field attached to a structured log record (e.g. connection id, stream id, peer, latency).
+ * Doesn't own the key and string values, so it must not outlive the logging call.
+ */
+struct LogField {
+    using Value = std::variant<int64_t, uint64_t, double, bool, std::string_view, std::chrono::microseconds>;
+
+    std::string_view key;
+    Value value;
+
+    template <std::signed_integral T>
+    LogField(std::string_view key, T value)
+            : key(key)
+            , value(int64_t(value)) {
+    }
+    template <std::unsigned_integral T>
+        requires(!std::same_as<T, bool>)
+    LogField(std::string_view key, T value)
+            : key(key)
+            , value(uint64_t(value)) {
+    }
+    template <std::floating_point T>
+    LogField(std::string_view key, T value)
+            : key(key)
+            , value(double(value)) {
+    }
+    LogField(std::string_view key, bool value)
+            : key(key)
+            , value(value) {
+    }
+    LogField(std::string_view key, std::string_view value)
+            : key(key)
+            , value(value) {
+    }
+    LogField(std::string_view key, const char *value)
+            : key(key)
+            , value(std::string_view{value}) {
+    }
+    template <typename Rep, typename Period>
+    LogField(std::string_view key, std::chrono::duration<Rep, Period> value)
+            : key(key)
+            , value(std::chrono::duration_cast<std::chrono::microseconds>(value)) {
+    }
+};
+
+/**
+ * List of fields attached to a log record. Refers to the fields without copying them, so it can't be copied
+ * or moved, and it is intended to be constructed in place in the logging call:
+ * `infolog_fields(log, ag::LogFields({{"conn_id", id}, {"peer", peer_str}}), "Connected")`.
+ * The fields may also live in caller storage, e.g. an array, which must outlive the logging call.
+ */
+class LogFields {
+public:
+    LogFields() = default;
+    LogFields(std::initializer_list<LogField> fields [[clang::lifetimebound]])
+            : m_fields(fields.begin(), fields.size()) {
+    }
+    explicit LogFields(std::span<const LogField> fields)
+            : m_fields(fields) {
+    }
+
+    LogFields(const LogFields &) = delete;
+    LogFields &operator=(const LogFields &) = delete;
+    LogFields(LogFields &&) = delete;
+    LogFields &operator=(LogFields &&) = delete;
+
+    [[nodiscard]] const LogField *begin() const {
+        return m_fields.data();
+    }
+    [[nodiscard]] const LogField *end() const {
+        return m_fields.data() + m_fields.size();
+    }
+    [[nodiscard]] size_t size() const {
+        return m_fields.size();
+    }
+    [[nodiscard]] bool empty() const {
+        return m_fields.empty();
+    }
+    [[nodiscard]] std::span<const LogField> span() const {
+        return m_fields;
+    }
+
+private:
+    std::span<const LogField> m_fields;
+};
+
+/**
+ * Structured log record. Views are valid only during the callback call.
+ */
+struct LogRecord {
+    LogLevel level;
+    /** Name of the logger which emitted the record */
+    std::string_view logger;
+    /** Function which emitted the record, empty if not known */
+    std::string_view function;
+    /** Formatted message without the logger name and function */
+    std::string_view message;
+    /** Attached fields, empty if none */
+    std::span<const LogField> fields;
+
+    /**
+     * Render the record as a logfmt line, e.g. `level=INFO logger=http func=send msg="Sent" stream_id=1`
+     */
+    [[nodiscard]] std::string to_logfmt() const;
+
+    /**
+     * Render the record as a JSON object, e.g. `{"level":"INFO","logger":"http","msg":"Sent","stream_id":1}`
+     */
+    [[nodiscard]] std::string to_json() const;
+};
+
+/**
+ * Structured logger callback. Make sure that it could somehow handle parallel calls from several threads.
+ */
+using StructuredLoggerCallback = std::function<void(const LogRecord &record)>;
+
+/**
+ * Suppression state of a rate-limited logging call site. See `warnlog_every` and `dbglog_sampled`.
+ * Thread-safe.
+ *
+ * There is no timer behind the limiter: the number of suppressed messages is carried by the next message that
+ * passes, so a call site which goes quiet after a storm does not report the tail of the storm until it is hit again.
+ */
+class LogRateLimiter {
+public:
+    /**
+     * Let at most one message per `period` through
+     * @return Number of messages suppressed since the previous passed one if the message should be logged,
+     *         `std::nullopt` if it should be suppressed
+     */
+    std::optional<size_t> every(std::chrono::steady_clock::duration period) {
+        int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+        int64_t next = m_next_allowed.load(std::memory_order_relaxed);
+        if (now < next
+                || !m_next_allowed.compare_exchange_strong(next, now + period.count(), std::memory_order_relaxed)) {
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+        return m_suppressed.exchange(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * Let one of every `n` messages through
+     * @return Number of messages suppressed since the previous passed one if the message should be logged,
+     *         `std::nullopt` if it should be suppressed
+     */
+    std::optional<size_t> sampled(size_t n) {
+        if (n > 1 && m_counter.fetch_add(1, std::memory_order_relaxed) % n != 0) {
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+        return m_suppressed.exchange(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<int64_t> m_next_allowed{0};
+    std::atomic<size_t> m_counter{0};
+    std::atomic<size_t> m_suppressed{0};
+};
+
 class Logger {
 public:
     /**
@@ -65,6 +232,31 @@ public:
     }
 #endif
 
+    /**
+     * Log message with attached structured fields
+     * @param level Log level
+     * @param function Name of the function emitting the message
+     * @param fields Fields attached to the record
+     * @param fmt Format string. Use FMT_STRING to enable type checks
+     * @param args Format arguments
+     *
+     * See `log()` for the reasons of optnone and _MSC_VER.
+     */
+#if _MSC_VER >= 1938
+    template <typename... Ts>
+    inline void log_fields(LogLevel level, std::string_view function, const LogFields &fields, fmt::string_view fmt,
+            Ts &&...args) const {
+        vlog_fields(level, function, fields, fmt, fmt::make_format_args(args...));
+    }
+#else
+    template <typename... Ts>
+    [[clang::optnone]]
+    inline void log_fields(LogLevel level, std::string_view function, const LogFields &fields,
+            ag::StrictFormatString<Ts...> fmt, Ts &&...args) const {
+        vlog_fields(level, function, fields, fmt::string_view(fmt), fmt::make_format_args(args...));
+    }
+#endif
+
     /**
      * @return True if log level  is enabled on current logger
      * @param level Log level
@@ -89,11 +281,24 @@ public:
     static LogLevel get_log_level();
 
     /**
-     * Set common logger callback
+     * Set common logger callback.
+     * Logging threads keep their own copies of the callback which are refreshed on their next message.
+     * Each thread that has logged keeps the previous callback, and everything it captures, alive
+     * until the thread logs again or exits, and it may be destroyed on any of them. Don't rely on
+     * this call to release the resources of the previous callback (a file, a JNI reference) promptly.
      * @param callback Logger callback
      */
     static void set_callback(LoggerCallback callback);
 
+    /**
+     * Set common structured logger callback.
+     * If set, it receives all the records instead of the callback set by `set_callback()`.
+     * If not set, the fields of structured records are appended to the message in logfmt form.
+     * The previous callback is released lazily by the logging threads, as with `set_callback()`.
+     * @param callback Structured logger callback, or empty to get back to the plain one
+     */
+    static void set_structured_callback(StructuredLoggerCallback callback);
+
     /**
      * Functor for logging to file
      * LogToFile doesn't take file ownership. You need to close manually
@@ -117,6 +322,9 @@ public:
 private:
     void vlog(LogLevel level, fmt::string_view format, fmt::format_args args) const;
 
+    void vlog_fields(LogLevel level, std::string_view function, const LogFields &fields, fmt::string_view format,
+            fmt::format_args args) const;
+
     void log_impl(LogLevel level, std::string_view message) const;
 
     std::string m_name;
@@ -137,4 +345,60 @@ private:
             (l).log(::ag::LOG_LEVEL_TRACE, ("{}: " fmt_), ::fmt::string_view{__func__}, ##__VA_ARGS__);                \
     } while (0)
 
+/**
+ * Log a message passed by a rate limiter. Messages suppressed since the previous passed one are summarized
+ * in the message itself, there is no separate summary record. For inner use only.
+ */
+#define AG_LOG_RATE_LIMITED(l, level_, limit_, fmt_, ...)                                                              \
+    do {                                                                                                               \
+        if ((l).is_enabled(level_)) {                                                                                  \
+            static ::ag::LogRateLimiter ag_log_rate_limiter_;                                                          \
+            if (std::optional<size_t> ag_log_suppressed_ = ag_log_rate_limiter_.limit_; ag_log_suppressed_ == 0) {    \
+                (l).log(level_, ("{}: " fmt_), ::fmt::string_view{__func__}, ##__VA_ARGS__);                          \
+            } else if (ag_log_suppressed_.has_value()) {                                                               \
+                (l).log(level_, ("{}: " fmt_ " (suppressed {} messages)"), ::fmt::string_view{__func__},              \
+                        ##__VA_ARGS__, *ag_log_suppressed_);                                                           \
+            }                                                                                                          \
+        }                                                                                                              \
+    } while (0)
+
+/**
+ * Rate-limited logging: at most one message per `period_` (an `std::chrono` duration) from the call site.
+ * The first message after the period elapses always passes and reports how many were suppressed before it.
+ * If the call site is never hit again, the pending count is not reported.
+ */
+#define errlog_every(l, period_, fmt_, ...)                                                                            \
+    AG_LOG_RATE_LIMITED(l, ::ag::LOG_LEVEL_ERROR, every(period_), fmt_, ##__VA_ARGS__)
+#define warnlog_every(l, period_, fmt_, ...)                                                                           \
+    AG_LOG_RATE_LIMITED(l, ::ag::LOG_LEVEL_WARN, every(period_), fmt_, ##__VA_ARGS__)
+#define infolog_every(l, period_, fmt_, ...)                                                                           \
+    AG_LOG_RATE_LIMITED(l, ::ag::LOG_LEVEL_INFO, every(period_), fmt_, ##__VA_ARGS__)
+#define dbglog_every(l, period_, fmt_, ...)                                                                            \
+    AG_LOG_RATE_LIMITED(l, ::ag::LOG_LEVEL_DEBUG, every(period_), fmt_, ##__VA_ARGS__)
+
+/**
+ * Sampled logging: one of every `n_` messages from the call site
+ */
+#define dbglog_sampled(l, n_, fmt_, ...)                                                                               \
+    AG_LOG_RATE_LIMITED(l, ::ag::LOG_LEVEL_DEBUG, sampled(n_), fmt_, ##__VA_ARGS__)
+#define tracelog_sampled(l, n_, fmt_, ...)                                                                             \
+    AG_LOG_RATE_LIMITED(l, ::ag::LOG_LEVEL_TRACE, sampled(n_), fmt_, ##__VA_ARGS__)
+
+#define errlog_fields(l, fields_, fmt_, ...)                                                                           \
+    (l).log_fields(::ag::LOG_LEVEL_ERROR, __func__, fields_, (fmt_), ##__VA_ARGS__)
+#define warnlog_fields(l, fields_, fmt_, ...)                                                                          \
+    (l).log_fields(::ag::LOG_LEVEL_WARN, __func__, fields_, (fmt_), ##__VA_ARGS__)
+#define infolog_fields(l, fields_, fmt_, ...)                                                                          \
+    (l).log_fields(::ag::LOG_LEVEL_INFO, __func__, fields_, (fmt_), ##__VA_ARGS__)
+#define dbglog_fields(l, fields_, fmt_, ...)                                                                           \
+    do {                                                                                                               \
+        if ((l).is_enabled(::ag::LOG_LEVEL_DEBUG))                                                                     \
+            (l).log_fields(::ag::LOG_LEVEL_DEBUG, __func__, fields_, (fmt_), ##__VA_ARGS__);                           \
+    } while (0)
+#define tracelog_fields(l, fields_, fmt_, ...)                                                                         \
+    do {                                                                                                               \
+        if ((l).is_enabled(::ag::LOG_LEVEL_TRACE))                                                                     \
+            (l).log_fields(::ag::LOG_LEVEL_TRACE, __func__, fields_, (fmt_), ##__VA_ARGS__);                           \
+    } while (0)
+
 } // namespace ag
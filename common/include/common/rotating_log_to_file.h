@@ -1,10 +1,13 @@
 #pragma once
 
+#include <condition_variable>
 #include <cstddef>
+#include <deque>
 #include <fstream>
 #include <mutex>
 #include <string>
 #include <string_view>
+#include <thread>
 
 #include "logger.h"
 
@@ -16,14 +19,28 @@ namespace ag {
  */
 class RotatingLogToFile {
 public:
+    /**
+     * Compression applied to the rotated log files
+     */
+    enum Compression {
+        /** Rotated files are kept as is (`path.N`) */
+        NO_COMPRESSION,
+        /** Rotated files are compressed with brotli (`path.N.br`) */
+        BROTLI,
+    };
+
     /**
      * Construct a RotatingLogToFile object
      * Opens the initial log file and sets up parameters for file rotation
      * @param log_file_path Path to the base log file
      * @param file_max_size_bytes Maximum size of each log file in bytes before rotation
      * @param files_count Maximum number of rotated log files to keep
+     * @param compression Compression of the rotated files. If enabled, the rotated files are
+     *                    compressed on a background thread, so the rotation doesn't block the caller.
+     *                    `files_count` is applied to the compressed files in this case.
      */
-    RotatingLogToFile(std::string log_file_path, size_t file_max_size_bytes, size_t files_count);
+    RotatingLogToFile(std::string log_file_path, size_t file_max_size_bytes, size_t files_count,
+            Compression compression = NO_COMPRESSION);
 
     /**
      * Log a message to the current log file
@@ -45,17 +62,37 @@ public:
     RotatingLogToFile &operator=(const RotatingLogToFile &) = delete;
     RotatingLogToFile &operator=(RotatingLogToFile &&) = delete;
 
-    ~RotatingLogToFile() = default;
+    /**
+     * Waits for the pending rotated files to be compressed
+     */
+    ~RotatingLogToFile();
 
 private:
     const size_t m_file_max_size_bytes;
     const size_t m_files_count;
+    const Compression m_compression;
     std::string m_log_file_path;
     std::ofstream m_file_handle;
     std::mutex m_mutex;
 
+    // Rotated files waiting to be compressed, guarded by `m_compression_mutex`
+    std::deque<std::string> m_compression_queue;
+    std::mutex m_compression_mutex;
+    std::condition_variable m_compression_cv;
+    bool m_compression_stopped = false;
+    size_t m_next_pending_id = 0;
+    std::thread m_compression_thread;
+
     void open_log_file();
     bool rotate_files();
+    bool rotate_files_for_compression();
+    /**
+     * Queue the rotated files a previous process left uncompressed, and continue their numbering
+     */
+    void enqueue_leftover_pending_files();
+    void compression_loop();
+    void compress_rotated_file(const std::string &pending_file_name);
+    [[nodiscard]] std::string compressed_file_name(size_t index) const;
     void log_to_ofstream(std::string_view formatted_message);
     void full_log(LogLevel level, std::string_view message);
     void lite_log(std::string_view message);
@@ -175,19 +175,50 @@ static inline std::string_view trim(std::string_view str) {
 }
 
 /**
- * Check whether 2 strings are equal ignoring case
+ * Lower-case an ASCII letter, other characters are returned as is.
+ * Unlike `std::tolower` doesn't depend on the locale.
+ */
+static inline constexpr char ascii_to_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? char(c | 0x20) : c;
+}
+
+namespace detail {
+
+/**
+ * Vectorized case-insensitive comparison of ASCII strings of the same length
+ */
+bool ascii_iequals(const char *lhs, const char *rhs, size_t length);
+
+/**
+ * Vectorized case-insensitive search of an ASCII substring
+ */
+size_t ascii_ifind(std::string_view haystack, std::string_view needle);
+
+} // namespace detail
+
+/**
+ * Check whether 2 strings are equal ignoring case of the ASCII letters
  */
 static inline constexpr bool iequals(std::string_view lhs, std::string_view rhs) {
-    return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](char l, char r) {
-        return std::tolower(l) == std::tolower(r);
-    });
+    if (lhs.length() != rhs.length()) {
+        return false;
+    }
+    if (std::is_constant_evaluated()) {
+        return std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](char l, char r) {
+            return ascii_to_lower(l) == ascii_to_lower(r);
+        });
+    }
+    return detail::ascii_iequals(lhs.data(), rhs.data(), lhs.length());
 }
 
 /**
- * Find the first occurrence of the given substring ignoring case
+ * Find the first occurrence of the given substring ignoring case of the ASCII letters
  * @return Position of the first character of the found substring or `npos` if no such substring is found.
  */
 static inline constexpr std::string_view::size_type ifind(std::string_view haystack, std::string_view needle) {
+    if (!std::is_constant_evaluated()) {
+        return detail::ascii_ifind(haystack, needle);
+    }
     if (needle.empty()) {
         return 0;
     }
@@ -195,14 +226,14 @@ static inline constexpr std::string_view::size_type ifind(std::string_view hayst
         return std::string_view::npos;
     }
 
-    auto c = std::tolower(needle.front());
+    auto c = ascii_to_lower(needle.front());
     size_t pos = 0;
     do {     // NOLINT(*-avoid-do-while)
         do { // NOLINT(*-avoid-do-while)
             if (haystack.length() <= pos || haystack.length() - pos < needle.length()) {
                 return std::string_view::npos;
             }
-        } while (std::tolower(haystack[pos++]) != c);
+        } while (ascii_to_lower(haystack[pos++]) != c);
     } while (!iequals(haystack.substr(pos, needle.length() - 1), needle.substr(1)));
 
     return pos - 1;
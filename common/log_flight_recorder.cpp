@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "common/log_flight_recorder.h"
+#include "common/time_utils.h"
+#include "common/utils.h"
+
+namespace ag {
+
+static constexpr std::string_view LEVEL_NAMES[] = {
+        "ERROR",
+        "WARN",
+        "INFO",
+        "DEBUG",
+        "TRACE",
+};
+static constexpr size_t SLOT_HEADER_SIZE = 32;
+static constexpr size_t SLOT_PAYLOAD_SIZE = LogFlightRecorder::SLOT_SIZE - SLOT_HEADER_SIZE;
+static constexpr size_t SLOT_PAYLOAD_WORDS = SLOT_PAYLOAD_SIZE / sizeof(uint64_t);
+// Longer records are truncated
+static constexpr size_t MAX_FRAGMENTS = UINT8_MAX;
+
+// All the fields are atomic, as the reader accesses them concurrently with the writers.
+// Relaxed accesses are enough, the ordering is provided by `sequence`.
+struct LogFlightRecorder::Slot {
+    // `2 * index + 1` while the slot is being written and `2 * index + 2` once it's written,
+    // where `index` is the number of the slot in the endless stream of the recorded slots.
+    // Lets the reader detect the slots overwritten while it was reading them, and the writers
+    // claim the slot exclusively.
+    std::atomic<uint64_t> sequence{0};
+    std::atomic<int64_t> timestamp_us{0};
+    std::atomic<uint32_t> thread_id{0};
+    std::atomic<uint16_t> length{0};
+    std::atomic<uint8_t> level{0};
+    // Index of the slot within the record
+    std::atomic<uint8_t> fragment{0};
+    // Number of the slots the record occupies
+    std::atomic<uint8_t> fragments{0};
+    std::atomic<uint64_t> data[SLOT_PAYLOAD_WORDS];
+};
+
+static_assert(SLOT_PAYLOAD_SIZE % sizeof(uint64_t) == 0);
+static_assert(sizeof(std::atomic<uint64_t>) + sizeof(std::atomic<int64_t>) + sizeof(std::atomic<uint32_t>)
+                + sizeof(std::atomic<uint16_t>) + 3 * sizeof(std::atomic<uint8_t>)
+        <= SLOT_HEADER_SIZE);
+
+namespace {
+
+/**
+ * Buffered writer formatting without allocations, locale and stdio, so it's usable in a fatal error handler
+ */
+class DumpWriter {
+public:
+    explicit DumpWriter(file::Handle file)
+            : m_file(file) {
+    }
+
+    void put(std::string_view str) {
+        while (!str.empty()) {
+            size_t n = std::min(str.size(), sizeof(m_buffer) - m_size);
+            std::memcpy(m_buffer + m_size, str.data(), n);
+            m_size += n;
+            str.remove_prefix(n);
+            if (m_size == sizeof(m_buffer)) {
+                flush();
+            }
+        }
+    }
+
+    void put(char c) {
+        put(std::string_view{&c, 1});
+    }
+
+    /** Write a decimal number padded with zeros to `width` digits */
+    void put_number(uint64_t value, size_t width = 1) {
+        char digits[20];
+        size_t n = 0;
+        do {
+            digits[std::size(digits) - ++n] = char('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        for (size_t i = n; i < width; ++i) {
+            put('0');
+        }
+        put(std::string_view{digits + std::size(digits) - n, n});
+    }
+
+    /** Write the UTC time as `YYYY-MM-DD hh:mm:ss.uuuuuu` */
+    void put_timestamp(int64_t timestamp_us) {
+        int64_t seconds = timestamp_us / 1000000;
+        int64_t micros = timestamp_us % 1000000;
+        if (micros < 0) {
+            micros += 1000000;
+            seconds -= 1;
+        }
+        int64_t days = seconds / 86400;
+        int64_t day_seconds = seconds % 86400;
+        if (day_seconds < 0) {
+            day_seconds += 86400;
+            days -= 1;
+        }
+
+        // Civil date from the number of days since the epoch, see http://howardhinnant.github.io/date_algorithms.html
+        days += 719468;
+        int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+        int64_t day_of_era = days - era * 146097;
+        int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+        int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+        int64_t shifted_month = (5 * day_of_year + 2) / 153;
+        int64_t day = day_of_year - (153 * shifted_month + 2) / 5 + 1;
+        int64_t month = shifted_month < 10 ? shifted_month + 3 : shifted_month - 9;
+        int64_t year = year_of_era + era * 400 + (month <= 2);
+
+        put_number(std::max<int64_t>(0, year), 4);
+        put('-');
+        put_number(month, 2);
+        put('-');
+        put_number(day, 2);
+        put(' ');
+        put_number(day_seconds / 3600, 2);
+        put(':');
+        put_number(day_seconds / 60 % 60, 2);
+        put(':');
+        put_number(day_seconds % 60, 2);
+        put('.');
+        put_number(micros, 6);
+    }
+
+    /**
+     * Write out the buffered data
+     * @return True if all the data written so far reached the file
+     */
+    bool flush() {
+        for (size_t written = 0; m_ok && written < m_size;) {
+            ssize_t r = file::write(m_file, m_buffer + written, m_size - written);
+            if (r <= 0) {
+                m_ok = false;
+            } else {
+                written += r;
+            }
+        }
+        m_size = 0;
+        return m_ok;
+    }
+
+private:
+    file::Handle m_file;
+    char m_buffer[1024];
+    size_t m_size = 0;
+    bool m_ok = true;
+};
+
+} // namespace
+
+LogFlightRecorder::LogFlightRecorder(size_t capacity_bytes, LoggerCallback next, LogLevel next_max_level)
+        : m_slots_count(std::max<size_t>(1, (capacity_bytes + SLOT_SIZE - 1) / SLOT_SIZE))
+        , m_slots(new Slot[m_slots_count])
+        , m_next(std::move(next))
+        , m_next_max_level(next_max_level) {
+}
+
+LogFlightRecorder::~LogFlightRecorder() = default;
+
+void LogFlightRecorder::operator()(LogLevel level, std::string_view message) {
+    static thread_local uint32_t thread_id = utils::gettid();
+    int64_t timestamp_us = to_micros(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    size_t fragments = std::max<size_t>(1, (message.size() + SLOT_PAYLOAD_SIZE - 1) / SLOT_PAYLOAD_SIZE);
+    fragments = std::min({fragments, MAX_FRAGMENTS, m_slots_count});
+    uint64_t first_index = m_next_slot.fetch_add(fragments, std::memory_order_relaxed);
+
+    for (size_t i = 0; i < fragments; ++i) {
+        uint64_t index = first_index + i;
+        Slot &slot = m_slots[index % m_slots_count];
+        std::string_view chunk = message.substr(i * SLOT_PAYLOAD_SIZE, SLOT_PAYLOAD_SIZE);
+
+        // Claim the slot. If a writer which has lapped this one has already claimed it, or one which is lapped
+        // by this one is still writing it, drop the fragment: mixing two fragments would produce a torn slot
+        // passing the reader's validation.
+        uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+        if (sequence % 2 != 0 || sequence > 2 * index
+                || !slot.sequence.compare_exchange_strong(sequence, 2 * index + 1, std::memory_order_relaxed)) {
+            continue;
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+
+        uint64_t words[SLOT_PAYLOAD_WORDS] = {};
+        std::memcpy(words, chunk.data(), chunk.size());
+        slot.timestamp_us.store(timestamp_us, std::memory_order_relaxed);
+        slot.thread_id.store(thread_id, std::memory_order_relaxed);
+        slot.length.store(static_cast<uint16_t>(chunk.size()), std::memory_order_relaxed);
+        slot.level.store(static_cast<uint8_t>(level), std::memory_order_relaxed);
+        slot.fragment.store(static_cast<uint8_t>(i), std::memory_order_relaxed);
+        slot.fragments.store(static_cast<uint8_t>(fragments), std::memory_order_relaxed);
+        for (size_t w = 0; w < (chunk.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t); ++w) {
+            slot.data[w].store(words[w], std::memory_order_relaxed);
+        }
+        slot.sequence.store(2 * index + 2, std::memory_order_release);
+    }
+
+    if (m_next && level <= m_next_max_level) {
+        m_next(level, message);
+    }
+}
+
+bool LogFlightRecorder::dump(file::Handle file) const {
+    DumpWriter writer(file);
+    uint64_t end = m_next_slot.load(std::memory_order_acquire);
+    uint64_t begin = (end > m_slots_count) ? end - m_slots_count : 0;
+    // Whether the beginning of a record has been written, but its end hasn't yet
+    bool in_record = false;
+    uint8_t expected_fragment = 0;
+
+    for (uint64_t index = begin; index < end; ++index) {
+        const Slot &slot = m_slots[index % m_slots_count];
+        uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        int64_t timestamp_us = slot.timestamp_us.load(std::memory_order_relaxed);
+        uint32_t thread_id = slot.thread_id.load(std::memory_order_relaxed);
+        size_t length = std::min<size_t>(slot.length.load(std::memory_order_relaxed), SLOT_PAYLOAD_SIZE);
+        uint8_t level = slot.level.load(std::memory_order_relaxed);
+        uint8_t fragment = slot.fragment.load(std::memory_order_relaxed);
+        uint8_t fragments = slot.fragments.load(std::memory_order_relaxed);
+        uint64_t data[SLOT_PAYLOAD_WORDS];
+        for (size_t w = 0; w < (length + sizeof(uint64_t) - 1) / sizeof(uint64_t); ++w) {
+            data[w] = slot.data[w].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        bool valid = sequence == 2 * index + 2 && slot.sequence.load(std::memory_order_relaxed) == sequence;
+        if (valid && fragment == 0) {
+            if (in_record) {
+                writer.put('\n');
+            }
+            writer.put_timestamp(timestamp_us);
+            writer.put(' ');
+            std::string_view level_str = (level < std::size(LEVEL_NAMES)) ? LEVEL_NAMES[level] : "UNKNOWN";
+            writer.put(level_str);
+            for (size_t i = level_str.size(); i < 5; ++i) {
+                writer.put(' ');
+            }
+            writer.put(" [");
+            writer.put_number(thread_id);
+            writer.put("] ");
+            in_record = true;
+        } else if (!valid || !in_record || fragment != expected_fragment) {
+            // The record has been partially overwritten
+            if (in_record) {
+                writer.put('\n');
+                in_record = false;
+            }
+            continue;
+        }
+
+        writer.put(std::string_view{reinterpret_cast<const char *>(data), length});
+        expected_fragment = fragment + 1;
+        if (expected_fragment >= fragments) {
+            writer.put('\n');
+            in_record = false;
+        }
+    }
+
+    if (in_record) {
+        writer.put('\n');
+    }
+    return writer.flush();
+}
+
+bool LogFlightRecorder::dump(const char *path) const {
+    file::Handle file = file::open(path, file::WRONLY | file::CREAT | file::TRUNC);
+    if (!file::is_valid(file)) {
+        return false;
+    }
+    bool ok = dump(file);
+    file::close(file);
+    return ok;
+}
+
+} // namespace ag
@@ -1,3 +1,11 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+
 #include <fmt/chrono.h>
 
 #include "common/logger.h"
@@ -16,26 +24,92 @@ static constexpr std::string_view ENUM_NAMES[] = {
 static constexpr size_t ENUM_NAMES_NUMBER = std::size(ENUM_NAMES);
 
 static void log_to_file(FILE *file, LogLevel level, std::string_view message);
+static void append_logfmt_field(fmt::memory_buffer &out, std::string_view key, const LogField::Value &value);
 const LoggerCallback Logger::LOG_TO_STDERR = LogToFile(stderr);
 
 static std::atomic<LogLevel> g_log_level{LOG_LEVEL_INFO};
-static std::shared_ptr<LoggerCallback> g_log_callback = std::make_shared<LoggerCallback>(Logger::LOG_TO_STDERR);
+
+struct LogCallbacks {
+    std::shared_ptr<LoggerCallback> plain;
+    std::shared_ptr<StructuredLoggerCallback> structured;
+};
+
+// Guarded by `g_log_callbacks_mutex`. Touched only on updates and on refreshes of the per-thread copies,
+// so that logging itself doesn't contend on the shared pointer reference counters.
+static LogCallbacks g_log_callbacks{std::make_shared<LoggerCallback>(Logger::LOG_TO_STDERR), nullptr};
+static std::mutex g_log_callbacks_mutex;
+// Bumped on each update to invalidate the per-thread copies
+static std::atomic<uint64_t> g_log_callbacks_generation{1};
+
+struct LogCallbacksCache {
+    uint64_t generation = 0;
+    // Non-zero while a callback is running on the thread: the copy must not be replaced under its feet
+    // if the callback logs something itself
+    int depth = 0;
+    LogCallbacks callbacks;
+};
+
+static LogCallbacksCache &log_callbacks_cache() {
+    static thread_local LogCallbacksCache cache;
+    if (cache.depth == 0 && cache.generation != g_log_callbacks_generation.load(std::memory_order_acquire)) {
+        std::scoped_lock l{g_log_callbacks_mutex};
+        cache.callbacks = g_log_callbacks;
+        cache.generation = g_log_callbacks_generation.load(std::memory_order_relaxed);
+    }
+    return cache;
+}
+
+template <typename Callback, typename... Args>
+static void invoke_log_callback(LogCallbacksCache &cache, const Callback &callback, Args &&...args) {
+    ++cache.depth;
+    // A throwing callback must not leave the copy pinned for good
+    utils::ScopeExit depth_guard([&cache] {
+        --cache.depth;
+    });
+    callback(std::forward<Args>(args)...);
+}
+
+static void update_log_callbacks(const std::function<void(LogCallbacks &)> &update) {
+    std::scoped_lock l{g_log_callbacks_mutex};
+    update(g_log_callbacks);
+    g_log_callbacks_generation.fetch_add(1, std::memory_order_release);
+}
+
+static std::string_view level_name(LogLevel level) {
+    return (level >= 0 && level < ENUM_NAMES_NUMBER) ? ENUM_NAMES[level] : "UNKNOWN";
+}
 
 void Logger::set_log_level(LogLevel level) {
     g_log_level = level;
 }
 
 void Logger::set_callback(LoggerCallback callback) {
+    auto ptr = std::make_shared<LoggerCallback>(callback ? std::move(callback) : LOG_TO_STDERR);
+    update_log_callbacks([&ptr](LogCallbacks &callbacks) {
+        callbacks.plain = std::move(ptr);
+    });
+}
+
+void Logger::set_structured_callback(StructuredLoggerCallback callback) {
+    std::shared_ptr<StructuredLoggerCallback> ptr;
     if (callback) {
-        std::atomic_store(&g_log_callback, std::make_shared<LoggerCallback>(std::move(callback)));
-    } else {
-        std::atomic_store(&g_log_callback, std::make_shared<LoggerCallback>(LOG_TO_STDERR));
+        ptr = std::make_shared<StructuredLoggerCallback>(std::move(callback));
     }
+    update_log_callbacks([&ptr](LogCallbacks &callbacks) {
+        callbacks.structured = std::move(ptr);
+    });
 }
 
 void Logger::log_impl(LogLevel level, std::string_view message) const {
-    auto callback = std::atomic_load(&g_log_callback);
-    (*callback)(level, message);
+    LogCallbacksCache &cache = log_callbacks_cache();
+    if (cache.callbacks.structured != nullptr) {
+        // Strip the logger name prepended by `vlog()`
+        message.remove_prefix(std::min(message.size(), m_name.size() + 1));
+        invoke_log_callback(cache, *cache.callbacks.structured, LogRecord{level, m_name, {}, message, {}});
+        return;
+    }
+
+    invoke_log_callback(cache, *cache.callbacks.plain, level, message);
 }
 
 bool Logger::is_enabled(LogLevel level) const {
@@ -59,8 +133,165 @@ void Logger::vlog(LogLevel level, fmt::string_view format, fmt::format_args args
     }
 }
 
+void Logger::vlog_fields(LogLevel level, std::string_view function, const LogFields &fields, fmt::string_view format,
+        fmt::format_args args) const {
+    if (!is_enabled(level)) {
+        return;
+    }
+
+    fmt::basic_memory_buffer<char> buffer;
+    fmt::detail::vformat_to(buffer, format, args);
+    std::string_view message{buffer.data(), buffer.size()};
+
+    LogCallbacksCache &cache = log_callbacks_cache();
+    if (cache.callbacks.structured != nullptr) {
+        invoke_log_callback(
+                cache, *cache.callbacks.structured, LogRecord{level, m_name, function, message, fields.span()});
+        return;
+    }
+
+    fmt::basic_memory_buffer<char> line;
+    fmt::format_to(std::back_inserter(line), "{} {}: {}", m_name, function, message);
+    for (const LogField &field : fields) {
+        line.push_back(' ');
+        append_logfmt_field(line, field.key, field.value);
+    }
+    invoke_log_callback(cache, *cache.callbacks.plain, level, std::string_view{line.data(), line.size()});
+}
+
+static bool needs_logfmt_quoting(std::string_view str) {
+    return str.empty() || std::any_of(str.begin(), str.end(), [](char c) {
+        return (unsigned char) c <= ' ' || c == '=' || c == '"' || c == '\\';
+    });
+}
+
+static void append_escaped(fmt::memory_buffer &out, std::string_view str) {
+    for (char c : str) {
+        switch (c) {
+        case '"':
+            out.append(std::string_view{"\\\""});
+            break;
+        case '\\':
+            out.append(std::string_view{"\\\\"});
+            break;
+        case '\n':
+            out.append(std::string_view{"\\n"});
+            break;
+        case '\r':
+            out.append(std::string_view{"\\r"});
+            break;
+        case '\t':
+            out.append(std::string_view{"\\t"});
+            break;
+        default:
+            if ((unsigned char) c < 0x20) {
+                fmt::format_to(std::back_inserter(out), "\\u{:04x}", int(c));
+            } else {
+                out.push_back(c);
+            }
+            break;
+        }
+    }
+}
+
+static void append_logfmt_string(fmt::memory_buffer &out, std::string_view str) {
+    if (!needs_logfmt_quoting(str)) {
+        out.append(str);
+        return;
+    }
+    out.push_back('"');
+    append_escaped(out, str);
+    out.push_back('"');
+}
+
+static void append_json_string(fmt::memory_buffer &out, std::string_view str) {
+    out.push_back('"');
+    append_escaped(out, str);
+    out.push_back('"');
+}
+
+static void append_logfmt_field(fmt::memory_buffer &out, std::string_view key, const LogField::Value &value) {
+    append_logfmt_string(out, key);
+    out.push_back('=');
+    std::visit(
+            [&out](const auto &v) {
+                using T = std::decay_t<decltype(v)>;
+                if constexpr (std::is_same_v<T, std::string_view>) {
+                    append_logfmt_string(out, v);
+                } else if constexpr (std::is_same_v<T, std::chrono::microseconds>) {
+                    fmt::format_to(std::back_inserter(out), "{}us", v.count());
+                } else {
+                    fmt::format_to(std::back_inserter(out), "{}", v);
+                }
+            },
+            value);
+}
+
+static void append_json_field(fmt::memory_buffer &out, std::string_view key, const LogField::Value &value) {
+    append_json_string(out, key);
+    out.push_back(':');
+    std::visit(
+            [&out](const auto &v) {
+                using T = std::decay_t<decltype(v)>;
+                if constexpr (std::is_same_v<T, std::string_view>) {
+                    append_json_string(out, v);
+                } else if constexpr (std::is_same_v<T, std::chrono::microseconds>) {
+                    // Durations are rendered as a number of microseconds
+                    fmt::format_to(std::back_inserter(out), "{}", v.count());
+                } else if constexpr (std::is_same_v<T, double>) {
+                    // JSON has no representation for NaN and infinities
+                    if (std::isfinite(v)) {
+                        fmt::format_to(std::back_inserter(out), "{}", v);
+                    } else {
+                        out.append(std::string_view{"null"});
+                    }
+                } else {
+                    fmt::format_to(std::back_inserter(out), "{}", v);
+                }
+            },
+            value);
+}
+
+std::string LogRecord::to_logfmt() const {
+    fmt::memory_buffer out;
+    append_logfmt_field(out, "level", level_name(level));
+    out.push_back(' ');
+    append_logfmt_field(out, "logger", logger);
+    if (!function.empty()) {
+        out.push_back(' ');
+        append_logfmt_field(out, "func", function);
+    }
+    out.push_back(' ');
+    append_logfmt_field(out, "msg", message);
+    for (const LogField &field : fields) {
+        out.push_back(' ');
+        append_logfmt_field(out, field.key, field.value);
+    }
+    return fmt::to_string(out);
+}
+
+std::string LogRecord::to_json() const {
+    fmt::memory_buffer out;
+    out.push_back('{');
+    append_json_field(out, "level", level_name(level));
+    out.push_back(',');
+    append_json_field(out, "logger", logger);
+    if (!function.empty()) {
+        out.push_back(',');
+        append_json_field(out, "func", function);
+    }
+    out.push_back(',');
+    append_json_field(out, "msg", message);
+    for (const LogField &field : fields) {
+        out.push_back(',');
+        append_json_field(out, field.key, field.value);
+    }
+    out.push_back('}');
+    return fmt::to_string(out);
+}
+
 static void log_to_file(FILE *file, LogLevel level, std::string_view message) {
-    std::string_view level_str = (level >= 0 && level < ENUM_NAMES_NUMBER) ? ENUM_NAMES[level] : "UNKNOWN";
+    std::string_view level_str = level_name(level);
     auto now = std::chrono::system_clock::now();
     std::tm tm = ag::localtime_from_system_time(now);
     auto us = to_micros(now.time_since_epoch() - to_secs(now.time_since_epoch())).count();
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <array>
 #include <cerrno>
 #include <cstddef>
 #include <filesystem>
@@ -7,21 +9,98 @@
 #include <fmt/ostream.h>
 #include <iostream>
 #include <iterator>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <utility>
+#include <vector>
 
+#include <brotli/encode.h>
+
+#include "common/defs.h"
 #include "common/logger.h"
 #include "common/rotating_log_to_file.h"
 #include "common/utils.h"
 
 #include "common/time_utils.h"
 
-ag::RotatingLogToFile::RotatingLogToFile(std::string log_file_path, size_t file_max_size_bytes, size_t files_count)
+// Favour speed over ratio: log files compress well even on the lower levels
+static constexpr int BROTLI_QUALITY = 5;
+// 1 MiB window keeps the encoder memory footprint small on constrained devices
+static constexpr int BROTLI_WINDOW_BITS = 20;
+static constexpr size_t COMPRESSION_CHUNK_SIZE = 16 * 1024;
+static constexpr std::string_view COMPRESSED_FILE_SUFFIX = ".br";
+
+static bool brotli_compress_file(const std::string &src_path, const std::string &dst_path) {
+    std::ifstream src(src_path, std::ios_base::binary);
+    std::ofstream dst(dst_path, std::ios_base::binary | std::ios_base::trunc);
+    if (!src.is_open() || !dst.is_open()) {
+        return false;
+    }
+
+    ag::UniquePtr<BrotliEncoderState, &BrotliEncoderDestroyInstance> encoder{
+            BrotliEncoderCreateInstance(nullptr, nullptr, nullptr)};
+    if (encoder == nullptr) {
+        return false;
+    }
+    BrotliEncoderSetParameter(encoder.get(), BROTLI_PARAM_MODE, BROTLI_MODE_TEXT);
+    BrotliEncoderSetParameter(encoder.get(), BROTLI_PARAM_QUALITY, BROTLI_QUALITY);
+    BrotliEncoderSetParameter(encoder.get(), BROTLI_PARAM_LGWIN, BROTLI_WINDOW_BITS);
+
+    std::array<uint8_t, COMPRESSION_CHUNK_SIZE> in_buf; // NOLINT(*-member-init)
+    std::array<uint8_t, COMPRESSION_CHUNK_SIZE> out_buf; // NOLINT(*-member-init)
+    bool eof = false;
+    while (!BrotliEncoderIsFinished(encoder.get())) {
+        src.read((char *) in_buf.data(), std::streamsize(in_buf.size()));
+        if (src.bad()) {
+            return false;
+        }
+        eof = src.eof();
+
+        size_t avail_in = src.gcount();
+        const uint8_t *next_in = in_buf.data();
+        BrotliEncoderOperation op = eof ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS;
+        do { // NOLINT(*-avoid-do-while)
+            size_t avail_out = out_buf.size();
+            uint8_t *next_out = out_buf.data();
+            if (!BrotliEncoderCompressStream(
+                        encoder.get(), op, &avail_in, &next_in, &avail_out, &next_out, nullptr)) {
+                return false;
+            }
+            dst.write((char *) out_buf.data(), std::streamsize(out_buf.size() - avail_out));
+        } while (avail_in > 0 || BrotliEncoderHasMoreOutput(encoder.get())
+                || (eof && !BrotliEncoderIsFinished(encoder.get())));
+    }
+
+    dst.flush();
+    return !dst.fail();
+}
+
+ag::RotatingLogToFile::RotatingLogToFile(
+        std::string log_file_path, size_t file_max_size_bytes, size_t files_count, Compression compression)
         : m_file_max_size_bytes(file_max_size_bytes)
         , m_files_count(files_count)
+        , m_compression(compression)
         , m_log_file_path(std::move(log_file_path)) {
     open_log_file();
+    if (m_compression != NO_COMPRESSION && m_files_count > 1) {
+        enqueue_leftover_pending_files();
+        m_compression_thread = std::thread([this]() {
+            compression_loop();
+        });
+    }
+}
+
+ag::RotatingLogToFile::~RotatingLogToFile() {
+    if (!m_compression_thread.joinable()) {
+        return;
+    }
+    {
+        std::scoped_lock l{m_compression_mutex};
+        m_compression_stopped = true;
+    }
+    m_compression_cv.notify_one();
+    m_compression_thread.join();
 }
 
 void ag::RotatingLogToFile::operator()(LogLevel level, std::string_view message) {
@@ -45,6 +124,10 @@ void ag::RotatingLogToFile::open_log_file() {
 }
 
 bool ag::RotatingLogToFile::rotate_files() {
+    if (m_compression != NO_COMPRESSION) {
+        return rotate_files_for_compression();
+    }
+
     std::error_code error;
     const size_t first_index = 1;
     const size_t last_index = m_files_count - 1;
@@ -72,6 +155,119 @@ bool ag::RotatingLogToFile::rotate_files() {
     return true;
 }
 
+bool ag::RotatingLogToFile::rotate_files_for_compression() {
+    std::error_code error;
+    std::string pending_file_name = AG_FMT("{}.pending.{}", m_log_file_path, m_next_pending_id++);
+
+    m_file_handle.close();
+    if (std::filesystem::rename(m_log_file_path, pending_file_name, error); error) {
+        open_log_file();
+        full_log(LOG_LEVEL_ERROR, AG_FMT("Error rotating log file: {}", m_log_file_path));
+        return false;
+    }
+    open_log_file();
+
+    std::scoped_lock l{m_compression_mutex};
+    m_compression_queue.push_back(std::move(pending_file_name));
+    m_compression_cv.notify_one();
+    return true;
+}
+
+void ag::RotatingLogToFile::enqueue_leftover_pending_files() {
+    // The files rotated by a previous process which exited before compressing them
+    std::filesystem::path log_path{m_log_file_path};
+    std::filesystem::path dir = log_path.has_parent_path() ? log_path.parent_path() : std::filesystem::path{"."};
+    std::string prefix = AG_FMT("{}.pending.", log_path.filename().string());
+
+    std::vector<std::pair<size_t, std::string>> leftovers;
+    std::error_code error;
+    for (std::filesystem::directory_iterator it{dir, error}, end; !error && it != end; it.increment(error)) {
+        std::string file_name = it->path().filename().string();
+        if (!file_name.starts_with(prefix)) {
+            continue;
+        }
+        if (std::optional<size_t> id = utils::to_integer<size_t>(std::string_view{file_name}.substr(prefix.size()));
+                id.has_value()) {
+            leftovers.emplace_back(id.value(), it->path().string());
+        }
+    }
+    if (leftovers.empty()) {
+        return;
+    }
+
+    // Oldest first, and the new ids mustn't overwrite the leftovers
+    std::sort(leftovers.begin(), leftovers.end());
+    m_next_pending_id = leftovers.back().first + 1;
+    for (auto &[id, path] : leftovers) {
+        m_compression_queue.push_back(std::move(path));
+    }
+}
+
+void ag::RotatingLogToFile::compression_loop() {
+    std::unique_lock l{m_compression_mutex};
+    while (true) {
+        m_compression_cv.wait(l, [this]() {
+            return m_compression_stopped || !m_compression_queue.empty();
+        });
+        // Drain the queue before stopping, so that no rotated file is left uncompressed
+        if (m_compression_queue.empty()) {
+            return;
+        }
+
+        std::string pending_file_name = std::move(m_compression_queue.front());
+        m_compression_queue.pop_front();
+        // The file would be pushed out of the retained set by the newer ones anyway
+        bool outdated = m_compression_queue.size() >= m_files_count - 1;
+        l.unlock();
+
+        if (outdated) {
+            std::error_code error;
+            std::filesystem::remove(pending_file_name, error);
+        } else {
+            compress_rotated_file(pending_file_name);
+        }
+
+        l.lock();
+    }
+}
+
+void ag::RotatingLogToFile::compress_rotated_file(const std::string &pending_file_name) {
+    std::error_code error;
+    const size_t first_index = 1;
+    const size_t last_index = m_files_count - 1;
+
+    for (auto index = last_index - 1; index >= first_index; --index) {
+        std::string old_file_name = compressed_file_name(index);
+        std::string new_file_name = compressed_file_name(index + 1);
+
+        std::filesystem::rename(old_file_name, new_file_name, error);
+        if (error && error != std::errc::no_such_file_or_directory) {
+            std::scoped_lock l{m_mutex};
+            full_log(LOG_LEVEL_ERROR, AG_FMT("Error rotating log file: {}", old_file_name));
+            break;
+        }
+    }
+
+    std::string first_file_name = compressed_file_name(first_index);
+    std::string tmp_file_name = AG_FMT("{}.tmp", first_file_name);
+    if (!brotli_compress_file(pending_file_name, tmp_file_name)) {
+        std::scoped_lock l{m_mutex};
+        full_log(LOG_LEVEL_ERROR, AG_FMT("Error compressing log file: {}", pending_file_name));
+        std::filesystem::remove(tmp_file_name, error);
+    } else if (std::filesystem::rename(tmp_file_name, first_file_name, error); error) {
+        std::scoped_lock l{m_mutex};
+        full_log(LOG_LEVEL_ERROR, AG_FMT("Error rotating log file: {}", tmp_file_name));
+        std::filesystem::remove(tmp_file_name, error);
+    }
+
+    // The uncompressed file is removed anyway: keeping it would defeat the purpose on small storages
+    std::filesystem::remove(pending_file_name, error);
+}
+
+std::string ag::RotatingLogToFile::compressed_file_name(size_t index) const {
+    return AG_FMT("{}.{}{}", m_log_file_path, index, COMPRESSED_FILE_SUFFIX);
+}
+
 void ag::RotatingLogToFile::log_to_ofstream(std::string_view formatted_message) {
     m_file_handle.write(formatted_message.data(), std::streamsize(formatted_message.size()));
     m_file_handle.flush();
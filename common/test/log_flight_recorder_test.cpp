@@ -0,0 +1,104 @@
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/log_flight_recorder.h"
+#include "common/utils.h"
+
+class LogFlightRecorderTest : public ::testing::Test {
+protected:
+    std::string m_dump_file = "test_flight_recorder.log";
+
+    void TearDown() override {
+        std::filesystem::remove(m_dump_file);
+    }
+
+    std::vector<std::string> dump_lines(const ag::LogFlightRecorder &recorder) {
+        EXPECT_TRUE(recorder.dump(m_dump_file.c_str()));
+        std::ifstream file(m_dump_file);
+        std::vector<std::string> lines;
+        for (std::string line; std::getline(file, line);) {
+            lines.emplace_back(std::move(line));
+        }
+        return lines;
+    }
+};
+
+TEST_F(LogFlightRecorderTest, KeepsRecentRecords) {
+    ag::LogFlightRecorder recorder(16 * ag::LogFlightRecorder::SLOT_SIZE);
+    for (int i = 0; i < 100; ++i) {
+        recorder(ag::LOG_LEVEL_DEBUG, AG_FMT("Log entry {}", i));
+    }
+
+    std::vector<std::string> lines = dump_lines(recorder);
+    ASSERT_EQ(lines.size(), 16);
+    ASSERT_TRUE(std::regex_match(lines.front(),
+            std::regex{R"(\d{4}-\d{2}-\d{2} \d{2}:\d{2}:\d{2}\.\d{6} DEBUG \[\d+\] Log entry 84)"}))
+            << lines.front();
+    std::time_t now = std::time(nullptr);
+    char today[16];
+    std::strftime(today, sizeof(today), "%Y-%m-%d ", std::gmtime(&now));
+    ASSERT_TRUE(lines.front().starts_with(today)) << lines.front();
+    ASSERT_TRUE(lines.back().ends_with("Log entry 99")) << lines.back();
+}
+
+TEST_F(LogFlightRecorderTest, LongRecords) {
+    ag::LogFlightRecorder recorder(16 * ag::LogFlightRecorder::SLOT_SIZE);
+    std::string long_message(3 * ag::LogFlightRecorder::SLOT_SIZE, 'x');
+    recorder(ag::LOG_LEVEL_INFO, "Short");
+    recorder(ag::LOG_LEVEL_INFO, long_message);
+    recorder(ag::LOG_LEVEL_INFO, "Short");
+
+    std::vector<std::string> lines = dump_lines(recorder);
+    ASSERT_EQ(lines.size(), 3);
+    ASSERT_TRUE(lines[1].ends_with(long_message));
+
+    // Fill the ring, so that the beginning of the long record is overwritten
+    for (int i = 0; i < 14; ++i) {
+        recorder(ag::LOG_LEVEL_INFO, "Filler");
+    }
+    lines = dump_lines(recorder);
+    ASSERT_EQ(lines.size(), 15);
+    ASSERT_TRUE(lines[0].ends_with("Short"));
+}
+
+TEST_F(LogFlightRecorderTest, PassesToNext) {
+    std::vector<std::string> passed;
+    ag::LogFlightRecorder recorder(
+            1024,
+            [&passed](ag::LogLevel, std::string_view message) {
+                passed.emplace_back(message);
+            },
+            ag::LOG_LEVEL_INFO);
+
+    recorder(ag::LOG_LEVEL_DEBUG, "Debug");
+    recorder(ag::LOG_LEVEL_WARN, "Warn");
+    ASSERT_EQ(passed, std::vector<std::string>{"Warn"});
+    ASSERT_EQ(dump_lines(recorder).size(), 2);
+}
+
+TEST_F(LogFlightRecorderTest, ConcurrentWriters) {
+    ag::LogFlightRecorder recorder(64 * ag::LogFlightRecorder::SLOT_SIZE);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&recorder, t]() {
+            for (int i = 0; i < 10000; ++i) {
+                recorder(ag::LOG_LEVEL_TRACE, AG_FMT("Thread {} entry {}", t, i));
+            }
+        });
+    }
+    std::vector<std::string> lines = dump_lines(recorder);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (const std::string &line : lines) {
+        ASSERT_NE(line.find("TRACE"), std::string::npos) << line;
+    }
+    ASSERT_EQ(dump_lines(recorder).size(), 64);
+}
@@ -1,4 +1,10 @@
+#include <atomic>
+#include <chrono>
 #include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 #include "common/logger.h"
 #include "common/socket_address.h"
@@ -91,3 +97,134 @@ TEST(Logger, SocketAddressFormatter) {
     infolog(logger, "{}", ag::SocketAddress{"1.2.3.4:443"});
     infolog(logger, "{}", ag::SocketAddress{"[12:03:04:05::0067]:443"});
 }
+
+TEST(Logger, StructuredFields) {
+    using namespace ag;
+    using namespace std::chrono_literals;
+    Logger logger("TEST_LOGGER");
+    Logger::set_log_level(LOG_LEVEL_DEBUG);
+
+    std::string plain;
+    Logger::set_callback([&plain](LogLevel, std::string_view message) {
+        plain = message;
+    });
+    infolog_fields(logger, LogFields({{"conn_id", 42U}, {"peer", "1.2.3.4:443"}, {"latency", 1500us}}), "Connected {}",
+            "ok");
+    ASSERT_EQ(plain, "TEST_LOGGER TestBody: Connected ok conn_id=42 peer=1.2.3.4:443 latency=1500us");
+
+    std::string logfmt;
+    std::string json;
+    Logger::set_structured_callback([&](const LogRecord &record) {
+        logfmt = record.to_logfmt();
+        json = record.to_json();
+    });
+    std::string peer = "peer \"x\"";
+    dbglog_fields(logger, LogFields({{"stream_id", -1}, {"peer", peer}, {"ok", true}, {"ratio", 0.5}}), "Done");
+    ASSERT_EQ(logfmt,
+            R"(level=DEBUG logger=TEST_LOGGER func=TestBody msg=Done stream_id=-1 peer="peer \"x\"" ok=true ratio=0.5)");
+    ASSERT_EQ(json,
+            R"({"level":"DEBUG","logger":"TEST_LOGGER","func":"TestBody","msg":"Done","stream_id":-1,)"
+            R"("peer":"peer \"x\"","ok":true,"ratio":0.5})");
+
+    // The fields may live in caller storage
+    const LogField fields[] = {{"stream_id", 2}, {"ok", false}};
+    dbglog_fields(logger, LogFields(fields), "Stored");
+    ASSERT_EQ(logfmt, R"(level=DEBUG logger=TEST_LOGGER func=TestBody msg=Stored stream_id=2 ok=false)");
+    // Fields can't be kept beyond the call they're built in
+    static_assert(!std::is_copy_constructible_v<LogFields> && !std::is_move_constructible_v<LogFields>);
+
+    // Plain records reach the structured callback without the logger name
+    infolog(logger, "{}", "Hello, world!");
+    ASSERT_EQ(logfmt, R"(level=INFO logger=TEST_LOGGER msg="TestBody: Hello, world!")");
+
+    // Disabled levels are not formatted
+    Logger::set_log_level(LOG_LEVEL_INFO);
+    logfmt.clear();
+    dbglog_fields(logger, LogFields({{"stream_id", 1}}), "Skipped");
+    ASSERT_TRUE(logfmt.empty());
+
+    Logger::set_structured_callback(nullptr);
+    Logger::set_callback(Logger::LOG_TO_STDERR);
+}
+
+TEST(Logger, RateLimited) {
+    using namespace ag;
+    Logger logger("TEST_LOGGER");
+    Logger::set_log_level(LOG_LEVEL_DEBUG);
+
+    std::vector<std::string> messages;
+    Logger::set_callback([&messages](LogLevel, std::string_view message) {
+        messages.emplace_back(message);
+    });
+
+    auto log_every = [&](int i) {
+        warnlog_every(logger, std::chrono::milliseconds(100), "Message {}", i);
+    };
+    for (int i = 0; i < 10; ++i) {
+        log_every(i);
+    }
+    ASSERT_EQ(messages.size(), 1);
+    ASSERT_EQ(messages[0], "TEST_LOGGER operator(): Message 0");
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    log_every(10);
+    ASSERT_EQ(messages.size(), 2);
+    ASSERT_EQ(messages[1], "TEST_LOGGER operator(): Message 10 (suppressed 9 messages)");
+
+    // The summary is not emitted on its own when the storm stops: it is carried by the next passed message
+    for (int i = 11; i < 15; ++i) {
+        log_every(i);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    ASSERT_EQ(messages.size(), 2);
+    log_every(15);
+    ASSERT_EQ(messages.size(), 3);
+    ASSERT_EQ(messages[2], "TEST_LOGGER operator(): Message 15 (suppressed 4 messages)");
+
+    messages.clear();
+    for (int i = 0; i < 10; ++i) {
+        dbglog_sampled(logger, 4, "Sampled {}", i);
+    }
+    ASSERT_EQ(messages.size(), 3);
+    ASSERT_EQ(messages[1], "TEST_LOGGER TestBody: Sampled 4 (suppressed 3 messages)");
+
+    // Disabled levels don't touch the limiter
+    messages.clear();
+    Logger::set_log_level(LOG_LEVEL_INFO);
+    for (int i = 0; i < 10; ++i) {
+        dbglog_sampled(logger, 1, "Sampled {}", i);
+    }
+    ASSERT_TRUE(messages.empty());
+
+    Logger::set_callback(Logger::LOG_TO_STDERR);
+}
+
+TEST(Logger, CallbackSwitchIsSeenByAllThreads) {
+    using namespace ag;
+    Logger logger("TEST_LOGGER");
+    Logger::set_log_level(LOG_LEVEL_INFO);
+
+    std::atomic<int> first_counter = 0;
+    std::atomic<int> second_counter = 0;
+    Logger::set_callback([&](LogLevel, std::string_view) {
+        if (++first_counter > 1) {
+            return;
+        }
+        // Logging from a callback must not replace the callback under its feet
+        Logger::set_callback([&](LogLevel, std::string_view) {
+            ++second_counter;
+        });
+        infolog(logger, "Nested");
+    });
+    infolog(logger, "First");
+    ASSERT_EQ(first_counter, 2);
+    ASSERT_EQ(second_counter, 0);
+
+    std::thread([&]() {
+        infolog(logger, "Second");
+    }).join();
+    infolog(logger, "Second");
+    ASSERT_EQ(first_counter, 2);
+    ASSERT_EQ(second_counter, 2);
+
+    Logger::set_callback(Logger::LOG_TO_STDERR);
+}
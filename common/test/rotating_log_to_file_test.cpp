@@ -1,6 +1,9 @@
 #include <filesystem>
 #include <fstream>
 #include <gtest/gtest.h>
+#include <vector>
+
+#include <brotli/decode.h>
 
 #include "common/rotating_log_to_file.h"
 #include "common/utils.h"
@@ -19,11 +22,12 @@ protected:
         std::filesystem::remove(m_log_file);
         for (auto i = 1; i < m_max_files; i++) {
             std::filesystem::remove(AG_FMT("{}.{}", m_log_file, i));
+            std::filesystem::remove(AG_FMT("{}.{}.br", m_log_file, i));
         }
     }
 
     std::string read_file(const std::string &file_name) {
-        std::ifstream file(file_name);
+        std::ifstream file(file_name, std::ios_base::binary);
         if (!file.is_open()) {
             return "";
         }
@@ -112,3 +116,61 @@ TEST_F(RotatingLogToFileTest, TestRename) {
         ASSERT_TRUE(content.find(AG_FMT("{}{}", test_string, i - 2)) != std::string::npos);
     }
 }
+
+TEST_F(RotatingLogToFileTest, TestBrotliCompression) {
+    m_max_files = 3;
+    size_t max_file_size = 200;
+
+    {
+        ag::RotatingLogToFile logger(m_log_file, max_file_size, m_max_files, ag::RotatingLogToFile::BROTLI);
+        for (int i = 0; i < 100; ++i) {
+            logger(ag::LOG_LEVEL_INFO, AG_FMT("Log entry {}", i));
+        }
+        // The destructor waits for the pending files to be compressed
+    }
+
+    for (auto i = 1; i < m_max_files; i++) {
+        ASSERT_TRUE(std::filesystem::exists(AG_FMT("{}.{}.br", m_log_file, i))) << i;
+        ASSERT_FALSE(std::filesystem::exists(AG_FMT("{}.{}", m_log_file, i))) << i;
+    }
+    ASSERT_FALSE(std::filesystem::exists(AG_FMT("{}.{}.br", m_log_file, m_max_files)));
+
+    std::string compressed = read_file(AG_FMT("{}.1.br", m_log_file));
+    ASSERT_FALSE(compressed.empty());
+    std::vector<uint8_t> decompressed(16 * max_file_size);
+    size_t decompressed_size = decompressed.size();
+    ASSERT_EQ(BROTLI_DECODER_RESULT_SUCCESS,
+            BrotliDecoderDecompress(compressed.size(), (const uint8_t *) compressed.data(), &decompressed_size,
+                    decompressed.data()));
+    std::string_view text{(const char *) decompressed.data(), decompressed_size};
+    ASSERT_NE(text.find("Log entry"), std::string_view::npos) << text;
+}
+
+TEST_F(RotatingLogToFileTest, TestLeftoverPendingFiles) {
+    m_max_files = 3;
+    size_t max_file_size = 200;
+    // Files rotated by a previous process which exited before compressing them
+    std::vector<std::string> leftovers = {AG_FMT("{}.pending.0", m_log_file), AG_FMT("{}.pending.7", m_log_file)};
+    for (const std::string &leftover : leftovers) {
+        std::ofstream{leftover} << "Leftover entry " << leftover << "\n";
+    }
+
+    {
+        ag::RotatingLogToFile logger(m_log_file, max_file_size, m_max_files, ag::RotatingLogToFile::BROTLI);
+        logger(ag::LOG_LEVEL_INFO, "Log entry");
+    }
+
+    for (const std::string &leftover : leftovers) {
+        ASSERT_FALSE(std::filesystem::exists(leftover)) << leftover;
+    }
+    std::string compressed = read_file(AG_FMT("{}.1.br", m_log_file));
+    std::vector<uint8_t> decompressed(16 * max_file_size);
+    size_t decompressed_size = decompressed.size();
+    ASSERT_EQ(BROTLI_DECODER_RESULT_SUCCESS,
+            BrotliDecoderDecompress(compressed.size(), (const uint8_t *) compressed.data(), &decompressed_size,
+                    decompressed.data()));
+    std::string_view text{(const char *) decompressed.data(), decompressed_size};
+    // The newest leftover is the most recent rotated file
+    ASSERT_NE(text.find(leftovers.back()), std::string_view::npos) << text;
+    ASSERT_TRUE(std::filesystem::exists(AG_FMT("{}.2.br", m_log_file)));
+}
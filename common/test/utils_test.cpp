@@ -123,6 +123,22 @@ TEST(utils, GenerallyWork) {
 TEST(utils, iequals) {
     ASSERT_TRUE(ag::utils::iequals("AaAaA", "aaaaa"));
     ASSERT_TRUE(ag::utils::iequals("aaaaa", "AaAaA"));
+    ASSERT_FALSE(ag::utils::iequals("aaaaa", "aaaa"));
+    ASSERT_FALSE(ag::utils::iequals("@", "`"));
+    ASSERT_FALSE(ag::utils::iequals("[", "{"));
+    static_assert(ag::utils::iequals("Content-Length", "content-length"));
+
+    // Cover the vectorized blocks and their overlapping tails
+    std::string lower = "sec-websocket-extensions-x-forwarded-for-access-control-allow-origin";
+    std::string upper = ag::utils::to_upper(lower);
+    for (size_t length = 0; length <= lower.size(); ++length) {
+        ASSERT_TRUE(ag::utils::iequals(lower.substr(0, length), upper.substr(0, length))) << length;
+        for (size_t i = 0; i < length; ++i) {
+            std::string mismatch = upper.substr(0, length);
+            mismatch[i] = '#';
+            ASSERT_FALSE(ag::utils::iequals(lower.substr(0, length), mismatch)) << length << " " << i;
+        }
+    }
 }
 
 TEST(utils, ifind) {
@@ -136,6 +152,16 @@ TEST(utils, ifind) {
     ASSERT_EQ(ag::utils::ifind("AaAaB", "ab"), 3);
     ASSERT_EQ(ag::utils::ifind("AaBaB", "Ab"), 1);
     ASSERT_EQ(ag::utils::ifind("AaAaB", "aaaabb"), std::string_view::npos);
+    static_assert(ag::utils::ifind("www.Example.org", "EXAMPLE") == 4);
+
+    std::string haystack(100, 'a');
+    for (size_t pos = 0; pos + 3 <= haystack.size(); ++pos) {
+        std::string str = haystack;
+        str.replace(pos, 3, "XyZ");
+        ASSERT_EQ(ag::utils::ifind(str, "xYz"), pos);
+        ASSERT_EQ(ag::utils::ifind(str, "xYzz"), std::string_view::npos);
+        ASSERT_EQ(ag::utils::ifind(str.substr(0, pos + 2), "xyz"), std::string_view::npos);
+    }
 }
 
 TEST(utils, EncodeDecodeToHex) {
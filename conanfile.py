@@ -37,6 +37,7 @@ class NativeLibsCommon(ConanFile):
         else:
             self.requires("openssl/boring-2024-09-13@adguard/oss", transitive_headers=True)
         self.requires("pcre2/10.37@adguard/oss", transitive_headers=True)
+        self.requires("zlib/1.3.1", transitive_headers=True)
 
     def build_requirements(self):
         self.test_requires("gtest/1.14.0")
@@ -114,6 +115,7 @@ class NativeLibsCommon(ConanFile):
             "ngtcp2::ngtcp2",
             "openssl::openssl",
             "pcre2::pcre2",
+            "zlib::zlib",
         ]
         if self.settings.os == "Windows":
             self.cpp_info.system_libs = ["ws2_32", "iphlpapi", "ntdll", "fwpuclnt"]
@@ -0,0 +1,314 @@
+#include <algorithm>
+#include <cstring>
+
+#include <brotli/decode.h>
+#include <zlib.h>
+
+#include "common/http/body_decoder.h"
+#include "common/utils.h"
+
+namespace ag::http {
+
+// Maximum window size, lets zlib detect the gzip and zlib wrappers automatically
+static constexpr int ZLIB_AUTO_WINDOW_BITS = MAX_WBITS + 32;
+static constexpr int ZLIB_RAW_WINDOW_BITS = -MAX_WBITS;
+static constexpr size_t ZLIB_HEADER_SIZE = 2;
+static constexpr uint8_t GZIP_MAGIC[] = {0x1f, 0x8b};
+
+// RFC 1950: deflate compression method, at most 32K window, and the check bits
+static bool is_zlib_header(const uint8_t (&header)[ZLIB_HEADER_SIZE]) {
+    return (header[0] & 0x0f) == Z_DEFLATED && (header[0] >> 4) <= MAX_WBITS - 8
+            && ((header[0] << 8) | header[1]) % 31 == 0;
+}
+
+std::optional<ContentEncoding> parse_content_encoding(std::string_view value) {
+    value = utils::trim(value);
+    if (utils::iequals(value, "gzip") || utils::iequals(value, "x-gzip")) {
+        return CONTENT_ENCODING_GZIP;
+    }
+    if (utils::iequals(value, "deflate")) {
+        return CONTENT_ENCODING_DEFLATE;
+    }
+    if (utils::iequals(value, "br")) {
+        return CONTENT_ENCODING_BROTLI;
+    }
+    return std::nullopt;
+}
+
+struct BodyDecoder::ZlibState {
+    z_stream stream{};
+    bool initialized = false;
+    // Some servers send raw deflate data instead of the zlib format for `deflate`. The first bytes
+    // are buffered until the header can be checked.
+    uint8_t header[ZLIB_HEADER_SIZE] = {};
+    size_t header_size = 0;
+
+    ~ZlibState() {
+        if (initialized) {
+            inflateEnd(&stream);
+        }
+    }
+
+    bool reset(int window_bits) {
+        if (initialized) {
+            return Z_OK == inflateReset2(&stream, window_bits);
+        }
+        initialized = Z_OK == inflateInit2(&stream, window_bits);
+        return initialized;
+    }
+};
+
+struct BodyDecoder::BrotliState {
+    UniquePtr<BrotliDecoderState, &BrotliDecoderDestroyInstance> state;
+};
+
+BodyDecoder::BodyDecoder(ContentEncoding encoding, size_t max_decoded_size)
+        : m_encoding(encoding)
+        , m_buffer(OUTPUT_BUFFER_SIZE) {
+    reset(encoding, max_decoded_size);
+}
+
+BodyDecoder::~BodyDecoder() = default;
+
+void BodyDecoder::reset(ContentEncoding encoding, size_t max_decoded_size) {
+    m_encoding = encoding;
+    m_max_decoded_size = max_decoded_size;
+    m_decoded_size = 0;
+    m_finished = false;
+
+    switch (encoding) {
+    case CONTENT_ENCODING_GZIP:
+    case CONTENT_ENCODING_DEFLATE:
+        if (m_zlib == nullptr) {
+            m_zlib = std::make_unique<ZlibState>();
+        }
+        m_zlib->header_size = 0;
+        m_zlib->reset(ZLIB_AUTO_WINDOW_BITS);
+        break;
+    case CONTENT_ENCODING_BROTLI:
+        if (m_brotli == nullptr) {
+            m_brotli = std::make_unique<BrotliState>();
+        }
+        // Brotli has no API to reset a decoder instance
+        m_brotli->state.reset(BrotliDecoderCreateInstance(nullptr, nullptr, nullptr));
+        break;
+    }
+}
+
+Error<BodyDecoderError> BodyDecoder::decode(Uint8View chunk, const Handler &handler) {
+    if (chunk.empty() || m_finished) {
+        // Trailing garbage after the end of the encoded data is ignored
+        return {};
+    }
+
+    switch (m_encoding) {
+    case CONTENT_ENCODING_GZIP:
+    case CONTENT_ENCODING_DEFLATE:
+        return decode_zlib(chunk, handler);
+    case CONTENT_ENCODING_BROTLI:
+        return decode_brotli(chunk, handler);
+    }
+
+    return {};
+}
+
+Error<BodyDecoderError> BodyDecoder::finish() const {
+    if (!m_finished) {
+        return make_error(BDE_TRUNCATED_DATA);
+    }
+    return {};
+}
+
+Error<BodyDecoderError> BodyDecoder::decode_zlib(Uint8View chunk, const Handler &handler) {
+    if (!m_zlib->initialized) {
+        return make_error(BDE_INIT_ERROR);
+    }
+
+    ZlibState &zlib = *m_zlib;
+    if (m_encoding == CONTENT_ENCODING_DEFLATE && zlib.header_size < ZLIB_HEADER_SIZE) {
+        size_t length = std::min(chunk.size(), ZLIB_HEADER_SIZE - zlib.header_size);
+        std::memcpy(zlib.header + zlib.header_size, chunk.data(), length);
+        zlib.header_size += length;
+        chunk.remove_prefix(length);
+        if (zlib.header_size < ZLIB_HEADER_SIZE) {
+            return {};
+        }
+        if (!is_zlib_header(zlib.header) && !std::equal(std::begin(GZIP_MAGIC), std::end(GZIP_MAGIC), zlib.header)
+                && !zlib.reset(ZLIB_RAW_WINDOW_BITS)) {
+            return make_error(BDE_INIT_ERROR);
+        }
+        if (auto error = inflate_chunk({zlib.header, ZLIB_HEADER_SIZE}, handler); error != nullptr) {
+            return error;
+        }
+        if (chunk.empty() || m_finished) {
+            return {};
+        }
+    }
+
+    return inflate_chunk(chunk, handler);
+}
+
+Error<BodyDecoderError> BodyDecoder::inflate_chunk(Uint8View chunk, const Handler &handler) {
+    z_stream &stream = m_zlib->stream;
+    stream.next_in = (Bytef *) chunk.data();
+    stream.avail_in = chunk.size();
+
+    while (true) {
+        stream.next_out = m_buffer.data();
+        stream.avail_out = m_buffer.size();
+        int ret = inflate(&stream, Z_NO_FLUSH);
+        if (size_t decoded = m_buffer.size() - stream.avail_out; decoded > 0) {
+            if (auto error = on_decoded({m_buffer.data(), decoded}, handler); error != nullptr) {
+                return error;
+            }
+        }
+
+        switch (ret) {
+        case Z_OK:
+            break;
+        case Z_STREAM_END:
+            if (m_encoding == CONTENT_ENCODING_GZIP && stream.avail_in > 0) {
+                // Concatenated gzip members
+                inflateReset(&stream);
+                break;
+            }
+            m_finished = true;
+            return {};
+        case Z_BUF_ERROR:
+            // No progress is possible until more input is received
+            return {};
+        default:
+            return make_error(BDE_CORRUPTED_DATA,
+                    AG_FMT("{} ({})", (stream.msg != nullptr) ? stream.msg : "inflate() failed", ret));
+        }
+
+        if (stream.avail_in == 0 && stream.avail_out != 0) {
+            return {};
+        }
+    }
+}
+
+Error<BodyDecoderError> BodyDecoder::decode_brotli(Uint8View chunk, const Handler &handler) {
+    BrotliDecoderState *state = m_brotli->state.get();
+    if (state == nullptr) {
+        return make_error(BDE_INIT_ERROR);
+    }
+
+    const uint8_t *next_in = chunk.data();
+    size_t avail_in = chunk.size();
+    while (true) {
+        uint8_t *next_out = m_buffer.data();
+        size_t avail_out = m_buffer.size();
+        BrotliDecoderResult ret =
+                BrotliDecoderDecompressStream(state, &avail_in, &next_in, &avail_out, &next_out, nullptr);
+        if (size_t decoded = m_buffer.size() - avail_out; decoded > 0) {
+            if (auto error = on_decoded({m_buffer.data(), decoded}, handler); error != nullptr) {
+                return error;
+            }
+        }
+
+        switch (ret) {
+        case BROTLI_DECODER_RESULT_SUCCESS:
+            m_finished = true;
+            return {};
+        case BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT:
+            return {};
+        case BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT:
+            break;
+        case BROTLI_DECODER_RESULT_ERROR:
+            return make_error(BDE_CORRUPTED_DATA, BrotliDecoderErrorString(BrotliDecoderGetErrorCode(state)));
+        }
+    }
+}
+
+Error<BodyDecoderError> BodyDecoder::on_decoded(Uint8View chunk, const Handler &handler) {
+    m_decoded_size += chunk.size();
+    if (m_max_decoded_size != 0 && m_decoded_size > m_max_decoded_size) {
+        return make_error(BDE_TOO_LARGE, AG_FMT("The limit is {} bytes", m_max_decoded_size));
+    }
+    if (handler.on_data != nullptr) {
+        handler.on_data(handler.arg, chunk);
+    }
+    return {};
+}
+
+BodyDecoderPool::BodyDecoderPool(size_t capacity)
+        : m_capacity(capacity) {
+}
+
+BodyDecoderPool::~BodyDecoderPool() = default;
+
+std::unique_ptr<BodyDecoder> BodyDecoderPool::acquire(Headers &headers, size_t max_decoded_size) {
+    auto [begin, end] = headers.value_range(HEADER_TOKEN_CONTENT_ENCODING);
+    if (begin == end || std::next(begin) != end) {
+        return nullptr;
+    }
+    std::optional<ContentEncoding> encoding = parse_content_encoding(*begin);
+    if (!encoding.has_value()) {
+        return nullptr;
+    }
+
+    headers.remove(HEADER_TOKEN_CONTENT_ENCODING);
+    headers.remove(HEADER_TOKEN_CONTENT_LENGTH);
+
+    if (m_idle.empty()) {
+        return std::make_unique<BodyDecoder>(encoding.value(), max_decoded_size);
+    }
+    std::unique_ptr<BodyDecoder> decoder = std::move(m_idle.back());
+    m_idle.pop_back();
+    decoder->reset(encoding.value(), max_decoded_size);
+    return decoder;
+}
+
+void BodyDecoderPool::release(std::unique_ptr<BodyDecoder> decoder) {
+    if (decoder != nullptr && m_idle.size() < m_capacity) {
+        m_idle.emplace_back(std::move(decoder));
+    }
+}
+
+void DecodedBodyFlowControl::on_received(uint64_t stream_id, size_t wire_length, size_t decoded_length) {
+    Entry &entry = m_streams[stream_id];
+    entry.wire += wire_length;
+    entry.decoded += decoded_length;
+}
+
+size_t DecodedBodyFlowControl::on_consumed(uint64_t stream_id, size_t decoded_length) {
+    auto it = m_streams.find(stream_id);
+    if (it == m_streams.end()) {
+        return decoded_length;
+    }
+
+    Entry &entry = it->second;
+    size_t wire_length = entry.wire;
+    if (decoded_length < entry.decoded) {
+        wire_length = uint64_t(entry.wire) * decoded_length / entry.decoded;
+        entry.decoded -= decoded_length;
+    } else {
+        entry.decoded = 0;
+    }
+    entry.wire -= wire_length;
+
+    if (entry.finished && entry.decoded == 0) {
+        m_streams.erase(it);
+    }
+    return wire_length;
+}
+
+size_t DecodedBodyFlowControl::on_finished(uint64_t stream_id) {
+    auto it = m_streams.find(stream_id);
+    if (it == m_streams.end()) {
+        return 0;
+    }
+
+    Entry &entry = it->second;
+    if (entry.decoded != 0) {
+        // Returned with the last consumed data
+        entry.finished = true;
+        return 0;
+    }
+    size_t wire_length = entry.wire;
+    m_streams.erase(it);
+    return wire_length;
+}
+
+} // namespace ag::http
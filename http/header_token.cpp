@@ -0,0 +1,192 @@
+#include <array>
+#include <iterator>
+#include <utility>
+
+#include "common/http/header_token.h"
+#include "common/utils.h"
+
+namespace ag::http {
+
+// Indexed by the tokens
+static constexpr std::string_view HEADER_TOKEN_NAMES[] = {
+        "",
+        ":authority",
+        ":method",
+        ":path",
+        ":protocol",
+        ":scheme",
+        ":status",
+        "accept",
+        "accept-charset",
+        "accept-encoding",
+        "accept-language",
+        "accept-ranges",
+        "access-control-allow-credentials",
+        "access-control-allow-headers",
+        "access-control-allow-methods",
+        "access-control-allow-origin",
+        "access-control-expose-headers",
+        "access-control-request-headers",
+        "access-control-request-method",
+        "age",
+        "allow",
+        "alt-svc",
+        "authorization",
+        "cache-control",
+        "connection",
+        "content-disposition",
+        "content-encoding",
+        "content-language",
+        "content-length",
+        "content-location",
+        "content-range",
+        "content-security-policy",
+        "content-type",
+        "cookie",
+        "date",
+        "early-data",
+        "etag",
+        "expect",
+        "expect-ct",
+        "expires",
+        "forwarded",
+        "from",
+        "host",
+        "if-match",
+        "if-modified-since",
+        "if-none-match",
+        "if-range",
+        "if-unmodified-since",
+        "keep-alive",
+        "last-modified",
+        "link",
+        "location",
+        "max-forwards",
+        "origin",
+        "priority",
+        "proxy-authenticate",
+        "proxy-authorization",
+        "proxy-connection",
+        "purpose",
+        "range",
+        "referer",
+        "refresh",
+        "retry-after",
+        "sec-websocket-accept",
+        "sec-websocket-extensions",
+        "sec-websocket-key",
+        "sec-websocket-protocol",
+        "sec-websocket-version",
+        "server",
+        "set-cookie",
+        "strict-transport-security",
+        "te",
+        "timing-allow-origin",
+        "trailer",
+        "transfer-encoding",
+        "upgrade",
+        "upgrade-insecure-requests",
+        "user-agent",
+        "vary",
+        "via",
+        "www-authenticate",
+        "x-content-type-options",
+        "x-forwarded-for",
+        "x-frame-options",
+        "x-xss-protection",
+};
+static_assert(std::size(HEADER_TOKEN_NAMES) == HEADER_TOKEN_COUNT);
+
+static constexpr size_t MAX_HEADER_TOKEN_NAME_LENGTH = 32;
+static constexpr size_t HASH_BUCKETS = 32;
+static constexpr size_t HASH_SLOTS = 128;
+
+// FNV-1a of the name with the ASCII letters folded to lower case.
+// The other characters of the well-known names have the folded bit set already.
+static constexpr uint32_t name_hash(uint32_t seed, std::string_view name) {
+    uint32_t hash = 2166136261U ^ seed;
+    for (char c : name) {
+        hash ^= uint8_t(c) | 0x20U;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+// Hash-and-displace perfect hash: the names are split into buckets by the hash with zero seed,
+// then each bucket gets the seed placing all of its names into the free slots.
+struct PerfectHash {
+    std::array<uint16_t, HASH_BUCKETS> seeds;
+    std::array<HeaderToken, HASH_SLOTS> slots;
+};
+
+static constexpr PerfectHash PERFECT_HASH = [] {
+    PerfectHash result{};
+    std::array<std::array<HeaderToken, HEADER_TOKEN_COUNT>, HASH_BUCKETS> buckets{};
+    std::array<size_t, HASH_BUCKETS> bucket_sizes{};
+    for (size_t i = HEADER_TOKEN_UNKNOWN + 1; i < HEADER_TOKEN_COUNT; ++i) {
+        size_t bucket = name_hash(0, HEADER_TOKEN_NAMES[i]) % HASH_BUCKETS;
+        buckets[bucket][bucket_sizes[bucket]++] = HeaderToken(i);
+    }
+
+    // Place the largest buckets first while there is more room
+    std::array<size_t, HASH_BUCKETS> order{};
+    for (size_t i = 0; i < HASH_BUCKETS; ++i) {
+        order[i] = i;
+    }
+    for (size_t i = 1; i < HASH_BUCKETS; ++i) {
+        for (size_t j = i; j > 0 && bucket_sizes[order[j - 1]] < bucket_sizes[order[j]]; --j) {
+            std::swap(order[j - 1], order[j]);
+        }
+    }
+
+    for (size_t bucket : order) {
+        for (uint16_t seed = 1; bucket_sizes[bucket] > 0; ++seed) {
+            std::array<size_t, HEADER_TOKEN_COUNT> positions{};
+            bool fits = true;
+            for (size_t i = 0; fits && i < bucket_sizes[bucket]; ++i) {
+                positions[i] = name_hash(seed, HEADER_TOKEN_NAMES[buckets[bucket][i]]) % HASH_SLOTS;
+                fits = result.slots[positions[i]] == HEADER_TOKEN_UNKNOWN;
+                for (size_t j = 0; fits && j < i; ++j) {
+                    fits = positions[i] != positions[j];
+                }
+            }
+            if (fits) {
+                result.seeds[bucket] = seed;
+                for (size_t i = 0; i < bucket_sizes[bucket]; ++i) {
+                    result.slots[positions[i]] = buckets[bucket][i];
+                }
+                break;
+            }
+        }
+    }
+    return result;
+}();
+
+static_assert([] {
+    for (size_t i = HEADER_TOKEN_UNKNOWN + 1; i < HEADER_TOKEN_COUNT; ++i) {
+        std::string_view name = HEADER_TOKEN_NAMES[i];
+        uint16_t seed = PERFECT_HASH.seeds[name_hash(0, name) % HASH_BUCKETS];
+        if (name.size() > MAX_HEADER_TOKEN_NAME_LENGTH || PERFECT_HASH.slots[name_hash(seed, name) % HASH_SLOTS] != i) {
+            return false;
+        }
+    }
+    return true;
+}());
+
+HeaderToken header_token(std::string_view name) {
+    if (name.empty() || name.size() > MAX_HEADER_TOKEN_NAME_LENGTH) {
+        return HEADER_TOKEN_UNKNOWN;
+    }
+    uint16_t seed = PERFECT_HASH.seeds[name_hash(0, name) % HASH_BUCKETS];
+    HeaderToken token = PERFECT_HASH.slots[name_hash(seed, name) % HASH_SLOTS];
+    if (token != HEADER_TOKEN_UNKNOWN && utils::iequals(name, HEADER_TOKEN_NAMES[token])) {
+        return token;
+    }
+    return HEADER_TOKEN_UNKNOWN;
+}
+
+std::string_view header_token_name(HeaderToken token) {
+    return (token < HEADER_TOKEN_COUNT) ? HEADER_TOKEN_NAMES[token] : std::string_view{};
+}
+
+} // namespace ag::http
@@ -1,4 +1,7 @@
 #include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <memory>
 #include <utility>
 
 #include "common/http/headers.h"
@@ -6,14 +9,243 @@
 
 namespace ag::http {
 
+// Most messages fit the first block, so the storage usually costs a single allocation
+static constexpr size_t ARENA_FIRST_BLOCK_SIZE = 1024;
+static constexpr size_t ARENA_MAX_BLOCK_SIZE = 16 * 1024;
+static constexpr std::string_view CRLF = "\r\n";
+
+// The serializers run twice: with `SizeCounter` to find the exact size and with `BufferWriter` to write
+struct SizeCounter {
+    size_t size = 0;
+
+    void operator()(std::string_view str) {
+        size += str.size();
+    }
+};
+
+struct BufferWriter {
+    Uint8Span buffer;
+    size_t pos = 0;
+    bool overflow = false;
+
+    void operator()(std::string_view str) {
+        if (overflow || buffer.size() - pos < str.size()) {
+            overflow = true;
+            return;
+        }
+        std::memcpy(buffer.data() + pos, str.data(), str.size());
+        pos += str.size();
+    }
+};
+
+template <typename Writer>
+static void write_number(Writer &out, int64_t number) {
+    char buf[20];
+    auto [end, _] = std::to_chars(std::begin(buf), std::end(buf), number);
+    out({buf, size_t(end - buf)});
+}
+
+template <typename Writer>
+static void write_version(Writer &out, Version version) {
+    out("HTTP/");
+    write_number(out, version_get_major(version));
+    out(".");
+    write_number(out, version_get_minor(version));
+}
+
+// Mirrors `fmt::formatter<Headers>`
+template <typename Writer>
+static void write_headers(Writer &out, const Headers &headers) {
+    for (const auto &header : headers) {
+        out(header.name);
+        out(": ");
+        out(header.value);
+        out(CRLF);
+    }
+    if (headers.length() == 0) {
+        out(CRLF);
+    }
+}
+
+// Mirrors `fmt::formatter<Request>`
+template <typename Writer>
+static void write_request(Writer &out, const Request &request) {
+    std::string_view method = request.method();
+    std::string_view path = request.path();
+    std::string_view authority = request.authority();
+    std::string_view protocol = request.protocol();
+    bool is_h2_or_h3 = request.version() == HTTP_2_0 || request.version() == HTTP_3_0;
+    bool is_connect = (method == "CONNECT") && protocol.empty();
+
+    out(method.empty() ? "OPTIONS" : method);
+    out(" ");
+    if (!is_h2_or_h3) {
+        out(path.empty() ? "*" : path);
+    } else if (is_connect) {
+        out(!authority.empty() ? authority : "<empty :authority>");
+    } else {
+        out(!path.empty() ? path : "<empty :path>");
+    }
+    out(" ");
+    write_version(out, request.version());
+    out(CRLF);
+
+    if (is_h2_or_h3) {
+        if (std::string_view scheme = request.scheme(); !scheme.empty()) {
+            out(":scheme: ");
+            out(scheme);
+            out(CRLF);
+        }
+        if (is_connect && !path.empty()) {
+            out(":path: ");
+            out(path);
+            out(CRLF);
+        } else if (!is_connect && !authority.empty()) {
+            out(":authority: ");
+            out(authority);
+            out(CRLF);
+        }
+        if (!protocol.empty()) {
+            out(":protocol: ");
+            out(protocol);
+            out(CRLF);
+        }
+    }
+
+    write_headers(out, request.headers());
+    out(CRLF);
+}
+
+// Mirrors `fmt::formatter<Response>`
+template <typename Writer>
+static void write_response(Writer &out, const Response &response) {
+    write_version(out, response.version());
+    out(" ");
+    write_number(out, response.status_code());
+    std::string_view status_message = (response.version() < HTTP_2_0) ? response.status_string() : "";
+    if (!status_message.empty()) {
+        out(" ");
+        out(status_message);
+    }
+    out(CRLF);
+    if (response.headers().length() == 0) {
+        out(CRLF);
+        return;
+    }
+    write_headers(out, response.headers());
+    out(CRLF);
+}
+
+Headers::Arena::Arena(Arena &&other) noexcept
+        : m_blocks(std::move(other.m_blocks))
+        , m_block_size(std::exchange(other.m_block_size, 0))
+        , m_block_used(std::exchange(other.m_block_used, 0)) {
+    other.m_blocks.clear();
+}
+
+Headers::Arena &Headers::Arena::operator=(Arena &&other) noexcept {
+    if (this != &other) {
+        m_blocks = std::move(other.m_blocks);
+        m_block_size = std::exchange(other.m_block_size, 0);
+        m_block_used = std::exchange(other.m_block_used, 0);
+        other.m_blocks.clear();
+    }
+    return *this;
+}
+
+std::string_view Headers::Arena::store(std::string_view str) {
+    if (str.empty()) {
+        return {};
+    }
+    if (m_blocks.empty() || m_block_size - m_block_used < str.size()) {
+        size_t next_size = m_blocks.empty() ? ARENA_FIRST_BLOCK_SIZE : std::min(2 * m_block_size, ARENA_MAX_BLOCK_SIZE);
+        m_block_size = std::max(next_size, str.size());
+        m_block_used = 0;
+        m_blocks.emplace_back(std::make_unique_for_overwrite<char[]>(m_block_size));
+    }
+    char *dst = m_blocks.back().get() + m_block_used;
+    std::memcpy(dst, str.data(), str.size());
+    m_block_used += str.size();
+    return {dst, str.size()};
+}
+
+void Headers::Arena::clear() {
+    if (m_blocks.empty()) {
+        return;
+    }
+    if (m_blocks.size() > 1) {
+        std::swap(m_blocks.front(), m_blocks.back());
+        m_blocks.resize(1);
+    }
+    m_block_used = 0;
+}
+
+Headers::~Headers() {
+    release_buffer_refs();
+}
+
+Headers::Headers(const Headers &headers)
+        : m_has_body(headers.m_has_body) {
+    reserve(headers.length());
+    for (size_t i = 0; i < headers.m_headers.size(); ++i) {
+        put_impl(headers.m_headers[i].name, headers.m_headers[i].value, headers.m_tokens[i]);
+    }
+}
+
+Headers &Headers::operator=(const Headers &headers) {
+    if (this != &headers) {
+        *this = Headers(headers);
+    }
+    return *this;
+}
+
+Headers::Headers(Headers &&headers) noexcept
+        : m_headers(std::move(headers.m_headers))
+        , m_tokens(std::move(headers.m_tokens))
+        , m_index(std::exchange(headers.m_index, {}))
+        , m_arena(std::move(headers.m_arena))
+        , m_has_body(std::exchange(headers.m_has_body, false))
+        , m_buffer_refs(std::move(headers.m_buffer_refs)) {
+    headers.m_headers.clear();
+    headers.m_tokens.clear();
+    headers.m_buffer_refs.clear();
+}
+
+Headers &Headers::operator=(Headers &&headers) noexcept {
+    if (this != &headers) {
+        release_buffer_refs();
+        m_headers = std::move(headers.m_headers);
+        m_tokens = std::move(headers.m_tokens);
+        m_index = std::exchange(headers.m_index, {});
+        m_arena = std::move(headers.m_arena);
+        m_has_body = std::exchange(headers.m_has_body, false);
+        m_buffer_refs = std::move(headers.m_buffer_refs);
+        headers.m_headers.clear();
+        headers.m_tokens.clear();
+        headers.m_buffer_refs.clear();
+    }
+    return *this;
+}
+
+Headers::Headers(ConstIterator begin, ConstIterator end) {
+    reserve(std::distance(begin, end));
+    for (; begin != end; ++begin) {
+        put(begin->name, begin->value);
+    }
+}
+
 void Headers::reserve(size_t n) {
     m_headers.reserve(n);
+    m_tokens.reserve(n);
 }
 
 std::optional<std::string_view> Headers::get(std::string_view name) const {
-    auto iter = std::find_if(m_headers.begin(), m_headers.end(), [name](const auto &h) {
-        return utils::iequals(h.name, name);
-    });
+    auto iter = find(name, header_token(name));
+    return (iter != m_headers.end()) ? std::make_optional<std::string_view>(iter->value) : std::nullopt;
+}
+
+std::optional<std::string_view> Headers::get(HeaderToken token) const {
+    auto iter = find(header_token_name(token), token);
     return (iter != m_headers.end()) ? std::make_optional<std::string_view>(iter->value) : std::nullopt;
 }
 
@@ -21,39 +253,85 @@ std::string_view Headers::gets(std::string_view name) const {
     return get(name).value_or("");
 }
 
-void Headers::put(std::string name, std::string value) {
-    m_headers.emplace_back(Header<>{std::move(name), std::move(value)});
+std::string_view Headers::gets(HeaderToken token) const {
+    return get(token).value_or("");
+}
+
+void Headers::put(std::string_view name, std::string_view value) {
+    put_impl(name, value, header_token(name));
+}
+
+void Headers::put(HeaderToken token, std::string_view value) {
+    put_impl(header_token_name(token), value, token);
+}
+
+void Headers::put(std::string_view name, std::string_view value, HeaderToken token) {
+    put_impl(name, value, token);
+}
+
+void Headers::put_borrowed(std::string_view name, std::string_view value, HeaderToken token, BufferRef name_ref,
+        BufferRef value_ref) {
+    m_buffer_refs.push_back(name_ref);
+    m_buffer_refs.push_back(value_ref);
+    if (token != HEADER_TOKEN_UNKNOWN && m_index[token] == 0) {
+        m_index[token] = m_headers.size() + 1;
+    }
+    m_headers.emplace_back(Header<std::string_view>{name, value});
+    m_tokens.push_back(token);
 }
 
 bool Headers::contains(std::string_view name) const {
-    return get(name).has_value();
+    return find(name, header_token(name)) != m_headers.end();
+}
+
+bool Headers::contains(HeaderToken token) const {
+    return find(header_token_name(token), token) != m_headers.end();
 }
 
 size_t Headers::remove(std::string_view name) {
-    auto iter = std::remove_if(m_headers.begin(), m_headers.end(), [name](const auto &h) {
-        return h.name == name;
-    });
-    size_t n = std::distance(iter, m_headers.end());
-    m_headers.erase(iter, m_headers.end());
+    HeaderToken token = header_token(name);
+    size_t n = 0;
+    for (size_t i = 0; i < m_headers.size(); ++i) {
+        if (matches(m_headers.begin() + i, name, token)) {
+            ++n;
+        } else if (n > 0) {
+            m_headers[i - n] = m_headers[i];
+            m_tokens[i - n] = m_tokens[i];
+        }
+    }
+    if (n > 0) {
+        m_headers.resize(m_headers.size() - n);
+        m_tokens.resize(m_tokens.size() - n);
+        rebuild_index();
+    }
     return n;
 }
 
-Headers::Iterator Headers::erase(Iterator iter) {
-    return m_headers.erase(iter);
+size_t Headers::remove(HeaderToken token) {
+    return remove(header_token_name(token));
 }
 
-Headers::Iterator Headers::erase(ConstIterator iter) {
-    return m_headers.erase(iter);
+void Headers::clear() {
+    m_headers.clear();
+    m_tokens.clear();
+    m_index = {};
+    m_arena.clear();
+    m_has_body = false;
+    release_buffer_refs();
 }
 
-Headers::ValueIterator<Headers::Iterator> Headers::erase(ValueIterator<Iterator> iter) {
-    std::string_view name = iter.m_name;
-    return {m_headers.erase(iter.m_current), m_headers.end(), name};
+Headers::Iterator Headers::erase(ConstIterator iter) {
+    size_t pos = std::distance(m_headers.cbegin(), iter);
+    m_tokens.erase(m_tokens.begin() + ssize_t(pos));
+    auto next = m_headers.erase(iter);
+    rebuild_index();
+    return next;
 }
 
 Headers::ValueIterator<Headers::Iterator> Headers::erase(ValueIterator<ConstIterator> iter) {
     std::string_view name = iter.m_name;
-    return {m_headers.erase(iter.m_current), m_headers.end(), name};
+    HeaderToken token = iter.m_token;
+    return {this, erase(iter.m_current), name, token};
 }
 
 size_t Headers::length() const {
@@ -69,15 +347,29 @@ void Headers::has_body(bool flag) {
 }
 
 std::string Headers::str() const {
-    return fmt::format("{}", *this);
+    std::string result(size_hint(), '\0');
+    serialize_into({(uint8_t *) result.data(), result.size()});
+    return result;
+}
+
+size_t Headers::size_hint() const {
+    SizeCounter counter;
+    write_headers(counter, *this);
+    return counter.size;
+}
+
+size_t Headers::serialize_into(Uint8Span buffer) const {
+    BufferWriter writer{buffer};
+    write_headers(writer, *this);
+    return writer.overflow ? 0 : writer.pos;
 }
 
 Headers::Iterator Headers::begin() {
-    return m_headers.begin();
+    return m_headers.cbegin();
 }
 
 Headers::Iterator Headers::end() {
-    return m_headers.end();
+    return m_headers.cend();
 }
 
 Headers::ConstIterator Headers::begin() const {
@@ -88,28 +380,74 @@ Headers::ConstIterator Headers::end() const {
     return m_headers.cend();
 }
 
-std::pair<Headers::ValueIterator<Headers::Iterator>, Headers::ValueIterator<Headers::Iterator>> Headers::value_range(
-        std::string_view name) {
-    return {{m_headers.begin(), m_headers.end(), name}, {m_headers.end(), m_headers.end(), name}};
+std::pair<Headers::ValueIterator<Headers::ConstIterator>, Headers::ValueIterator<Headers::ConstIterator>>
+Headers::value_range(std::string_view name) const {
+    HeaderToken token = header_token(name);
+    return {{this, find(name, token), name, token}, {this, m_headers.end(), name, token}};
 }
 
 std::pair<Headers::ValueIterator<Headers::ConstIterator>, Headers::ValueIterator<Headers::ConstIterator>>
-Headers::value_range(std::string_view name) const {
-    return {{m_headers.begin(), m_headers.end(), name}, {m_headers.end(), m_headers.end(), name}};
+Headers::value_range(HeaderToken token) const {
+    std::string_view name = header_token_name(token);
+    return {{this, find(name, token), name, token}, {this, m_headers.end(), name, token}};
 }
 
-template <typename I>
-Headers::ValueIterator<I>::ValueIterator(I begin, I end, std::string_view name)
-        : m_current(begin)
-        , m_end(end)
-        , m_name(name) {
-    if (m_current != m_end) {
-        if (utils::iequals(m_current->name, m_name)) {
-            m_value = m_current->value;
-        } else {
-            *this = this->operator++();
+void Headers::put_impl(std::string_view name, std::string_view value, HeaderToken token) {
+    if (token != HEADER_TOKEN_UNKNOWN && m_index[token] == 0) {
+        m_index[token] = m_headers.size() + 1;
+    }
+    name = m_arena.store(name);
+    value = m_arena.store(value);
+    m_headers.emplace_back(Header<std::string_view>{name, value});
+    m_tokens.push_back(token);
+}
+
+void Headers::release_buffer_refs() {
+    for (const BufferRef &ref : m_buffer_refs) {
+        ref.release(ref.buffer);
+    }
+    m_buffer_refs.clear();
+}
+
+void Headers::rebuild_index() {
+    m_index = {};
+    for (size_t i = m_tokens.size(); i-- > 0;) {
+        m_index[m_tokens[i]] = i + 1;
+    }
+    m_index[HEADER_TOKEN_UNKNOWN] = 0;
+}
+
+Headers::ConstIterator Headers::find(std::string_view name, HeaderToken token) const {
+    if (token != HEADER_TOKEN_UNKNOWN) {
+        return (m_index[token] != 0) ? std::next(m_headers.begin(), m_index[token] - 1) : m_headers.end();
+    }
+    for (auto iter = m_headers.begin(); iter != m_headers.end(); ++iter) {
+        if (matches(iter, name, token)) {
+            return iter;
         }
     }
+    return m_headers.end();
+}
+
+HeaderToken Headers::token(ConstIterator iter) const {
+    return m_tokens[std::distance(m_headers.begin(), iter)];
+}
+
+bool Headers::matches(ConstIterator iter, std::string_view name, HeaderToken token) const {
+    HeaderToken iter_token = m_tokens[std::distance(m_headers.begin(), iter)];
+    if (token != HEADER_TOKEN_UNKNOWN || iter_token != HEADER_TOKEN_UNKNOWN) {
+        return token == iter_token;
+    }
+    return utils::iequals(iter->name, name);
+}
+
+template <typename I>
+Headers::ValueIterator<I>::ValueIterator(const Headers *headers, I begin, std::string_view name, HeaderToken token)
+        : m_headers(headers)
+        , m_current(begin)
+        , m_name(name)
+        , m_token(token) {
+    skip_mismatching();
 }
 
 template <typename I>
@@ -119,14 +457,8 @@ typename Headers::ValueIterator<I>::reference Headers::ValueIterator<I>::operato
 
 template <typename I>
 typename Headers::ValueIterator<I> &Headers::ValueIterator<I>::operator++() {
-    do {
-        ++m_current;
-    } while (m_current != m_end && !utils::iequals(m_current->name, m_name));
-    if (m_current != m_end) {
-        m_value = m_current->value;
-    } else {
-        m_value.reset();
-    }
+    ++m_current;
+    skip_mismatching();
     return *this;
 }
 
@@ -147,7 +479,19 @@ bool Headers::ValueIterator<I>::operator!=(ValueIterator rhs) const {
     return !(rhs == *this);
 }
 
-template class Headers::ValueIterator<Headers::Iterator>;
+template <typename I>
+void Headers::ValueIterator<I>::skip_mismatching() {
+    auto end = m_headers->m_headers.end();
+    while (m_current != end && !m_headers->matches(m_current, m_name, m_token)) {
+        ++m_current;
+    }
+    if (m_current != end) {
+        m_value = m_current->value;
+    } else {
+        m_value.reset();
+    }
+}
+
 template class Headers::ValueIterator<Headers::ConstIterator>;
 
 Request::Request(Version version)
@@ -204,6 +548,14 @@ void Request::authority(std::string val) {
     m_authority = std::move(val);
 }
 
+std::string_view Request::protocol() const {
+    return m_protocol;
+}
+
+void Request::protocol(std::string val) {
+    m_protocol = std::move(val);
+}
+
 Headers &Request::headers() {
     return m_headers;
 }
@@ -213,7 +565,21 @@ const Headers &Request::headers() const {
 }
 
 std::string Request::str() const {
-    return fmt::format("{}", *this);
+    std::string result(size_hint(), '\0');
+    serialize_into({(uint8_t *) result.data(), result.size()});
+    return result;
+}
+
+size_t Request::size_hint() const {
+    SizeCounter counter;
+    write_request(counter, *this);
+    return counter.size;
+}
+
+size_t Request::serialize_into(Uint8Span buffer) const {
+    BufferWriter writer{buffer};
+    write_request(writer, *this);
+    return writer.overflow ? 0 : writer.pos;
 }
 
 Headers Request::into_headers(Request self) {
@@ -288,6 +654,13 @@ void Request::Iterator::update_current() {
             m_current = make_header<std::string_view>(PSEUDO_HEADER_NAME_AUTHORITY, m_obj->m_authority);
             break;
         }
+        m_state = PROTOCOL;
+        [[fallthrough]];
+    case PROTOCOL:
+        if (!m_obj->m_protocol.empty()) {
+            m_current = make_header<std::string_view>(PSEUDO_HEADER_NAME_PROTOCOL, m_obj->m_protocol);
+            break;
+        }
         m_state = HEADERS;
         [[fallthrough]];
     case HEADERS:
@@ -367,7 +740,21 @@ const Headers &Response::headers() const {
 }
 
 std::string Response::str() const {
-    return fmt::format("{}", *this);
+    std::string result(size_hint(), '\0');
+    serialize_into({(uint8_t *) result.data(), result.size()});
+    return result;
+}
+
+size_t Response::size_hint() const {
+    SizeCounter counter;
+    write_response(counter, *this);
+    return counter.size;
+}
+
+size_t Response::serialize_into(Uint8Span buffer) const {
+    BufferWriter writer{buffer};
+    write_response(writer, *this);
+    return writer.overflow ? 0 : writer.pos;
 }
 
 Headers Response::into_headers(Response self) {
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <atomic>
 
 #include <magic_enum/magic_enum.hpp>
@@ -14,6 +15,47 @@ namespace ag::http {
 static const Logger g_logger("H1");    // NOLINT(*-identifier-naming)
 static std::atomic_uint32_t g_next_id; // NOLINT(*-avoid-non-const-global-variables)
 static constexpr std::string_view CHUNK_FOOTER = "\r\n";
+static constexpr std::string_view LAST_CHUNK = "0\r\n";
+
+// The parser reports a field in one piece unless it is split between input chunks,
+// so most of the fields are put into the headers straight from the input chunk
+static void append_fragment(std::string_view &field, std::string &storage, std::string_view fragment) {
+    if (field.empty()) {
+        field = fragment;
+        return;
+    }
+    if (field.data() != storage.data()) {
+        storage.assign(field);
+    }
+    storage.append(fragment);
+    field = storage;
+}
+
+static void materialize_fragment(std::string_view &field, std::string &storage) {
+    if (!field.empty() && field.data() != storage.data()) {
+        storage.assign(field);
+        field = storage;
+    }
+}
+
+// Maximum number of the stream objects kept for reuse by a session
+static constexpr size_t MAX_IDLE_STREAMS = 4;
+// Larger buffers of the postponed output aren't kept in the idle streams
+static constexpr size_t MAX_IDLE_STREAM_BUFFER_SIZE = 64 * 1024;
+
+// Methods of the requests the fast path handles, all of them have no body unless it's framed explicitly
+static constexpr std::string_view SIMPLE_REQUEST_METHODS[] = {"GET", "HEAD", "OPTIONS", "DELETE"};
+static constexpr std::string_view HTTP_1_1_VERSION = "HTTP/1.1";
+static constexpr std::string_view HEADER_BLOCK_END = "\r\n\r\n";
+
+static constexpr bool is_token_char(uint8_t c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+            || std::string_view{"!#$%&'*+-.^_`|~"}.find(char(c)) != std::string_view::npos;
+}
+
+static constexpr bool is_field_value_char(uint8_t c) {
+    return c == '\t' || (c >= 0x20 && c != 0x7f);
+}
 
 template <typename T>
 Http1Session<T>::Http1Session()
@@ -24,6 +66,7 @@ Http1Session<T>::Http1Session()
     m_settings.on_status = on_status;
     m_settings.on_header_field = on_header_field;
     m_settings.on_header_value = on_header_value;
+    m_settings.on_header_value_complete = on_header_value_complete;
     m_settings.on_headers_complete = on_headers_complete;
     m_settings.on_body = on_body;
     m_settings.on_message_complete = on_message_complete;
@@ -49,7 +92,7 @@ int Http1Session<T>::on_message_begin(llhttp_t *parser) {
     auto *self = (Http1Session<T> *) parser->data;
 
     if constexpr (std::is_same_v<T, Http1Server>) {
-        const Stream &stream = self->m_streams.emplace_back(self->m_next_stream_id++);
+        const Stream &stream = self->emplace_stream(self->m_next_stream_id++);
         log_sid(trace, self->m_id, stream.id, "...");
     } else {
         if (self->m_streams.empty()) {
@@ -64,7 +107,12 @@ int Http1Session<T>::on_message_begin(llhttp_t *parser) {
         stream.flags.reset(Stream::INTERMEDIATE_RESPONSE);
     }
 
-    self->m_parser_context.emplace();
+    if (self->m_parser_context.has_value()) {
+        self->m_parser_context->reset();
+    } else {
+        self->m_parser_context.emplace();
+    }
+    self->m_message_in_progress = true;
 
     return 0;
 }
@@ -142,11 +190,7 @@ int Http1Session<T>::on_header_field(llhttp_t *parser, const char *at, size_t le
     }
 
     ParserContext &context = self->m_parser_context.value();
-    if (bool is_new_field = context.headers.empty() || !context.headers.back().second.empty(); is_new_field) {
-        context.headers.emplace_back(field, std::string{});
-    } else {
-        context.headers.back().first.append(field);
-    }
+    append_fragment(context.field_name, context.field_name_storage, field);
 
     return 0;
 }
@@ -170,12 +214,27 @@ int Http1Session<T>::on_header_value(llhttp_t *parser, const char *at, size_t le
     }
 
     ParserContext &context = self->m_parser_context.value();
-    if (context.headers.empty()) {
+    if (context.field_name.empty()) {
         log_sid(dbg, self->m_id, stream.id, "Got value before name: {}", value);
         return -1;
     }
 
-    context.headers.back().second.append(value);
+    append_fragment(context.field_value, context.field_value_storage, value);
+    return 0;
+}
+
+template <typename T>
+int Http1Session<T>::on_header_value_complete(llhttp_t *parser) {
+    auto *self = (Http1Session<T> *) parser->data;
+    if (!self->m_parser_context.has_value()) {
+        log_id(dbg, self->m_id, "Parser context isn't initialized");
+        return -1;
+    }
+
+    ParserContext &context = self->m_parser_context.value();
+    context.headers.put(context.field_name, context.field_value);
+    context.field_name = {};
+    context.field_value = {};
     return 0;
 }
 
@@ -214,10 +273,7 @@ int Http1Session<T>::on_headers_complete(llhttp_t *parser) {
         return -1;
     }
 
-    Headers headers;
-    for (auto &[name, value] : std::exchange(context.headers, {})) {
-        headers.put(std::move(name), std::move(value));
-    }
+    Headers headers = std::exchange(context.headers, {});
 
     Result ret = PROCEED_NORMALLY;
     if constexpr (std::is_same_v<T, Http1Server>) {
@@ -253,6 +309,9 @@ int Http1Session<T>::on_headers_complete(llhttp_t *parser) {
 
         stream.flags.set(Stream::HAS_BODY, response.headers().has_body());
         stream.flags.set(Stream::INTERMEDIATE_RESPONSE, status_code < HTTP_STATUS_OK);
+        if (self->m_decode_content_encoding && stream.flags.test(Stream::HAS_BODY)) {
+            stream.body_decoder = self->m_body_decoders.acquire(response.headers(), self->m_max_decoded_body_size);
+        }
 
         if (auto &h = static_cast<T *>(self)->m_handler; h.on_response != nullptr) {
             h.on_response(h.arg, stream.id, std::move(response));
@@ -286,6 +345,9 @@ int Http1Session<T>::on_body(llhttp_t *parser, const char *at, size_t length) {
     log_sid(trace, self->m_id, stream.id, "length={}", length);
 
     stream.flags.set(Stream::BODY_DATA_STARTED);
+    if (stream.body_decoder != nullptr) {
+        return self->decode_body(stream, {(uint8_t *) at, length});
+    }
     if (auto &h = static_cast<T *>(self)->m_handler; h.on_body != nullptr) {
         h.on_body(h.arg, stream.id, {(uint8_t *) at, length});
     }
@@ -293,6 +355,30 @@ int Http1Session<T>::on_body(llhttp_t *parser, const char *at, size_t length) {
     return 0;
 }
 
+template <typename T>
+int Http1Session<T>::decode_body(Stream &stream, Uint8View chunk) {
+    struct Context {
+        T *self;
+        uint64_t stream_id;
+    } context{static_cast<T *>(this), stream.id};
+    BodyDecoder::Handler handler{
+            .arg = &context,
+            .on_data =
+                    [](void *arg, Uint8View decoded) {
+                        auto *context = (Context *) arg;
+                        if (auto &h = context->self->m_handler; h.on_body != nullptr) {
+                            h.on_body(h.arg, context->stream_id, decoded);
+                        }
+                    },
+    };
+
+    if (Error<BodyDecoderError> error = stream.body_decoder->decode(chunk, handler); error != nullptr) {
+        log_sid(dbg, m_id, stream.id, "Couldn't decode body: {}", error->str());
+        return -1;
+    }
+    return 0;
+}
+
 template <typename T>
 int Http1Session<T>::on_message_complete(llhttp_t *parser) {
     auto *self = (Http1Session<T> *) parser->data;
@@ -303,37 +389,182 @@ int Http1Session<T>::on_message_complete(llhttp_t *parser) {
 
     Stream &stream = self->active_stream();
     log_sid(trace, self->m_id, stream.id, "...");
+    self->m_message_in_progress = false;
+    self->m_keep_alive = llhttp_should_keep_alive(parser);
+
+    if (stream.body_decoder != nullptr) {
+        Error<BodyDecoderError> error = stream.body_decoder->finish();
+        self->m_body_decoders.release(std::move(stream.body_decoder));
+        if (error != nullptr) {
+            log_sid(dbg, self->m_id, stream.id, "Couldn't decode body: {}", error->str());
+            return -1;
+        }
+    }
 
     auto &handler = static_cast<T *>(self)->m_handler;
     if (stream.flags.test(Stream::HAS_BODY)) {
         if (handler.on_trailer_headers != nullptr && self->m_parser_context.has_value()
-                && !self->m_parser_context->headers.empty()) {
-            Headers headers;
-            for (auto &[name, value] : std::exchange(self->m_parser_context->headers, {})) {
-                headers.put(std::move(name), std::move(value));
-            }
-            handler.on_trailer_headers(handler.arg, stream.id, std::move(headers));
+                && self->m_parser_context->headers.length() > 0) {
+            handler.on_trailer_headers(handler.arg, stream.id, std::exchange(self->m_parser_context->headers, {}));
         }
         if (handler.on_body_finished != nullptr) {
             handler.on_body_finished(handler.arg, stream.id);
         }
     }
 
-    if (std::is_same_v<T, Http1Client> && !stream.flags.test(Stream::INTERMEDIATE_RESPONSE)) {
-        if (handler.on_stream_finished != nullptr) {
-            handler.on_stream_finished(handler.arg, stream.id, 0);
+    if constexpr (std::is_same_v<T, Http1Client>) {
+        if (!stream.flags.test(Stream::INTERMEDIATE_RESPONSE)) {
+            if (handler.on_stream_finished != nullptr) {
+                handler.on_stream_finished(handler.arg, stream.id, 0);
+            }
+            self->pop_stream();
+        }
+    }
+
+    // An upgrade stops the parser anyway, and the upgraded stream isn't going to be finished by a response
+    if constexpr (std::is_same_v<T, Http1Server>) {
+        if (self->m_streams.size() >= self->m_max_pipelined_requests && !llhttp_get_upgrade(parser)) {
+            log_id(dbg, self->m_id, "Pausing input: {} requests are waiting for responses", self->m_streams.size());
+            return HPE_PAUSED;
         }
-        self->m_streams.pop_front();
-        self->m_parser_context.reset();
     }
 
     return 0;
 }
 
+template <typename T>
+template <typename M>
+void Http1Session<T>::output_message(Stream &stream, const M &message) {
+    output(stream, serialize_message(message));
+}
+
+template <typename T>
+template <typename M>
+Uint8View Http1Session<T>::serialize_message(const M &message) {
+    m_output_buffer.resize(message.size_hint());
+    size_t size = message.serialize_into({m_output_buffer.data(), m_output_buffer.size()});
+    return {m_output_buffer.data(), size};
+}
+
+template <typename T>
+void Http1Session<T>::output(Stream &stream, Uint8View chunk) {
+    if constexpr (std::is_same_v<T, Http1Server>) {
+        if (&stream != &m_streams.front()) {
+            stream.pending_output.insert(stream.pending_output.end(), chunk.begin(), chunk.end());
+            return;
+        }
+    }
+    if (auto &handler = static_cast<T *>(this)->m_handler; handler.on_output != nullptr) {
+        handler.on_output(handler.arg, chunk);
+    }
+}
+
+template <typename T>
+void Http1Session<T>::output(Stream &stream, std::span<const Uint8View> chunks) {
+    auto &handler = static_cast<T *>(this)->m_handler;
+    bool buffered = false;
+    if constexpr (std::is_same_v<T, Http1Server>) {
+        buffered = &stream != &m_streams.front();
+    }
+    if (!buffered && chunks.size() > 1 && handler.on_output_vectored != nullptr) {
+        handler.on_output_vectored(handler.arg, chunks.data(), chunks.size());
+        return;
+    }
+    for (Uint8View chunk : chunks) {
+        output(stream, chunk);
+    }
+}
+
+template <typename T>
+typename Http1Session<T>::Stream *Http1Session<T>::find_sending_stream(uint64_t stream_id) {
+    if constexpr (std::is_same_v<T, Http1Server>) {
+        auto it = std::find_if(m_streams.begin(), m_streams.end(), [stream_id](const Stream &stream) {
+            return stream.id == stream_id;
+        });
+        return (it != m_streams.end() && !it->flags.test(Stream::RESPONSE_COMPLETE)) ? &*it : nullptr;
+    }
+    return (!m_streams.empty() && m_streams.front().id == stream_id) ? &m_streams.front() : nullptr;
+}
+
+template <typename T>
+typename Http1Session<T>::Stream &Http1Session<T>::emplace_stream(uint32_t stream_id) {
+    if (m_idle_streams.empty()) {
+        return m_streams.emplace_back(stream_id);
+    }
+    m_streams.splice(m_streams.end(), m_idle_streams, m_idle_streams.begin());
+    Stream &stream = m_streams.back();
+    stream.reset(stream_id);
+    return stream;
+}
+
+template <typename T>
+void Http1Session<T>::pop_stream() {
+    Stream &stream = m_streams.front();
+    if (stream.body_decoder != nullptr) {
+        m_body_decoders.release(std::move(stream.body_decoder));
+    }
+    if (m_idle_streams.size() >= MAX_IDLE_STREAMS) {
+        m_streams.pop_front();
+        return;
+    }
+    if (stream.pending_output.capacity() > MAX_IDLE_STREAM_BUFFER_SIZE) {
+        stream.pending_output = {};
+    }
+    m_idle_streams.splice(m_idle_streams.end(), m_streams, m_streams.begin());
+}
+
+template <typename T>
+void Http1Session<T>::finish_stream(Stream &stream) {
+    auto &handler = static_cast<T *>(this)->m_handler;
+    stream.flags.set(Stream::RESPONSE_COMPLETE);
+    // Responses leave in the order of the requests
+    while (!m_streams.empty() && m_streams.front().flags.test(Stream::RESPONSE_COMPLETE)) {
+        uint32_t stream_id = m_streams.front().id;
+        pop_stream();
+        if (!m_streams.empty() && !m_streams.front().pending_output.empty()) {
+            uint32_t flushed_id = m_streams.front().id;
+            // Moved out as the output callback may send more data to the stream
+            Uint8Vector pending = std::exchange(m_streams.front().pending_output, {});
+            log_sid(trace, m_id, flushed_id, "Flushing {} bytes of postponed output", pending.size());
+            if (handler.on_output != nullptr) {
+                handler.on_output(handler.arg, {pending.data(), pending.size()});
+            }
+            pending.clear();
+            return_output_buffer(flushed_id, std::move(pending));
+        }
+        if (handler.on_stream_finished != nullptr) {
+            handler.on_stream_finished(handler.arg, stream_id, 0);
+        }
+    }
+
+    resume_parsing();
+}
+
+template <typename T>
+void Http1Session<T>::return_output_buffer(uint32_t stream_id, Uint8Vector buffer) {
+    // The stream may have completed in the output callback and become idle
+    for (std::list<Stream> *streams : {&m_streams, &m_idle_streams}) {
+        auto it = std::find_if(streams->begin(), streams->end(), [stream_id](const Stream &stream) {
+            return stream.id == stream_id;
+        });
+        if (it == streams->end()) {
+            continue;
+        }
+        bool idle = streams == &m_idle_streams;
+        if (it->pending_output.empty() && (!idle || buffer.capacity() <= MAX_IDLE_STREAM_BUFFER_SIZE)) {
+            it->pending_output.swap(buffer);
+        }
+        return;
+    }
+}
+
 template <typename T>
 void Http1Session<T>::reset_parser() {
     llhttp_reset(&m_parser);
     m_parser_context.reset();
+    m_pending_input.clear();
+    m_message_in_progress = false;
+    m_keep_alive = true;
 }
 
 template <typename T>
@@ -348,55 +579,223 @@ template <typename T>
 Result<typename Http1Session<T>::InputResult, Http1Error> Http1Session<T>::input_impl(ag::Uint8View chunk) {
     log_id(trace, m_id, "length={}", chunk.length());
 
+    if (m_deferred_input_result.has_value()) {
+        auto result = std::move(m_deferred_input_result.value());
+        m_deferred_input_result.reset();
+        if (result.has_value()) {
+            // The chunk follows the upgraded message, so it belongs to the new protocol too
+            Uint8Vector &data = std::get<InputUpgrade>(result.value()).data;
+            data.insert(data.end(), chunk.begin(), chunk.end());
+        }
+        return result;
+    }
+
+    if (llhttp_get_errno(&m_parser) == HPE_PAUSED) {
+        m_pending_input.insert(m_pending_input.end(), chunk.begin(), chunk.end());
+        return InputOk{};
+    }
+
     if (llhttp_get_errno(&m_parser) != HPE_OK) {
         reset_parser();
     }
 
+    if constexpr (std::is_same_v<T, Http1Server>) {
+        // Complete simple requests are handled without the general parser. Once a message has closed
+        // the connection, the general parser rejects any further requests.
+        while (!chunk.empty() && !m_message_in_progress && m_keep_alive) {
+            size_t length = parse_simple_request(chunk);
+            if (length == 0) {
+                break;
+            }
+            chunk.remove_prefix(length);
+            if (m_streams.size() >= m_max_pipelined_requests) {
+                log_id(dbg, m_id, "Pausing input: {} requests are waiting for responses", m_streams.size());
+                llhttp_pause(&m_parser);
+                m_pending_input.assign(chunk.begin(), chunk.end());
+                return InputOk{};
+            }
+        }
+        if (chunk.empty()) {
+            return InputOk{};
+        }
+    }
+
+    return parse(chunk);
+}
+
+template <typename T>
+size_t Http1Session<T>::parse_simple_request(Uint8View chunk) {
+    std::string_view input = {(const char *) chunk.data(), chunk.size()};
+    size_t head_end = input.find(HEADER_BLOCK_END);
+    if (head_end == std::string_view::npos) {
+        return 0;
+    }
+    std::string_view head = input.substr(0, head_end + 2);
+
+    // Request line
+    size_t line_end = head.find("\r\n");
+    std::string_view line = head.substr(0, line_end);
+    head.remove_prefix(line_end + 2);
+    size_t method_end = line.find(' ');
+    if (method_end == std::string_view::npos) {
+        return 0;
+    }
+    std::string_view method = line.substr(0, method_end);
+    if (std::find(std::begin(SIMPLE_REQUEST_METHODS), std::end(SIMPLE_REQUEST_METHODS), method)
+            == std::end(SIMPLE_REQUEST_METHODS)) {
+        return 0;
+    }
+    line.remove_prefix(method_end + 1);
+    if (!line.ends_with(HTTP_1_1_VERSION) || line.size() < HTTP_1_1_VERSION.size() + 2
+            || line[line.size() - HTTP_1_1_VERSION.size() - 1] != ' ') {
+        return 0;
+    }
+    std::string_view path = line.substr(0, line.size() - HTTP_1_1_VERSION.size() - 1);
+    if (std::any_of(path.begin(), path.end(), [](uint8_t c) {
+            return c <= ' ' || c == 0x7f;
+        })) {
+        return 0;
+    }
+
+    // Header fields
+    Headers headers;
+    while (!head.empty()) {
+        line_end = head.find("\r\n");
+        line = head.substr(0, line_end);
+        head.remove_prefix(line_end + 2);
+
+        size_t colon = line.find(':');
+        if (colon == 0 || colon == std::string_view::npos) {
+            return 0;
+        }
+        std::string_view name = line.substr(0, colon);
+        std::string_view value = utils::ltrim(line.substr(colon + 1));
+        if (!std::all_of(name.begin(), name.end(), is_token_char)
+                || !std::all_of(value.begin(), value.end(), is_field_value_char)
+                || (!value.empty() && (value.back() == ' ' || value.back() == '\t'))) {
+            return 0;
+        }
+        HeaderToken token = header_token(name);
+        switch (token) {
+        case HEADER_TOKEN_CONTENT_LENGTH:
+        case HEADER_TOKEN_TRANSFER_ENCODING:
+        case HEADER_TOKEN_CONNECTION:
+        case HEADER_TOKEN_UPGRADE:
+            // Affect the message framing or the connection, leave them to the general parser
+            return 0;
+        default:
+            break;
+        }
+        headers.put(name, value, token);
+    }
+
+    // Same as `on_message_begin()`, `on_headers_complete()` and `on_message_complete()` do for a request without body
+    Stream &stream = emplace_stream(m_next_stream_id++);
+    uint32_t stream_id = stream.id;
+    log_sid(trace, m_id, stream_id, "{} {}", method, path);
+    stream.flags.set(Stream::HEAD_REQUEST, method == "HEAD");
+
+    Request request(HTTP_1_1, std::string(method), std::string(path));
+    request.headers() = std::move(headers);
+    if (auto &h = static_cast<T *>(this)->m_handler; h.on_request != nullptr) {
+        h.on_request(h.arg, stream_id, std::move(request));
+    }
+
+    return head_end + HEADER_BLOCK_END.size();
+}
+
+template <typename T>
+Result<typename Http1Session<T>::InputResult, Http1Error> Http1Session<T>::parse(Uint8View chunk) {
+    m_parsing = true;
     llhttp_errno_t err = llhttp_execute(&m_parser, (char *) chunk.data(), chunk.length());
+    // Responses completed in the callbacks may have released the pipeline
+    while (err == HPE_PAUSED && m_streams.size() < m_max_pipelined_requests) {
+        auto *pos = (const uint8_t *) llhttp_get_error_pos(&m_parser);
+        chunk.remove_prefix(pos - chunk.data());
+        llhttp_resume(&m_parser);
+        err = llhttp_execute(&m_parser, (char *) chunk.data(), chunk.length());
+    }
+    m_parsing = false;
+
+    if (m_parser_context.has_value()) {
+        // The chunk is going away, copy the field the parser stopped in the middle of
+        materialize_fragment(m_parser_context->field_name, m_parser_context->field_name_storage);
+        materialize_fragment(m_parser_context->field_value, m_parser_context->field_value_storage);
+    }
     switch (err) {
     case HPE_OK:
         return InputOk{};
-    case HPE_PAUSED_UPGRADE:
-        return InputUpgrade{};
+    case HPE_PAUSED: {
+        auto *pos = (const uint8_t *) llhttp_get_error_pos(&m_parser);
+        m_pending_input.assign(pos, chunk.data() + chunk.size());
+        return InputOk{};
+    }
+    case HPE_PAUSED_UPGRADE: {
+        auto *pos = (const uint8_t *) llhttp_get_error_pos(&m_parser);
+        return InputUpgrade{.data = Uint8Vector(pos, chunk.data() + chunk.size())};
+    }
     default:
         return make_error(Http1Error{}, AG_FMT("{} ({})", llhttp_errno_name(err), magic_enum::enum_name(err)));
     }
 }
 
+template <typename T>
+void Http1Session<T>::resume_parsing() {
+    if (m_parsing || llhttp_get_errno(&m_parser) != HPE_PAUSED || m_streams.size() >= m_max_pipelined_requests) {
+        return;
+    }
+
+    log_id(dbg, m_id, "Resuming input: {} bytes are pending", m_pending_input.size());
+    llhttp_resume(&m_parser);
+    Uint8Vector input = std::exchange(m_pending_input, {});
+    auto result = parse({input.data(), input.size()});
+    if (result.has_value() && result.value() == InputOk{}) {
+        return;
+    }
+    if constexpr (std::is_same_v<T, Http1Server>) {
+        if (auto &handler = static_cast<T *>(this)->m_handler; handler.on_postponed_input_result != nullptr) {
+            handler.on_postponed_input_result(handler.arg, std::move(result));
+            return;
+        }
+    }
+    m_deferred_input_result = std::move(result);
+}
+
 template <typename T>
 Error<Http1Error> Http1Session<T>::send_trailer_impl(uint32_t stream_id, const ag::http::Headers &headers, bool eof) {
     if (m_streams.empty()) {
         return make_error(Http1Error{}, "There're no active streams");
     }
 
-    Stream &stream = m_streams.front();
-    if (stream_id != stream.id) {
-        return make_error(Http1Error{}, AG_FMT("Invalid stream ID ({}), expected {}", stream_id, stream.id));
+    Stream *stream = find_sending_stream(stream_id);
+    if (stream == nullptr) {
+        return make_error(Http1Error{}, AG_FMT("Invalid stream ID ({})", stream_id));
     }
 
-    bool zero_chunk_sent = stream.flags.test(Stream::ZERO_CHUNK_SENT);
-    stream.flags.set(Stream::ZERO_CHUNK_SENT);
+    bool zero_chunk_sent = stream->flags.test(Stream::ZERO_CHUNK_SENT);
+    stream->flags.set(Stream::ZERO_CHUNK_SENT);
 
-    auto &handler = static_cast<T *>(this)->m_handler;
-    if (handler.on_output == nullptr) {
-        return {};
+    // The last chunk, the trailer section and the end of the message are passed to the transport at once
+    Uint8View parts[3];
+    size_t parts_count = 0;
+    if (!zero_chunk_sent && std::holds_alternative<ContentLengthChunked>(stream->content_length)) {
+        parts[parts_count++] = as_u8v(LAST_CHUNK);
     }
-
-    if (!zero_chunk_sent) {
-        if (Error<Http1Error> error = send_body_impl(stream_id, {}, false); error != nullptr) {
-            return make_error(Http1Error{}, error);
-        }
-        handler.on_output(handler.arg, {(uint8_t *) CHUNK_FOOTER.data(), CHUNK_FOOTER.size()});
+    parts[parts_count++] = serialize_message(headers);
+    if (eof) {
+        parts[parts_count++] = as_u8v(CHUNK_FOOTER);
     }
-
-    std::string data = headers.str();
-    handler.on_output(handler.arg, {(uint8_t *) data.data(), data.length()});
+    output(*stream, {parts, parts_count});
 
     if (eof) {
-        handler.on_output(handler.arg, {(uint8_t *) CHUNK_FOOTER.data(), CHUNK_FOOTER.size()});
-        m_streams.pop_front();
-        if (handler.on_stream_finished != nullptr) {
-            handler.on_stream_finished(handler.arg, stream_id, 0);
+        if constexpr (std::is_same_v<T, Http1Server>) {
+            finish_stream(*stream);
+        } else {
+            auto &handler = static_cast<T *>(this)->m_handler;
+            pop_stream();
+            if (handler.on_stream_finished != nullptr) {
+                handler.on_stream_finished(handler.arg, stream_id, 0);
+            }
         }
     }
 
@@ -411,38 +810,38 @@ Error<Http1Error> Http1Session<T>::send_body_impl(uint64_t stream_id, ag::Uint8V
         return make_error(Http1Error{}, "There're no active streams");
     }
 
-    Stream &stream = active_stream();
-    if (stream_id != stream.id) {
-        return make_error(Http1Error{}, AG_FMT("Invalid stream ID ({}), expected {}", stream_id, stream.id));
+    Stream *stream_ptr = find_sending_stream(stream_id);
+    if (stream_ptr == nullptr) {
+        return make_error(Http1Error{}, AG_FMT("Invalid stream ID ({})", stream_id));
     }
 
-    auto &handler = static_cast<T *>(this)->m_handler;
+    Stream &stream = *stream_ptr;
     bool chunked = std::holds_alternative<ContentLengthChunked>(stream.content_length);
     if (chunked) {
         char chunk_header[64]; // NOLINT(*-magic-numbers)
         size_t chunk_header_size =
                 fmt::format_to_n(chunk_header, sizeof(chunk_header), "{:X}\r\n", chunk.length()).size;
 
-        stream.flags.set(Stream::ZERO_CHUNK_SENT, chunk.empty());
-
-        if (handler.on_output != nullptr) {
-            handler.on_output(handler.arg, {(uint8_t *) chunk_header, chunk_header_size});
-            if (!chunk.empty()) {
-                handler.on_output(handler.arg, chunk);
-                handler.on_output(handler.arg, {(uint8_t *) CHUNK_FOOTER.data(), CHUNK_FOOTER.size()});
-                if (eof) {
-                    if (Error<Http1Error> error = send_body_impl(stream_id, {}, false); error != nullptr) {
-                        return make_error(Http1Error{}, error);
-                    }
-                }
-            }
+        stream.flags.set(Stream::ZERO_CHUNK_SENT, chunk.empty() || eof);
+
+        // The whole framed chunk (and the last chunk if it's the end of the body) is passed to the transport at once
+        Uint8View parts[5];
+        size_t parts_count = 0;
+        parts[parts_count++] = {(uint8_t *) chunk_header, chunk_header_size};
+        if (!chunk.empty()) {
+            parts[parts_count++] = chunk;
+            parts[parts_count++] = as_u8v(CHUNK_FOOTER);
             if (eof) {
-                handler.on_output(handler.arg, {(uint8_t *) CHUNK_FOOTER.data(), CHUNK_FOOTER.size()});
+                parts[parts_count++] = as_u8v(LAST_CHUNK);
             }
         }
+        if (eof) {
+            parts[parts_count++] = as_u8v(CHUNK_FOOTER);
+        }
+        output(stream, {parts, parts_count});
     } else {
-        if (!chunk.empty() && handler.on_output != nullptr) {
-            handler.on_output(handler.arg, chunk);
+        if (!chunk.empty()) {
+            output(stream, chunk);
         }
         if (auto *content_length = std::get_if<size_t>(&stream.content_length); content_length != nullptr) {
             *content_length = (*content_length >= chunk.length()) ? *content_length - chunk.length() : 0;
@@ -452,10 +851,7 @@ Error<Http1Error> Http1Session<T>::send_body_impl(uint64_t stream_id, ag::Uint8V
 
     if (eof) {
         if constexpr (std::is_same_v<Http1Server, T>) {
-            m_streams.pop_front();
-            if (handler.on_stream_finished != nullptr) {
-                handler.on_stream_finished(handler.arg, stream_id, 0);
-            }
+            finish_stream(stream);
         } else {
             stream.flags.set(Stream::REQ_SENT);
         }
@@ -464,8 +860,9 @@ Error<Http1Error> Http1Session<T>::send_body_impl(uint64_t stream_id, ag::Uint8V
     return {};
 }
 
-Http1Server::Http1Server(const Callbacks &handler)
+Http1Server::Http1Server(const Callbacks &handler, const Http1Settings &settings)
         : m_handler(handler) {
+    m_max_pipelined_requests = std::max<size_t>(1, settings.max_pipelined_requests);
 }
 
 Http1Server::~Http1Server() = default;
@@ -481,24 +878,21 @@ Error<Http1Error> Http1Server::send_response(uint64_t stream_id, const ag::http:
         return make_error(Http1Error{}, "There're no active streams");
     }
 
-    Stream &stream = m_streams.front();
-    if (stream_id != stream.id) {
-        return make_error(Http1Error{}, AG_FMT("Invalid stream ID ({}), expected {}", stream_id, stream.id));
+    Stream *stream_ptr = find_sending_stream(stream_id);
+    if (stream_ptr == nullptr) {
+        return make_error(Http1Error{}, AG_FMT("Invalid stream ID ({})", stream_id));
     }
 
+    Stream &stream = *stream_ptr;
     const Headers &headers = response.headers();
-    if (utils::iequals(headers.gets("Transfer-Encoding"), "chunked")) {
+    if (utils::iequals(headers.gets(HEADER_TOKEN_TRANSFER_ENCODING), "chunked")) {
         stream.content_length = ContentLengthChunked{};
-    } else if (std::optional x = utils::to_integer<size_t>(headers.gets("Content-Length")).has_value(); x.has_value()) {
-        stream.content_length = x.value();
     } else {
-        stream.content_length = ContentLengthUnset{};
+        // A response without valid length is considered to have no body
+        stream.content_length = utils::to_integer<size_t>(headers.gets(HEADER_TOKEN_CONTENT_LENGTH)).value_or(0);
     }
 
-    if (m_handler.on_output != nullptr) {
-        std::string data = response.str();
-        m_handler.on_output(m_handler.arg, {(uint8_t *) data.data(), data.length()});
-    }
+    output_message(stream, response);
 
     int status_code = response.status_code();
     // NOLINTNEXTLINE(*-magic-numbers)
@@ -512,10 +906,7 @@ Error<Http1Error> Http1Server::send_response(uint64_t stream_id, const ag::http:
                 && (!headers.gets("Upgrade").empty()
                         || std::string_view::npos != utils::ifind(headers.gets("Connection"), "upgrade"));
         if (!is_upgrade && status_code != HTTP_STATUS_CONTINUE && status_code != HTTP_STATUS_EARLY_HINTS) {
-            m_streams.pop_front();
-            if (m_handler.on_stream_finished != nullptr) {
-                m_handler.on_stream_finished(m_handler.arg, stream_id, 0);
-            }
+            finish_stream(stream);
         }
     }
 
@@ -530,8 +921,10 @@ Error<Http1Error> Http1Server::send_body(uint64_t stream_id, Uint8View chunk, bo
     return send_body_impl(stream_id, chunk, eof);
 }
 
-Http1Client::Http1Client(const Callbacks &handler)
+Http1Client::Http1Client(const Callbacks &handler, const Http1Settings &settings)
         : m_handler(handler) {
+    m_decode_content_encoding = settings.decode_content_encoding;
+    m_max_decoded_body_size = settings.max_decoded_body_size;
 }
 
 Http1Client::~Http1Client() = default;
@@ -544,23 +937,20 @@ Result<uint32_t, Http1Error> Http1Client::send_request(const Request &request) {
     uint32_t stream_id = m_next_stream_id++;
     log_sid(trace, m_id, stream_id, "...");
 
-    Stream &stream = m_streams.emplace_back(stream_id);
+    Stream &stream = emplace_stream(stream_id);
 
     const Headers &headers = request.headers();
     if (utils::iequals(headers.gets("Transfer-Encoding"), "chunked")) {
         stream.content_length = ContentLengthChunked{};
     } else if (std::optional h = headers.get("Content-Length"); h.has_value()) {
-        if (std::optional x = utils::to_integer<size_t>(h.value()).has_value(); x.has_value()) {
+        if (std::optional x = utils::to_integer<size_t>(h.value()); x.has_value()) {
             stream.content_length = x.value();
         } else {
             log_sid(dbg, m_id, stream_id, "Couldn't parse Content-Length header value: {}", h.value());
         }
     }
 
-    if (m_handler.on_output != nullptr) {
-        std::string data = request.str();
-        m_handler.on_output(m_handler.arg, {(uint8_t *) data.data(), data.length()});
-    }
+    output_message(stream, request);
 
     bool empty_msg = request.method() == "HEAD" || std::holds_alternative<ContentLengthUnset>(stream.content_length)
             || (std::holds_alternative<size_t>(stream.content_length) && std::get<size_t>(stream.content_length) == 0);
@@ -1,5 +1,9 @@
 #include <algorithm>
 #include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 
 #include <event2/buffer.h>
 #include <magic_enum/magic_enum.hpp>
@@ -10,6 +14,9 @@
 
 #define log_id(lvl_, id_, fmt_, ...) lvl_##log(g_logger, "[{}] " fmt_, id_, ##__VA_ARGS__)
 #define log_sid(lvl_, id_, stream_, fmt_, ...) lvl_##log(g_logger, "[{}-{}] " fmt_, id_, stream_, ##__VA_ARGS__)
+// For the messages a misbehaving peer may trigger at will
+#define log_sid_limited(lvl_, id_, stream_, fmt_, ...)                                                                 \
+    lvl_##log_every(g_logger, PEER_TRIGGERED_LOG_PERIOD, "[{}-{}] " fmt_, id_, stream_, ##__VA_ARGS__)
 #define log_frsid(lvl_, id_, frm_, fmt_, ...) log_sid(lvl_, id_, (frm_)->hd.stream_id, fmt_, ##__VA_ARGS__)
 
 namespace ag::http {
@@ -17,16 +24,102 @@ namespace ag::http {
 static const Logger g_logger("H2");    // NOLINT(*-identifier-naming)
 static std::atomic_uint32_t g_next_id; // NOLINT(*-avoid-non-const-global-variables)
 
-template <typename T>
-static constexpr nghttp2_nv transform_header(const Header<T> &header) {
+static constexpr auto PEER_TRIGGERED_LOG_PERIOD = std::chrono::seconds(1);
+
+static constexpr size_t FRAME_HEADER_LENGTH = 9;
+// The padding of a DATA frame is at most 255 bytes long
+static constexpr uint8_t DATA_FRAME_PADDING[UINT8_MAX] = {};
+// Distinguishes the window auto-tuning PINGs from the ones sent by the application
+static constexpr uint8_t WINDOW_TUNING_PING_DATA[8] = {'a', 'g', '-', 'b', 'd', 'p'};
+
+// The pseudo-header field values which are passed to nghttp2 by reference
+static constexpr std::string_view STATIC_PSEUDO_HEADER_VALUES[] = {
+        "GET", "HEAD", "POST", "PUT", "DELETE", "CONNECT", "OPTIONS", "PATCH", "http", "https", "200", "204", "206",
+        "301", "302", "304", "400", "401", "403", "404", "500", "502", "503", "504"};
+
+static nghttp2_nv make_nv(std::string_view name, std::string_view value, uint8_t flags) {
     return nghttp2_nv{
-            .name = (uint8_t *) header.name.data(),
-            .value = (uint8_t *) header.value.data(),
-            .namelen = header.name.size(),
-            .valuelen = header.value.size(),
+            .name = (uint8_t *) name.data(),
+            .value = (uint8_t *) value.data(),
+            .namelen = name.size(),
+            .valuelen = value.size(),
+            .flags = flags,
     };
 }
 
+/**
+ * Serialize the priority into the value of a `priority` header field or a PRIORITY_UPDATE frame (RFC 9218)
+ */
+static std::string priority_field_value(const Http2Priority &priority) {
+    return priority.incremental ? AG_FMT("u={}, i", priority.urgency) : AG_FMT("u={}", priority.urgency);
+}
+
+// Each allocation of nghttp2 is prefixed with its size keeping the alignment of `malloc()`
+static constexpr size_t ALLOCATION_HEADER_LENGTH = alignof(std::max_align_t);
+
+/**
+ * nghttp2 allocator accounting the allocated memory in the counter passed as the user data
+ */
+static void *account_malloc(size_t size, void *counter) {
+    auto *ptr = (uint8_t *) std::malloc(ALLOCATION_HEADER_LENGTH + size); // NOLINT(*-no-malloc)
+    if (ptr == nullptr) {
+        return nullptr;
+    }
+    memcpy(ptr, &size, sizeof(size));
+    *(size_t *) counter += size;
+    return ptr + ALLOCATION_HEADER_LENGTH;
+}
+
+static void account_free(void *ptr, void *counter) {
+    if (ptr == nullptr) {
+        return;
+    }
+    auto *base = (uint8_t *) ptr - ALLOCATION_HEADER_LENGTH;
+    size_t size = 0;
+    memcpy(&size, base, sizeof(size));
+    *(size_t *) counter -= size;
+    std::free(base); // NOLINT(*-no-malloc)
+}
+
+static void *account_calloc(size_t nmemb, size_t size, void *counter) {
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        return nullptr;
+    }
+    void *ptr = account_malloc(nmemb * size, counter);
+    if (ptr != nullptr) {
+        memset(ptr, 0, nmemb * size);
+    }
+    return ptr;
+}
+
+static void *account_realloc(void *ptr, size_t size, void *counter) {
+    if (ptr == nullptr) {
+        return account_malloc(size, counter);
+    }
+    auto *base = (uint8_t *) ptr - ALLOCATION_HEADER_LENGTH;
+    size_t old_size = 0;
+    memcpy(&old_size, base, sizeof(old_size));
+    base = (uint8_t *) std::realloc(base, ALLOCATION_HEADER_LENGTH + size); // NOLINT(*-no-malloc)
+    if (base == nullptr) {
+        return nullptr;
+    }
+    memcpy(base, &size, sizeof(size));
+    *(size_t *) counter += size - old_size;
+    return base + ALLOCATION_HEADER_LENGTH;
+}
+
+/**
+ * Keeps the counter passed as the argument equal to the total length of the buffers it's attached to
+ */
+static void account_buffer_change(evbuffer *, const evbuffer_cb_info *info, void *counter) {
+    *(size_t *) counter += info->n_added;
+    *(size_t *) counter -= info->n_deleted;
+}
+
+static void release_rcbuf(void *buf) {
+    nghttp2_rcbuf_decref((nghttp2_rcbuf *) buf);
+}
+
 #ifndef NDEBUG
 static void log_http2(const char *format, va_list args) {
     if (g_logger.is_enabled(LOG_LEVEL_TRACE)) {
@@ -44,6 +137,13 @@ template <typename T>
 Http2Session<T>::Http2Session(const Http2Settings &settings)
         : m_settings(settings)
         , m_id(g_next_id.fetch_add(1, std::memory_order_relaxed)) {
+    m_window_tuning.stream_window = settings.initial_stream_window_size;
+    m_window_tuning.session_window = settings.initial_session_window_size;
+    if (size_t limit = settings.max_session_memory / 4; limit != 0) {
+        // Otherwise a peer filling the table the session has advertised would be found misbehaving
+        m_settings.header_table_size = uint32_t(std::min<size_t>(m_settings.header_table_size, limit));
+        m_settings.max_deflate_table_size = uint32_t(std::min<size_t>(m_settings.max_deflate_table_size, limit));
+    }
 }
 
 template <typename T>
@@ -66,11 +166,14 @@ Error<Http2Error> Http2Session<T>::initialize_session() {
     nghttp2_session_callbacks_set_on_frame_send_callback(session_callbacks.get(), on_frame_send);
     nghttp2_session_callbacks_set_on_invalid_frame_recv_callback(session_callbacks.get(), on_invalid_frame_recv);
     nghttp2_session_callbacks_set_on_begin_headers_callback(session_callbacks.get(), on_begin_headers);
-    nghttp2_session_callbacks_set_on_header_callback(session_callbacks.get(), on_header);
+    nghttp2_session_callbacks_set_on_header_callback2(session_callbacks.get(), on_header);
     nghttp2_session_callbacks_set_on_data_chunk_recv_callback(session_callbacks.get(), on_data_chunk_recv);
     nghttp2_session_callbacks_set_on_stream_close_callback(session_callbacks.get(), on_stream_close);
     nghttp2_session_callbacks_set_send_callback(session_callbacks.get(), on_send);
     nghttp2_session_callbacks_set_error_callback(session_callbacks.get(), on_error);
+    if (static_cast<T *>(this)->m_handler.on_output_vectored != nullptr) {
+        nghttp2_session_callbacks_set_send_data_callback(session_callbacks.get(), on_send_data);
+    }
 
     UniquePtr<nghttp2_option, &nghttp2_option_del> option{[]() {
         nghttp2_option *x = nullptr;
@@ -81,14 +184,25 @@ Error<Http2Error> Http2Session<T>::initialize_session() {
     if (!m_settings.auto_flow_control) {
         nghttp2_option_set_no_auto_window_update(option.get(), 1);
     }
-
+    if (m_settings.extensible_priorities) {
+        nghttp2_option_set_builtin_recv_extension_type(option.get(), NGHTTP2_PRIORITY_UPDATE);
+    }
+    nghttp2_option_set_max_deflate_dynamic_table_size(option.get(), m_settings.max_deflate_table_size);
+
+    nghttp2_mem mem = {
+            .mem_user_data = &m_nghttp2_memory,
+            .malloc = account_malloc,
+            .free = account_free,
+            .calloc = account_calloc,
+            .realloc = account_realloc,
+    };
     nghttp2_session *session = nullptr;
     int status; // NOLINT(*-init-variables)
     static_assert(std::is_same_v<T, Http2Server> || std::is_same_v<T, Http2Client>);
     if constexpr (std::is_same_v<T, Http2Server>) {
-        status = nghttp2_session_server_new2(&session, session_callbacks.get(), this, option.get());
+        status = nghttp2_session_server_new3(&session, session_callbacks.get(), this, option.get(), &mem);
     } else {
-        status = nghttp2_session_client_new2(&session, session_callbacks.get(), this, option.get());
+        status = nghttp2_session_client_new3(&session, session_callbacks.get(), this, option.get(), &mem);
     }
     if (status != 0) {
         return make_error(Http2Error{}, AG_FMT("Couldn't create session: {} ({})", nghttp2_strerror(status), status));
@@ -101,6 +215,16 @@ Error<Http2Error> Http2Session<T>::initialize_session() {
             m_session.reset();
             return make_error(Http2Error{}, error);
         }
+    } else if (m_settings.extensible_priorities) {
+        // The server sends its settings after the handshake, but nghttp2 accepts this one
+        // only before the client settings are received
+        nghttp2_settings_entry settings[] = {{NGHTTP2_SETTINGS_NO_RFC7540_PRIORITIES, true}};
+        if (status = nghttp2_submit_settings(m_session.get(), 0, settings, std::size(settings));
+                status != NGHTTP2_NO_ERROR) {
+            m_session.reset();
+            return make_error(
+                    Http2Error{}, AG_FMT("Couldn't submit settings: {} ({})", nghttp2_strerror(status), status));
+        }
     }
 
     return nullptr;
@@ -108,7 +232,9 @@ Error<Http2Error> Http2Session<T>::initialize_session() {
 
 template <typename T>
 Http2Session<T>::~Http2Session() {
-    for (auto &[stream_id, _] : std::exchange(m_streams, {})) {
+    std::vector<uint32_t> stream_ids = m_streams.ids();
+    m_streams.clear();
+    for (uint32_t stream_id : stream_ids) {
         close_stream(stream_id, NGHTTP2_CANCEL);
     }
 
@@ -125,6 +251,7 @@ Http2Session<T>::~Http2Session() {
     if (status != NGHTTP2_NO_ERROR) {
         log_id(dbg, m_id, "Couldn't flush session: {} ({})", nghttp2_strerror(status), status);
     }
+    flush_output_batch();
 }
 
 template <typename T>
@@ -144,10 +271,8 @@ int Http2Session<T>::on_frame_recv(nghttp2_session *session, const nghttp2_frame
     Stream *stream = nullptr;
 
     if (frame->hd.type == NGHTTP2_HEADERS || frame->hd.type == NGHTTP2_DATA || frame->hd.type == NGHTTP2_PUSH_PROMISE) {
-        auto iter = self->m_streams.find(stream_id);
-        if (iter != self->m_streams.end()) {
-            stream = &iter->second;
-        } else {
+        stream = self->m_streams.find(stream_id);
+        if (stream == nullptr) {
             log_frsid(dbg, self->m_id, frame, "Stream not found");
         }
     }
@@ -162,6 +287,7 @@ int Http2Session<T>::on_frame_recv(nghttp2_session *session, const nghttp2_frame
      */
     switch (frame->hd.type) {
     case NGHTTP2_HEADERS:
+        self->on_header_block_recv(frame);
         if (stream != nullptr && (frame->hd.flags & NGHTTP2_FLAG_END_HEADERS)) {
             self->on_end_headers(frame, stream_id, *stream);
         }
@@ -189,6 +315,12 @@ int Http2Session<T>::on_frame_recv(nghttp2_session *session, const nghttp2_frame
             }
         }
 
+        break;
+    case NGHTTP2_PING:
+        if ((frame->hd.flags & NGHTTP2_FLAG_ACK)
+                && 0 == memcmp(frame->ping.opaque_data, WINDOW_TUNING_PING_DATA, std::size(WINDOW_TUNING_PING_DATA))) {
+            self->tune_windows_on_ping_ack();
+        }
         break;
     default:
         // do nothing
@@ -213,6 +345,14 @@ int Http2Session<T>::on_frame_send(nghttp2_session *session, const nghttp2_frame
     log_frsid(trace, self->m_id, frame, "{}", magic_enum::enum_name(nghttp2_frame_type(frame->hd.type)));
 
     switch (frame->hd.type) {
+    case NGHTTP2_HEADERS:
+        // The length of a header block split into CONTINUATION frames is the total one
+        self->m_hpack_stats.sent_blocks += 1;
+        self->m_hpack_stats.sent_encoded_bytes += frame->hd.length;
+        for (size_t i = 0; i < frame->headers.nvlen; ++i) {
+            self->m_hpack_stats.sent_decoded_bytes += frame->headers.nva[i].namelen + frame->headers.nva[i].valuelen;
+        }
+        break;
     case NGHTTP2_WINDOW_UPDATE:
         log_frsid(trace, self->m_id, frame, "Sent window update: increment={}",
                 frame->window_update.window_size_increment);
@@ -258,7 +398,7 @@ int Http2Session<T>::on_begin_headers(nghttp2_session *, const nghttp2_frame *fr
     auto *self = (T *) arg;
     log_frsid(trace, self->m_id, frame, "...");
 
-    Stream &stream = self->m_streams.emplace(frame->hd.stream_id, Stream{}).first->second;
+    Stream &stream = self->m_streams.emplace(frame->hd.stream_id);
     if (stream.message.has_value()) {
         log_frsid(warn, self->m_id, frame, "Another headers is already in progress: {}", stream.message.value());
         return NGHTTP2_ERR_CALLBACK_FAILURE;
@@ -271,46 +411,53 @@ int Http2Session<T>::on_begin_headers(nghttp2_session *, const nghttp2_frame *fr
 }
 
 template <typename T>
-int Http2Session<T>::on_header(nghttp2_session *, const nghttp2_frame *frame, const uint8_t *name_, size_t name_len,
-        const uint8_t *value_, size_t value_len, uint8_t, void *arg) {
+int Http2Session<T>::on_header(nghttp2_session *, const nghttp2_frame *frame, nghttp2_rcbuf *name_buf,
+        nghttp2_rcbuf *value_buf, uint8_t, void *arg) {
     auto *self = (T *) arg;
-    std::string_view name = {(char *) name_, name_len};
-    std::string_view value = {(char *) value_, value_len};
+    nghttp2_vec name_ = nghttp2_rcbuf_get_buf(name_buf);   // NOLINT(*-identifier-naming)
+    nghttp2_vec value_ = nghttp2_rcbuf_get_buf(value_buf); // NOLINT(*-identifier-naming)
+    std::string_view name = {(char *) name_.base, name_.len};
+    std::string_view value = {(char *) value_.base, value_.len};
     log_frsid(trace, self->m_id, frame, "{}: {}", name, value);
+    self->m_hpack_stats.received_decoded_bytes += name.size() + value.size();
 
-    auto iter = self->m_streams.find(frame->hd.stream_id);
-    if (iter == self->m_streams.end()) {
+    Stream *stream = self->m_streams.find(frame->hd.stream_id);
+    if (stream == nullptr) {
         log_frsid(warn, self->m_id, frame, "Stream not found");
         return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
     }
 
-    Stream &stream = iter->second;
-    if (!stream.message.has_value()) {
+    if (!stream->message.has_value()) {
         log_frsid(warn, self->m_id, frame, "Stream has no pending message");
         return NGHTTP2_ERR_CALLBACK_FAILURE;
     }
 
-    Message &message = stream.message.value();
+    Message &message = stream->message.value();
     static_assert(std::is_same_v<T, Http2Server> || std::is_same_v<T, Http2Client>);
+    HeaderToken token = header_token(name);
     if constexpr (std::is_same_v<T, Http2Server>) {
-        if (name == PSEUDO_HEADER_NAME_METHOD) {
+        switch (token) {
+        case HEADER_TOKEN_PSEUDO_METHOD:
             message.method(std::string{value});
             return 0;
-        }
-        if (name == PSEUDO_HEADER_NAME_SCHEME) {
+        case HEADER_TOKEN_PSEUDO_SCHEME:
             message.scheme(std::string{value});
             return 0;
-        }
-        if (name == PSEUDO_HEADER_NAME_AUTHORITY) {
+        case HEADER_TOKEN_PSEUDO_AUTHORITY:
             message.authority(std::string{value});
             return 0;
-        }
-        if (name == PSEUDO_HEADER_NAME_PATH) {
+        case HEADER_TOKEN_PSEUDO_PATH:
             message.path(std::string{value});
             return 0;
+        case HEADER_TOKEN_PSEUDO_PROTOCOL:
+            // nghttp2 rejects it unless `Http2Settings::enable_connect_protocol` is set
+            message.protocol(std::string{value});
+            return 0;
+        default:
+            break;
         }
     } else {
-        if (name == PSEUDO_HEADER_NAME_STATUS) {
+        if (token == HEADER_TOKEN_PSEUDO_STATUS) {
             std::optional code = utils::to_integer<unsigned int>(value);
             if (!code.has_value()) {
                 log_frsid(dbg, self->m_id, frame, "Couldn't parse status code: {}", value);
@@ -321,7 +468,13 @@ int Http2Session<T>::on_header(nghttp2_session *, const nghttp2_frame *frame, co
         }
     }
 
-    message.headers().put(std::string{name}, std::string{value});
+    if (self->m_settings.borrow_header_buffers) {
+        nghttp2_rcbuf_incref(name_buf);
+        nghttp2_rcbuf_incref(value_buf);
+        message.headers().put_borrowed(name, value, token, {name_buf, release_rcbuf}, {value_buf, release_rcbuf});
+    } else {
+        message.headers().put(name, value, token);
+    }
 
     return 0;
 }
@@ -366,12 +519,21 @@ int Http2Session<T>::on_data_chunk_recv(
         consume_guard.emplace(self->m_id, session, len);
     }
 
-    auto iter = self->m_streams.find(stream_id);
-    if (iter == self->m_streams.end()) {
-        log_sid(warn, self->m_id, stream_id, "Stream not found");
+    if (self->m_settings.auto_tune_windows) {
+        self->tune_windows_on_data(len);
+    }
+
+    Stream *stream = self->m_streams.find(stream_id);
+    if (stream == nullptr) {
+        log_sid_limited(warn, self->m_id, stream_id, "Stream not found");
         return NGHTTP2_ERR_INVALID_STATE;
     }
 
+    if (stream->body_decoder != nullptr) {
+        self->decode_body(stream_id, *stream, {data, len});
+        return 0;
+    }
+
     if (const auto &h = static_cast<T *>(self)->m_handler; h.on_body != nullptr) {
         h.on_body(h.arg, stream_id, {data, len});
     }
@@ -379,18 +541,169 @@ int Http2Session<T>::on_data_chunk_recv(
     return 0;
 }
 
+template <typename T>
+void Http2Session<T>::tune_windows_on_data(size_t length) {
+    WindowTuning &tuning = m_window_tuning;
+    if (!tuning.ping_sent.has_value()) {
+        if (tuning.stream_window >= m_settings.max_stream_window_size
+                && tuning.session_window >= m_settings.max_session_window_size) {
+            return;
+        }
+        if (int status = nghttp2_submit_ping(m_session.get(), NGHTTP2_FLAG_NONE, WINDOW_TUNING_PING_DATA);
+                status != NGHTTP2_NO_ERROR) {
+            log_id(dbg, m_id, "Couldn't submit ping: {} ({})", nghttp2_strerror(status), status);
+            return;
+        }
+        tuning.ping_sent = std::chrono::steady_clock::now();
+        tuning.received = 0;
+    }
+    tuning.received += length;
+}
+
+template <typename T>
+void Http2Session<T>::tune_windows_on_ping_ack() {
+    WindowTuning &tuning = m_window_tuning;
+    if (!tuning.ping_sent.has_value()) {
+        return;
+    }
+    auto rtt = std::chrono::steady_clock::now() - std::exchange(tuning.ping_sent, std::nullopt).value();
+    // The sample is the amount of data in flight during the round trip. If it's close to the window,
+    // the window is what limits the throughput.
+    size_t bdp = tuning.received;
+    log_id(trace, m_id, "BDP sample: {} bytes in {}us", bdp, std::chrono::duration_cast<Micros>(rtt).count());
+
+    auto grown_window = [bdp](uint32_t window, uint32_t max_window) -> std::optional<uint32_t> {
+        if (window >= max_window || 3 * bdp < 2 * size_t(window)) {
+            return std::nullopt;
+        }
+        return uint32_t(std::min(2 * bdp, size_t(max_window)));
+    };
+
+    if (std::optional<uint32_t> window = grown_window(tuning.stream_window, m_settings.max_stream_window_size);
+            window.has_value()) {
+        nghttp2_settings_entry settings[] = {{NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, window.value()}};
+        if (int status = nghttp2_submit_settings(m_session.get(), NGHTTP2_FLAG_NONE, settings, std::size(settings));
+                status != NGHTTP2_NO_ERROR) {
+            log_id(dbg, m_id, "Couldn't submit settings: {} ({})", nghttp2_strerror(status), status);
+        } else {
+            log_id(dbg, m_id, "Stream window size: {} -> {}", tuning.stream_window, window.value());
+            tuning.stream_window = window.value();
+        }
+    }
+
+    if (std::optional<uint32_t> window = grown_window(tuning.session_window, m_settings.max_session_window_size);
+            window.has_value()) {
+        if (int status = nghttp2_session_set_local_window_size(
+                    m_session.get(), NGHTTP2_FLAG_NONE, 0, int32_t(window.value()));
+                status != NGHTTP2_NO_ERROR) {
+            log_id(dbg, m_id, "Couldn't set session window size: {} ({})", nghttp2_strerror(status), status);
+        } else {
+            log_id(dbg, m_id, "Session window size: {} -> {}", tuning.session_window, window.value());
+            tuning.session_window = window.value();
+        }
+    }
+}
+
+template <typename T>
+void Http2Session<T>::on_header_block_recv(const nghttp2_frame *frame) {
+    // The length of a header block merged with its CONTINUATION frames is the total one
+    m_hpack_stats.received_blocks += 1;
+    m_hpack_stats.received_encoded_bytes += frame->hd.length;
+
+    if (!m_settings.adaptive_header_table_size
+            || m_hpack_stats.received_blocks != Http2Settings::HEADER_TABLE_SAMPLE_BLOCKS
+            || m_settings.header_table_size <= Http2Settings::MIN_HEADER_TABLE_SIZE) {
+        return;
+    }
+    uint64_t encoded = m_hpack_stats.received_encoded_bytes;
+    uint64_t decoded = m_hpack_stats.received_decoded_bytes;
+    log_id(trace, m_id, "HPACK sample: {} bytes encoded into {}", decoded, encoded);
+    if (3 * encoded < 2 * decoded) {
+        return;
+    }
+
+    nghttp2_settings_entry settings[] = {{NGHTTP2_SETTINGS_HEADER_TABLE_SIZE, Http2Settings::MIN_HEADER_TABLE_SIZE}};
+    if (int status = nghttp2_submit_settings(m_session.get(), NGHTTP2_FLAG_NONE, settings, std::size(settings));
+            status != NGHTTP2_NO_ERROR) {
+        log_id(dbg, m_id, "Couldn't submit settings: {} ({})", nghttp2_strerror(status), status);
+        return;
+    }
+    log_id(dbg, m_id, "Header table size: {} -> {}", m_settings.header_table_size,
+            Http2Settings::MIN_HEADER_TABLE_SIZE);
+    // Keep the settings sent later consistent
+    m_settings.header_table_size = Http2Settings::MIN_HEADER_TABLE_SIZE;
+}
+
+template <typename T>
+void Http2Session<T>::decode_body(uint32_t stream_id, Stream &stream, Uint8View chunk) {
+    if (!m_settings.auto_flow_control) {
+        m_decoded_flow_control.on_received(stream_id, chunk.size(), 0);
+    }
+
+    struct Context {
+        Http2Session *self;
+        uint32_t stream_id;
+    } context{this, stream_id};
+    BodyDecoder::Handler handler{
+            .arg = &context,
+            .on_data =
+                    [](void *arg, Uint8View decoded) {
+                        auto *context = (Context *) arg;
+                        Http2Session *self = context->self;
+                        if (!self->m_settings.auto_flow_control) {
+                            self->m_decoded_flow_control.on_received(context->stream_id, 0, decoded.size());
+                        }
+                        if (const auto &h = static_cast<T *>(self)->m_handler; h.on_body != nullptr) {
+                            h.on_body(h.arg, context->stream_id, decoded);
+                        }
+                    },
+    };
+
+    if (Error<BodyDecoderError> error = stream.body_decoder->decode(chunk, handler); error != nullptr) {
+        log_sid(dbg, m_id, stream_id, "Couldn't decode body: {}", error->str());
+        finish_body_decoding(stream_id, stream);
+        if (Error<Http2Error> reset_error = reset_stream_impl(stream_id, NGHTTP2_INTERNAL_ERROR);
+                reset_error != nullptr) {
+            log_sid(dbg, m_id, stream_id, "Couldn't reset stream: {}", reset_error->str());
+        }
+    }
+}
+
+template <typename T>
+void Http2Session<T>::finish_body_decoding(uint32_t stream_id, Stream &stream) {
+    m_body_decoders.release(std::move(stream.body_decoder));
+    if (m_settings.auto_flow_control) {
+        return;
+    }
+    // The received data that has produced nothing for the application to consume
+    if (size_t length = m_decoded_flow_control.on_finished(stream_id); length > 0) {
+        if (Error<Http2Error> error = consume_stream_impl(stream_id, length); error != nullptr) {
+            log_sid(dbg, m_id, stream_id, "Couldn't consume stream: {}", error->str());
+        }
+    }
+}
+
 template <typename T>
 int Http2Session<T>::on_stream_close(nghttp2_session *, int32_t stream_id, uint32_t error_code, void *arg) {
     auto *self = (T *) arg;
     log_sid(trace, self->m_id, stream_id, "{} ({})", nghttp2_strerror(error_code), error_code);
 
-    auto node = self->m_streams.extract(stream_id);
-    if (node.empty()) {
-        log_sid(warn, self->m_id, stream_id, "Stream not found");
+    std::unique_ptr<Stream> stream = self->m_streams.extract(stream_id);
+    if (stream == nullptr) {
+        log_sid_limited(warn, self->m_id, stream_id, "Stream not found");
         return NGHTTP2_ERR_INVALID_STATE;
     }
 
+    if (stream->body_decoder != nullptr) {
+        self->finish_body_decoding(stream_id, *stream);
+    }
+
     self->close_stream(stream_id, nghttp2_error_code(error_code));
+    if (stream->data_source.buffer != nullptr) {
+        // Not left to `recycle()`, which may destroy the buffer without updating `m_buffered_body`
+        evbuffer_drain(stream->data_source.buffer.get(), evbuffer_get_length(stream->data_source.buffer.get()));
+    }
+    self->m_streams.recycle(std::move(stream));
 
     return 0;
 }
@@ -400,6 +713,16 @@ ssize_t Http2Session<T>::on_send(nghttp2_session *, const uint8_t *data, size_t
     auto *self = (T *) arg;
     log_id(trace, self->m_id, "length={}", length);
 
+    if (size_t batch_size = self->m_settings.output_batch_size; batch_size > 0) {
+        if (!self->m_output_batch.empty() || length < batch_size) {
+            self->m_output_batch.insert(self->m_output_batch.end(), data, data + length);
+            if (self->m_output_batch.size() >= batch_size) {
+                self->flush_output_batch();
+            }
+            return ssize_t(length);
+        }
+    }
+
     if (const auto &h = self->m_handler; h.on_output != nullptr) {
         h.on_output(h.arg, {data, length});
     }
@@ -407,6 +730,18 @@ ssize_t Http2Session<T>::on_send(nghttp2_session *, const uint8_t *data, size_t
     return ssize_t(length);
 }
 
+template <typename T>
+void Http2Session<T>::flush_output_batch() {
+    if (m_output_batch.empty()) {
+        return;
+    }
+    log_id(trace, m_id, "Flushing {} bytes of coalesced output", m_output_batch.size());
+    if (const auto &h = static_cast<T *>(this)->m_handler; h.on_output != nullptr) {
+        h.on_output(h.arg, {m_output_batch.data(), m_output_batch.size()});
+    }
+    m_output_batch.clear();
+}
+
 template <typename T>
 int Http2Session<T>::on_error(nghttp2_session *, const char *msg, size_t len, void *arg) {
     auto *self = (T *) arg;
@@ -424,22 +759,34 @@ ssize_t Http2Session<T>::on_data_source_read(nghttp2_session *session, int32_t s
         uint32_t *data_flags, nghttp2_data_source *source, void *arg) {
     auto *self = (T *) arg;
 
-    auto iter = self->m_streams.find(stream_id);
-    if (iter == self->m_streams.end()) {
-        log_sid(warn, self->m_id, stream_id, "Stream not found");
+    Stream *stream = self->m_streams.find(stream_id);
+    if (stream == nullptr) {
+        log_sid_limited(warn, self->m_id, stream_id, "Stream not found");
         return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
     }
 
-    Stream &stream = iter->second;
     auto *ds = (DataSource *) source->ptr;
 
     // Pause and destroy a data source if no work on the current buffer
-    if (!stream.flags.test(Stream::HAS_EOF) && 0 == evbuffer_get_length(ds->buffer.get())) {
+    if (!stream->flags.test(Stream::HAS_EOF) && 0 == evbuffer_get_length(ds->buffer.get())) {
         log_sid(trace, self->m_id, stream_id, "No work on current buffer");
+        stream->flags.set(Stream::DEFERRED);
         return NGHTTP2_ERR_DEFERRED;
     }
 
-    ssize_t n = evbuffer_remove(ds->buffer.get(), buf, length);
+    ssize_t n = 0;
+    size_t left = 0;
+    bool no_copy = self->m_handler.on_output_vectored != nullptr;
+    if (no_copy) {
+        // The data is left in the buffer until `on_send_data()` passes it to the transport
+        left = evbuffer_get_length(ds->buffer.get());
+        n = ssize_t(std::min(length, left));
+        left -= n;
+        *data_flags |= NGHTTP2_DATA_FLAG_NO_COPY;
+    } else {
+        n = evbuffer_remove(ds->buffer.get(), buf, length);
+        left = evbuffer_get_length(ds->buffer.get());
+    }
     log_sid(trace, self->m_id, stream_id, "{} bytes", n);
     if (n < 0) {
         log_sid(dbg, self->m_id, stream_id, "Couldn't read buffer");
@@ -447,12 +794,12 @@ ssize_t Http2Session<T>::on_data_source_read(nghttp2_session *session, int32_t s
     }
 
     // If eof, set flag and destroy data source
-    if (stream.flags.test(Stream::HAS_EOF) && 0 == evbuffer_get_length(ds->buffer.get())) {
+    if (stream->flags.test(Stream::HAS_EOF) && 0 == left) {
         log_sid(trace, self->m_id, stream_id, "No data left in buffers -- set eof flag");
         *data_flags |= NGHTTP2_DATA_FLAG_EOF;
     }
 
-    if (const auto &h = self->m_handler; h.on_data_sent != nullptr) {
+    if (const auto &h = self->m_handler; !no_copy && h.on_data_sent != nullptr) {
         h.on_data_sent(h.arg, stream_id, n);
     }
 
@@ -466,6 +813,62 @@ ssize_t Http2Session<T>::on_data_source_read(nghttp2_session *session, int32_t s
     return n;
 }
 
+/**
+ * Send data callback. Called by nghttp2 to send a DATA frame whose payload has been left in the data source
+ * by `on_data_source_read()`. Passes the frame header and the buffer segments to the transport without copying.
+ */
+template <typename T>
+int Http2Session<T>::on_send_data(nghttp2_session *, nghttp2_frame *frame, const uint8_t *framehd, size_t length,
+        nghttp2_data_source *source, void *arg) {
+    auto *self = (T *) arg;
+    auto *ds = (DataSource *) source->ptr;
+    int32_t stream_id = frame->hd.stream_id;
+    log_sid(trace, self->m_id, stream_id, "length={} padding={}", length, frame->data.padlen);
+
+    std::vector<Uint8View> &chunks = self->m_output_chunks;
+    chunks.clear();
+    // The coalesced frames precede this one
+    if (!self->m_output_batch.empty()) {
+        chunks.emplace_back(self->m_output_batch.data(), self->m_output_batch.size());
+    }
+    chunks.emplace_back(framehd, FRAME_HEADER_LENGTH);
+    uint8_t pad_length = 0;
+    if (frame->data.padlen > 0) {
+        pad_length = frame->data.padlen - 1;
+        chunks.emplace_back(&pad_length, 1);
+    }
+    if (length > 0) {
+        int segments_num = evbuffer_peek(ds->buffer.get(), ssize_t(length), nullptr, nullptr, 0);
+        self->m_data_segments.resize(std::max(segments_num, 0));
+        segments_num = evbuffer_peek(ds->buffer.get(), ssize_t(length), nullptr, self->m_data_segments.data(),
+                int(self->m_data_segments.size()));
+        size_t left = length;
+        for (int i = 0; i < segments_num && left > 0; ++i) {
+            size_t segment_length = std::min(left, self->m_data_segments[i].iov_len);
+            chunks.emplace_back((uint8_t *) self->m_data_segments[i].iov_base, segment_length);
+            left -= segment_length;
+        }
+        if (left > 0) {
+            log_sid(dbg, self->m_id, stream_id, "Buffer is shorter than the frame: {} bytes are missing", left);
+            return NGHTTP2_ERR_CALLBACK_FAILURE;
+        }
+    }
+    if (pad_length > 0) {
+        chunks.emplace_back(DATA_FRAME_PADDING, pad_length);
+    }
+
+    const auto &h = self->m_handler;
+    h.on_output_vectored(h.arg, chunks.data(), chunks.size());
+    self->m_output_batch.clear();
+    evbuffer_drain(ds->buffer.get(), length);
+
+    if (h.on_data_sent != nullptr) {
+        h.on_data_sent(h.arg, stream_id, length);
+    }
+
+    return 0;
+}
+
 template <typename T>
 void Http2Session<T>::on_end_headers(const nghttp2_frame *frame, uint32_t stream_id, Stream &stream) {
     log_frsid(trace, m_id, frame, "...");
@@ -490,6 +893,10 @@ void Http2Session<T>::on_end_headers(const nghttp2_frame *frame, uint32_t stream
     } else {
         // NOLINTNEXTLINE(*-magic-numbers)
         stream.flags.set(Stream::MESSAGE_ALREADY_RECEIVED, 200 <= message.status_code());
+        if (m_settings.decode_content_encoding && message.headers().has_body()
+                && !stream.flags.test(Stream::HEAD_REQUEST)) {
+            stream.body_decoder = m_body_decoders.acquire(message.headers(), m_settings.max_decoded_body_size);
+        }
         if (const auto &h = static_cast<T *>(this)->m_handler; h.on_response != nullptr) {
             h.on_response(h.arg, stream_id, std::move(message));
         }
@@ -500,6 +907,19 @@ template <typename T>
 void Http2Session<T>::on_end_stream(uint32_t stream_id) {
     log_sid(trace, m_id, stream_id, "...");
 
+    if (Stream *stream = m_streams.find(stream_id); stream != nullptr && stream->body_decoder != nullptr) {
+        Error<BodyDecoderError> error = stream->body_decoder->finish();
+        finish_body_decoding(stream_id, *stream);
+        if (error != nullptr) {
+            log_sid(dbg, m_id, stream_id, "Couldn't decode body: {}", error->str());
+            if (Error<Http2Error> reset_error = reset_stream_impl(stream_id, NGHTTP2_INTERNAL_ERROR);
+                    reset_error != nullptr) {
+                log_sid(dbg, m_id, stream_id, "Couldn't reset stream: {}", reset_error->str());
+            }
+            return;
+        }
+    }
+
     if (const auto &h = static_cast<T *>(this)->m_handler; h.on_stream_read_finished != nullptr) {
         h.on_stream_read_finished(h.arg, stream_id);
     }
@@ -513,17 +933,49 @@ void Http2Session<T>::close_stream(uint32_t stream_id, nghttp2_error_code error_
 }
 
 template <typename T>
-int Http2Session<T>::push_data(Stream &stream, Uint8View chunk, bool eof) {
+bool Http2Session<T>::fits_memory_limit(size_t length) const {
+    // A chunk larger than the limit is accepted once the previous data is sent, so that it's sent eventually
+    return m_settings.max_session_memory == 0 || m_buffered_body == 0
+            || memory_usage_impl() + length <= m_settings.max_session_memory;
+}
+
+template <typename T>
+evbuffer *Http2Session<T>::body_buffer(Stream &stream) {
     if (stream.data_source.buffer == nullptr) {
         stream.data_source.buffer.reset(evbuffer_new());
+        evbuffer_add_cb(stream.data_source.buffer.get(), account_buffer_change, &m_buffered_body);
     }
+    return stream.data_source.buffer.get();
+}
+
+template <typename T>
+int Http2Session<T>::push_data(Stream &stream, Uint8View chunk, bool eof) {
+    evbuffer *buffer = body_buffer(stream);
+    stream.flags.set(Stream::HAS_EOF, eof);
+    return evbuffer_add(buffer, chunk.data(), chunk.size());
+}
+
+template <typename T>
+int Http2Session<T>::push_data(Stream &stream, const BodyBuffer &buffer, bool eof) {
+    evbuffer *data_buffer = body_buffer(stream);
     stream.flags.set(Stream::HAS_EOF, eof);
-    return evbuffer_add(stream.data_source.buffer.get(), chunk.data(), chunk.size());
+    if (buffer.data.empty()) {
+        if (buffer.release != nullptr) {
+            buffer.release(buffer.data.data(), 0, buffer.arg);
+        }
+        return 0;
+    }
+    return evbuffer_add_reference(data_buffer, buffer.data.data(), buffer.data.size(), buffer.release, buffer.arg);
 }
 
 template <typename T>
 int Http2Session<T>::schedule_send(uint32_t stream_id, Stream &stream) {
     if (stream.flags.test(Stream::SCHEDULED)) {
+        if (!stream.flags.test(Stream::DEFERRED)) {
+            // nghttp2 will read the new data along with the pending one
+            return 0;
+        }
+        stream.flags.reset(Stream::DEFERRED);
         return nghttp2_session_resume_data(m_session.get(), int32_t(stream_id));
     }
 
@@ -542,11 +994,24 @@ template <typename T>
 Result<size_t, Http2Error> Http2Session<T>::input_impl(Uint8View chunk) {
     log_id(trace, m_id, "Length={}", chunk.length());
 
+    size_t memory_before = m_nghttp2_memory;
     ssize_t status = nghttp2_session_mem_recv(m_session.get(), chunk.data(), chunk.size());
     if (status < 0) {
         return make_error(Http2Error{}, AG_FMT("{} ({})", nghttp2_strerror(status), status));
     }
 
+    // Only the session state grown by the input is the peer's fault, the buffered body data is subject
+    // to the backpressure of `submit_body()`
+    if (m_settings.max_session_memory != 0 && m_error != NGHTTP2_ENHANCE_YOUR_CALM
+            && m_nghttp2_memory > memory_before && m_nghttp2_memory > m_settings.max_session_memory) {
+        log_id(dbg, m_id, "Memory limit exceeded: nghttp2={} body={}", m_nghttp2_memory, m_buffered_body);
+        m_error = NGHTTP2_ENHANCE_YOUR_CALM;
+        if (int error = nghttp2_session_terminate_session(m_session.get(), m_error); error != NGHTTP2_NO_ERROR) {
+            log_id(dbg, m_id, "Couldn't terminate session: {} ({})", nghttp2_strerror(error), error);
+        }
+        return make_error(Http2Error{}, "Session memory limit exceeded");
+    }
+
     return size_t(status);
 }
 
@@ -558,9 +1023,21 @@ Error<Http2Error> Http2Session<T>::submit_settings_impl() {
             {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, m_settings.max_concurrent_streams},
             {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, m_settings.initial_stream_window_size},
             {NGHTTP2_SETTINGS_MAX_FRAME_SIZE, m_settings.max_frame_size},
+            // Space for the optional entries
+            {},
+            {},
     };
+    size_t settings_num = std::size(settings) - 2;
+    if (m_settings.extensible_priorities) {
+        settings[settings_num++] = {NGHTTP2_SETTINGS_NO_RFC7540_PRIORITIES, true};
+    }
+    if constexpr (std::is_same_v<T, Http2Server>) {
+        if (m_settings.enable_connect_protocol) {
+            settings[settings_num++] = {NGHTTP2_SETTINGS_ENABLE_CONNECT_PROTOCOL, true};
+        }
+    }
 
-    if (int status = nghttp2_submit_settings(m_session.get(), 0, settings, std::size(settings));
+    if (int status = nghttp2_submit_settings(m_session.get(), 0, settings, settings_num);
             status != NGHTTP2_NO_ERROR) {
         return make_error(Http2Error{}, AG_FMT("Couldn't submit settings: {} ({})", nghttp2_strerror(status), status));
     }
@@ -576,13 +1053,38 @@ Error<Http2Error> Http2Session<T>::submit_settings_impl() {
     return {};
 }
 
+template <typename T>
+void Http2Session<T>::push_pseudo_header(std::string_view name, std::string_view value) {
+    if (value.empty()) {
+        return;
+    }
+    uint8_t flags = NGHTTP2_NV_FLAG_NO_COPY_NAME;
+    const auto *it = std::find(std::begin(STATIC_PSEUDO_HEADER_VALUES), std::end(STATIC_PSEUDO_HEADER_VALUES), value);
+    if (it != std::end(STATIC_PSEUDO_HEADER_VALUES)) {
+        value = *it;
+        flags |= NGHTTP2_NV_FLAG_NO_COPY_VALUE;
+    }
+    m_nv_list.push_back(make_nv(name, value, flags));
+}
+
+template <typename T>
+void Http2Session<T>::push_headers(const Headers &headers) {
+    for (auto it = headers.begin(); it != headers.end(); ++it) {
+        if (std::string_view name = header_token_name(headers.token(it)); !name.empty()) {
+            // The canonical names are lower-case and static, so nghttp2 has nothing to do with them
+            m_nv_list.push_back(make_nv(name, it->value, NGHTTP2_NV_FLAG_NO_COPY_NAME));
+        } else {
+            m_nv_list.push_back(make_nv(it->name, it->value, NGHTTP2_NV_FLAG_NONE));
+        }
+    }
+}
+
 template <typename T>
 Error<Http2Error> Http2Session<T>::submit_trailer_impl(uint32_t stream_id, const Headers &headers) {
-    std::vector<nghttp2_nv> nv_list;
-    nv_list.reserve(std::distance(headers.begin(), headers.end()));
-    std::transform(headers.begin(), headers.end(), std::back_inserter(nv_list), transform_header<std::string>);
+    m_nv_list.clear();
+    push_headers(headers);
 
-    if (int status = nghttp2_submit_trailer(m_session.get(), int32_t(stream_id), nv_list.data(), nv_list.size());
+    if (int status = nghttp2_submit_trailer(m_session.get(), int32_t(stream_id), m_nv_list.data(), m_nv_list.size());
             status != NGHTTP2_NO_ERROR) {
         return make_error(Http2Error{}, AG_FMT("{} ({})", nghttp2_strerror(status), status));
     }
@@ -594,16 +1096,50 @@ template <typename T>
 Error<Http2Error> Http2Session<T>::submit_body_impl(uint32_t stream_id, ag::Uint8View chunk, bool eof) {
     log_sid(trace, m_id, stream_id, "Length={} eof={}", chunk.length(), eof);
 
-    auto iter = m_streams.find(stream_id);
-    if (iter == m_streams.end()) {
+    Stream *stream = m_streams.find(stream_id);
+    if (stream == nullptr) {
         return make_error(Http2Error{}, "Stream not found");
     }
 
-    Stream &stream = iter->second;
-    if (0 != push_data(stream, chunk, eof)) {
+    if (!fits_memory_limit(chunk.size())) {
+        return make_error(Http2Error{}, "Session memory limit exceeded");
+    }
+    if (0 != push_data(*stream, chunk, eof)) {
         return make_error(Http2Error{}, "Couldn't push data in buffer");
     }
-    if (int status = schedule_send(stream_id, stream); status != 0) {
+    if (int status = schedule_send(stream_id, *stream); status != 0) {
+        return make_error(
+                Http2Error{}, AG_FMT("Couldn't schedule data to send: {} ({})", nghttp2_strerror(status), status));
+    }
+
+    return {};
+}
+
+template <typename T>
+Error<Http2Error> Http2Session<T>::submit_body_ref_impl(uint32_t stream_id, const BodyBuffer &buffer, bool eof) {
+    log_sid(trace, m_id, stream_id, "Length={} eof={}", buffer.data.length(), eof);
+
+    Stream *stream = m_streams.find(stream_id);
+    if (stream == nullptr) {
+        if (buffer.release != nullptr) {
+            buffer.release(buffer.data.data(), buffer.data.size(), buffer.arg);
+        }
+        return make_error(Http2Error{}, "Stream not found");
+    }
+
+    if (!fits_memory_limit(buffer.data.size())) {
+        if (buffer.release != nullptr) {
+            buffer.release(buffer.data.data(), buffer.data.size(), buffer.arg);
+        }
+        return make_error(Http2Error{}, "Session memory limit exceeded");
+    }
+    if (0 != push_data(*stream, buffer, eof)) {
+        if (buffer.release != nullptr) {
+            buffer.release(buffer.data.data(), buffer.data.size(), buffer.arg);
+        }
+        return make_error(Http2Error{}, "Couldn't push data in buffer");
+    }
+    if (int status = schedule_send(stream_id, *stream); status != 0) {
         return make_error(
                 Http2Error{}, AG_FMT("Couldn't schedule data to send: {} ({})", nghttp2_strerror(status), status));
     }
@@ -663,12 +1199,48 @@ Error<Http2Error> Http2Session<T>::consume_stream_impl(uint32_t stream_id, size_
 template <typename T>
 Error<Http2Error> Http2Session<T>::flush_impl() {
     int status = nghttp2_session_send(m_session.get());
+    flush_output_batch();
     if (status != NGHTTP2_NO_ERROR) {
         return make_error(Http2Error{}, AG_FMT("{} ({})", nghttp2_strerror(status), status));
     }
     return {};
 }
 
+template <typename T>
+Error<Http2Error> Http2Session<T>::update_priority_impl(uint32_t stream_id, const Http2Priority &priority) {
+    log_sid(trace, m_id, stream_id, "Urgency={} incremental={}", priority.urgency, priority.incremental);
+
+    int status; // NOLINT(*-init-variables)
+    if constexpr (std::is_same_v<T, Http2Server>) {
+        nghttp2_extpri extpri{.urgency = priority.urgency, .inc = priority.incremental};
+        status = nghttp2_session_change_extpri_stream_priority(m_session.get(), int32_t(stream_id), &extpri, 1);
+    } else {
+        std::string value = priority_field_value(priority);
+        status = nghttp2_submit_priority_update(
+                m_session.get(), NGHTTP2_FLAG_NONE, int32_t(stream_id), (uint8_t *) value.data(), value.size());
+    }
+    if (status != NGHTTP2_NO_ERROR) {
+        return make_error(Http2Error{}, AG_FMT("Couldn't update priority: {} ({})", nghttp2_strerror(status), status));
+    }
+
+    return {};
+}
+
+template <typename T>
+Http2HpackStats Http2Session<T>::hpack_stats_impl() const {
+    Http2HpackStats stats = m_hpack_stats;
+    if (m_session != nullptr) {
+        stats.deflate_table_size = nghttp2_session_get_hd_deflate_dynamic_table_size(m_session.get());
+        stats.inflate_table_size = nghttp2_session_get_hd_inflate_dynamic_table_size(m_session.get());
+    }
+    return stats;
+}
+
+template <typename T>
+size_t Http2Session<T>::memory_usage_impl() const {
+    return m_nghttp2_memory + m_buffered_body;
+}
+
 Http2Server::Http2Server(PrivateAccess, const Http2Settings &settings, const Callbacks &callbacks)
         : Http2Session<Http2Server>(settings)
         , m_handler(callbacks) {
@@ -691,22 +1263,27 @@ Result<size_t, Http2Error> Http2Server::input(Uint8View chunk) {
     return input_impl(chunk);
 }
 
-Error<Http2Error> Http2Server::submit_response(uint32_t stream_id, const Response &response, bool eof) {
-    auto iter = m_streams.find(stream_id);
-    if (iter == m_streams.end()) {
+Error<Http2Error> Http2Server::submit_response(
+        uint32_t stream_id, const Response &response, bool eof, std::optional<Http2Priority> priority) {
+    Stream *stream = m_streams.find(stream_id);
+    if (stream == nullptr) {
         return make_error(Http2Error{}, "Stream not found");
     }
+    if (priority.has_value()) {
+        if (Error<Http2Error> error = update_priority_impl(stream_id, priority.value()); error != nullptr) {
+            return error;
+        }
+    }
 
-    const Stream &stream = iter->second;
-    eof = eof || stream.flags.test(Stream::HEAD_REQUEST);
+    eof = eof || stream->flags.test(Stream::HEAD_REQUEST);
 
-    std::vector<nghttp2_nv> nv_list;
-    nv_list.reserve(std::distance(response.begin(), response.end()));
-    std::transform(response.begin(), response.end(), std::back_inserter(nv_list), transform_header<std::string_view>);
+    m_nv_list.clear();
+    push_pseudo_header(PSEUDO_HEADER_NAME_STATUS, response.status_string());
+    push_headers(response.headers());
 
     uint32_t flags = eof ? NGHTTP2_FLAG_END_STREAM : 0;
     if (int status = nghttp2_submit_headers(
-                m_session.get(), flags, int32_t(stream_id), nullptr, nv_list.data(), nv_list.size(), nullptr);
+                m_session.get(), flags, int32_t(stream_id), nullptr, m_nv_list.data(), m_nv_list.size(), nullptr);
             status != NGHTTP2_NO_ERROR) {
         return make_error(Http2Error{}, AG_FMT("{} ({})", nghttp2_strerror(status), status));
     }
@@ -722,10 +1299,18 @@ Error<Http2Error> Http2Server::submit_body(uint32_t stream_id, Uint8View chunk,
     return submit_body_impl(stream_id, chunk, eof);
 }
 
+Error<Http2Error> Http2Server::submit_body_ref(uint32_t stream_id, const BodyBuffer &buffer, bool eof) {
+    return submit_body_ref_impl(stream_id, buffer, eof);
+}
+
 Error<Http2Error> Http2Server::reset_stream(uint32_t stream_id, nghttp2_error_code error_code) {
     return reset_stream_impl(stream_id, error_code);
 }
 
+Error<Http2Error> Http2Server::update_priority(uint32_t stream_id, const Http2Priority &priority) {
+    return update_priority_impl(stream_id, priority);
+}
+
 void Http2Server::set_session_close_error(nghttp2_error_code error_code) {
     m_error = error_code;
 }
@@ -738,6 +1323,14 @@ Error<Http2Error> Http2Server::consume_stream(uint32_t stream_id, size_t length)
     return consume_stream_impl(stream_id, length);
 }
 
+Http2HpackStats Http2Server::hpack_stats() const {
+    return hpack_stats_impl();
+}
+
+size_t Http2Server::memory_usage() const {
+    return memory_usage_impl();
+}
+
 Error<Http2Error> Http2Server::flush() {
     return flush_impl();
 }
@@ -764,10 +1357,27 @@ Result<size_t, Http2Error> Http2Client::input(Uint8View chunk) {
     return input_impl(chunk);
 }
 
-Result<uint32_t, Http2Error> Http2Client::submit_request(const Request &request, bool eof) {
-    std::vector<nghttp2_nv> nv_list;
-    nv_list.reserve(std::distance(request.begin(), request.end()));
-    std::transform(request.begin(), request.end(), std::back_inserter(nv_list), transform_header<std::string_view>);
+Result<uint32_t, Http2Error> Http2Client::submit_request(
+        const Request &request, bool eof, std::optional<Http2Priority> priority) {
+    if (!request.protocol().empty()
+            && 0 == nghttp2_session_get_remote_settings(m_session.get(), NGHTTP2_SETTINGS_ENABLE_CONNECT_PROTOCOL)) {
+        return make_error(Http2Error{}, "Server hasn't enabled extended CONNECT");
+    }
+
+    m_nv_list.clear();
+    push_pseudo_header(PSEUDO_HEADER_NAME_METHOD, request.method());
+    push_pseudo_header(PSEUDO_HEADER_NAME_SCHEME, request.scheme());
+    push_pseudo_header(PSEUDO_HEADER_NAME_PATH, request.path());
+    push_pseudo_header(PSEUDO_HEADER_NAME_AUTHORITY, request.authority());
+    push_pseudo_header(PSEUDO_HEADER_NAME_PROTOCOL, request.protocol());
+    push_headers(request.headers());
+
+    std::string priority_value;
+    if (priority.has_value() && !request.headers().contains(HEADER_TOKEN_PRIORITY)) {
+        priority_value = priority_field_value(priority.value());
+        m_nv_list.push_back(
+                make_nv(header_token_name(HEADER_TOKEN_PRIORITY), priority_value, NGHTTP2_NV_FLAG_NO_COPY_NAME));
+    }
 
     uint32_t stream_id = nghttp2_session_get_next_stream_id(m_session.get());
     if (int status = nghttp2_session_set_next_stream_id(m_session.get(), int32_t(stream_id));
@@ -780,12 +1390,12 @@ Result<uint32_t, Http2Error> Http2Client::submit_request(const Request &request,
 
     uint32_t flags = eof ? NGHTTP2_FLAG_END_STREAM : 0;
     if (int status = nghttp2_submit_headers(
-                m_session.get(), flags, -1, nullptr, nv_list.data(), nv_list.size(), nullptr);
+                m_session.get(), flags, -1, nullptr, m_nv_list.data(), m_nv_list.size(), nullptr);
             status < 0) {
         return make_error(Http2Error{}, AG_FMT("Couldn't submit request: {} ({})", nghttp2_strerror(status), status));
     }
 
-    Stream &stream = m_streams.emplace(stream_id, Stream{}).first->second;
+    Stream &stream = m_streams.emplace(stream_id);
     stream.flags.set(Stream::HEAD_REQUEST, head_request);
     stream.flags.set(Stream::HAS_EOF, eof);
     return stream_id;
@@ -799,10 +1409,18 @@ Error<Http2Error> Http2Client::submit_body(uint32_t stream_id, Uint8View chunk,
     return submit_body_impl(stream_id, chunk, eof);
 }
 
+Error<Http2Error> Http2Client::submit_body_ref(uint32_t stream_id, const BodyBuffer &buffer, bool eof) {
+    return submit_body_ref_impl(stream_id, buffer, eof);
+}
+
 Error<Http2Error> Http2Client::reset_stream(uint32_t stream_id, nghttp2_error_code error_code) {
     return reset_stream_impl(stream_id, error_code);
 }
 
+Error<Http2Error> Http2Client::update_priority(uint32_t stream_id, const Http2Priority &priority) {
+    return update_priority_impl(stream_id, priority);
+}
+
 void Http2Client::set_session_close_error(nghttp2_error_code error_code) {
     m_error = error_code;
 }
@@ -812,7 +1430,15 @@ Error<Http2Error> Http2Client::consume_connection(size_t length) {
 }
 
 Error<Http2Error> Http2Client::consume_stream(uint32_t stream_id, size_t length) {
-    return consume_stream_impl(stream_id, length);
+    return consume_stream_impl(stream_id, m_decoded_flow_control.on_consumed(stream_id, length));
+}
+
+Http2HpackStats Http2Client::hpack_stats() const {
+    return hpack_stats_impl();
+}
+
+size_t Http2Client::memory_usage() const {
+    return memory_usage_impl();
 }
 
 Error<Http2Error> Http2Client::flush() {
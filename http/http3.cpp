@@ -15,12 +15,17 @@
 
 #define log_id(lvl_, id_, fmt_, ...) lvl_##log(g_logger, "[{}] " fmt_, id_, ##__VA_ARGS__)
 #define log_sid(lvl_, id_, stream_, fmt_, ...) lvl_##log(g_logger, "[{}-{}] " fmt_, id_, stream_, ##__VA_ARGS__)
+// For the messages a misbehaving peer may trigger at will
+#define log_sid_limited(lvl_, id_, stream_, fmt_, ...)                                                                 \
+    lvl_##log_every(g_logger, PEER_TRIGGERED_LOG_PERIOD, "[{}-{}] " fmt_, id_, stream_, ##__VA_ARGS__)
 
 namespace ag::http {
 
 static const Logger g_logger("H3");    // NOLINT(*-identifier-naming)
 static std::atomic_uint32_t g_next_id; // NOLINT(*-avoid-non-const-global-variables)
 
+static constexpr auto PEER_TRIGGERED_LOG_PERIOD = std::chrono::seconds(1);
+
 // DCID length in the Initial packet matches Chrome's QUIC fingerprint (Chrome uses 8 bytes, SCID = 0 bytes)
 static constexpr size_t ORIGINAL_DCID_DATALEN = 8;
 // Typical DCID length after handshake
@@ -37,12 +42,16 @@ static constexpr nghttp3_nv transform_header(const Header<T> &header) {
     };
 }
 
+static void release_rcbuf(void *buf) {
+    nghttp3_rcbuf_decref((nghttp3_rcbuf *) buf);
+}
+
 template <typename T>
 int Http3Session<T>::on_begin_headers(nghttp3_conn *, int64_t stream_id, void *arg, void *) {
     auto *self = (Http3Session *) arg;
     log_sid(trace, self->m_id, stream_id, "...");
 
-    Stream &stream = self->m_streams.emplace(stream_id, Stream{}).first->second;
+    Stream &stream = self->m_streams.emplace(stream_id);
     if (stream.message.has_value()) {
         log_sid(warn, self->m_id, stream_id, "Another headers is already in progress: {}", stream.message.value());
         return NGHTTP3_ERR_CALLBACK_FAILURE;
@@ -64,39 +73,43 @@ int Http3Session<T>::on_recv_header(nghttp3_conn *, int64_t stream_id, int32_t,
     std::string_view value = {(char *) value_.base, value_.len};
     log_sid(trace, self->m_id, stream_id, "{}: {}", name, value);
 
-    auto iter = self->m_streams.find(stream_id);
-    if (iter == self->m_streams.end()) {
-        log_sid(warn, self->m_id, stream_id, "Stream not found");
+    Stream *stream = self->m_streams.find(stream_id);
+    if (stream == nullptr) {
+        log_sid_limited(warn, self->m_id, stream_id, "Stream not found");
         return NGHTTP3_ERR_CALLBACK_FAILURE;
     }
 
-    Stream &stream = iter->second;
-    if (!stream.message.has_value()) {
-        log_sid(warn, self->m_id, stream_id, "Stream has no pending message");
+    if (!stream->message.has_value()) {
+        log_sid_limited(warn, self->m_id, stream_id, "Stream has no pending message");
         return NGHTTP3_ERR_CALLBACK_FAILURE;
     }
 
-    Message &message = stream.message.value();
+    Message &message = stream->message.value();
     static_assert(std::is_same_v<T, Http3Server> || std::is_same_v<T, Http3Client>);
+    HeaderToken token = header_token(name);
     if constexpr (std::is_same_v<T, Http3Server>) {
-        if (name == PSEUDO_HEADER_NAME_METHOD) {
+        switch (token) {
+        case HEADER_TOKEN_PSEUDO_METHOD:
             message.method(std::string{value});
             return 0;
-        }
-        if (name == PSEUDO_HEADER_NAME_SCHEME) {
+        case HEADER_TOKEN_PSEUDO_SCHEME:
             message.scheme(std::string{value});
             return 0;
-        }
-        if (name == PSEUDO_HEADER_NAME_AUTHORITY) {
+        case HEADER_TOKEN_PSEUDO_AUTHORITY:
             message.authority(std::string{value});
             return 0;
-        }
-        if (name == PSEUDO_HEADER_NAME_PATH) {
+        case HEADER_TOKEN_PSEUDO_PATH:
             message.path(std::string{value});
             return 0;
+        case HEADER_TOKEN_PSEUDO_PROTOCOL:
+            // nghttp3 rejects it unless `Http3Settings::enable_connect_protocol` is set
+            message.protocol(std::string{value});
+            return 0;
+        default:
+            break;
         }
     } else {
-        if (name == PSEUDO_HEADER_NAME_STATUS) {
+        if (token == HEADER_TOKEN_PSEUDO_STATUS) {
             std::optional code = utils::to_integer<unsigned int>(value);
             if (!code.has_value()) {
                 log_sid(dbg, self->m_id, stream_id, "Couldn't parse status code: {}", value);
@@ -107,7 +120,13 @@ int Http3Session<T>::on_recv_header(nghttp3_conn *, int64_t stream_id, int32_t,
         }
     }
 
-    message.headers().put(std::string{name}, std::string{value});
+    if (self->m_settings.borrow_header_buffers) {
+        nghttp3_rcbuf_incref(name_buf);
+        nghttp3_rcbuf_incref(value_buf);
+        message.headers().put_borrowed(name, value, token, {name_buf, release_rcbuf}, {value_buf, release_rcbuf});
+    } else {
+        message.headers().put(name, value, token);
+    }
 
     return 0;
 }
@@ -117,23 +136,27 @@ int Http3Session<T>::on_end_headers(nghttp3_conn *, int64_t stream_id, int fin,
     auto *self = (Http3Session *) arg;
     log_sid(trace, self->m_id, stream_id, "...");
 
-    auto iter = self->m_streams.find(stream_id);
-    if (iter == self->m_streams.end()) {
-        log_sid(warn, self->m_id, stream_id, "Stream not found");
+    Stream *stream = self->m_streams.find(stream_id);
+    if (stream == nullptr) {
+        log_sid_limited(warn, self->m_id, stream_id, "Stream not found");
         return NGHTTP3_ERR_CALLBACK_FAILURE;
     }
 
-    Stream &stream = iter->second;
-    Message message = std::move(std::exchange(stream.message, std::nullopt).value());
+    Message message = std::move(std::exchange(stream->message, std::nullopt).value());
     message.headers().has_body(!fin);
 
     static_assert(std::is_same_v<T, Http3Server> || std::is_same_v<T, Http3Client>);
     if constexpr (std::is_same_v<T, Http3Server>) {
-        stream.flags.set(Stream::HEAD_REQUEST, message.method() == "HEAD");
+        stream->flags.set(Stream::HEAD_REQUEST, message.method() == "HEAD");
         if (const auto &h = static_cast<T *>(self)->m_handler; h.on_request != nullptr) {
             h.on_request(h.arg, stream_id, std::move(message));
         }
     } else {
+        if (self->m_settings.decode_content_encoding && message.headers().has_body()
+                && !stream->flags.test(Stream::HEAD_REQUEST)) {
+            stream->body_decoder =
+                    self->m_body_decoders.acquire(message.headers(), self->m_settings.max_decoded_body_size);
+        }
         if (const auto &h = static_cast<T *>(self)->m_handler; h.on_response != nullptr) {
             h.on_response(h.arg, stream_id, std::move(message));
         }
@@ -147,19 +170,18 @@ int Http3Session<T>::on_begin_trailers(nghttp3_conn *, int64_t stream_id, void *
     auto *self = (Http3Session *) arg;
     log_sid(trace, self->m_id, stream_id, "...");
 
-    auto iter = self->m_streams.find(stream_id);
-    if (iter == self->m_streams.end()) {
-        log_sid(warn, self->m_id, stream_id, "Stream not found");
+    Stream *stream = self->m_streams.find(stream_id);
+    if (stream == nullptr) {
+        log_sid_limited(warn, self->m_id, stream_id, "Stream not found");
         return NGHTTP3_ERR_CALLBACK_FAILURE;
     }
 
-    Stream &stream = iter->second;
-    if (stream.message.has_value()) {
-        log_sid(warn, self->m_id, stream_id, "Another headers is already in progress: {}", stream.message.value());
+    if (stream->message.has_value()) {
+        log_sid(warn, self->m_id, stream_id, "Another headers is already in progress: {}", stream->message.value());
         return NGHTTP3_ERR_CALLBACK_FAILURE;
     }
 
-    stream.message.emplace(HTTP_3_0);
+    stream->message.emplace(HTTP_3_0);
 
     return 0;
 }
@@ -175,20 +197,26 @@ int Http3Session<T>::on_recv_trailer(nghttp3_conn *, int64_t stream_id, int32_t,
     std::string_view value = {(char *) value_.base, value_.len};
     log_sid(trace, self->m_id, stream_id, "{}: {}", name, value);
 
-    auto iter = self->m_streams.find(stream_id);
-    if (iter == self->m_streams.end()) {
-        log_sid(warn, self->m_id, stream_id, "Stream not found");
+    Stream *stream = self->m_streams.find(stream_id);
+    if (stream == nullptr) {
+        log_sid_limited(warn, self->m_id, stream_id, "Stream not found");
         return NGHTTP3_ERR_CALLBACK_FAILURE;
     }
 
-    Stream &stream = iter->second;
-    if (!stream.message.has_value()) {
-        log_sid(warn, self->m_id, stream_id, "Stream has no pending message");
+    if (!stream->message.has_value()) {
+        log_sid_limited(warn, self->m_id, stream_id, "Stream has no pending message");
         return NGHTTP3_ERR_CALLBACK_FAILURE;
     }
 
-    Message &message = stream.message.value();
-    message.headers().put(std::string{name}, std::string{value});
+    Message &message = stream->message.value();
+    if (self->m_settings.borrow_header_buffers) {
+        nghttp3_rcbuf_incref(name_buf);
+        nghttp3_rcbuf_incref(value_buf);
+        message.headers().put_borrowed(name, value, header_token(name), {name_buf, release_rcbuf},
+                {value_buf, release_rcbuf});
+    } else {
+        message.headers().put(name, value);
+    }
 
     return 0;
 }
@@ -198,14 +226,13 @@ int Http3Session<T>::on_end_trailers(nghttp3_conn *, int64_t stream_id, int, voi
     auto *self = (Http3Session *) arg;
     log_sid(trace, self->m_id, stream_id, "...");
 
-    auto iter = self->m_streams.find(stream_id);
-    if (iter == self->m_streams.end()) {
-        log_sid(warn, self->m_id, stream_id, "Stream not found");
+    Stream *stream = self->m_streams.find(stream_id);
+    if (stream == nullptr) {
+        log_sid_limited(warn, self->m_id, stream_id, "Stream not found");
         return NGHTTP3_ERR_CALLBACK_FAILURE;
     }
 
-    Stream &stream = iter->second;
-    Message message = std::move(std::exchange(stream.message, std::nullopt).value());
+    Message message = std::move(std::exchange(stream->message, std::nullopt).value());
 
     if (const auto &h = static_cast<T *>(self)->m_handler; h.on_trailer_headers != nullptr) {
         h.on_trailer_headers(h.arg, stream_id, Message::into_headers(std::move(message)));
@@ -220,12 +247,17 @@ int Http3Session<T>::on_data_chunk_recv(
     auto *self = (Http3Session *) arg;
     log_sid(trace, self->m_id, stream_id, "{}", len);
 
-    auto iter = self->m_streams.find(stream_id);
-    if (iter == self->m_streams.end()) {
-        log_sid(warn, self->m_id, stream_id, "Stream not found");
+    Stream *stream = self->m_streams.find(stream_id);
+    if (stream == nullptr) {
+        log_sid_limited(warn, self->m_id, stream_id, "Stream not found");
         return NGHTTP3_ERR_CALLBACK_FAILURE;
     }
 
+    if (stream->body_decoder != nullptr) {
+        self->decode_body(stream_id, *stream, {data, len});
+        return 0;
+    }
+
     if (const auto &h = static_cast<T *>(self)->m_handler; h.on_body != nullptr) {
         h.on_body(h.arg, stream_id, {data, len});
     }
@@ -233,6 +265,48 @@ int Http3Session<T>::on_data_chunk_recv(
     return 0;
 }
 
+template <typename T>
+void Http3Session<T>::decode_body(uint64_t stream_id, Stream &stream, Uint8View chunk) {
+    m_decoded_flow_control.on_received(stream_id, chunk.size(), 0);
+
+    struct Context {
+        Http3Session *self;
+        uint64_t stream_id;
+    } context{this, stream_id};
+    BodyDecoder::Handler handler{
+            .arg = &context,
+            .on_data =
+                    [](void *arg, Uint8View decoded) {
+                        auto *context = (Context *) arg;
+                        Http3Session *self = context->self;
+                        self->m_decoded_flow_control.on_received(context->stream_id, 0, decoded.size());
+                        if (const auto &h = static_cast<T *>(self)->m_handler; h.on_body != nullptr) {
+                            h.on_body(h.arg, context->stream_id, decoded);
+                        }
+                    },
+    };
+
+    if (Error<BodyDecoderError> error = stream.body_decoder->decode(chunk, handler); error != nullptr) {
+        log_sid(dbg, m_id, stream_id, "Couldn't decode body: {}", error->str());
+        finish_body_decoding(stream_id, stream);
+        if (Error<Http3Error> reset_error = reset_stream_impl(stream_id, NGHTTP3_H3_INTERNAL_ERROR);
+                reset_error != nullptr) {
+            log_sid(dbg, m_id, stream_id, "Couldn't reset stream: {}", reset_error->str());
+        }
+    }
+}
+
+template <typename T>
+void Http3Session<T>::finish_body_decoding(uint64_t stream_id, Stream &stream) {
+    m_body_decoders.release(std::move(stream.body_decoder));
+    // The received data that has produced nothing for the application to consume
+    if (size_t length = m_decoded_flow_control.on_finished(stream_id); length > 0) {
+        if (Error<Http3Error> error = consume_stream_impl(stream_id, length); error != nullptr) {
+            log_sid(dbg, m_id, stream_id, "Couldn't consume stream: {}", error->str());
+        }
+    }
+}
+
 template <typename T>
 int Http3Session<T>::on_h3_stop_sending(nghttp3_conn *, int64_t stream_id, uint64_t app_error_code, void *arg, void *) {
     auto *self = (Http3Session *) arg;
@@ -263,6 +337,19 @@ int Http3Session<T>::on_end_stream(nghttp3_conn *, int64_t stream_id, void *arg,
     auto *self = (Http3Session *) arg;
     log_sid(trace, self->m_id, stream_id, "...");
 
+    if (Stream *stream = self->m_streams.find(stream_id); stream != nullptr && stream->body_decoder != nullptr) {
+        Error<BodyDecoderError> error = stream->body_decoder->finish();
+        self->finish_body_decoding(stream_id, *stream);
+        if (error != nullptr) {
+            log_sid(dbg, self->m_id, stream_id, "Couldn't decode body: {}", error->str());
+            if (Error<Http3Error> reset_error = self->reset_stream_impl(stream_id, NGHTTP3_H3_INTERNAL_ERROR);
+                    reset_error != nullptr) {
+                log_sid(dbg, self->m_id, stream_id, "Couldn't reset stream: {}", reset_error->str());
+            }
+            return 0;
+        }
+    }
+
     if (const auto &h = static_cast<T *>(self)->m_handler; h.on_stream_read_finished != nullptr) {
         h.on_stream_read_finished(h.arg, stream_id);
     }
@@ -333,13 +420,18 @@ int Http3Session<T>::on_h3_stream_close(nghttp3_conn *, int64_t stream_id, uint6
     auto *self = (Http3Session *) arg;
     log_sid(trace, self->m_id, stream_id, "{} ({})", nghttp3_strerror(error_code), error_code);
 
-    auto node = self->m_streams.extract(stream_id);
-    if (node.empty()) {
-        log_sid(warn, self->m_id, stream_id, "Stream not found");
+    std::unique_ptr<Stream> stream = self->m_streams.extract(stream_id);
+    if (stream == nullptr) {
+        log_sid_limited(warn, self->m_id, stream_id, "Stream not found");
         return NGHTTP3_ERR_CALLBACK_FAILURE;
     }
 
+    if (stream->body_decoder != nullptr) {
+        self->finish_body_decoding(stream_id, *stream);
+    }
+
     self->close_stream(stream_id, int(error_code));
+    self->m_streams.recycle(std::move(stream));
 
     return 0;
 }
@@ -444,7 +536,9 @@ Http3Session<T>::Http3Session(const Http3Settings &settings)
 
 template <typename T>
 Http3Session<T>::~Http3Session() {
-    for (auto &[stream_id, _] : std::exchange(m_streams, {})) {
+    std::vector<uint64_t> stream_ids = m_streams.ids();
+    m_streams.clear();
+    for (uint64_t stream_id : stream_ids) {
         close_stream(stream_id, NGHTTP3_H3_REQUEST_CANCELLED);
     }
 
@@ -626,6 +720,9 @@ Error<Http3Error> Http3Session<T>::initialize_session(const QuicNetworkPath &pat
 
     nghttp3_settings h3_settings;
     nghttp3_settings_default(&h3_settings);
+    if constexpr (std::is_same_v<T, Http3Server>) {
+        h3_settings.enable_connect_protocol = m_settings.enable_connect_protocol;
+    }
 
 #ifndef NDEBUG
     if (g_logger.is_enabled(LOG_LEVEL_TRACE)) {
@@ -699,16 +796,14 @@ int Http3Session<T>::input_impl(const QuicNetworkPath &path, Uint8View chunk) {
 
 template <typename T>
 Error<Http3Error> Http3Session<T>::submit_trailer_impl(uint64_t stream_id, const Headers &headers) {
-    auto iter = m_streams.find(stream_id);
-    if (iter == m_streams.end()) {
+    Stream *stream = m_streams.find(stream_id);
+    if (stream == nullptr) {
         return make_error(Http3Error{NGTCP2_ERR_STREAM_NOT_FOUND});
     }
 
-    Stream &stream = iter->second;
-
     std::vector<nghttp3_nv> nv_list;
     nv_list.reserve(std::distance(headers.begin(), headers.end()));
-    std::transform(headers.begin(), headers.end(), std::back_inserter(nv_list), transform_header<std::string>);
+    std::transform(headers.begin(), headers.end(), std::back_inserter(nv_list), transform_header<std::string_view>);
 
     if (int status =
                     nghttp3_conn_submit_trailers(m_http_conn.get(), int32_t(stream_id), nv_list.data(), nv_list.size());
@@ -722,7 +817,7 @@ Error<Http3Error> Http3Session<T>::submit_trailer_impl(uint64_t stream_id, const
                 AG_FMT("Couldn't resume stream: {} ({})", nghttp3_strerror(status), status));
     }
 
-    stream.flags.set(Stream::TRAILERS_SUBMITTED);
+    stream->flags.set(Stream::TRAILERS_SUBMITTED);
 
     return {};
 }
@@ -747,50 +842,92 @@ int Http3Session<T>::recv_h3_stream_data(int64_t stream_id, Uint8View chunk, boo
 
 template <typename T>
 Error<Http3Error> Http3Session<T>::push_data(Stream &stream, Uint8View chunk, bool eof) {
+    if (chunk.empty()) {
+        return push_data(stream, BodyBuffer{}, eof);
+    }
+
+    // nghttp3's read_data callback is no-copy: it keeps raw pointers into this buffer
+    // until the data is acknowledged, and ngtcp2 re-reads them for retransmission.
+    auto owned = std::make_unique_for_overwrite<uint8_t[]>(chunk.size());
+    std::memcpy(owned.get(), chunk.data(), chunk.size());
+    BodyBuffer buffer{
+            .data = {owned.get(), chunk.size()},
+            .arg = owned.get(),
+            .release =
+                    [](const void *, size_t, void *arg) {
+                        delete[] static_cast<uint8_t *>(arg);
+                    },
+    };
+    // Ownership handed off to the buffer; the release callback frees it on ACK/drain or failure.
+    (void) owned.release();
+    return push_data(stream, buffer, eof);
+}
+
+template <typename T>
+Error<Http3Error> Http3Session<T>::push_data(Stream &stream, const BodyBuffer &buffer, bool eof) {
     if (stream.data_source.buffer == nullptr) {
         stream.data_source.buffer.reset(evbuffer_new());
     }
     stream.flags.set(Stream::HAS_EOF, eof);
-    if (!chunk.empty()) {
-        // nghttp3's read_data callback is no-copy: it keeps raw pointers into this buffer
-        // until the data is acknowledged, and ngtcp2 re-reads them for retransmission.
-        auto owned = std::make_unique_for_overwrite<uint8_t[]>(chunk.size());
-        std::memcpy(owned.get(), chunk.data(), chunk.size());
-        if (0
-                != evbuffer_add_reference(
-                        stream.data_source.buffer.get(), owned.get(), chunk.size(),
-                        [](const void *, size_t, void *arg) {
-                            delete[] static_cast<uint8_t *>(arg);
-                        },
-                        owned.get())) {
-            return make_error(Http3Error{NGTCP2_ERR_NOMEM}, "Couldn't write data in buffer");
+    if (buffer.data.empty()) {
+        if (buffer.release != nullptr) {
+            buffer.release(buffer.data.data(), 0, buffer.arg);
+        }
+        return {};
+    }
+
+    if (0
+            != evbuffer_add_reference(stream.data_source.buffer.get(), buffer.data.data(), buffer.data.size(),
+                    buffer.release, buffer.arg)) {
+        if (buffer.release != nullptr) {
+            buffer.release(buffer.data.data(), buffer.data.size(), buffer.arg);
         }
-        // Ownership handed off to the evbuffer; the cleanup callback frees it on ACK/drain.
-        (void) owned.release();
+        return make_error(Http3Error{NGTCP2_ERR_NOMEM}, "Couldn't write data in buffer");
     }
 
     return {};
 }
 
+template <typename T>
+Error<Http3Error> Http3Session<T>::resume_stream(uint64_t stream_id) {
+    if (int status = nghttp3_conn_resume_stream(m_http_conn.get(), int64_t(stream_id)); status != 0) {
+        return make_error(Http3Error{NGTCP2_ERR_NOMEM},
+                AG_FMT("Couldn't resume stream: {} ({})", nghttp3_strerror(status), status));
+    }
+    return {};
+}
+
 template <typename T>
 Error<Http3Error> Http3Session<T>::submit_body_impl(uint64_t stream_id, Uint8View chunk, bool eof) {
     log_sid(trace, m_id, stream_id, "Length={} eof={}", chunk.length(), eof);
 
-    auto iter = m_streams.find(stream_id);
-    if (iter == m_streams.end()) {
+    Stream *stream = m_streams.find(stream_id);
+    if (stream == nullptr) {
         return make_error(Http3Error{NGTCP2_ERR_STREAM_NOT_FOUND});
     }
 
-    Stream &stream = iter->second;
-    if (Error<Http3Error> error = push_data(stream, chunk, eof); error != nullptr) {
+    if (Error<Http3Error> error = push_data(*stream, chunk, eof); error != nullptr) {
         return error;
     }
-    if (int status = nghttp3_conn_resume_stream(m_http_conn.get(), int64_t(stream_id)); status != 0) {
-        return make_error(Http3Error{NGTCP2_ERR_NOMEM},
-                AG_FMT("Couldn't resume stream: {} ({})", nghttp3_strerror(status), status));
+    return resume_stream(stream_id);
+}
+
+template <typename T>
+Error<Http3Error> Http3Session<T>::submit_body_ref_impl(uint64_t stream_id, const BodyBuffer &buffer, bool eof) {
+    log_sid(trace, m_id, stream_id, "Length={} eof={}", buffer.data.length(), eof);
+
+    Stream *stream = m_streams.find(stream_id);
+    if (stream == nullptr) {
+        if (buffer.release != nullptr) {
+            buffer.release(buffer.data.data(), buffer.data.size(), buffer.arg);
+        }
+        return make_error(Http3Error{NGTCP2_ERR_STREAM_NOT_FOUND});
     }
 
-    return {};
+    if (Error<Http3Error> error = push_data(*stream, buffer, eof); error != nullptr) {
+        return error;
+    }
+    return resume_stream(stream_id);
 }
 
 template <typename T>
@@ -959,9 +1096,8 @@ size_t Http3Session<T>::get_stream_send_capacity_impl(uint64_t stream_id) const
 
     // Subtract data already submitted but not yet handed to the transport, so the reported
     // capacity bounds the inner send buffer to a single flow-control window.
-    if (auto iter = m_streams.find(stream_id);
-            iter != m_streams.end() && iter->second.data_source.buffer != nullptr) {
-        const DataSource &ds = iter->second.data_source;
+    if (const Stream *stream = m_streams.find(stream_id); stream != nullptr && stream->data_source.buffer != nullptr) {
+        const DataSource &ds = stream->data_source;
         size_t buffered = evbuffer_get_length(ds.buffer.get());
         size_t unsent = buffered > ds.read_offset ? buffered - ds.read_offset : 0;
         capacity = unsent >= capacity ? 0 : capacity - unsent;
@@ -975,14 +1111,13 @@ nghttp3_ssize Http3Session<T>::on_read_data(
         nghttp3_conn *, int64_t stream_id, nghttp3_vec *vec, size_t vec_num, uint32_t *pflags, void *arg, void *) {
     auto *self = (Http3Session *) arg;
 
-    auto iter = self->m_streams.find(stream_id);
-    if (iter == self->m_streams.end()) {
+    Stream *stream = self->m_streams.find(stream_id);
+    if (stream == nullptr) {
         log_sid(dbg, self->m_id, stream_id, "Stream not found");
         return NGHTTP3_ERR_CALLBACK_FAILURE;
     }
 
-    Stream &stream = iter->second;
-    DataSource &data_source = stream.data_source;
+    DataSource &data_source = stream->data_source;
 
     evbuffer_ptr pos{};
     if (0 != evbuffer_ptr_set(data_source.buffer.get(), &pos, data_source.read_offset, EVBUFFER_PTR_SET)) {
@@ -996,13 +1131,13 @@ nghttp3_ssize Http3Session<T>::on_read_data(
     data_source.read_offset += n;
     size_t unsent = evbuffer_get_length(data_source.buffer.get()) - data_source.read_offset;
 
-    if (vec_num == 0 && unsent == 0 && stream.flags.test(Stream::TRAILERS_SUBMITTED)) {
+    if (vec_num == 0 && unsent == 0 && stream->flags.test(Stream::TRAILERS_SUBMITTED)) {
         log_sid(trace, self->m_id, stream_id, "No data left in buffers -- set eof flag");
         *pflags |= NGHTTP3_DATA_FLAG_EOF | NGHTTP3_DATA_FLAG_NO_END_STREAM;
         return 0;
     }
 
-    bool eof = unsent == 0 && stream.flags.test(Stream::HAS_EOF);
+    bool eof = unsent == 0 && stream->flags.test(Stream::HAS_EOF);
     if (vec_num == 0 && !eof) {
         log_sid(trace, self->m_id, stream_id, "No work on current buffer");
         return NGHTTP3_ERR_WOULDBLOCK;
@@ -1022,14 +1157,13 @@ template <typename T>
 int Http3Session<T>::on_acked_stream_data(nghttp3_conn *, int64_t stream_id, uint64_t orig_len, void *arg, void *) {
     auto *self = (Http3Session *) arg;
 
-    auto iter = self->m_streams.find(stream_id);
-    if (iter == self->m_streams.end()) {
+    Stream *stream = self->m_streams.find(stream_id);
+    if (stream == nullptr) {
         log_sid(dbg, self->m_id, stream_id, "Stream not found");
         return NGHTTP3_ERR_CALLBACK_FAILURE;
     }
 
-    Stream &stream = iter->second;
-    DataSource &data_source = stream.data_source;
+    DataSource &data_source = stream->data_source;
 
     uint64_t len = orig_len;
     if (size_t buffer_size = evbuffer_get_length(data_source.buffer.get()); buffer_size < len) {
@@ -1251,21 +1385,23 @@ Result<Http3Server::InputResult, Http3Error> Http3Server::input(const QuicNetwor
 }
 
 Error<Http3Error> Http3Server::submit_response(uint64_t stream_id, const Response &response, bool eof) {
-    auto iter = m_streams.find(stream_id);
-    if (iter == m_streams.end()) {
+    Stream *stream = m_streams.find(stream_id);
+    if (stream == nullptr) {
         return make_error(Http3Error{NGTCP2_ERR_STREAM_NOT_FOUND}, "Stream not found");
     }
 
-    Stream &stream = iter->second;
-    eof = eof || stream.flags.test(Stream::HEAD_REQUEST);
+    eof = eof || stream->flags.test(Stream::HEAD_REQUEST);
 
     std::vector<nghttp3_nv> nv_list;
     nv_list.reserve(std::distance(response.begin(), response.end()));
     std::transform(response.begin(), response.end(), std::back_inserter(nv_list), transform_header<std::string_view>);
 
     nghttp3_data_reader reader{};
-    if (!eof && stream.data_source.buffer == nullptr) {
-        stream.data_source.buffer.reset(evbuffer_new());
+    if (!eof && !stream->flags.test(Stream::HAS_DATA_READER)) {
+        stream->flags.set(Stream::HAS_DATA_READER);
+        if (stream->data_source.buffer == nullptr) {
+            stream->data_source.buffer.reset(evbuffer_new());
+        }
         reader = {
                 .read_data = on_read_data,
         };
@@ -1294,6 +1430,10 @@ Error<Http3Error> Http3Server::submit_body(uint64_t stream_id, Uint8View chunk,
     return submit_body_impl(stream_id, chunk, eof);
 }
 
+Error<Http3Error> Http3Server::submit_body_ref(uint64_t stream_id, const BodyBuffer &buffer, bool eof) {
+    return submit_body_ref_impl(stream_id, buffer, eof);
+}
+
 Error<Http3Error> Http3Server::reset_stream(uint64_t stream_id, int error_code) {
     return reset_stream_impl(stream_id, error_code);
 }
@@ -1396,7 +1536,7 @@ Result<uint64_t, Http3Error> Http3Client::submit_request(const Request &request,
     bool head_request = request.method() == "HEAD";
     eof = eof || head_request;
 
-    Stream &stream = m_streams.emplace(stream_id, Stream{}).first->second;
+    Stream &stream = m_streams.emplace(stream_id);
     stream.flags.set(Stream::HEAD_REQUEST, head_request);
     stream.flags.set(Stream::HAS_EOF, eof);
 
@@ -1406,7 +1546,10 @@ Result<uint64_t, Http3Error> Http3Client::submit_request(const Request &request,
 
     nghttp3_data_reader reader{};
     if (!eof) {
-        stream.data_source.buffer.reset(evbuffer_new());
+        stream.flags.set(Stream::HAS_DATA_READER);
+        if (stream.data_source.buffer == nullptr) {
+            stream.data_source.buffer.reset(evbuffer_new());
+        }
         reader = {
                 .read_data = on_read_data,
         };
@@ -1431,6 +1574,10 @@ Error<Http3Error> Http3Client::submit_body(uint64_t stream_id, Uint8View chunk,
     return submit_body_impl(stream_id, chunk, eof);
 }
 
+Error<Http3Error> Http3Client::submit_body_ref(uint64_t stream_id, const BodyBuffer &buffer, bool eof) {
+    return submit_body_ref_impl(stream_id, buffer, eof);
+}
+
 Error<Http3Error> Http3Client::reset_stream(uint64_t stream_id, int error_code) {
     return reset_stream_impl(stream_id, error_code);
 }
@@ -1447,7 +1594,7 @@ void Http3Client::set_session_close_error(int error_code, Uint8View reason) {
 }
 
 Error<Http3Error> Http3Client::consume_stream(uint64_t stream_id, size_t length) {
-    return consume_stream_impl(stream_id, length);
+    return consume_stream_impl(stream_id, m_decoded_flow_control.on_consumed(stream_id, length));
 }
 
 Error<Http3Error> Http3Client::consume_connection(size_t length) {
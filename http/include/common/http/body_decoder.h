@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "common/defs.h"
+#include "common/error.h"
+#include "common/http/headers.h"
+
+namespace ag {
+namespace http {
+
+enum ContentEncoding {
+    CONTENT_ENCODING_GZIP,
+    CONTENT_ENCODING_DEFLATE,
+    CONTENT_ENCODING_BROTLI,
+};
+
+enum BodyDecoderError {
+    BDE_INIT_ERROR,
+    BDE_CORRUPTED_DATA,
+    BDE_TRUNCATED_DATA,
+    BDE_TOO_LARGE,
+};
+
+/**
+ * Parse the value of a `Content-Encoding` header field
+ * @return The encoding if it's a single supported content coding, `std::nullopt` otherwise
+ */
+std::optional<ContentEncoding> parse_content_encoding(std::string_view value);
+
+/**
+ * Incremental decoder of an encoded message body.
+ * The decoding state (and its memory) is kept between the messages, so that it's reused
+ * after `reset()`.
+ */
+class BodyDecoder {
+public:
+    /** Size of the buffer the body is decoded into */
+    static constexpr size_t OUTPUT_BUFFER_SIZE = 16 * 1024;
+    static constexpr size_t DEFAULT_MAX_DECODED_SIZE = 64 * 1024 * 1024;
+
+    struct Handler {
+        /** User context, will be raised in the callbacks */
+        void *arg;
+        /** A decoded chunk of the body is ready, it is valid only during the call */
+        void (*on_data)(void *arg, Uint8View chunk);
+    };
+
+    /**
+     * @param encoding Content coding of the body
+     * @param max_decoded_size The maximum size of the decoded body, protects from decompression bombs.
+     *                         0 means no limit.
+     */
+    explicit BodyDecoder(ContentEncoding encoding, size_t max_decoded_size = DEFAULT_MAX_DECODED_SIZE);
+    ~BodyDecoder();
+
+    BodyDecoder(const BodyDecoder &) = delete;
+    BodyDecoder &operator=(const BodyDecoder &) = delete;
+    BodyDecoder(BodyDecoder &&) = delete;
+    BodyDecoder &operator=(BodyDecoder &&) = delete;
+
+    /**
+     * Prepare the decoder for a new body
+     * @param encoding Content coding of the body
+     * @param max_decoded_size The maximum size of the decoded body, 0 means no limit
+     */
+    void reset(ContentEncoding encoding, size_t max_decoded_size = DEFAULT_MAX_DECODED_SIZE);
+
+    /**
+     * Decode a chunk of the encoded body raising `Handler::on_data` for the decoded data
+     * @return Some error if the data is corrupted or decodes to more than the limit, null otherwise
+     */
+    Error<BodyDecoderError> decode(Uint8View chunk, const Handler &handler);
+
+    /**
+     * Check that the whole encoded body has been decoded
+     * @return Some error if the body is truncated, null otherwise
+     */
+    Error<BodyDecoderError> finish() const;
+
+    [[nodiscard]] ContentEncoding encoding() const {
+        return m_encoding;
+    }
+
+private:
+    struct ZlibState;
+    struct BrotliState;
+
+    ContentEncoding m_encoding;
+    std::unique_ptr<ZlibState> m_zlib;
+    std::unique_ptr<BrotliState> m_brotli;
+    Uint8Vector m_buffer;
+    size_t m_max_decoded_size = DEFAULT_MAX_DECODED_SIZE;
+    size_t m_decoded_size = 0;
+    // Whether the end of the encoded data has been reached
+    bool m_finished = false;
+
+    Error<BodyDecoderError> decode_zlib(Uint8View chunk, const Handler &handler);
+    Error<BodyDecoderError> inflate_chunk(Uint8View chunk, const Handler &handler);
+    Error<BodyDecoderError> decode_brotli(Uint8View chunk, const Handler &handler);
+    /**
+     * Pass the decoded data to the handler checking the size limit
+     */
+    Error<BodyDecoderError> on_decoded(Uint8View chunk, const Handler &handler);
+};
+
+/**
+ * Bounded pool of the body decoders, so that a session doesn't allocate the decoding state
+ * for every encoded message
+ */
+class BodyDecoderPool {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 4;
+
+    /**
+     * @param capacity The maximum number of idle decoders kept in the pool
+     */
+    explicit BodyDecoderPool(size_t capacity = DEFAULT_CAPACITY);
+    ~BodyDecoderPool();
+
+    BodyDecoderPool(const BodyDecoderPool &) = delete;
+    BodyDecoderPool &operator=(const BodyDecoderPool &) = delete;
+    BodyDecoderPool(BodyDecoderPool &&) = delete;
+    BodyDecoderPool &operator=(BodyDecoderPool &&) = delete;
+
+    /**
+     * Get a decoder for the body of the message with the specified headers.
+     * If the body is going to be decoded, `Content-Encoding` and `Content-Length` are removed from
+     * the headers, as they describe the encoded body.
+     * @param max_decoded_size The maximum size of the decoded body, 0 means no limit
+     * @return Null if the body is not encoded with a supported content coding
+     */
+    std::unique_ptr<BodyDecoder> acquire(
+            Headers &headers, size_t max_decoded_size = BodyDecoder::DEFAULT_MAX_DECODED_SIZE);
+
+    /**
+     * Return a decoder to the pool. It's destroyed if the pool is full.
+     */
+    void release(std::unique_ptr<BodyDecoder> decoder);
+
+private:
+    size_t m_capacity;
+    std::vector<std::unique_ptr<BodyDecoder>> m_idle;
+};
+
+/**
+ * Flow control accounting of the decoded bodies.
+ * The application consumes the decoded data it has received, while the flow control windows must be
+ * updated by the amount of the received (encoded) data. Converts the former into the latter.
+ */
+class DecodedBodyFlowControl {
+public:
+    /**
+     * Account a chunk of the encoded body
+     * @param wire_length Length of the received chunk
+     * @param decoded_length Length of the data decoded from the chunk and passed to the application
+     */
+    void on_received(uint64_t stream_id, size_t wire_length, size_t decoded_length);
+
+    /**
+     * Convert the length of the data consumed by the application
+     * @return Length of the received data to consume. The same length if the stream's body isn't decoded.
+     */
+    size_t on_consumed(uint64_t stream_id, size_t decoded_length);
+
+    /**
+     * No more data is expected on the stream
+     * @return Length of the received data to consume right away, because it has produced no decoded data
+     *         that the application could consume
+     */
+    size_t on_finished(uint64_t stream_id);
+
+private:
+    struct Entry {
+        size_t wire = 0;
+        size_t decoded = 0;
+        bool finished = false;
+    };
+
+    std::unordered_map<uint64_t, Entry> m_streams;
+};
+
+} // namespace http
+
+// clang-format off
+template <>
+struct ErrorCodeToString<http::BodyDecoderError> {
+    std::string operator()(http::BodyDecoderError e) {
+        switch (e) {
+        case http::BDE_INIT_ERROR: return "Couldn't initialize decoder";
+        case http::BDE_CORRUPTED_DATA: return "Corrupted data";
+        case http::BDE_TRUNCATED_DATA: return "Truncated data";
+        case http::BDE_TOO_LARGE: return "Decoded data is too large";
+        }
+    }
+};
+// clang-format on
+
+} // namespace ag
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace ag::http {
+
+/**
+ * Well-known header field names interned as small integers.
+ * Lets the header containers look them up without comparing strings.
+ * Covers the names of the HPACK (RFC 7541) and QPACK (RFC 9204) static tables, the pseudo-headers
+ * and the hop-by-hop and WebSocket headers.
+ */
+enum HeaderToken : uint8_t {
+    HEADER_TOKEN_UNKNOWN,
+    HEADER_TOKEN_PSEUDO_AUTHORITY,
+    HEADER_TOKEN_PSEUDO_METHOD,
+    HEADER_TOKEN_PSEUDO_PATH,
+    HEADER_TOKEN_PSEUDO_PROTOCOL,
+    HEADER_TOKEN_PSEUDO_SCHEME,
+    HEADER_TOKEN_PSEUDO_STATUS,
+    HEADER_TOKEN_ACCEPT,
+    HEADER_TOKEN_ACCEPT_CHARSET,
+    HEADER_TOKEN_ACCEPT_ENCODING,
+    HEADER_TOKEN_ACCEPT_LANGUAGE,
+    HEADER_TOKEN_ACCEPT_RANGES,
+    HEADER_TOKEN_ACCESS_CONTROL_ALLOW_CREDENTIALS,
+    HEADER_TOKEN_ACCESS_CONTROL_ALLOW_HEADERS,
+    HEADER_TOKEN_ACCESS_CONTROL_ALLOW_METHODS,
+    HEADER_TOKEN_ACCESS_CONTROL_ALLOW_ORIGIN,
+    HEADER_TOKEN_ACCESS_CONTROL_EXPOSE_HEADERS,
+    HEADER_TOKEN_ACCESS_CONTROL_REQUEST_HEADERS,
+    HEADER_TOKEN_ACCESS_CONTROL_REQUEST_METHOD,
+    HEADER_TOKEN_AGE,
+    HEADER_TOKEN_ALLOW,
+    HEADER_TOKEN_ALT_SVC,
+    HEADER_TOKEN_AUTHORIZATION,
+    HEADER_TOKEN_CACHE_CONTROL,
+    HEADER_TOKEN_CONNECTION,
+    HEADER_TOKEN_CONTENT_DISPOSITION,
+    HEADER_TOKEN_CONTENT_ENCODING,
+    HEADER_TOKEN_CONTENT_LANGUAGE,
+    HEADER_TOKEN_CONTENT_LENGTH,
+    HEADER_TOKEN_CONTENT_LOCATION,
+    HEADER_TOKEN_CONTENT_RANGE,
+    HEADER_TOKEN_CONTENT_SECURITY_POLICY,
+    HEADER_TOKEN_CONTENT_TYPE,
+    HEADER_TOKEN_COOKIE,
+    HEADER_TOKEN_DATE,
+    HEADER_TOKEN_EARLY_DATA,
+    HEADER_TOKEN_ETAG,
+    HEADER_TOKEN_EXPECT,
+    HEADER_TOKEN_EXPECT_CT,
+    HEADER_TOKEN_EXPIRES,
+    HEADER_TOKEN_FORWARDED,
+    HEADER_TOKEN_FROM,
+    HEADER_TOKEN_HOST,
+    HEADER_TOKEN_IF_MATCH,
+    HEADER_TOKEN_IF_MODIFIED_SINCE,
+    HEADER_TOKEN_IF_NONE_MATCH,
+    HEADER_TOKEN_IF_RANGE,
+    HEADER_TOKEN_IF_UNMODIFIED_SINCE,
+    HEADER_TOKEN_KEEP_ALIVE,
+    HEADER_TOKEN_LAST_MODIFIED,
+    HEADER_TOKEN_LINK,
+    HEADER_TOKEN_LOCATION,
+    HEADER_TOKEN_MAX_FORWARDS,
+    HEADER_TOKEN_ORIGIN,
+    HEADER_TOKEN_PRIORITY,
+    HEADER_TOKEN_PROXY_AUTHENTICATE,
+    HEADER_TOKEN_PROXY_AUTHORIZATION,
+    HEADER_TOKEN_PROXY_CONNECTION,
+    HEADER_TOKEN_PURPOSE,
+    HEADER_TOKEN_RANGE,
+    HEADER_TOKEN_REFERER,
+    HEADER_TOKEN_REFRESH,
+    HEADER_TOKEN_RETRY_AFTER,
+    HEADER_TOKEN_SEC_WEBSOCKET_ACCEPT,
+    HEADER_TOKEN_SEC_WEBSOCKET_EXTENSIONS,
+    HEADER_TOKEN_SEC_WEBSOCKET_KEY,
+    HEADER_TOKEN_SEC_WEBSOCKET_PROTOCOL,
+    HEADER_TOKEN_SEC_WEBSOCKET_VERSION,
+    HEADER_TOKEN_SERVER,
+    HEADER_TOKEN_SET_COOKIE,
+    HEADER_TOKEN_STRICT_TRANSPORT_SECURITY,
+    HEADER_TOKEN_TE,
+    HEADER_TOKEN_TIMING_ALLOW_ORIGIN,
+    HEADER_TOKEN_TRAILER,
+    HEADER_TOKEN_TRANSFER_ENCODING,
+    HEADER_TOKEN_UPGRADE,
+    HEADER_TOKEN_UPGRADE_INSECURE_REQUESTS,
+    HEADER_TOKEN_USER_AGENT,
+    HEADER_TOKEN_VARY,
+    HEADER_TOKEN_VIA,
+    HEADER_TOKEN_WWW_AUTHENTICATE,
+    HEADER_TOKEN_X_CONTENT_TYPE_OPTIONS,
+    HEADER_TOKEN_X_FORWARDED_FOR,
+    HEADER_TOKEN_X_FRAME_OPTIONS,
+    HEADER_TOKEN_X_XSS_PROTECTION,
+
+    HEADER_TOKEN_COUNT,
+};
+
+/**
+ * Find the token of a header field name (case-insensitive)
+ * @param name Header field name
+ * @return The token if the name is well-known, `HEADER_TOKEN_UNKNOWN` otherwise
+ */
+HeaderToken header_token(std::string_view name);
+
+/**
+ * Get the canonical (lower-case) name of a token
+ * @param token Header token
+ * @return The name, or empty string if the token is `HEADER_TOKEN_UNKNOWN` or out of range
+ */
+std::string_view header_token_name(HeaderToken token);
+
+} // namespace ag::http
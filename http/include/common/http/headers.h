@@ -1,7 +1,11 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <iterator>
+#include <memory>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -10,6 +14,7 @@
 #include <fmt/ranges.h>
 
 #include "common/defs.h"
+#include "common/http/header_token.h"
 #include "common/http/util.h"
 
 namespace ag::http {
@@ -19,6 +24,7 @@ constexpr std::string_view PSEUDO_HEADER_NAME_SCHEME = ":scheme";
 constexpr std::string_view PSEUDO_HEADER_NAME_AUTHORITY = ":authority";
 constexpr std::string_view PSEUDO_HEADER_NAME_PATH = ":path";
 constexpr std::string_view PSEUDO_HEADER_NAME_STATUS = ":status";
+constexpr std::string_view PSEUDO_HEADER_NAME_PROTOCOL = ":protocol";
 
 template <typename T = std::string>
 struct Header {
@@ -40,13 +46,58 @@ Header<T> make_header(U &&name, V &&value) {
 }
 
 class Headers {
+public:
+    /**
+     * Reference to an externally owned reference-counted buffer (e.g. nghttp2 or nghttp3 rcbuf)
+     */
+    struct BufferRef {
+        void *buffer;
+        void (*release)(void *buffer);
+    };
+
 private:
-    std::vector<Header<>> m_headers;
+    /**
+     * Append-only storage of the header names and values.
+     * The stored strings never move, so the views into them stay valid until the storage is destroyed.
+     */
+    class Arena {
+    public:
+        Arena() = default;
+        ~Arena() = default;
+        Arena(const Arena &) = delete;
+        Arena &operator=(const Arena &) = delete;
+        Arena(Arena &&other) noexcept;
+        Arena &operator=(Arena &&other) noexcept;
+
+        /**
+         * Copy the string into the storage
+         * @return View of the copy
+         */
+        std::string_view store(std::string_view str);
+        /**
+         * Drop the stored strings keeping the largest block for reuse
+         */
+        void clear();
+
+    private:
+        std::vector<std::unique_ptr<char[]>> m_blocks;
+        size_t m_block_size = 0;
+        size_t m_block_used = 0;
+    };
+
+    std::vector<Header<std::string_view>> m_headers;
+    // Tokens of the names of `m_headers`, one per header
+    std::vector<HeaderToken> m_tokens;
+    // Position of the first header with the token in `m_headers` plus one, or zero if there is no such header
+    std::array<uint32_t, HEADER_TOKEN_COUNT> m_index{};
+    Arena m_arena;
     bool m_has_body = false;
+    // References keeping the borrowed names and values alive
+    std::vector<BufferRef> m_buffer_refs;
 
 public:
-    using Iterator = decltype(m_headers)::iterator;
-    using ConstIterator = decltype(m_headers)::const_iterator;
+    using Iterator = decltype(m_headers)::const_iterator;
+    using ConstIterator = Iterator;
 
     /**
      * Yields the sequence of the values
@@ -60,7 +111,7 @@ public:
         using difference_type = ssize_t;                     // NOLINT(*-identifier-naming)
         using iterator_category = std::forward_iterator_tag; // NOLINT(*-identifier-naming)
 
-        ValueIterator(I begin, I end, std::string_view name);
+        ValueIterator(const Headers *headers, I begin, std::string_view name, HeaderToken token);
         ~ValueIterator() = default;
 
         ValueIterator(const ValueIterator &) = default;
@@ -77,27 +128,31 @@ public:
     private:
         friend Headers;
 
+        const Headers *m_headers;
         I m_current;
-        I m_end;
         std::string_view m_name;
+        HeaderToken m_token;
         std::optional<std::string_view> m_value;
+
+        void skip_mismatching();
     };
 
     Headers() = default;
-    ~Headers() = default;
-    Headers(const Headers &headers) = default;
-    Headers &operator=(const Headers &headers) = default;
-    Headers(Headers &&headers) = default;
-    Headers &operator=(Headers &&headers) = default;
-
-    Headers(ConstIterator begin, ConstIterator end)
-            : m_headers(begin, end) {
-    }
+    ~Headers();
+    Headers(const Headers &headers);
+    Headers &operator=(const Headers &headers);
+    Headers(Headers &&headers) noexcept;
+    Headers &operator=(Headers &&headers) noexcept;
+
+    Headers(ConstIterator begin, ConstIterator end);
 
     template <typename I, typename F>
     Headers(I begin, I end, F convert) {
-        m_headers.reserve(std::distance(begin, end));
-        std::transform(begin, end, std::back_inserter(m_headers), convert);
+        reserve(std::distance(begin, end));
+        for (; begin != end; ++begin) {
+            auto header = convert(*begin);
+            put(header.name, header.value);
+        }
     }
 
     /**
@@ -115,21 +170,59 @@ public:
      */
     void has_body(bool flag);
     /**
-     * Get value of the first found header with specified name
+     * Get value of the first found header with specified name.
+     * Doesn't compare strings if the name is well-known (see `HeaderToken`).
      * @param name Name of HTTP header
      * @return Some string with the value of HTTP header, none if not found
      */
     [[nodiscard]] std::optional<std::string_view> get(std::string_view name) const;
+    /**
+     * Get value of the first found header with specified well-known name
+     * @param token Token of the header name
+     * @return Some string with the value of HTTP header, none if not found
+     */
+    [[nodiscard]] std::optional<std::string_view> get(HeaderToken token) const;
     /**
      * Safe version of `get` always returning some string (empty if not found)
      */
     [[nodiscard]] std::string_view gets(std::string_view name) const;
     /**
-     * Put HTTP header field with specified name and value
+     * Safe version of `get` always returning some string (empty if not found)
+     */
+    [[nodiscard]] std::string_view gets(HeaderToken token) const;
+    /**
+     * Put HTTP header field with specified name and value.
+     * The name and value are copied into the storage of the headers object.
      * @param name HTTP header field name
      * @param value HTTp header field value
      */
-    void put(std::string name, std::string value);
+    void put(std::string_view name, std::string_view value);
+    /**
+     * Put HTTP header field with specified well-known name and value
+     * @param token Token of the header name, the canonical (lower-case) name is used
+     * @param value HTTp header field value
+     */
+    void put(HeaderToken token, std::string_view value);
+    /**
+     * Put HTTP header field with the name token already known to the caller (e.g. a protocol parser)
+     * @param name HTTP header field name
+     * @param value HTTP header field value
+     * @param token Token of the name, must be the result of `header_token(name)`
+     */
+    void put(std::string_view name, std::string_view value, HeaderToken token);
+    /**
+     * Put HTTP header field without copying the name and value.
+     * The object holds the references until it's cleared or destroyed, so it must be destroyed
+     * in the thread of the buffers owner if their reference counters are not thread-safe.
+     * A copy of the object gets its own copies of the name and value.
+     * @param name HTTP header field name
+     * @param value HTTP header field value
+     * @param token Token of the name, must be the result of `header_token(name)`
+     * @param name_ref Reference keeping the name alive, acquired by the caller
+     * @param value_ref Reference keeping the value alive, acquired by the caller
+     */
+    void put_borrowed(std::string_view name, std::string_view value, HeaderToken token, BufferRef name_ref,
+            BufferRef value_ref);
     /**
      * Check if HTTP headers contains field with specified name
      * @param fieldName HTTP field name
@@ -137,26 +230,32 @@ public:
      */
     [[nodiscard]] bool contains(std::string_view fieldName) const;
     /**
-     * Remove field with specified name from HTTP headers
+     * Check if HTTP headers contains field with specified well-known name
+     * @param token Token of the header name
+     * @return True if such field exists
+     */
+    [[nodiscard]] bool contains(HeaderToken token) const;
+    /**
+     * Remove field with specified name from HTTP headers (case-insensitive)
      * @param name HTTP field name
      * @return number of removed fields
      */
     size_t remove(std::string_view name);
     /**
-     * Erase the specified element
-     * @return Iterator following the removed element
+     * Remove field with specified well-known name from HTTP headers
+     * @param token Token of the header name
+     * @return number of removed fields
      */
-    Iterator erase(Iterator iter);
+    size_t remove(HeaderToken token);
     /**
-     * Erase the specified element
-     * @return Iterator following the removed element
+     * Remove all the fields
      */
-    Iterator erase(ConstIterator iter);
+    void clear();
     /**
      * Erase the specified element
      * @return Iterator following the removed element
      */
-    ValueIterator<Iterator> erase(ValueIterator<Iterator> iter);
+    Iterator erase(ConstIterator iter);
     /**
      * Erase the specified element
      * @return Iterator following the removed element
@@ -183,20 +282,42 @@ public:
      */
     [[nodiscard]] ConstIterator end() const;
     /**
-     * Get all values of header with specified name
-     * @param name Name of the HTTP header
+     * Get the token of the name of the specified element
      */
-    [[nodiscard]] std::pair<ValueIterator<Iterator>, ValueIterator<Iterator>> value_range(std::string_view name);
+    [[nodiscard]] HeaderToken token(ConstIterator iter) const;
     /**
      * Get all values of header with specified name
      * @param name Name of the HTTP header
      */
     [[nodiscard]] std::pair<ValueIterator<ConstIterator>, ValueIterator<ConstIterator>> value_range(
             std::string_view name) const;
+    /**
+     * Get all values of header with specified well-known name
+     * @param token Token of the header name
+     */
+    [[nodiscard]] std::pair<ValueIterator<ConstIterator>, ValueIterator<ConstIterator>> value_range(
+            HeaderToken token) const;
     /**
      * Get string representation of the headers
      */
     [[nodiscard]] std::string str() const;
+    /**
+     * Get the exact size of the HTTP/1 representation of the headers (see `str()`)
+     */
+    [[nodiscard]] size_t size_hint() const;
+    /**
+     * Write the HTTP/1 representation of the headers (see `str()`) without intermediate allocations
+     * @param buffer Buffer of at least `size_hint()` bytes
+     * @return Number of written bytes, 0 if the buffer is too short (its contents are unspecified then)
+     */
+    size_t serialize_into(Uint8Span buffer) const;
+
+private:
+    void put_impl(std::string_view name, std::string_view value, HeaderToken token);
+    void release_buffer_refs();
+    void rebuild_index();
+    [[nodiscard]] ConstIterator find(std::string_view name, HeaderToken token) const;
+    [[nodiscard]] bool matches(ConstIterator iter, std::string_view name, HeaderToken token) const;
 };
 
 class Request {
@@ -262,6 +383,18 @@ public:
      * @param val Host of HTTP request
      */
     void authority(std::string val);
+    /**
+     * Get the protocol of an extended CONNECT request (`:protocol` pseudo-header of HTTP/2 or HTTP/3 request,
+     * RFC 8441 and RFC 9220)
+     * @return Protocol to run over the tunnel (e.g. "websocket"), empty for the other requests
+     */
+    [[nodiscard]] std::string_view protocol() const;
+    /**
+     * Set the protocol of an extended CONNECT request. Such a request has `:scheme` and `:path` unlike
+     * the classic CONNECT one.
+     * @param val Protocol to run over the tunnel (e.g. "websocket")
+     */
+    void protocol(std::string val);
     /**
      * Get the headers
      */
@@ -274,6 +407,16 @@ public:
      * Get string representation of the headers
      */
     [[nodiscard]] std::string str() const;
+    /**
+     * Get the exact size of the HTTP/1 representation of the request (see `str()`)
+     */
+    [[nodiscard]] size_t size_hint() const;
+    /**
+     * Write the HTTP/1 representation of the request (see `str()`) without intermediate allocations
+     * @param buffer Buffer of at least `size_hint()` bytes
+     * @return Number of written bytes, 0 if the buffer is too short (its contents are unspecified then)
+     */
+    size_t serialize_into(Uint8Span buffer) const;
     /**
      * Extract inner headers object from the request
      */
@@ -307,6 +450,7 @@ public:
             SCHEME,
             PATH,
             AUTHORITY,
+            PROTOCOL,
             HEADERS,
             DONE,
         };
@@ -336,6 +480,7 @@ private:
     std::string m_path;
     std::string m_scheme;
     std::string m_authority;
+    std::string m_protocol;
     Headers m_headers;
 };
 
@@ -393,6 +538,16 @@ public:
      * Get string representation of the headers
      */
     [[nodiscard]] std::string str() const;
+    /**
+     * Get the exact size of the HTTP/1 representation of the response (see `str()`)
+     */
+    [[nodiscard]] size_t size_hint() const;
+    /**
+     * Write the HTTP/1 representation of the response (see `str()`) without intermediate allocations
+     * @param buffer Buffer of at least `size_hint()` bytes
+     * @return Number of written bytes, 0 if the buffer is too short (its contents are unspecified then)
+     */
+    size_t serialize_into(Uint8Span buffer) const;
     /**
      * Extract inner headers object from the response
      */
@@ -505,7 +660,9 @@ struct fmt::formatter<ag::http::Request> {
         case ag::http::HTTP_3_0: {
             auto path = self.path();
             auto authority = self.authority();
-            bool is_connect = (method == "CONNECT");
+            auto protocol = self.protocol();
+            // An extended CONNECT request targets a path like the other ones
+            bool is_connect = (method == "CONNECT") && protocol.empty();
             if (is_connect) {
                 fmt::format_to(
                         ctx.out(), "{} {}\r\n", !authority.empty() ? authority : "<empty :authority>", self.version());
@@ -524,6 +681,9 @@ struct fmt::formatter<ag::http::Request> {
                     fmt::format_to(ctx.out(), ":authority: {}\r\n", authority);
                 }
             }
+            if (!protocol.empty()) {
+                fmt::format_to(ctx.out(), ":protocol: {}\r\n", protocol);
+            }
             break;
         }
         }
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <list>
+#include <memory>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
 #include <utility>
@@ -11,6 +14,7 @@
 #include <llhttp.h>
 
 #include "common/error.h"
+#include "common/http/body_decoder.h"
 #include "common/http/headers.h"
 
 namespace ag {
@@ -18,6 +22,27 @@ namespace http {
 
 enum Http1Error {};
 
+struct Http1Settings {
+    static constexpr size_t DEFAULT_MAX_PIPELINED_REQUESTS = 16;
+
+    /**
+     * The maximum number of the received requests which are not responded yet (HTTP/1.1 pipelining).
+     * Once it's reached, the server stops parsing the input and buffers it until some response is sent.
+     */
+    size_t max_pipelined_requests = DEFAULT_MAX_PIPELINED_REQUESTS;
+    /**
+     * Client side: decode the bodies of the responses encoded with a supported content coding
+     * (gzip, deflate or br). `Content-Encoding` and `Content-Length` are removed from such responses
+     * and `on_body` receives the decoded data.
+     */
+    bool decode_content_encoding = false;
+    /**
+     * Client side: the maximum size of a decoded response body, see `decode_content_encoding`.
+     * Decoding of a larger body fails like decoding of a corrupted one. 0 means no limit.
+     */
+    size_t max_decoded_body_size = BodyDecoder::DEFAULT_MAX_DECODED_SIZE;
+};
+
 /**
  * Contains common code of client- and server-side implementations.
  * For inner use only.
@@ -27,7 +52,10 @@ template <typename T>
 class Http1Session {
 public:
     struct InputOk {};
-    struct InputUpgrade {};
+    struct InputUpgrade {
+        // The received data following the upgraded message, it belongs to the new protocol
+        Uint8Vector data;
+    };
     using InputResult = std::variant<InputOk, InputUpgrade>;
 
     Http1Session();
@@ -54,6 +82,8 @@ protected:
             HAS_BODY,
             INTERMEDIATE_RESPONSE,
             ZERO_CHUNK_SENT,
+            // The response is complete, but it's waiting for the responses to the preceding pipelined requests
+            RESPONSE_COMPLETE,
         };
 
         explicit Stream(uint32_t id)
@@ -61,11 +91,21 @@ protected:
         }
         ~Stream() = default;
 
-        Stream(const Stream &) = default;
-        Stream &operator=(const Stream &) = default;
+        Stream(const Stream &) = delete;
+        Stream &operator=(const Stream &) = delete;
         Stream(Stream &&) = default;
         Stream &operator=(Stream &&) = default;
 
+        /**
+         * Prepare the stream object of a completed message for the next one
+         */
+        void reset(uint32_t new_id) {
+            id = new_id;
+            flags.reset();
+            content_length = ContentLengthUnset{};
+            pending_output.clear();
+        }
+
         // Stream id
         uint32_t id;
         // Flags for pending actions for the stream
@@ -73,41 +113,142 @@ protected:
         // Content-length of an HTTP message that currently being sent
         // or `ContentLengthChunked` (set automatically if there is "Transfer-encoding" in output headers)
         ContentLength content_length = ContentLengthUnset{};
+        // Response data sent before the responses to the preceding pipelined requests are complete
+        Uint8Vector pending_output;
+        // Set if the received body is being decoded
+        std::unique_ptr<BodyDecoder> body_decoder;
     };
 
     struct ParserContext {
         Version version = HTTP_1_1;
         std::string path;
         std::string status_string;
-        std::vector<std::pair<std::string, std::string>> headers;
+        Headers headers;
+        // The field being parsed. Refer to the input chunk until the field is split between chunks,
+        // then to the storages.
+        std::string_view field_name;
+        std::string_view field_value;
+        std::string field_name_storage;
+        std::string field_value_storage;
+
+        /**
+         * Prepare the context for the next message keeping the capacity of the storages
+         */
+        void reset() {
+            version = HTTP_1_1;
+            path.clear();
+            status_string.clear();
+            headers.clear();
+            field_name = {};
+            field_value = {};
+            field_name_storage.clear();
+            field_value_storage.clear();
+        }
     };
 
     // HTTP parser
     llhttp_t m_parser = {};
     // Connection id
     uint32_t m_id;
-    // Current message context
+    // Current message context, reused for the subsequent messages
     std::optional<ParserContext> m_parser_context;
     uint32_t m_next_stream_id = 1;
     // Active HTTP streams
     std::list<Stream> m_streams;
+    // Streams of the completed messages, their nodes are moved back to `m_streams` for the next messages
+    std::list<Stream> m_idle_streams;
     // The HTTP parser settings
     llhttp_settings_t m_settings;
+    // Reused for serializing the outgoing messages
+    Uint8Vector m_output_buffer;
+    // The input received while parsing is paused due to the pipelining limit
+    Uint8Vector m_pending_input;
+    // Result of parsing the pending input outside of `input()` to be reported by the next `input()` call
+    // if there's no `on_postponed_input_result` callback
+    std::optional<Result<InputResult, Http1Error>> m_deferred_input_result;
+    // Whether `llhttp_execute()` is running
+    bool m_parsing = false;
+    // Whether the parser has started a message, but hasn't completed it yet
+    bool m_message_in_progress = false;
+    // Whether the last complete message allows the connection to be reused
+    bool m_keep_alive = true;
+    size_t m_max_pipelined_requests = SIZE_MAX;
+    bool m_decode_content_encoding = false;
+    size_t m_max_decoded_body_size = BodyDecoder::DEFAULT_MAX_DECODED_SIZE;
+    BodyDecoderPool m_body_decoders;
 
     Result<InputResult, Http1Error> input_impl(Uint8View chunk);
     Error<Http1Error> send_response_impl(uint64_t stream_id, const Response &response);
     Error<Http1Error> send_trailer_impl(uint32_t stream_id, const Headers &headers, bool eof);
     Error<Http1Error> send_body_impl(uint64_t stream_id, Uint8View chunk, bool eof);
+    /**
+     * Serialize the message into the output buffer and pass it to the output callback
+     * @tparam M `Headers`, `Request` or `Response`
+     */
+    template <typename M>
+    void output_message(Stream &stream, const M &message);
+    /**
+     * Serialize the message into the output buffer
+     * @return View of the serialized message valid until the next serialization
+     */
+    template <typename M>
+    Uint8View serialize_message(const M &message);
+    /**
+     * Pass the data to the output callback, or buffer it until the responses to the preceding
+     * pipelined requests are complete
+     */
+    void output(Stream &stream, Uint8View chunk);
+    /**
+     * Same as above, but passes all the chunks to the vectored output callback at once if it's set
+     */
+    void output(Stream &stream, std::span<const Uint8View> chunks);
+    /**
+     * Find the stream the application may send data to: any stream with incomplete response
+     * on the server side and the oldest stream on the client side
+     * @return Null if not found
+     */
+    Stream *find_sending_stream(uint64_t stream_id);
+    /**
+     * Append a new stream to the active ones reusing an idle stream object if there is one
+     */
+    Stream &emplace_stream(uint32_t stream_id);
+    /**
+     * Remove the oldest active stream keeping its object for the next messages
+     */
+    void pop_stream();
+    /**
+     * Complete the response and finish the streams whose responses can be flushed now.
+     * The stream may be destroyed.
+     */
+    void finish_stream(Stream &stream);
+    /**
+     * Give the flushed postponed-output buffer back to its stream to keep the capacity
+     * for the next postponed output. The buffer is dropped if the stream is gone.
+     */
+    void return_output_buffer(uint32_t stream_id, Uint8Vector buffer);
 
 private:
+    Result<InputResult, Http1Error> parse(Uint8View chunk);
+    /**
+     * Handle a complete request without body bypassing the general parser
+     * @return Length of the request, or 0 if it must be handled by the general parser
+     */
+    size_t parse_simple_request(Uint8View chunk);
+    void resume_parsing();
     void reset_parser();
     Stream &active_stream();
+    /**
+     * Pass the chunk of the received body to the stream's decoder
+     * @return 0 if successful, -1 if the body is corrupted
+     */
+    int decode_body(Stream &stream, Uint8View chunk);
 
     static int on_message_begin(llhttp_t *parser);
     static int on_url(llhttp_t *parser, const char *at, size_t length);
     static int on_status(llhttp_t *parser, const char *at, size_t length);
     static int on_header_field(llhttp_t *parser, const char *at, size_t length);
     static int on_header_value(llhttp_t *parser, const char *at, size_t length);
+    static int on_header_value_complete(llhttp_t *parser);
     static int on_headers_complete(llhttp_t *parser);
     static int on_body(llhttp_t *parser, const char *at, size_t length);
     static int on_message_complete(llhttp_t *parser);
@@ -115,6 +256,10 @@ private:
 
 class Http1Server : public Http1Session<Http1Server> {
 public:
+    using InputOk = Http1Session<Http1Server>::InputOk;
+    using InputUpgrade = Http1Session<Http1Server>::InputUpgrade;
+    using InputResult = Http1Session<Http1Server>::InputResult;
+
     struct Callbacks {
         /** User context, will be raised in the callbacks */
         void *arg;
@@ -133,13 +278,22 @@ public:
         void (*on_stream_finished)(void *arg, uint64_t stream_id, int error_code);
         /** The session wants to send a raw data chunk to the peer */
         void (*on_output)(void *arg, Uint8View chunk);
+        /**
+         * The session wants to send several raw data chunks to the peer at once (e.g., a whole framed
+         * body chunk), so that they can be written with a single `writev()`-like call.
+         * Optional: if not set, `on_output` is raised for each chunk.
+         */
+        void (*on_output_vectored)(void *arg, const Uint8View *chunks, size_t count);
+        /**
+         * The input postponed due to the pipelining limit has been parsed once a response completed,
+         * and it has led to a connection upgrade or an error, which `input()` would have returned.
+         * Raised from `send_response()`, `send_body()` or `send_trailer()`, the session must not be destroyed
+         * in the callback. Optional: if not set, the result is returned by the next `input()` call.
+         */
+        void (*on_postponed_input_result)(void *arg, Result<InputResult, Http1Error> result);
     };
 
-    using InputOk = Http1Session<Http1Server>::InputOk;
-    using InputUpgrade = Http1Session<Http1Server>::InputUpgrade;
-    using InputResult = Http1Session<Http1Server>::InputResult;
-
-    explicit Http1Server(const Callbacks &handler);
+    explicit Http1Server(const Callbacks &handler, const Http1Settings &settings = {});
     ~Http1Server();
 
     Http1Server(const Http1Server &) = delete;
@@ -151,7 +305,8 @@ public:
     /**
      * Process a raw data chunk raising necessary callbacks.
      * @return `InputOk` if successfully parsed.
-     *         `InputUpgrade` if the connection protocol needs to be upgraded.
+     *         `InputUpgrade` if the connection protocol needs to be upgraded, it carries the data
+     *         following the upgraded message.
      *         Error otherwise.
      */
     Result<InputResult, Http1Error> input(Uint8View chunk);
@@ -197,13 +352,19 @@ public:
         void (*on_stream_finished)(void *arg, uint64_t stream_id, int error_code);
         /** The session wants to send a raw data chunk to the peer */
         void (*on_output)(void *arg, Uint8View chunk);
+        /**
+         * The session wants to send several raw data chunks to the peer at once (e.g., a whole framed
+         * body chunk), so that they can be written with a single `writev()`-like call.
+         * Optional: if not set, `on_output` is raised for each chunk.
+         */
+        void (*on_output_vectored)(void *arg, const Uint8View *chunks, size_t count);
     };
 
     using InputOk = Http1Session<Http1Client>::InputOk;
     using InputUpgrade = Http1Session<Http1Client>::InputUpgrade;
     using InputResult = Http1Session<Http1Client>::InputResult;
 
-    explicit Http1Client(const Callbacks &handler);
+    explicit Http1Client(const Callbacks &handler, const Http1Settings &settings = {});
     ~Http1Client();
 
     Http1Client(const Http1Client &) = delete;
@@ -215,7 +376,8 @@ public:
     /**
      * Process a raw data chunk raising necessary callbacks.
      * @return `InputOk` if successfully parsed.
-     *         `InputUpgrade` if the connection protocol needs to be upgraded.
+     *         `InputUpgrade` if the connection protocol needs to be upgraded, it carries the data
+     *         following the upgraded message.
      *         Error otherwise.
      */
     Result<InputResult, Http1Error> input(Uint8View chunk);
@@ -1,9 +1,10 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 #include <memory>
 #include <optional>
-#include <unordered_map>
+#include <vector>
 
 // Unbreak Windows build
 #include "common/defs.h"
@@ -12,7 +13,9 @@
 #include <nghttp2/nghttp2.h>
 
 #include "common/error.h"
+#include "common/http/body_decoder.h"
 #include "common/http/headers.h"
+#include "common/http/stream_table.h"
 
 namespace ag {
 namespace http {
@@ -20,6 +23,12 @@ namespace http {
 struct Http2Settings {
     // Chrome/Firefox constant
     static constexpr uint32_t DEFAULT_HEADER_TABLE_SIZE = 64 * 1024;
+    // The initial value of SETTINGS_HEADER_TABLE_SIZE defined by the protocol
+    static constexpr uint32_t MIN_HEADER_TABLE_SIZE = 4096;
+    // nghttp2 constant
+    static constexpr uint32_t DEFAULT_MAX_DEFLATE_TABLE_SIZE = 4096;
+    // The number of the received field blocks `adaptive_header_table_size` decision is based on
+    static constexpr size_t HEADER_TABLE_SAMPLE_BLOCKS = 32;
     // Chrome constant
     static constexpr uint32_t DEFAULT_MAX_CONCURRENT_STREAMS = 1000;
     // Chrome constant
@@ -27,6 +36,9 @@ struct Http2Settings {
     // Firefox constant
     static constexpr uint32_t DEFAULT_MAX_FRAME_SIZE = 1u << 14u;
     static constexpr uint32_t DEFAULT_INITIAL_SESSION_WINDOW_SIZE = 8 * 1024 * 1024;
+    // Chrome constant
+    static constexpr uint32_t DEFAULT_MAX_STREAM_WINDOW_SIZE = 16 * 1024 * 1024;
+    static constexpr uint32_t DEFAULT_MAX_SESSION_WINDOW_SIZE = 32 * 1024 * 1024;
 
     /**
      * Prevents sending WINDOW_UPDATE frames automatically.
@@ -40,6 +52,18 @@ struct Http2Settings {
      * in units of octets.
      */
     uint32_t header_table_size = DEFAULT_HEADER_TABLE_SIZE;
+    /**
+     * The maximum size of the compression table used to encode the sent field blocks.
+     * The table is also limited by the `header_table_size` the peer advertises.
+     */
+    uint32_t max_deflate_table_size = DEFAULT_MAX_DEFLATE_TABLE_SIZE;
+    /**
+     * Shrink the decoding table to `MIN_HEADER_TABLE_SIZE` if the peer turns out to barely benefit from it.
+     * The decision is made once `HEADER_TABLE_SAMPLE_BLOCKS` field blocks are received: if they are compressed
+     * by less than a third, which is about what Huffman coding alone achieves, the rest of `header_table_size`
+     * is considered a waste of memory.
+     */
+    bool adaptive_header_table_size = false;
     /**
      * https://datatracker.ietf.org/doc/html/rfc9113#section-6.5.2
      * The maximum number of concurrent streams that the sender will allow.
@@ -62,6 +86,103 @@ struct Http2Settings {
      * in units of octets.
      */
     uint32_t max_frame_size = DEFAULT_MAX_FRAME_SIZE;
+    /**
+     * Make the received headers refer to the decoder buffers instead of copying them.
+     * The reference counters of the buffers are not thread-safe, so in this mode the headers of the received
+     * messages must be destroyed in the session's thread.
+     */
+    bool borrow_header_buffers = false;
+    /**
+     * Client side: decode the bodies of the responses encoded with a supported content coding
+     * (gzip, deflate or br). `Content-Encoding` and `Content-Length` are removed from such responses,
+     * `on_body` receives the decoded data, and `consume_stream()` expects the length of the decoded data
+     * (the flow control windows are still updated by the length of the received data).
+     */
+    bool decode_content_encoding = false;
+    /**
+     * Client side: the maximum size of a decoded response body, see `decode_content_encoding`.
+     * Decoding of a larger body fails like decoding of a corrupted one. 0 means no limit.
+     */
+    size_t max_decoded_body_size = BodyDecoder::DEFAULT_MAX_DECODED_SIZE;
+    /**
+     * Coalesce the serialized frames into a buffer and pass them to `on_output` in batches
+     * of at least this size, or when `flush()` completes. Reduces the number of transport writes
+     * (and TLS records) for the messages consisting of many small frames. Zero disables coalescing.
+     * If `on_output_vectored` is set, a pending batch, which may be smaller than this size, is passed
+     * to it as the first chunk of the next DATA frame instead.
+     */
+    size_t output_batch_size = 0;
+    /**
+     * Use the extensible prioritization scheme (RFC 9218) instead of the deprecated RFC 7540 priorities.
+     * The server sends DATA frames of the streams with higher urgency first, interleaving only the incremental
+     * streams of the same urgency. The priorities are taken from the `priority` request header fields,
+     * PRIORITY_UPDATE frames, and the ones set by the application. Takes effect only if the peer
+     * also sends SETTINGS_NO_RFC7540_PRIORITIES = 1.
+     */
+    bool extensible_priorities = false;
+    /**
+     * Grow the receive windows according to the estimated bandwidth-delay product of the connection.
+     * While the data is being received, the session sends PING frames and counts the data received
+     * during their round trips. If a sample approaches the current window, the window is set
+     * to the doubled sample (using SETTINGS for the stream windows and WINDOW_UPDATE for the session one).
+     * `initial_*_window_size` are the starting points, `max_*_window_size` are the limits.
+     */
+    bool auto_tune_windows = false;
+    /** The limit of the auto-tuned stream-level window (see `auto_tune_windows`) */
+    uint32_t max_stream_window_size = DEFAULT_MAX_STREAM_WINDOW_SIZE;
+    /** The limit of the auto-tuned connection-level window (see `auto_tune_windows`) */
+    uint32_t max_session_window_size = DEFAULT_MAX_SESSION_WINDOW_SIZE;
+    /**
+     * The limit of the memory used by the session state inside nghttp2 (header compression tables,
+     * streams, queued frames) plus the submitted body data waiting to be sent. Zero means no limit.
+     * - `submit_body()` and `submit_body_ref()` fail if the data does not fit in the limit, unless there is
+     *   no other body data waiting, so the application should retry after `on_data_sent`;
+     * - if the input makes the session state alone exceed the limit, the session is terminated with
+     *   `NGHTTP2_ENHANCE_YOUR_CALM` and `input()` fails. `flush()` sends the GOAWAY frame.
+     * `header_table_size` and `max_deflate_table_size` larger than a quarter of the limit are reduced to it.
+     */
+    size_t max_session_memory = 0;
+    /**
+     * Server side: accept the extended CONNECT requests (RFC 8441), e.g. for WebSocket tunnels,
+     * by sending SETTINGS_ENABLE_CONNECT_PROTOCOL = 1. The protocol of such a request is available
+     * through `Request::protocol()`. The client may send them regardless of this setting,
+     * but only after the server has enabled them.
+     */
+    bool enable_connect_protocol = false;
+};
+
+/**
+ * Stream priority parameters (RFC 9218)
+ */
+struct Http2Priority {
+    static constexpr uint8_t DEFAULT_URGENCY = NGHTTP2_EXTPRI_DEFAULT_URGENCY;
+
+    /** From 0 (the highest) to 7 (the lowest) */
+    uint8_t urgency = DEFAULT_URGENCY;
+    /** Whether the response may be processed incrementally, i.e. interleaved with the others of the same urgency */
+    bool incremental = false;
+};
+
+/**
+ * Header compression (HPACK) statistics of a session
+ */
+struct Http2HpackStats {
+    /** The current size of the compression table used to encode the sent field blocks */
+    size_t deflate_table_size = 0;
+    /** The current size of the compression table used to decode the received field blocks */
+    size_t inflate_table_size = 0;
+    /** The number of the sent field blocks */
+    uint64_t sent_blocks = 0;
+    /** The total length of the names and values of the sent header fields */
+    uint64_t sent_decoded_bytes = 0;
+    /** The total length of the sent field blocks */
+    uint64_t sent_encoded_bytes = 0;
+    /** The number of the received field blocks */
+    uint64_t received_blocks = 0;
+    /** The total length of the names and values of the received header fields */
+    uint64_t received_decoded_bytes = 0;
+    /** The total length of the received field blocks */
+    uint64_t received_encoded_bytes = 0;
 };
 
 class Http2Server;
@@ -98,18 +219,59 @@ protected:
             HAS_EOF,
             SCHEDULED,
             HEAD_REQUEST,
+            // The data source has no data to send, nghttp2 waits for `nghttp2_session_resume_data()`
+            DEFERRED,
         };
 
         std::optional<Message> message;
         DataSource data_source;
         EnumSet<Flags> flags;
+        // Set if the received body is being decoded
+        std::unique_ptr<BodyDecoder> body_decoder;
+
+        /**
+         * Prepare the object of a closed stream for the next one keeping the data buffer
+         */
+        void reset() {
+            message.reset();
+            if (data_source.buffer != nullptr) {
+                evbuffer_drain(data_source.buffer.get(), evbuffer_get_length(data_source.buffer.get()));
+            }
+            flags.reset();
+            body_decoder.reset();
+        }
     };
 
+    // The memory allocated by nghttp2, declared before `m_session` to outlive it
+    size_t m_nghttp2_memory = 0;
     UniquePtr<nghttp2_session, &nghttp2_session_del> m_session;
     Http2Settings m_settings;
+    BodyDecoderPool m_body_decoders;
+    DecodedBodyFlowControl m_decoded_flow_control;
     uint32_t m_id;
-    std::unordered_map<uint32_t, Stream> m_streams;
+    // Client-initiated stream identifiers are odd
+    StreamTable<uint32_t, Stream, 1> m_streams;
     nghttp2_error_code m_error = NGHTTP2_NO_ERROR;
+    // Reused for passing DATA frames to the vectored output callback
+    std::vector<evbuffer_iovec> m_data_segments;
+    std::vector<Uint8View> m_output_chunks;
+    // The frames waiting to be passed to the output callback, see `Http2Settings::output_batch_size`
+    Uint8Vector m_output_batch;
+    // Reused for building the header blocks to submit
+    std::vector<nghttp2_nv> m_nv_list;
+    // Bandwidth-delay product estimation, see `Http2Settings::auto_tune_windows`
+    struct WindowTuning {
+        // Set while a PING is in flight
+        std::optional<std::chrono::steady_clock::time_point> ping_sent;
+        // Length of the data received since the PING was sent
+        size_t received = 0;
+        uint32_t stream_window = 0;
+        uint32_t session_window = 0;
+    } m_window_tuning;
+    // The counters of `Http2HpackStats`, the table sizes are queried on demand
+    Http2HpackStats m_hpack_stats;
+    // The total length of the data in the data sources of the streams
+    size_t m_buffered_body = 0;
 
     explicit Http2Session(const Http2Settings &settings);
 
@@ -119,10 +281,23 @@ protected:
     Error<Http2Error> submit_settings_impl();
     Error<Http2Error> submit_trailer_impl(uint32_t stream_id, const Headers &headers);
     Error<Http2Error> submit_body_impl(uint32_t stream_id, Uint8View chunk, bool eof);
+    Error<Http2Error> submit_body_ref_impl(uint32_t stream_id, const BodyBuffer &buffer, bool eof);
     Error<Http2Error> reset_stream_impl(uint32_t stream_id, nghttp2_error_code error_code);
     Error<Http2Error> consume_connection_impl(size_t length);
     Error<Http2Error> consume_stream_impl(uint32_t stream_id, size_t length);
     Error<Http2Error> flush_impl();
+    Error<Http2Error> update_priority_impl(uint32_t stream_id, const Http2Priority &priority);
+    [[nodiscard]] Http2HpackStats hpack_stats_impl() const;
+    [[nodiscard]] size_t memory_usage_impl() const;
+    /**
+     * Append a pseudo-header field to `m_nv_list` unless the value is empty.
+     * @param name One of the `PSEUDO_HEADER_NAME_*` constants
+     */
+    void push_pseudo_header(std::string_view name, std::string_view value);
+    /**
+     * Append the header fields to `m_nv_list`
+     */
+    void push_headers(const Headers &headers);
 
 private:
     static int on_begin_frame(nghttp2_session *session, const nghttp2_frame_hd *hd, void *arg);
@@ -133,18 +308,48 @@ private:
     static int on_data_chunk_recv(
             nghttp2_session *session, uint8_t flags, int32_t stream_id, const uint8_t *data, size_t len, void *arg);
     static int on_begin_headers(nghttp2_session *session, const nghttp2_frame *frame, void *arg);
-    static int on_header(nghttp2_session *session, const nghttp2_frame *frame, const uint8_t *name, size_t namelen,
-            const uint8_t *value, size_t valuelen, uint8_t flags, void *arg);
+    static int on_header(nghttp2_session *session, const nghttp2_frame *frame, nghttp2_rcbuf *name_buf,
+            nghttp2_rcbuf *value_buf, uint8_t flags, void *arg);
     static int on_stream_close(nghttp2_session *session, int32_t stream_id, uint32_t error_code, void *arg);
     static ssize_t on_send(nghttp2_session *session, const uint8_t *data, size_t length, int flags, void *arg);
     static int on_error(nghttp2_session *session, const char *msg, size_t len, void *arg);
     static ssize_t on_data_source_read(nghttp2_session *session, int32_t stream_id, uint8_t *buf, size_t length,
             uint32_t *data_flags, nghttp2_data_source *source, void *arg);
+    static int on_send_data(nghttp2_session *session, nghttp2_frame *frame, const uint8_t *framehd, size_t length,
+            nghttp2_data_source *source, void *arg);
 
     void on_end_headers(const nghttp2_frame *frame, uint32_t stream_id, Stream &stream);
+    /**
+     * Pass the coalesced frames to the output callback
+     */
+    void flush_output_batch();
     void on_end_stream(uint32_t stream_id);
     void close_stream(uint32_t stream_id, nghttp2_error_code error_code);
-    static int push_data(Stream &stream, Uint8View chunk, bool eof);
+    void decode_body(uint32_t stream_id, Stream &stream, Uint8View chunk);
+    /**
+     * Account the received data for the window auto-tuning, starting a new sample if needed
+     */
+    void tune_windows_on_data(size_t length);
+    /**
+     * Finish the sample on the PING acknowledgement and grow the windows if needed
+     */
+    void tune_windows_on_ping_ack();
+    /**
+     * Account a received field block and shrink the decoding table if it's not worth its size
+     * (see `Http2Settings::adaptive_header_table_size`)
+     */
+    void on_header_block_recv(const nghttp2_frame *frame);
+    void finish_body_decoding(uint32_t stream_id, Stream &stream);
+    /**
+     * Check if the body data of the specified length may be buffered (see `Http2Settings::max_session_memory`)
+     */
+    [[nodiscard]] bool fits_memory_limit(size_t length) const;
+    /**
+     * Get the data source buffer of the stream creating it if needed
+     */
+    evbuffer *body_buffer(Stream &stream);
+    int push_data(Stream &stream, Uint8View chunk, bool eof);
+    int push_data(Stream &stream, const BodyBuffer &buffer, bool eof);
     int schedule_send(uint32_t stream_id, Stream &stream);
 };
 
@@ -215,6 +420,15 @@ public:
         void (*on_output)(void *arg, Uint8View chunk);
         /** A data chunk was transferred from the session inner buffer to the transport level */
         void (*on_data_sent)(void *arg, uint32_t stream_id, size_t n);
+        /**
+         * Optional. The session wants to send a DATA frame to the peer. The chunks are to be written
+         * in order as one contiguous byte sequence, their boundaries carry no meaning. They consist of
+         * the frames coalesced by `output_batch_size` and not flushed yet, if any, the DATA frame header,
+         * the padding length and padding if the frame is padded, and the body data referring
+         * to the session's buffers without copying. The chunks are valid only during the call.
+         * If not set, DATA frames are passed to `on_output` like the other frames.
+         */
+        void (*on_output_vectored)(void *arg, const Uint8View *chunks, size_t count);
     };
 
     Http2Server(PrivateAccess, const Http2Settings &settings, const Callbacks &callbacks);
@@ -240,9 +454,12 @@ public:
     Result<size_t, Http2Error> input(Uint8View chunk);
     /**
      * Submit a response to be sent to the peer.
+     * @param priority If set, overrides the priority requested by the client
+     *                 (see `Http2Settings::extensible_priorities`)
      * @return Some error if failed, null otherwise.
      */
-    Error<Http2Error> submit_response(uint32_t stream_id, const Response &response, bool eof);
+    Error<Http2Error> submit_response(uint32_t stream_id, const Response &response, bool eof,
+            std::optional<Http2Priority> priority = std::nullopt);
     /**
      * Submit trailer headers to be sent to the peer.
      * @return Some error if failed, null otherwise.
@@ -253,11 +470,25 @@ public:
      * @return Some error if failed, null otherwise.
      */
     Error<Http2Error> submit_body(uint32_t stream_id, Uint8View chunk, bool eof);
+    /**
+     * Submit a body chunk owned by the caller to be sent to the peer without copying it.
+     * `BodyBuffer::release` is raised once the session doesn't need the data any more,
+     * including the case of failure.
+     * @return Some error if failed, null otherwise.
+     */
+    Error<Http2Error> submit_body_ref(uint32_t stream_id, const BodyBuffer &buffer, bool eof);
     /**
      * Reset a stream.
      * @return Some error if failed, null otherwise
      */
     Error<Http2Error> reset_stream(uint32_t stream_id, nghttp2_error_code error_code);
+    /**
+     * Change the priority of a stream (see `Http2Settings::extensible_priorities`).
+     * The client sends a PRIORITY_UPDATE frame, the server reschedules the stream ignoring
+     * the further priority signals of the client.
+     * @return Some error if failed, null otherwise
+     */
+    Error<Http2Error> update_priority(uint32_t stream_id, const Http2Priority &priority);
     /**
      * Set the error code to send with GOAWAY frame when the session will be closed.
      */
@@ -272,6 +503,14 @@ public:
      * @return Some error if failed, null otherwise.
      */
     Error<Http2Error> consume_stream(uint32_t stream_id, size_t length);
+    /**
+     * Get the header compression statistics of the session.
+     */
+    [[nodiscard]] Http2HpackStats hpack_stats() const;
+    /**
+     * Get the memory used by the session, see `Http2Settings::max_session_memory`.
+     */
+    [[nodiscard]] size_t memory_usage() const;
     /**
      * Flush data waiting to be sent into the wire.
      * Must be called after doing any action or a bunch of actions over an instance.
@@ -353,6 +592,15 @@ public:
         void (*on_output)(void *arg, Uint8View chunk);
         /** A data chunk was transferred from the session inner buffer to the transport level */
         void (*on_data_sent)(void *arg, uint32_t stream_id, size_t n);
+        /**
+         * Optional. The session wants to send a DATA frame to the peer. The chunks are to be written
+         * in order as one contiguous byte sequence, their boundaries carry no meaning. They consist of
+         * the frames coalesced by `output_batch_size` and not flushed yet, if any, the DATA frame header,
+         * the padding length and padding if the frame is padded, and the body data referring
+         * to the session's buffers without copying. The chunks are valid only during the call.
+         * If not set, DATA frames are passed to `on_output` like the other frames.
+         */
+        void (*on_output_vectored)(void *arg, const Uint8View *chunks, size_t count);
     };
 
     Http2Client(PrivateAccess, const Http2Settings &settings, const Callbacks &callbacks);
@@ -378,9 +626,13 @@ public:
     Result<size_t, Http2Error> input(Uint8View chunk);
     /**
      * Submit a request to be sent to the peer.
+     * An extended CONNECT request (the one with `Request::protocol()`) fails unless the server has sent
+     * SETTINGS_ENABLE_CONNECT_PROTOCOL = 1 (see `Http2Settings::enable_connect_protocol`).
+     * @param priority If set, the priority is signalled to the server in the `priority` header field
      * @return Assigned stream ID if successful, an error otherwise.
      */
-    Result<uint32_t, Http2Error> submit_request(const Request &request, bool eof);
+    Result<uint32_t, Http2Error> submit_request(
+            const Request &request, bool eof, std::optional<Http2Priority> priority = std::nullopt);
     /**
      * Submit trailer headers to be sent to the peer.
      * @return Some error if failed, null otherwise.
@@ -391,11 +643,25 @@ public:
      * @return Some error if failed, null otherwise.
      */
     Error<Http2Error> submit_body(uint32_t stream_id, Uint8View chunk, bool eof);
+    /**
+     * Submit a body chunk owned by the caller to be sent to the peer without copying it.
+     * `BodyBuffer::release` is raised once the session doesn't need the data any more,
+     * including the case of failure.
+     * @return Some error if failed, null otherwise.
+     */
+    Error<Http2Error> submit_body_ref(uint32_t stream_id, const BodyBuffer &buffer, bool eof);
     /**
      * Reset a stream.
      * @return Some error if failed, null otherwise
      */
     Error<Http2Error> reset_stream(uint32_t stream_id, nghttp2_error_code error_code);
+    /**
+     * Change the priority of a stream (see `Http2Settings::extensible_priorities`).
+     * The client sends a PRIORITY_UPDATE frame, the server reschedules the stream ignoring
+     * the further priority signals of the client.
+     * @return Some error if failed, null otherwise
+     */
+    Error<Http2Error> update_priority(uint32_t stream_id, const Http2Priority &priority);
     /**
      * Set the error code to send with GOAWAY frame when the session will be closed.
      */
@@ -410,6 +676,14 @@ public:
      * @return Some error if failed, null otherwise.
      */
     Error<Http2Error> consume_stream(uint32_t stream_id, size_t length);
+    /**
+     * Get the header compression statistics of the session.
+     */
+    [[nodiscard]] Http2HpackStats hpack_stats() const;
+    /**
+     * Get the memory used by the session, see `Http2Settings::max_session_memory`.
+     */
+    [[nodiscard]] size_t memory_usage() const;
     /**
      * Flush data waiting to be sent into the wire.
      * Must be called after doing any action or a bunch of actions over an instance.
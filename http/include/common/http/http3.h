@@ -6,7 +6,6 @@
 #include <optional>
 #include <string>
 #include <type_traits>
-#include <unordered_map>
 #include <variant>
 #include <vector>
 
@@ -18,7 +17,9 @@
 
 #include "common/defs.h"
 #include "common/error.h"
+#include "common/http/body_decoder.h"
 #include "common/http/headers.h"
+#include "common/http/stream_table.h"
 
 namespace ag {
 
@@ -116,6 +117,30 @@ struct Http3Settings {
      * default version (`NGTCP2_PROTO_VER_V1`).
      */
     uint32_t quic_version = 0;
+    /**
+     * Make the received headers refer to the decoder buffers instead of copying them.
+     * The reference counters of the buffers are not thread-safe, so in this mode the headers of the received
+     * messages must be destroyed in the session's thread.
+     */
+    bool borrow_header_buffers = false;
+    /**
+     * Client side: decode the bodies of the responses encoded with a supported content coding
+     * (gzip, deflate or br). `Content-Encoding` and `Content-Length` are removed from such responses,
+     * `on_body` receives the decoded data, and `consume_stream()` expects the length of the decoded data
+     * (the flow control windows are still updated by the length of the received data).
+     */
+    bool decode_content_encoding = false;
+    /**
+     * Client side: the maximum size of a decoded response body, see `decode_content_encoding`.
+     * Decoding of a larger body fails like decoding of a corrupted one. 0 means no limit.
+     */
+    size_t max_decoded_body_size = BodyDecoder::DEFAULT_MAX_DECODED_SIZE;
+    /**
+     * Server side: accept the extended CONNECT requests (RFC 9220), e.g. for WebSocket tunnels,
+     * by sending SETTINGS_ENABLE_CONNECT_PROTOCOL = 1. The protocol of such a request is available
+     * through `Request::protocol()`. The client may send them only after the server has enabled them.
+     */
+    bool enable_connect_protocol = false;
 };
 
 struct QuicNetworkPath {
@@ -156,6 +181,7 @@ protected:
     int input_impl(const QuicNetworkPath &path, Uint8View chunk);
     Error<Http3Error> submit_trailer_impl(uint64_t stream_id, const Headers &headers);
     Error<Http3Error> submit_body_impl(uint64_t stream_id, Uint8View chunk, bool eof);
+    Error<Http3Error> submit_body_ref_impl(uint64_t stream_id, const BodyBuffer &buffer, bool eof);
     Error<Http3Error> reset_stream_impl(uint64_t stream_id, int error_code);
     Error<Http3Error> consume_connection_impl(size_t length);
     Error<Http3Error> consume_stream_impl(uint64_t stream_id, size_t length);
@@ -174,11 +200,28 @@ protected:
             HAS_EOF,
             TRAILERS_SUBMITTED,
             HEAD_REQUEST,
+            // The body is read from `data_source`
+            HAS_DATA_READER,
         };
 
         std::optional<Message> message;
         EnumSet<Flags> flags;
         DataSource data_source;
+        // Set if the received body is being decoded
+        std::unique_ptr<BodyDecoder> body_decoder;
+
+        /**
+         * Prepare the object of a closed stream for the next one keeping the data buffer
+         */
+        void reset() {
+            message.reset();
+            flags.reset();
+            if (data_source.buffer != nullptr) {
+                evbuffer_drain(data_source.buffer.get(), evbuffer_get_length(data_source.buffer.get()));
+            }
+            data_source.read_offset = 0;
+            body_decoder.reset();
+        }
     };
 
     uint32_t m_id;
@@ -186,8 +229,11 @@ protected:
     UniquePtr<nghttp3_conn, &nghttp3_conn_del> m_http_conn;
     ngtcp2_crypto_conn_ref m_ref;
     ag::UniquePtr<SSL, &SSL_free> m_ssl;
-    std::unordered_map<uint64_t, Stream> m_streams;
+    // Client-initiated bidirectional stream identifiers are multiples of 4
+    StreamTable<uint64_t, Stream, 2> m_streams;
     Http3Settings m_settings;
+    BodyDecoderPool m_body_decoders;
+    DecodedBodyFlowControl m_decoded_flow_control;
     ngtcp2_ccerr m_last_error{};
     bool m_handshake_completed = false;
     bool m_handled_rx_connection_close = false;
@@ -219,10 +265,14 @@ protected:
     static int on_h3_stream_close(
             nghttp3_conn *conn, int64_t stream_id, uint64_t error_code, void *arg, void *stream_data);
     void close_stream(uint32_t stream_id, int error_code);
+    void decode_body(uint64_t stream_id, Stream &stream, Uint8View chunk);
+    void finish_body_decoding(uint64_t stream_id, Stream &stream);
     static int on_handshake_completed(ngtcp2_conn *conn, void *arg);
     static void log_quic(void *arg, const char *format, ...);
     int recv_h3_stream_data(int64_t stream_id, Uint8View chunk, bool eof);
     Error<Http3Error> push_data(Stream &stream, Uint8View chunk, bool eof);
+    Error<Http3Error> push_data(Stream &stream, const BodyBuffer &buffer, bool eof);
+    Error<Http3Error> resume_stream(uint64_t stream_id);
     static nghttp3_ssize on_read_data(nghttp3_conn *conn, int64_t stream_id, nghttp3_vec *vec, size_t veccnt,
             uint32_t *pflags, void *arg, void *stream_data);
     static int on_acked_stream_data(
@@ -372,6 +422,13 @@ public:
      * @return Some error if failed, null otherwise.
      */
     Error<Http3Error> submit_body(uint64_t stream_id, Uint8View chunk, bool eof);
+    /**
+     * Submit a body chunk owned by the caller to be sent to the peer without copying it.
+     * `BodyBuffer::release` is raised once the data is acknowledged by the peer or the stream is closed,
+     * or right away in case of failure.
+     * @return Some error if failed, null otherwise.
+     */
+    Error<Http3Error> submit_body_ref(uint64_t stream_id, const BodyBuffer &buffer, bool eof);
     /**
      * Reset a stream.
      * @return Some error if failed, null otherwise
@@ -557,6 +614,13 @@ public:
      * @return Some error if failed, null otherwise.
      */
     Error<Http3Error> submit_body(uint64_t stream_id, Uint8View chunk, bool eof);
+    /**
+     * Submit a body chunk owned by the caller to be sent to the peer without copying it.
+     * `BodyBuffer::release` is raised once the data is acknowledged by the peer or the stream is closed,
+     * or right away in case of failure.
+     * @return Some error if failed, null otherwise.
+     */
+    Error<Http3Error> submit_body_ref(uint64_t stream_id, const BodyBuffer &buffer, bool eof);
     /**
      * Reset a stream.
      * @return Some error if failed, null otherwise
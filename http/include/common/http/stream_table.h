@@ -0,0 +1,170 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ag {
+namespace http {
+
+/**
+ * Table of the active streams of a multiplexed session.
+ * The identifiers of the streams of a connection grow monotonically and the active ones are usually
+ * close to each other, so the streams are placed in a ring of slots indexed by the identifier.
+ * The stream whose slot is taken by a long-living one goes to an overflow map.
+ * The objects of the closed streams are kept for reuse, so that their buffers are not reallocated.
+ *
+ * @tparam Id Stream identifier type
+ * @tparam Stream Stream type, must have `reset()` method, which prepares an object for reuse
+ * @tparam ID_SHIFT The identifiers of the consecutive streams differ by `1 << ID_SHIFT`
+ */
+template <typename Id, typename Stream, unsigned ID_SHIFT>
+class StreamTable {
+public:
+    /** The number of slots in the ring */
+    static constexpr size_t DEFAULT_CAPACITY = 256;
+    /** The maximum number of the closed stream objects kept for reuse */
+    static constexpr size_t MAX_IDLE_STREAMS = 16;
+
+    /**
+     * @param capacity The number of slots in the ring, rounded up to a power of two
+     */
+    explicit StreamTable(size_t capacity = DEFAULT_CAPACITY)
+            : m_slots(std::bit_ceil(std::max(capacity, size_t(1)))) {
+    }
+
+    /**
+     * @return The stream with the specified identifier, null if there is no such stream
+     */
+    [[nodiscard]] Stream *find(Id id) const {
+        if (const Slot &slot = m_slots[index(id)]; slot.stream != nullptr && slot.id == id) {
+            return slot.stream.get();
+        }
+        if (m_overflow.empty()) {
+            return nullptr;
+        }
+        auto it = m_overflow.find(id);
+        return (it != m_overflow.end()) ? it->second.get() : nullptr;
+    }
+
+    /**
+     * @return The stream with the specified identifier, a new one if there was no such stream
+     */
+    Stream &emplace(Id id) {
+        if (Stream *stream = find(id); stream != nullptr) {
+            return *stream;
+        }
+
+        std::unique_ptr<Stream> stream = acquire();
+        Stream &ref = *stream;
+        if (Slot &slot = m_slots[index(id)]; slot.stream == nullptr) {
+            slot.id = id;
+            slot.stream = std::move(stream);
+        } else {
+            m_overflow.emplace(id, std::move(stream));
+        }
+        ++m_size;
+        return ref;
+    }
+
+    /**
+     * Remove the stream from the table.
+     * The returned object should be passed to `recycle()` once it's not needed anymore.
+     * @return Null if there is no such stream
+     */
+    std::unique_ptr<Stream> extract(Id id) {
+        std::unique_ptr<Stream> stream;
+        if (Slot &slot = m_slots[index(id)]; slot.stream != nullptr && slot.id == id) {
+            stream = std::move(slot.stream);
+        } else if (auto node = m_overflow.extract(id); !node.empty()) {
+            stream = std::move(node.mapped());
+        }
+        if (stream != nullptr) {
+            --m_size;
+        }
+        return stream;
+    }
+
+    /**
+     * Return a stream object for reuse. It's destroyed if there are enough idle objects already.
+     */
+    void recycle(std::unique_ptr<Stream> stream) {
+        if (stream == nullptr || m_idle.size() >= MAX_IDLE_STREAMS) {
+            return;
+        }
+        stream->reset();
+        m_idle.emplace_back(std::move(stream));
+    }
+
+    void erase(Id id) {
+        recycle(extract(id));
+    }
+
+    /**
+     * @return The identifiers of all the streams in the table
+     */
+    [[nodiscard]] std::vector<Id> ids() const {
+        std::vector<Id> ids;
+        ids.reserve(m_size);
+        for (const Slot &slot : m_slots) {
+            if (slot.stream != nullptr) {
+                ids.push_back(slot.id);
+            }
+        }
+        for (const auto &[id, _] : m_overflow) {
+            ids.push_back(id);
+        }
+        return ids;
+    }
+
+    /**
+     * Destroy all the streams
+     */
+    void clear() {
+        for (Slot &slot : m_slots) {
+            slot.stream.reset();
+        }
+        m_overflow.clear();
+        m_idle.clear();
+        m_size = 0;
+    }
+
+    [[nodiscard]] size_t size() const {
+        return m_size;
+    }
+
+    [[nodiscard]] bool empty() const {
+        return m_size == 0;
+    }
+
+private:
+    struct Slot {
+        Id id{};
+        std::unique_ptr<Stream> stream;
+    };
+
+    std::vector<Slot> m_slots;
+    std::unordered_map<Id, std::unique_ptr<Stream>> m_overflow;
+    std::vector<std::unique_ptr<Stream>> m_idle;
+    size_t m_size = 0;
+
+    [[nodiscard]] size_t index(Id id) const {
+        return size_t(id >> ID_SHIFT) & (m_slots.size() - 1);
+    }
+
+    std::unique_ptr<Stream> acquire() {
+        if (m_idle.empty()) {
+            return std::make_unique<Stream>();
+        }
+        std::unique_ptr<Stream> stream = std::move(m_idle.back());
+        m_idle.pop_back();
+        return stream;
+    }
+};
+
+} // namespace http
+} // namespace ag
@@ -1,9 +1,12 @@
 #pragma once
 
+#include <cstddef>
 #include <optional>
 
 #include <fmt/format.h>
 
+#include "common/defs.h"
+
 namespace ag::http {
 
 /**
@@ -33,6 +36,22 @@ uint32_t version_get_minor(Version v);
 
 std::optional<Version> make_version(uint8_t major, uint8_t minor);
 
+/**
+ * A body chunk owned by the caller, which the sessions refer to instead of copying it
+ */
+struct BodyBuffer {
+    /** The data, must stay valid and unchanged until `release` is called */
+    Uint8View data;
+    /** User context passed to `release` */
+    void *arg;
+    /**
+     * Called once the session doesn't need the data any more (it's sent or acknowledged, the stream is
+     * closed, or the submission failed). The signature matches `evbuffer_ref_cleanup_cb`.
+     * May be null if the data outlives the session.
+     */
+    void (*release)(const void *data, size_t length, void *arg);
+};
+
 } // namespace ag::http
 
 template <>
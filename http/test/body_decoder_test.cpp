@@ -0,0 +1,237 @@
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <brotli/encode.h>
+#include <gtest/gtest.h>
+#include <zlib.h>
+
+#include "common/http/body_decoder.h"
+#include "common/utils.h"
+
+static constexpr int GZIP_WINDOW_BITS = MAX_WBITS + 16;
+static constexpr int ZLIB_WINDOW_BITS = MAX_WBITS;
+static constexpr int RAW_WINDOW_BITS = -MAX_WBITS;
+
+static std::string deflate_data(std::string_view data, int window_bits) {
+    z_stream stream{};
+    deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY);
+    std::string result(deflateBound(&stream, data.size()), '\0');
+    stream.next_in = (Bytef *) data.data();
+    stream.avail_in = data.size();
+    stream.next_out = (Bytef *) result.data();
+    stream.avail_out = result.size();
+    deflate(&stream, Z_FINISH);
+    result.resize(stream.total_out);
+    deflateEnd(&stream);
+    return result;
+}
+
+static std::string brotli_data(std::string_view data) {
+    size_t size = BrotliEncoderMaxCompressedSize(data.size());
+    std::string result(size, '\0');
+    BrotliEncoderCompress(BROTLI_DEFAULT_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, data.size(),
+            (const uint8_t *) data.data(), &size, (uint8_t *) result.data());
+    result.resize(size);
+    return result;
+}
+
+class BodyDecoder : public ::testing::Test {
+protected:
+    std::string m_decoded;
+    ag::http::BodyDecoder::Handler m_handler{
+            .arg = this,
+            .on_data =
+                    [](void *arg, ag::Uint8View chunk) {
+                        auto *self = (BodyDecoder *) arg;
+                        self->m_decoded.append((const char *) chunk.data(), chunk.size());
+                    },
+    };
+
+    static std::string make_body() {
+        std::string body;
+        // Larger than the output buffer, so that a chunk is decoded into several parts
+        for (int i = 0; body.size() < 4 * ag::http::BodyDecoder::OUTPUT_BUFFER_SIZE; ++i) {
+            body.append(AG_FMT("line {}: the quick brown fox jumps over the lazy dog\n", i));
+        }
+        return body;
+    }
+
+    void decode(ag::http::BodyDecoder &decoder, std::string_view encoded, size_t chunk_size) {
+        for (size_t i = 0; i < encoded.size(); i += chunk_size) {
+            std::string_view chunk = encoded.substr(i, chunk_size);
+            ag::Error<ag::http::BodyDecoderError> error = decoder.decode(ag::as_u8v(chunk), m_handler);
+            ASSERT_EQ(error, nullptr) << error->str();
+        }
+        ag::Error<ag::http::BodyDecoderError> error = decoder.finish();
+        ASSERT_EQ(error, nullptr) << error->str();
+    }
+};
+
+TEST_F(BodyDecoder, ParseContentEncoding) {
+    ASSERT_EQ(ag::http::parse_content_encoding("gzip"), ag::http::CONTENT_ENCODING_GZIP);
+    ASSERT_EQ(ag::http::parse_content_encoding(" X-Gzip "), ag::http::CONTENT_ENCODING_GZIP);
+    ASSERT_EQ(ag::http::parse_content_encoding("Deflate"), ag::http::CONTENT_ENCODING_DEFLATE);
+    ASSERT_EQ(ag::http::parse_content_encoding("br"), ag::http::CONTENT_ENCODING_BROTLI);
+    ASSERT_EQ(ag::http::parse_content_encoding("identity"), std::nullopt);
+    ASSERT_EQ(ag::http::parse_content_encoding("gzip, br"), std::nullopt);
+}
+
+TEST_F(BodyDecoder, Gzip) {
+    std::string body = make_body();
+    std::string encoded = deflate_data(body, GZIP_WINDOW_BITS);
+    for (size_t chunk_size : {size_t(1), size_t(1000), encoded.size()}) {
+        m_decoded.clear();
+        ag::http::BodyDecoder decoder(ag::http::CONTENT_ENCODING_GZIP);
+        ASSERT_NO_FATAL_FAILURE(decode(decoder, encoded, chunk_size));
+        ASSERT_EQ(m_decoded, body);
+    }
+}
+
+TEST_F(BodyDecoder, GzipConcatenatedMembers) {
+    std::string encoded = deflate_data("hello, ", GZIP_WINDOW_BITS) + deflate_data("world", GZIP_WINDOW_BITS);
+    ag::http::BodyDecoder decoder(ag::http::CONTENT_ENCODING_GZIP);
+    ASSERT_NO_FATAL_FAILURE(decode(decoder, encoded, encoded.size()));
+    ASSERT_EQ(m_decoded, "hello, world");
+}
+
+TEST_F(BodyDecoder, Deflate) {
+    std::string body = make_body();
+    for (int window_bits : {ZLIB_WINDOW_BITS, RAW_WINDOW_BITS}) {
+        m_decoded.clear();
+        std::string encoded = deflate_data(body, window_bits);
+        ag::http::BodyDecoder decoder(ag::http::CONTENT_ENCODING_DEFLATE);
+        ASSERT_NO_FATAL_FAILURE(decode(decoder, encoded, 1000));
+        ASSERT_EQ(m_decoded, body);
+    }
+}
+
+TEST_F(BodyDecoder, DeflateHeaderSplitBetweenChunks) {
+    std::string body = make_body();
+    for (int window_bits : {ZLIB_WINDOW_BITS, RAW_WINDOW_BITS}) {
+        m_decoded.clear();
+        std::string encoded = deflate_data(body, window_bits);
+        ag::http::BodyDecoder decoder(ag::http::CONTENT_ENCODING_DEFLATE);
+        ASSERT_NO_FATAL_FAILURE(decode(decoder, encoded, 1));
+        ASSERT_EQ(m_decoded, body);
+    }
+}
+
+TEST_F(BodyDecoder, DecodedSizeLimit) {
+    // Compresses about 1000:1
+    std::string bomb(4 * 1024 * 1024, '\0');
+    constexpr size_t LIMIT = 1024 * 1024;
+    std::pair<ag::http::ContentEncoding, std::string> bodies[] = {
+            {ag::http::CONTENT_ENCODING_GZIP, deflate_data(bomb, GZIP_WINDOW_BITS)},
+            {ag::http::CONTENT_ENCODING_BROTLI, brotli_data(bomb)},
+    };
+    for (const auto &[encoding, encoded] : bodies) {
+        m_decoded.clear();
+        ag::http::BodyDecoder decoder(encoding, LIMIT);
+        ag::Error<ag::http::BodyDecoderError> error = decoder.decode(ag::as_u8v(encoded), m_handler);
+        ASSERT_NE(error, nullptr);
+        ASSERT_EQ(error->value(), ag::http::BDE_TOO_LARGE);
+        ASSERT_LE(m_decoded.size(), LIMIT);
+    }
+
+    // The limit is reset with the decoder
+    m_decoded.clear();
+    ag::http::BodyDecoder decoder(ag::http::CONTENT_ENCODING_GZIP, LIMIT);
+    decoder.reset(ag::http::CONTENT_ENCODING_GZIP, 0);
+    std::string encoded = deflate_data(bomb, GZIP_WINDOW_BITS);
+    ASSERT_NO_FATAL_FAILURE(decode(decoder, encoded, encoded.size()));
+    ASSERT_EQ(m_decoded.size(), bomb.size());
+}
+
+TEST_F(BodyDecoder, Brotli) {
+    std::string body = make_body();
+    std::string encoded = brotli_data(body);
+    for (size_t chunk_size : {size_t(1), size_t(1000), encoded.size()}) {
+        m_decoded.clear();
+        ag::http::BodyDecoder decoder(ag::http::CONTENT_ENCODING_BROTLI);
+        ASSERT_NO_FATAL_FAILURE(decode(decoder, encoded, chunk_size));
+        ASSERT_EQ(m_decoded, body);
+    }
+}
+
+TEST_F(BodyDecoder, Reset) {
+    ag::http::BodyDecoder decoder(ag::http::CONTENT_ENCODING_BROTLI);
+    std::string encoded = brotli_data("first");
+    ASSERT_NO_FATAL_FAILURE(decode(decoder, encoded, encoded.size()));
+
+    decoder.reset(ag::http::CONTENT_ENCODING_GZIP);
+    encoded = deflate_data("second", GZIP_WINDOW_BITS);
+    ASSERT_NO_FATAL_FAILURE(decode(decoder, encoded, encoded.size()));
+
+    decoder.reset(ag::http::CONTENT_ENCODING_GZIP);
+    encoded = deflate_data("third", GZIP_WINDOW_BITS);
+    ASSERT_NO_FATAL_FAILURE(decode(decoder, encoded, encoded.size()));
+    ASSERT_EQ(m_decoded, "firstsecondthird");
+}
+
+TEST_F(BodyDecoder, Truncated) {
+    std::string encoded = deflate_data(make_body(), GZIP_WINDOW_BITS);
+    encoded.resize(encoded.size() / 2);
+    ag::http::BodyDecoder decoder(ag::http::CONTENT_ENCODING_GZIP);
+    ASSERT_EQ(decoder.decode(ag::as_u8v(encoded), m_handler), nullptr);
+    ag::Error<ag::http::BodyDecoderError> error = decoder.finish();
+    ASSERT_NE(error, nullptr);
+    ASSERT_EQ(error->value(), ag::http::BDE_TRUNCATED_DATA);
+}
+
+TEST_F(BodyDecoder, Corrupted) {
+    std::string encoded = brotli_data(make_body());
+    encoded[encoded.size() / 2] ^= 0x5a;
+    ag::http::BodyDecoder decoder(ag::http::CONTENT_ENCODING_BROTLI);
+    ag::Error<ag::http::BodyDecoderError> error = decoder.decode(ag::as_u8v(encoded), m_handler);
+    ASSERT_NE(error, nullptr);
+    ASSERT_EQ(error->value(), ag::http::BDE_CORRUPTED_DATA);
+}
+
+TEST_F(BodyDecoder, Pool) {
+    ag::http::BodyDecoderPool pool(1);
+
+    ag::http::Headers headers;
+    headers.put("Content-Type", "text/plain");
+    ASSERT_EQ(pool.acquire(headers), nullptr);
+    headers.put("Content-Encoding", "compress");
+    ASSERT_EQ(pool.acquire(headers), nullptr);
+    headers.remove("Content-Encoding");
+    headers.put("Content-Encoding", "gzip");
+    headers.put("Content-Length", "42");
+
+    std::unique_ptr<ag::http::BodyDecoder> decoder = pool.acquire(headers);
+    ASSERT_NE(decoder, nullptr);
+    ASSERT_EQ(decoder->encoding(), ag::http::CONTENT_ENCODING_GZIP);
+    ASSERT_FALSE(headers.contains("Content-Encoding"));
+    ASSERT_FALSE(headers.contains("Content-Length"));
+    ag::http::BodyDecoder *raw = decoder.get();
+    pool.release(std::move(decoder));
+
+    headers.put("Content-Encoding", "br");
+    decoder = pool.acquire(headers);
+    ASSERT_EQ(decoder.get(), raw);
+    ASSERT_EQ(decoder->encoding(), ag::http::CONTENT_ENCODING_BROTLI);
+}
+
+TEST(DecodedBodyFlowControl, ConvertsToWireBytes) {
+    ag::http::DecodedBodyFlowControl flow_control;
+
+    // Not decoded streams are passed through
+    ASSERT_EQ(flow_control.on_consumed(1, 100), 100);
+
+    flow_control.on_received(3, 100, 0);
+    ASSERT_EQ(flow_control.on_finished(5), 0);
+    flow_control.on_received(3, 0, 400);
+    ASSERT_EQ(flow_control.on_consumed(3, 200), 50);
+    flow_control.on_received(3, 10, 0);
+    ASSERT_EQ(flow_control.on_finished(3), 0);
+    ASSERT_EQ(flow_control.on_consumed(3, 200), 60);
+    // The stream is forgotten once all its data is consumed
+    ASSERT_EQ(flow_control.on_consumed(3, 200), 200);
+
+    // The data which has produced nothing to consume is returned at the end
+    flow_control.on_received(7, 30, 0);
+    ASSERT_EQ(flow_control.on_finished(7), 30);
+    ASSERT_EQ(flow_control.on_consumed(7, 10), 10);
+}
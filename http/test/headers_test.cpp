@@ -1,5 +1,7 @@
 #include <algorithm>
 #include <numeric>
+#include <optional>
+#include <string>
 #include <utility>
 
 #include <gtest/gtest.h>
@@ -198,6 +200,111 @@ TEST(HttpHeaders, ValueIterErase) {
     ASSERT_EQ(EXPECTED, collected);
 }
 
+TEST(HttpHeaders, HeaderTokens) {
+    ASSERT_EQ(ag::http::header_token("Content-Length"), ag::http::HEADER_TOKEN_CONTENT_LENGTH);
+    ASSERT_EQ(ag::http::header_token("HOST"), ag::http::HEADER_TOKEN_HOST);
+    ASSERT_EQ(ag::http::header_token("Access-Control-Allow-Credentials"),
+            ag::http::HEADER_TOKEN_ACCESS_CONTROL_ALLOW_CREDENTIALS);
+    ASSERT_EQ(ag::http::header_token(":status"), ag::http::HEADER_TOKEN_PSEUDO_STATUS);
+    ASSERT_EQ(ag::http::header_token("x-custom"), ag::http::HEADER_TOKEN_UNKNOWN);
+    ASSERT_EQ(ag::http::header_token("hosts"), ag::http::HEADER_TOKEN_UNKNOWN);
+    ASSERT_EQ(ag::http::header_token("content-lengtx"), ag::http::HEADER_TOKEN_UNKNOWN);
+    ASSERT_EQ(ag::http::header_token(std::string(64, 'a')), ag::http::HEADER_TOKEN_UNKNOWN);
+    ASSERT_EQ(ag::http::header_token(""), ag::http::HEADER_TOKEN_UNKNOWN);
+    for (int i = ag::http::HEADER_TOKEN_UNKNOWN + 1; i < ag::http::HEADER_TOKEN_COUNT; ++i) {
+        auto token = ag::http::HeaderToken(i);
+        ASSERT_EQ(ag::http::header_token(ag::http::header_token_name(token)), token);
+    }
+}
+
+TEST(HttpHeaders, TokenLookups) {
+    ag::http::Headers hs;
+    hs.put("x-custom", "1");
+    hs.put("Host", "example.org");
+    hs.put("Set-Cookie", "a=1");
+    hs.put(ag::http::HEADER_TOKEN_SET_COOKIE, "b=2");
+    hs.put("TRANSFER-ENCODING", "chunked");
+
+    ASSERT_EQ(hs.gets(ag::http::HEADER_TOKEN_HOST), "example.org");
+    ASSERT_EQ(hs.gets("host"), "example.org");
+    ASSERT_EQ(hs.gets("Transfer-Encoding"), "chunked");
+    ASSERT_FALSE(hs.contains(ag::http::HEADER_TOKEN_CONTENT_LENGTH));
+    ASSERT_EQ(hs.gets("X-Custom"), "1");
+    ASSERT_EQ(hs.token(hs.begin()), ag::http::HEADER_TOKEN_UNKNOWN);
+    ASSERT_EQ(hs.token(std::next(hs.begin())), ag::http::HEADER_TOKEN_HOST);
+
+    auto range = hs.value_range(ag::http::HEADER_TOKEN_SET_COOKIE);
+    ASSERT_EQ((std::vector<std::string_view>{range.first, range.second}), (std::vector<std::string_view>{"a=1", "b=2"}));
+
+    ASSERT_EQ(hs.remove("set-cookie"), 2);
+    ASSERT_FALSE(hs.contains(ag::http::HEADER_TOKEN_SET_COOKIE));
+    ASSERT_EQ(hs.gets(ag::http::HEADER_TOKEN_TRANSFER_ENCODING), "chunked");
+    hs.erase(hs.begin());
+    ASSERT_EQ(hs.gets(ag::http::HEADER_TOKEN_HOST), "example.org");
+    ASSERT_EQ(hs.begin()->name, "Host");
+}
+
+TEST(HttpHeaders, CopyAndMove) {
+    ag::http::Headers hs;
+    for (int i = 0; i < 100; ++i) {
+        hs.put(AG_FMT("x-header-{}", i), std::string(100, 'a' + i % 26));
+    }
+    hs.put("Content-Length", "42");
+    hs.has_body(true);
+
+    ag::http::Headers copy = hs;
+    ASSERT_EQ(copy.str(), hs.str());
+    ASSERT_TRUE(copy.has_body());
+
+    ag::http::Headers moved = std::move(hs);
+    ASSERT_EQ(moved.str(), copy.str());
+    ASSERT_EQ(moved.gets(ag::http::HEADER_TOKEN_CONTENT_LENGTH), "42");
+    ASSERT_EQ(hs.length(), 0); // NOLINT(*-use-after-move)
+    ASSERT_FALSE(hs.contains(ag::http::HEADER_TOKEN_CONTENT_LENGTH));
+
+    moved.clear();
+    ASSERT_EQ(moved.length(), 0);
+    moved.put("Host", "example.org");
+    ASSERT_EQ(moved.gets("host"), "example.org");
+    ASSERT_EQ(copy.gets("x-header-99"), std::string(100, 'a' + 99 % 26));
+}
+
+TEST(HttpHeaders, BorrowedBuffers) {
+    struct Buffer {
+        std::string data;
+        int refs = 1;
+    };
+    auto release = [](void *buffer) {
+        --((Buffer *) buffer)->refs;
+    };
+    Buffer name{"Content-Type"};
+    Buffer value{"text/plain"};
+
+    std::optional<ag::http::Headers> hs;
+    hs.emplace();
+    ++name.refs;
+    ++value.refs;
+    hs->put_borrowed(
+            name.data, value.data, ag::http::header_token(name.data), {&name, release}, {&value, release});
+    ASSERT_EQ(hs->gets(ag::http::HEADER_TOKEN_CONTENT_TYPE), "text/plain");
+    ASSERT_EQ(hs->gets("content-type").data(), value.data.data());
+
+    ag::http::Headers copy = hs.value();
+    ASSERT_NE(copy.gets("content-type").data(), value.data.data());
+    ASSERT_EQ(name.refs, 2);
+    ASSERT_EQ(value.refs, 2);
+
+    ag::http::Headers moved = std::move(hs.value());
+    hs.reset();
+    ASSERT_EQ(name.refs, 2);
+    ASSERT_EQ(moved.gets("content-type").data(), value.data.data());
+
+    moved.clear();
+    ASSERT_EQ(name.refs, 1);
+    ASSERT_EQ(value.refs, 1);
+    ASSERT_EQ(copy.gets("content-type"), "text/plain");
+}
+
 TEST(RequestHttpHeaders, H1ToString) {
     constexpr std::string_view EXPECTED = "GET /path HTTP/1.1\r\n"
                                           "a: 1\r\n"
@@ -260,17 +367,36 @@ TEST(RequestHttpHeaders, H3ToString) {
     ASSERT_EQ(EXPECTED, fmt::format("{}", req));
 }
 
+TEST(RequestHttpHeaders, H2ExtendedConnectToString) {
+    constexpr std::string_view EXPECTED = "CONNECT /chat HTTP/2.0\r\n"
+                                          ":scheme: https\r\n"
+                                          ":authority: example.com\r\n"
+                                          ":protocol: websocket\r\n"
+                                          "sec-websocket-version: 13\r\n"
+                                          "\r\n";
+
+    ag::http::Request req(ag::http::HTTP_2_0, "CONNECT", "/chat");
+    req.scheme("https");
+    req.authority("example.com");
+    req.protocol("websocket");
+    req.headers().put("sec-websocket-version", "13");
+
+    ASSERT_EQ(EXPECTED, req.str());
+    ASSERT_EQ(EXPECTED, fmt::format("{}", req));
+}
+
 TEST(RequestHttpHeaders, Iterator) {
     // clang-format off
     const std::vector<std::pair<std::string_view, std::string_view>> EXPECTED = {
             {":method", "GET"}, {":scheme", "scheme"}, {":path", "/path"}, {":authority", "authority"},
-            {"a", "1"}, {"b", "2"}
+            {":protocol", "protocol"}, {"a", "1"}, {"b", "2"}
     };
     // clang-format on
 
     ag::http::Request req(ag::http::HTTP_2_0, "GET", "/path");
     req.authority("authority");
     req.scheme("scheme");
+    req.protocol("protocol");
     req.headers().put("a", "1");
     req.headers().put("b", "2");
 
@@ -358,3 +484,34 @@ TEST(ResponseHttpHeaders, Iterator) {
 
     ASSERT_EQ(EXPECTED, collected);
 }
+
+TEST(HttpHeaders, SerializeInto) {
+    ag::http::Request h1_request(ag::http::HTTP_1_1, "GET", "/index.html");
+    h1_request.headers().put("Host", "example.org");
+    ag::http::Request h2_connect(ag::http::HTTP_2_0, "CONNECT");
+    h2_connect.authority("example.org:443");
+    ag::http::Response empty_response(ag::http::HTTP_1_0, 204); // NOLINT(*-magic-numbers)
+    ag::http::Response h3_response(ag::http::HTTP_3_0, 200);    // NOLINT(*-magic-numbers)
+    h3_response.headers().put("content-length", "0");
+    ag::http::Headers trailers;
+    trailers.put("x-checksum", "abc");
+
+    auto check = [](const auto &message) {
+        std::string expected = fmt::format("{}", message);
+        ASSERT_EQ(message.size_hint(), expected.size());
+        std::vector<uint8_t> buffer(expected.size() + 8);
+        size_t written = message.serialize_into({buffer.data(), buffer.size()});
+        ASSERT_EQ(std::string_view((char *) buffer.data(), written), expected);
+        ASSERT_EQ(message.str(), expected);
+        if (!expected.empty()) {
+            buffer.assign(expected.size() - 1, 0);
+            ASSERT_EQ(message.serialize_into({buffer.data(), buffer.size()}), 0);
+        }
+    };
+    check(h1_request);
+    check(h2_connect);
+    check(empty_response);
+    check(h3_response);
+    check(trailers);
+    check(ag::http::Headers{});
+}
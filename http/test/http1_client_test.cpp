@@ -143,6 +143,47 @@ TEST_F(Http1Client, OutgoingTrailer) {
     ASSERT_EQ(m_output, AG_FMT("0\r\n{}\r\n", trailer));
 }
 
+TEST_F(Http1Client, DecodeContentEncoding) {
+    ag::http::Http1Client client{
+            ag::http::Http1Client::Callbacks{
+                    .arg = this,
+                    .on_response = on_response,
+                    .on_trailer_headers = on_trailer_headers,
+                    .on_body = on_body,
+                    .on_body_finished = on_body_finished,
+                    .on_stream_finished = on_stream_finished,
+                    .on_output = on_output,
+            },
+            ag::http::Http1Settings{.decode_content_encoding = true},
+    };
+    using namespace std::string_view_literals;
+    // "Hello, world!" compressed with gzip, the literal suffix keeps the embedded zero bytes
+    static constexpr std::string_view BODY = "\x1f\x8b\x08\x00\x00\x00\x00\x00\x02\x03\xf3\x48\xcd\xc9\xc9\xd7\x51"
+                                             "\x28\xcf\x2f\xca\x49\x51\x04\x00\xe6\xc6\xe6\xeb\x0d\x00\x00\x00"sv;
+    std::string data = AG_FMT("HTTP/1.1 200 OK\r\n"
+                              "Content-Encoding: gzip\r\n"
+                              "Content-Length: {}\r\n"
+                              "\r\n"
+                              "{}",
+            BODY.size(), BODY);
+
+    ag::Result result = client.send_request(ag::http::Request(ag::http::HTTP_1_1, "GET", "/"));
+    ASSERT_TRUE(result.has_value()) << result.error()->str();
+
+    // Byte by byte to check the incremental decoding
+    for (char c : data) {
+        ASSERT_NO_FATAL_FAILURE(check_result(client.input({(uint8_t *) &c, 1}), ag::http::Http1Client::InputOk{}));
+    }
+    ASSERT_EQ(m_streams.size(), 1);
+    const Stream &stream = m_streams.begin()->second;
+    ASSERT_TRUE(stream.response.has_value());
+    ASSERT_FALSE(stream.response->headers().contains("Content-Encoding")); // NOLINT(*-unchecked-optional-access)
+    ASSERT_FALSE(stream.response->headers().contains("Content-Length"));   // NOLINT(*-unchecked-optional-access)
+    ASSERT_EQ(stream.body, "Hello, world!");
+    ASSERT_TRUE(stream.body_finished);
+    ASSERT_TRUE(stream.stream_finished);
+}
+
 TEST_F(Http1Client, PipelineSeparatePackets) {
     constexpr std::string_view BODIES[] = {"", "aaa", "bbb", "ccc"};
 
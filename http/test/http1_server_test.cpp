@@ -39,6 +39,8 @@ protected:
 
     std::map<uint64_t, Stream> m_streams;
     std::string m_output;
+    // Number of the chunks in each vectored output
+    std::vector<size_t> m_output_vectors;
 
     static void on_request(void *arg, uint64_t stream_id, ag::http::Request request) {
         auto *self = (Http1Server *) arg;
@@ -72,6 +74,14 @@ protected:
         self->m_output.insert(self->m_output.end(), chunk.begin(), chunk.end());
     }
 
+    static void on_output_vectored(void *arg, const ag::Uint8View *chunks, size_t count) {
+        auto *self = (Http1Server *) arg;
+        self->m_output_vectors.push_back(count);
+        for (size_t i = 0; i < count; ++i) {
+            on_output(arg, chunks[i]);
+        }
+    }
+
     template <typename E>
     void check_no_error(const ag::Error<E> &error) {
         ASSERT_EQ(error, nullptr) << error->str();
@@ -181,6 +191,250 @@ TEST_F(Http1Server, PipelineSinglePacket) {
     }
 }
 
+TEST_F(Http1Server, CompleteAndPartialRequests) {
+    // Complete requests without body, a request the general parser must handle, a partial request
+    constexpr std::string_view REQUESTS[] = {
+            "GET /index.html?q=1 HTTP/1.1\r\n"
+            "Host: example.com\r\n"
+            "Accept:\t*/*\r\n"
+            "X-Empty:\r\n"
+            "\r\n",
+            "HEAD / HTTP/1.1\r\n\r\n",
+            "POST /form HTTP/1.1\r\n"
+            "Host: example.com\r\n"
+            "Content-Length: 3\r\n"
+            "\r\n"
+            "abc",
+            "GET /keep HTTP/1.1\r\n"
+            "Connection: keep-alive\r\n"
+            "\r\n",
+            "GET /last HTTP/1.1\r\n"
+            "Host: example.com\r\n"
+            "\r\n",
+    };
+    std::string input;
+    for (std::string_view request : REQUESTS) {
+        input.append(request);
+    }
+    constexpr size_t LAST_INPUT_SIZE = 10;
+    ASSERT_NO_FATAL_FAILURE(check_result(m_server.input({(uint8_t *) input.data(), input.size() - LAST_INPUT_SIZE}),
+            ag::http::Http1Server::InputOk{}));
+    ASSERT_EQ(m_streams.size(), std::size(REQUESTS) - 1);
+    ASSERT_NO_FATAL_FAILURE(
+            check_result(m_server.input({(uint8_t *) input.data() + input.size() - LAST_INPUT_SIZE, LAST_INPUT_SIZE}),
+                    ag::http::Http1Server::InputOk{}));
+    ASSERT_EQ(m_streams.size(), std::size(REQUESTS));
+
+    auto it = m_streams.begin();
+    const ag::http::Request *request = &it->second.request.value(); // NOLINT(*-unchecked-optional-access)
+    ASSERT_EQ(request->method(), "GET");
+    ASSERT_EQ(request->path(), "/index.html?q=1");
+    ASSERT_EQ(request->version(), ag::http::HTTP_1_1);
+    ASSERT_EQ(request->headers().get("Host"), "example.com");
+    ASSERT_EQ(request->headers().get("accept"), "*/*");
+    ASSERT_EQ(request->headers().get("X-Empty"), "");
+    ASSERT_FALSE(request->headers().has_body());
+
+    request = &(++it)->second.request.value(); // NOLINT(*-unchecked-optional-access)
+    ASSERT_EQ(request->method(), "HEAD");
+
+    request = &(++it)->second.request.value(); // NOLINT(*-unchecked-optional-access)
+    ASSERT_EQ(request->method(), "POST");
+    ASSERT_EQ(it->second.body, "abc");
+    ASSERT_TRUE(it->second.body_finished);
+
+    request = &(++it)->second.request.value(); // NOLINT(*-unchecked-optional-access)
+    ASSERT_EQ(request->path(), "/keep");
+    ASSERT_EQ(request->headers().get("Connection"), "keep-alive");
+
+    request = &(++it)->second.request.value(); // NOLINT(*-unchecked-optional-access)
+    ASSERT_EQ(request->path(), "/last");
+    ASSERT_EQ(request->headers().get("Host"), "example.com");
+}
+
+TEST_F(Http1Server, KeepAliveRequests) {
+    // Stream objects and parser contexts are reused, nothing must leak from the preceding messages
+    constexpr int REQUESTS_NUM = 8;
+    for (int i = 0; i < REQUESTS_NUM; ++i) {
+        std::string request = (i % 2 == 0)
+                ? AG_FMT("GET /{} HTTP/1.1\r\nX-Index: {}\r\n\r\n", i, i)
+                : AG_FMT("POST /{} HTTP/1.1\r\nX-Index: {}\r\nContent-Length: 1\r\n\r\n{}", i, i, i);
+        ASSERT_NO_FATAL_FAILURE(check_result(
+                m_server.input({(uint8_t *) request.data(), request.size()}), ag::http::Http1Server::InputOk{}));
+        ASSERT_EQ(m_streams.size(), i + 1);
+        auto &[stream_id, stream] = *std::prev(m_streams.end());
+        ASSERT_EQ(stream.request->path(), AG_FMT("/{}", i)); // NOLINT(*-unchecked-optional-access)
+        ASSERT_EQ(stream.request->headers().length(), (i % 2 == 0) ? 1 : 2); // NOLINT(*-unchecked-optional-access)
+        ASSERT_EQ(stream.request->headers().get("X-Index"), AG_FMT("{}", i)); // NOLINT(*-unchecked-optional-access)
+        ASSERT_EQ(stream.body, (i % 2 == 0) ? "" : AG_FMT("{}", i));
+
+        ag::http::Response response(ag::http::HTTP_1_1, 200); // NOLINT(*-magic-numbers)
+        response.headers().put("Content-Length", "1");
+        ASSERT_NO_FATAL_FAILURE(check_no_error(m_server.send_response(stream_id, response)));
+        ASSERT_NO_FATAL_FAILURE(check_no_error(m_server.send_body(stream_id, {(uint8_t *) "x", 1}, true)));
+        ASSERT_NO_FATAL_FAILURE(check_output_equals(AG_FMT("{}x", response.str())));
+        ASSERT_TRUE(stream.stream_finished);
+    }
+}
+
+TEST_F(Http1Server, NoRequestsAfterConnectionClose) {
+    constexpr std::string_view CLOSING_REQUEST = "GET /1 HTTP/1.1\r\nConnection: close\r\n\r\n";
+    constexpr std::string_view SIMPLE_REQUEST = "GET /2 HTTP/1.1\r\n\r\n";
+    ASSERT_NO_FATAL_FAILURE(check_result(m_server.input({(uint8_t *) CLOSING_REQUEST.data(), CLOSING_REQUEST.size()}),
+            ag::http::Http1Server::InputOk{}));
+    ASSERT_EQ(m_streams.size(), 1);
+
+    // RFC 9112 9.6: the server must not process any further requests
+    ag::Result result = m_server.input({(uint8_t *) SIMPLE_REQUEST.data(), SIMPLE_REQUEST.size()});
+    ASSERT_FALSE(result.has_value());
+    ASSERT_EQ(m_streams.size(), 1);
+    ASSERT_EQ(m_streams.begin()->second.request->path(), "/1"); // NOLINT(*-unchecked-optional-access)
+}
+
+TEST_F(Http1Server, NoPipelinedRequestsAfterConnectionClose) {
+    constexpr std::string_view REQUESTS = "GET /1 HTTP/1.1\r\nConnection: close\r\n\r\n"
+                                          "GET /2 HTTP/1.1\r\n\r\n";
+    ag::Result result = m_server.input({(uint8_t *) REQUESTS.data(), REQUESTS.size()});
+    ASSERT_FALSE(result.has_value());
+    ASSERT_EQ(m_streams.size(), 1);
+    ASSERT_EQ(m_streams.begin()->second.request->path(), "/1"); // NOLINT(*-unchecked-optional-access)
+}
+
+TEST_F(Http1Server, PipelineOutOfOrderResponses) {
+    constexpr std::string_view REQUESTS = "GET /1 HTTP/1.1\r\n\r\n"
+                                          "GET /2 HTTP/1.1\r\n\r\n";
+    ASSERT_NO_FATAL_FAILURE(check_result(
+            m_server.input({(uint8_t *) REQUESTS.data(), REQUESTS.size()}), ag::http::Http1Server::InputOk{}));
+    ASSERT_EQ(m_streams.size(), 2);
+    const auto &[first_id, first] = *m_streams.begin();
+    const auto &[second_id, second] = *std::next(m_streams.begin());
+
+    ag::http::Response response(ag::http::HTTP_1_1, 200); // NOLINT(*-magic-numbers)
+    response.headers().put("Content-Length", "1");
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server.send_response(second_id, response)));
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server.send_body(second_id, {(uint8_t *) "2", 1}, true)));
+    // The response to the second request waits for the first one
+    ASSERT_NO_FATAL_FAILURE(check_output_equals(""));
+    ASSERT_FALSE(second.stream_finished);
+    ASSERT_NE(m_server.send_body(second_id, {(uint8_t *) "2", 1}, true), nullptr);
+
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server.send_response(first_id, response)));
+    ASSERT_NO_FATAL_FAILURE(check_output_equals(response.str()));
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server.send_body(first_id, {(uint8_t *) "1", 1}, true)));
+    ASSERT_NO_FATAL_FAILURE(check_output_equals(AG_FMT("1{}2", response.str())));
+    ASSERT_TRUE(first.stream_finished);
+    ASSERT_TRUE(second.stream_finished);
+}
+
+TEST_F(Http1Server, PipelineDepthLimit) {
+    ag::http::Http1Server server{
+            ag::http::Http1Server::Callbacks{
+                    .arg = this,
+                    .on_request = on_request,
+                    .on_trailer_headers = on_trailer_headers,
+                    .on_body = on_body,
+                    .on_body_finished = on_body_finished,
+                    .on_stream_finished = on_stream_finished,
+                    .on_output = on_output,
+            },
+            ag::http::Http1Settings{.max_pipelined_requests = 2},
+    };
+
+    std::string requests;
+    for (int i = 0; i < 4; ++i) {
+        requests.append(AG_FMT("GET /{} HTTP/1.1\r\n\r\n", i));
+    }
+    ASSERT_NO_FATAL_FAILURE(check_result(server.input({(uint8_t *) requests.data(), requests.size() - 1}),
+            ag::http::Http1Server::InputOk{}));
+    ASSERT_EQ(m_streams.size(), 2);
+    ASSERT_NO_FATAL_FAILURE(check_result(server.input({(uint8_t *) requests.data() + requests.size() - 1, 1}),
+            ag::http::Http1Server::InputOk{}));
+    ASSERT_EQ(m_streams.size(), 2);
+
+    ag::http::Response response(ag::http::HTTP_1_1, 204); // NOLINT(*-magic-numbers)
+    ASSERT_NO_FATAL_FAILURE(check_no_error(server.send_response(m_streams.begin()->first, response)));
+    ASSERT_EQ(m_streams.size(), 3);
+    ASSERT_NO_FATAL_FAILURE(check_no_error(server.send_response(std::next(m_streams.begin())->first, response)));
+    ASSERT_EQ(m_streams.size(), 4);
+    ASSERT_EQ(std::prev(m_streams.end())->second.request->path(), "/3"); // NOLINT(*-unchecked-optional-access)
+}
+
+TEST_F(Http1Server, PipelinedUpgradeKeepsPayload) {
+    ag::http::Http1Server server{
+            ag::http::Http1Server::Callbacks{
+                    .arg = this,
+                    .on_request = on_request,
+                    .on_trailer_headers = on_trailer_headers,
+                    .on_body = on_body,
+                    .on_body_finished = on_body_finished,
+                    .on_stream_finished = on_stream_finished,
+                    .on_output = on_output,
+            },
+            ag::http::Http1Settings{.max_pipelined_requests = 1},
+    };
+
+    constexpr std::string_view REQUESTS = "GET /1 HTTP/1.1\r\n\r\n"
+                                          "CONNECT example.org:443 HTTP/1.1\r\n"
+                                          "Host: example.org:443\r\n"
+                                          "\r\n"
+                                          "tunnel";
+    ASSERT_NO_FATAL_FAILURE(check_result(
+            server.input({(uint8_t *) REQUESTS.data(), REQUESTS.size()}), ag::http::Http1Server::InputOk{}));
+    ASSERT_EQ(m_streams.size(), 1);
+    ASSERT_NO_FATAL_FAILURE(
+            check_result(server.input({(uint8_t *) " data", 5}), ag::http::Http1Server::InputOk{}));
+
+    // The CONNECT request is parsed once the first response completes, the upgrade is reported by the next input
+    ag::http::Response response(ag::http::HTTP_1_1, 204); // NOLINT(*-magic-numbers)
+    ASSERT_NO_FATAL_FAILURE(check_no_error(server.send_response(m_streams.begin()->first, response)));
+    ASSERT_EQ(m_streams.size(), 2);
+    ASSERT_EQ(std::prev(m_streams.end())->second.request->method(), "CONNECT"); // NOLINT(*-unchecked-optional-access)
+
+    auto result = server.input({(uint8_t *) " more", 5});
+    ASSERT_NO_FATAL_FAILURE(check_result(result, ag::http::Http1Server::InputUpgrade{}));
+    const auto &data = std::get<ag::http::Http1Server::InputUpgrade>(result.value()).data;
+    ASSERT_EQ(std::string_view((char *) data.data(), data.size()), "tunnel data more");
+}
+
+TEST_F(Http1Server, PipelinedUpgradeReportedByCallback) {
+    static std::optional<ag::Result<ag::http::Http1Server::InputResult, ag::http::Http1Error>> postponed_result;
+    postponed_result.reset();
+    ag::http::Http1Server server{
+            ag::http::Http1Server::Callbacks{
+                    .arg = this,
+                    .on_request = on_request,
+                    .on_trailer_headers = on_trailer_headers,
+                    .on_body = on_body,
+                    .on_body_finished = on_body_finished,
+                    .on_stream_finished = on_stream_finished,
+                    .on_output = on_output,
+                    .on_postponed_input_result =
+                            [](void *, ag::Result<ag::http::Http1Server::InputResult, ag::http::Http1Error> result) {
+                                postponed_result.emplace(std::move(result));
+                            },
+            },
+            ag::http::Http1Settings{.max_pipelined_requests = 1},
+    };
+
+    constexpr std::string_view REQUESTS = "GET /1 HTTP/1.1\r\n\r\n"
+                                          "GET /2 HTTP/1.1\r\n"
+                                          "Connection: upgrade\r\n"
+                                          "Upgrade: websocket\r\n"
+                                          "\r\n"
+                                          "frame";
+    ASSERT_NO_FATAL_FAILURE(check_result(
+            server.input({(uint8_t *) REQUESTS.data(), REQUESTS.size()}), ag::http::Http1Server::InputOk{}));
+    ASSERT_EQ(m_streams.size(), 1);
+
+    ag::http::Response response(ag::http::HTTP_1_1, 204); // NOLINT(*-magic-numbers)
+    ASSERT_NO_FATAL_FAILURE(check_no_error(server.send_response(m_streams.begin()->first, response)));
+    ASSERT_EQ(m_streams.size(), 2);
+    ASSERT_TRUE(postponed_result.has_value());
+    ASSERT_NO_FATAL_FAILURE(check_result(*postponed_result, ag::http::Http1Server::InputUpgrade{}));
+    const auto &data = std::get<ag::http::Http1Server::InputUpgrade>(postponed_result->value()).data;
+    ASSERT_EQ(std::string_view((char *) data.data(), data.size()), "frame");
+}
+
 TEST_F(Http1Server, IncomingTrailer) {
     constexpr std::string_view REQUEST = "GET / HTTP/1.1\r\n"
                                          "Content-Type: text/plain\r\n"
@@ -242,6 +496,46 @@ TEST_F(Http1Server, OutgoingTrailer) {
     ASSERT_NO_FATAL_FAILURE(check_output_equals("foo: bar\r\nbar: foo\r\n\r\n"));
 }
 
+TEST_F(Http1Server, VectoredOutput) {
+    ag::http::Http1Server server{
+            ag::http::Http1Server::Callbacks{
+                    .arg = this,
+                    .on_request = on_request,
+                    .on_trailer_headers = on_trailer_headers,
+                    .on_body = on_body,
+                    .on_body_finished = on_body_finished,
+                    .on_stream_finished = on_stream_finished,
+                    .on_output = on_output,
+                    .on_output_vectored = on_output_vectored,
+            },
+    };
+    constexpr std::string_view REQUEST = "GET / HTTP/1.1\r\n\r\n";
+    constexpr std::string_view RESPONSE_BODY = "Hello, world!";
+
+    ASSERT_NO_FATAL_FAILURE(check_result(
+            server.input({(uint8_t *) REQUEST.data(), REQUEST.size()}), ag::http::Http1Server::InputOk{}));
+    ASSERT_EQ(m_streams.size(), 1);
+    uint64_t stream_id = m_streams.begin()->first;
+
+    ag::http::Response response(ag::http::HTTP_1_1, 200); // NOLINT(*-magic-numbers)
+    response.headers().put("Transfer-Encoding", "chunked");
+    ASSERT_NO_FATAL_FAILURE(check_no_error(server.send_response(stream_id, response)));
+    ASSERT_NO_FATAL_FAILURE(check_output_equals(response.str()));
+    ASSERT_TRUE(m_output_vectors.empty());
+
+    ASSERT_NO_FATAL_FAILURE(check_no_error(
+            server.send_body(stream_id, {(uint8_t *) RESPONSE_BODY.data(), RESPONSE_BODY.size()}, false)));
+    ASSERT_NO_FATAL_FAILURE(check_output_equals(AG_FMT("{:X}\r\n{}\r\n", RESPONSE_BODY.size(), RESPONSE_BODY)));
+    ASSERT_EQ(m_output_vectors, std::vector<size_t>{3});
+
+    ag::http::Headers headers;
+    headers.put("foo", "bar");
+    ASSERT_NO_FATAL_FAILURE(check_no_error(server.send_trailer(stream_id, headers, true)));
+    ASSERT_NO_FATAL_FAILURE(check_output_equals("0\r\nfoo: bar\r\n\r\n"));
+    ASSERT_EQ(m_output_vectors, (std::vector<size_t>{3, 3}));
+    ASSERT_TRUE(m_streams[stream_id].stream_finished);
+}
+
 TEST_F(Http1Server, IntermediateResponse) {
     constexpr std::string_view REQUEST = "GET / HTTP/1.1\r\n\r\n";
 
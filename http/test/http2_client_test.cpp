@@ -6,6 +6,7 @@
 #include <vector>
 
 #include <gtest/gtest.h>
+#include <zlib.h>
 
 #include "common/http/http2.h"
 #include "common/logger.h"
@@ -346,3 +347,201 @@ TEST_F(Http2Client, OutgoingTrailer) {
 
     ASSERT_TRUE(m_streams[stream_id].read_finished);
 }
+
+TEST_F(Http2Client, ExtendedConnect) {
+    constexpr uint8_t ENABLE_CONNECT_PROTOCOL_FRAME[] = {0x00, 0x00, 0x06, // length
+            0x04, 0x00,                                                    // frame type = settings, no flags
+            0x00, 0x00, 0x00, 0x00,                                        // stream id
+            0x00, 0x08, 0x00, 0x00, 0x00, 0x01};
+
+    ag::http::Request req(ag::http::HTTP_2_0, "CONNECT", "/chat");
+    req.scheme("https");
+    req.authority("example.com");
+    req.protocol("websocket");
+
+    // The server hasn't enabled extended CONNECT yet
+    ASSERT_TRUE(m_client->submit_request(req, false).has_error());
+
+    ASSERT_NO_FATAL_FAILURE(check_result(
+            m_client->input({ENABLE_CONNECT_PROTOCOL_FRAME, std::size(ENABLE_CONNECT_PROTOCOL_FRAME)}),
+            std::size(ENABLE_CONNECT_PROTOCOL_FRAME)));
+    ag::Result result = m_client->submit_request(req, false);
+    ASSERT_TRUE(result.has_value()) << result.error()->str();
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_client->flush()));
+    ASSERT_GT(m_output.size(), 2 * std::size(SETTINGS_ACK_FRAME));
+    ASSERT_EQ(m_output[std::size(SETTINGS_ACK_FRAME) + 3], 0x01); // frame type = headers
+}
+
+class Http2ClientDecoding : public Http2Client {
+protected:
+    static constexpr size_t FRAME_HEADER_LENGTH = 9;
+    // The protocol default: the session sends WINDOW_UPDATE once the half of a window is consumed
+    static constexpr uint32_t WINDOW_SIZE = 65535;
+    static constexpr uint32_t MAX_FRAME_SIZE = 65535;
+    // More than the half of the windows, so that the whole encoded body returned at once is visible
+    static constexpr size_t DECODED_BODY_SIZE = 40000;
+
+    ag::http::Http2Settings m_settings;
+    uint32_t m_stream_id = 0;
+    std::vector<uint8_t> m_encoded_body;
+
+    Http2ClientDecoding() {
+        m_settings.initial_stream_window_size = WINDOW_SIZE;
+        m_settings.initial_session_window_size = WINDOW_SIZE;
+        m_settings.max_frame_size = MAX_FRAME_SIZE;
+        m_settings.decode_content_encoding = true;
+
+        // Stored blocks keep the encoded body just a bit longer than the decoded one
+        std::vector<uint8_t> body(DECODED_BODY_SIZE, 'a');
+        uLongf encoded_size = compressBound(body.size());
+        m_encoded_body.resize(encoded_size);
+        compress2(m_encoded_body.data(), &encoded_size, body.data(), body.size(), Z_NO_COMPRESSION);
+        m_encoded_body.resize(encoded_size);
+    }
+
+    void SetUp() override {
+        ag::Result make_result = ag::http::Http2Client::make(m_settings,
+                ag::http::Http2Client::Callbacks{
+                        .arg = this,
+                        .on_response = on_response,
+                        .on_trailer_headers = on_trailer_headers,
+                        .on_body = on_body,
+                        .on_stream_read_finished = on_stream_read_finished,
+                        .on_stream_closed = on_stream_closed,
+                        .on_output = on_output,
+                });
+        ASSERT_FALSE(make_result.has_error()) << make_result.error()->str();
+        m_client = std::move(make_result.value());
+        // Forget the streams of the replaced client if the test sets the client up again
+        m_streams.clear();
+
+        ASSERT_NO_FATAL_FAILURE(check_no_error(m_client->flush()));
+        ASSERT_NO_FATAL_FAILURE(check_result(
+                m_client->input({INCOMING_SERVER_SETTINGS_FRAME, std::size(INCOMING_SERVER_SETTINGS_FRAME)}),
+                std::size(INCOMING_SERVER_SETTINGS_FRAME)));
+        ASSERT_NO_FATAL_FAILURE(check_result(
+                m_client->input({SETTINGS_ACK_FRAME, std::size(SETTINGS_ACK_FRAME)}), std::size(SETTINGS_ACK_FRAME)));
+
+        ag::http::Request req(ag::http::HTTP_2_0, "GET", "/");
+        req.scheme("http");
+        req.authority("example.com");
+        ag::Result result = m_client->submit_request(req, true);
+        ASSERT_TRUE(result.has_value()) << result.error()->str();
+        m_stream_id = result.value();
+        ASSERT_NO_FATAL_FAILURE(check_no_error(m_client->flush()));
+        m_output.clear();
+
+        constexpr uint8_t RESPONSE_FRAME[] = {0x00, 0x00, 0x0b, // length
+                0x01, 0x04,                                     // frame type = headers, flags = end headers
+                0x00, 0x00, 0x00, 0x01,                         // stream id
+                // :status: 200, content-encoding: deflate
+                0x88, 0x0f, 0x0b, 0x07, 'd', 'e', 'f', 'l', 'a', 't', 'e'};
+        ASSERT_NO_FATAL_FAILURE(
+                check_result(m_client->input({RESPONSE_FRAME, std::size(RESPONSE_FRAME)}), std::size(RESPONSE_FRAME)));
+        ASSERT_TRUE(m_streams[m_stream_id].response.has_value());
+    }
+
+    void input_data(ag::Uint8View payload, bool end_stream) {
+        std::vector<uint8_t> frame = {uint8_t(payload.size() >> 16), uint8_t(payload.size() >> 8),
+                uint8_t(payload.size()),                 // length
+                0x00, uint8_t(end_stream ? 0x01 : 0x00), // frame type = data
+                0x00, 0x00, 0x00, uint8_t(m_stream_id)};
+        frame.insert(frame.end(), payload.begin(), payload.end());
+        ASSERT_NO_FATAL_FAILURE(check_result(m_client->input({frame.data(), frame.size()}), frame.size()));
+    }
+
+    ag::Uint8View find_output_frame(uint8_t type, uint32_t stream_id) {
+        for (size_t offset = 0; offset + FRAME_HEADER_LENGTH <= m_output.size();) {
+            const uint8_t *header = &m_output[offset];
+            size_t length = FRAME_HEADER_LENGTH + ((header[0] << 16) | (header[1] << 8) | header[2]);
+            uint32_t frame_stream_id = (header[5] << 24) | (header[6] << 16) | (header[7] << 8) | header[8];
+            if (header[3] == type && frame_stream_id == stream_id) {
+                return {header, length};
+            }
+            offset += length;
+        }
+        return {};
+    }
+
+    /**
+     * @return Increment of the WINDOW_UPDATE frame sent on the stream, or 0 if there is none
+     */
+    uint32_t window_increment(uint32_t stream_id) {
+        ag::Uint8View frame = find_output_frame(0x08, stream_id);
+        if (frame.size() != FRAME_HEADER_LENGTH + 4) {
+            return 0;
+        }
+        const uint8_t *p = frame.data() + FRAME_HEADER_LENGTH;
+        return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+};
+
+TEST_F(Http2ClientDecoding, WindowReturnedInProportion) {
+    ASSERT_NO_FATAL_FAILURE(input_data({m_encoded_body.data(), m_encoded_body.size()}, false));
+    ASSERT_EQ(m_streams[m_stream_id].body.size(), DECODED_BODY_SIZE);
+
+    // A quarter of the decoded data stands for a quarter of the received data, not enough for a window update
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_client->consume_stream(m_stream_id, DECODED_BODY_SIZE / 4)));
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_client->flush()));
+    ASSERT_EQ(window_increment(m_stream_id), 0);
+    ASSERT_EQ(window_increment(0), 0);
+
+    // The rest of the decoded data returns the rest of the received data
+    ASSERT_NO_FATAL_FAILURE(
+            check_no_error(m_client->consume_stream(m_stream_id, DECODED_BODY_SIZE - DECODED_BODY_SIZE / 4)));
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_client->flush()));
+    ASSERT_EQ(window_increment(m_stream_id), m_encoded_body.size());
+    ASSERT_EQ(window_increment(0), m_encoded_body.size());
+}
+
+TEST_F(Http2ClientDecoding, CorruptedBodyResetsStream) {
+    std::vector<uint8_t> garbage(m_encoded_body.size(), 'x');
+    ASSERT_NO_FATAL_FAILURE(input_data({garbage.data(), garbage.size()}, false));
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_client->flush()));
+
+    ag::Uint8View rst_stream = find_output_frame(0x03, m_stream_id);
+    ASSERT_EQ(rst_stream.size(), FRAME_HEADER_LENGTH + 4);
+    ASSERT_EQ(rst_stream[FRAME_HEADER_LENGTH + 3], NGHTTP2_INTERNAL_ERROR);
+    const Stream &stream = m_streams[m_stream_id];
+    ASSERT_TRUE(stream.body.empty());
+    ASSERT_TRUE(stream.closed);
+    // Nothing is left for the application to consume, so the connection window is returned right away
+    ASSERT_EQ(window_increment(0), garbage.size());
+}
+
+TEST_F(Http2ClientDecoding, TooLargeBodyResetsStream) {
+    m_settings.max_decoded_body_size = DECODED_BODY_SIZE - 1;
+    ASSERT_NO_FATAL_FAILURE(SetUp());
+
+    ASSERT_NO_FATAL_FAILURE(input_data({m_encoded_body.data(), m_encoded_body.size()}, true));
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_client->flush()));
+
+    ag::Uint8View rst_stream = find_output_frame(0x03, m_stream_id);
+    ASSERT_EQ(rst_stream.size(), FRAME_HEADER_LENGTH + 4);
+    ASSERT_EQ(rst_stream[FRAME_HEADER_LENGTH + 3], NGHTTP2_INTERNAL_ERROR);
+    const Stream &stream = m_streams[m_stream_id];
+    ASSERT_LT(stream.body.size(), DECODED_BODY_SIZE);
+    ASSERT_FALSE(stream.read_finished);
+
+    // The decoded data passed before the failure still returns its share of the window
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_client->consume_stream(m_stream_id, stream.body.size())));
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_client->flush()));
+    ASSERT_EQ(window_increment(0), m_encoded_body.size());
+}
+
+TEST_F(Http2ClientDecoding, WindowReturnedAfterEarlyClose) {
+    constexpr uint8_t RST_STREAM_FRAME[] = {0x00, 0x00, 0x04, // length
+            0x03, 0x00,                                       // frame type = rst stream, no flags
+            0x00, 0x00, 0x00, 0x01,                           // stream id
+            0x00, 0x00, 0x00, 0x08};                          // error code = cancel
+
+    ASSERT_NO_FATAL_FAILURE(input_data({m_encoded_body.data(), m_encoded_body.size()}, false));
+    ASSERT_NO_FATAL_FAILURE(check_result(
+            m_client->input({RST_STREAM_FRAME, std::size(RST_STREAM_FRAME)}), std::size(RST_STREAM_FRAME)));
+    ASSERT_TRUE(m_streams[m_stream_id].closed);
+
+    // The decoded data received before the close still returns the received data to the connection window
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_client->consume_stream(m_stream_id, DECODED_BODY_SIZE)));
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_client->flush()));
+    ASSERT_EQ(window_increment(0), m_encoded_body.size());
+}
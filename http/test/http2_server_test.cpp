@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <map>
 #include <memory>
 #include <optional>
@@ -12,6 +13,7 @@
 #include "common/utils.h"
 
 constexpr std::string_view PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+constexpr size_t FRAME_HEADER_LENGTH = 9;
 
 constexpr uint8_t INCOMING_CLIENT_SETTINGS_FRAME[] = {0x00, 0x00, 0x1e, // length
         0x04, 0x00,                                                     // frame type = window update, no flags
@@ -98,17 +100,22 @@ protected:
     std::map<uint64_t, Stream> m_streams;
     std::vector<uint8_t> m_output;
 
+    ag::http::Http2Server::Callbacks m_callbacks{
+            .arg = this,
+            .on_request = on_request,
+            .on_trailer_headers = on_trailer_headers,
+            .on_body = on_body,
+            .on_stream_read_finished = on_stream_read_finished,
+            .on_stream_closed = on_stream_closed,
+            .on_output = on_output,
+    };
+    ag::http::Http2Settings m_settings;
+    // Number of the chunks in each vectored output
+    std::vector<size_t> m_output_vectors;
+    size_t m_output_calls = 0;
+
     void SetUp() override {
-        ag::Result result = ag::http::Http2Server::make(ag::http::Http2Settings{},
-                ag::http::Http2Server::Callbacks{
-                        .arg = this,
-                        .on_request = on_request,
-                        .on_trailer_headers = on_trailer_headers,
-                        .on_body = on_body,
-                        .on_stream_read_finished = on_stream_read_finished,
-                        .on_stream_closed = on_stream_closed,
-                        .on_output = on_output,
-                });
+        ag::Result result = ag::http::Http2Server::make(m_settings, m_callbacks);
         ASSERT_FALSE(result.has_error()) << result.error()->str();
         m_server = std::move(result.value());
 
@@ -171,6 +178,15 @@ protected:
     static void on_output(void *arg, ag::Uint8View chunk) {
         auto *self = (Http2Server *) arg;
         self->m_output.insert(self->m_output.end(), chunk.begin(), chunk.end());
+        ++self->m_output_calls;
+    }
+
+    static void on_output_vectored(void *arg, const ag::Uint8View *chunks, size_t count) {
+        auto *self = (Http2Server *) arg;
+        self->m_output_vectors.push_back(count);
+        for (size_t i = 0; i < count; ++i) {
+            on_output(arg, chunks[i]);
+        }
     }
 
     template <typename E>
@@ -188,6 +204,22 @@ protected:
         ASSERT_EQ(ag::utils::encode_to_hex({m_output.data(), m_output.size()}), ag::utils::encode_to_hex(data));
         m_output.clear();
     }
+
+    /**
+     * Find the first frame of the specified type in the output
+     * @return The frame including the header, or an empty view if not found
+     */
+    ag::Uint8View find_output_frame(uint8_t type) {
+        for (size_t offset = 0; offset + FRAME_HEADER_LENGTH <= m_output.size();) {
+            const uint8_t *header = &m_output[offset];
+            size_t length = FRAME_HEADER_LENGTH + ((header[0] << 16) | (header[1] << 8) | header[2]);
+            if (header[3] == type) {
+                return {header, length};
+            }
+            offset += length;
+        }
+        return {};
+    }
 };
 
 TEST_F(Http2Server, Exchange) {
@@ -402,3 +434,506 @@ TEST_F(Http2Server, IncomingTrailer) {
 
     ASSERT_TRUE(m_streams[1].closed);
 }
+
+TEST_F(Http2Server, SubmitBodyRef) {
+    ASSERT_NO_FATAL_FAILURE(check_result(
+            m_server->input({GET_REQUEST_FRAME_ES, std::size(GET_REQUEST_FRAME_ES)}), std::size(GET_REQUEST_FRAME_ES)));
+    ASSERT_TRUE(m_streams.contains(1));
+
+    ag::http::Response resp(ag::http::HTTP_2_0, 200); // NOLINT(*-magic-numbers)
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->submit_response(1, resp, false)));
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->flush()));
+    m_output.clear();
+
+    std::vector<ag::Uint8View> released;
+    ag::http::BodyBuffer buffer{
+            .data = {RESPONSE_DATA, std::size(RESPONSE_DATA)},
+            .arg = &released,
+            .release =
+                    [](const void *data, size_t length, void *arg) {
+                        ((std::vector<ag::Uint8View> *) arg)->emplace_back((const uint8_t *) data, length);
+                    },
+    };
+    // Several chunks may be submitted before flushing
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->submit_body_ref(1, buffer, false)));
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->submit_body_ref(1, buffer, true)));
+    ASSERT_TRUE(released.empty());
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->flush()));
+    ASSERT_EQ(released.size(), 2);
+    ASSERT_EQ(released[0].data(), RESPONSE_DATA);
+    ASSERT_EQ(released[0].size(), std::size(RESPONSE_DATA));
+
+    std::vector<uint8_t> expected = {0x00, 0x00, 2 * std::size(RESPONSE_DATA), // length
+            0x00, 0x01,                                                    // frame type = data, flags = end stream
+            0x00, 0x00, 0x00, 0x01};                                       // stream id
+    expected.insert(expected.end(), std::begin(RESPONSE_DATA), std::end(RESPONSE_DATA));
+    expected.insert(expected.end(), std::begin(RESPONSE_DATA), std::end(RESPONSE_DATA));
+    ASSERT_NO_FATAL_FAILURE(check_output_equals({expected.data(), expected.size()}));
+    ASSERT_TRUE(m_streams[1].closed);
+
+    // The buffer is released if it can't be submitted
+    ASSERT_NE(m_server->submit_body_ref(1, buffer, true), nullptr);
+    ASSERT_EQ(released.size(), 3);
+}
+
+struct Http2ServerVectoredOutput : public Http2Server {
+    Http2ServerVectoredOutput() {
+        m_callbacks.on_output_vectored = on_output_vectored;
+    }
+};
+
+TEST_F(Http2ServerVectoredOutput, DataFrames) {
+    ASSERT_NO_FATAL_FAILURE(check_result(
+            m_server->input({GET_REQUEST_FRAME_ES, std::size(GET_REQUEST_FRAME_ES)}), std::size(GET_REQUEST_FRAME_ES)));
+    ASSERT_TRUE(m_streams.contains(1));
+
+    ag::http::Response resp(ag::http::HTTP_2_0, 200); // NOLINT(*-magic-numbers)
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->submit_response(1, resp, false)));
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->flush()));
+    // Frames other than DATA go to the regular output
+    ASSERT_TRUE(m_output_vectors.empty());
+    m_output.clear();
+
+    // Spans several frames of the maximum size
+    std::vector<uint8_t> body(ag::http::Http2Settings::DEFAULT_MAX_FRAME_SIZE * 2 + 42);
+    for (size_t i = 0; i < body.size(); ++i) {
+        body[i] = uint8_t(i);
+    }
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->submit_body(1, {body.data(), body.size()}, true)));
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->flush()));
+
+    std::vector<uint8_t> expected;
+    for (size_t offset = 0; offset < body.size(); offset += ag::http::Http2Settings::DEFAULT_MAX_FRAME_SIZE) {
+        size_t length = std::min<size_t>(body.size() - offset, ag::http::Http2Settings::DEFAULT_MAX_FRAME_SIZE);
+        bool last = offset + length == body.size();
+        const uint8_t header[] = {uint8_t(length >> 16), uint8_t(length >> 8), uint8_t(length), // length
+                0x00, uint8_t(last ? 0x01 : 0x00),                                               // type = data
+                0x00, 0x00, 0x00, 0x01};                                                         // stream id
+        expected.insert(expected.end(), std::begin(header), std::end(header));
+        expected.insert(expected.end(), body.begin() + ssize_t(offset), body.begin() + ssize_t(offset + length));
+    }
+    ASSERT_NO_FATAL_FAILURE(check_output_equals({expected.data(), expected.size()}));
+    ASSERT_EQ(m_output_vectors.size(), 3);
+    ASSERT_TRUE(m_streams[1].closed);
+}
+
+struct Http2ServerOutputBatch : public Http2Server {
+    Http2ServerOutputBatch() {
+        m_settings.output_batch_size = 1024; // NOLINT(*-magic-numbers)
+    }
+};
+
+TEST_F(Http2ServerOutputBatch, CoalescesFrames) {
+    ASSERT_NO_FATAL_FAILURE(check_result(
+            m_server->input({GET_REQUEST_FRAME_ES, std::size(GET_REQUEST_FRAME_ES)}), std::size(GET_REQUEST_FRAME_ES)));
+    ASSERT_TRUE(m_streams.contains(1));
+
+    ag::http::Response resp(ag::http::HTTP_2_0, 200); // NOLINT(*-magic-numbers)
+    for (auto [k, v] : RESPONSE_HEADERS) {
+        resp.headers().put(std::string{k}, std::string{v});
+    }
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->submit_response(1, resp, false)));
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->submit_body(1, {RESPONSE_DATA, std::size(RESPONSE_DATA)}, true)));
+    m_output_calls = 0;
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->flush()));
+
+    // HEADERS and DATA frames are passed to the transport at once
+    ASSERT_EQ(m_output_calls, 1);
+    ASSERT_GT(m_output.size(), 2 * FRAME_HEADER_LENGTH + std::size(RESPONSE_DATA));
+    size_t headers_frame_length = FRAME_HEADER_LENGTH + ((m_output[0] << 16) | (m_output[1] << 8) | m_output[2]);
+    ASSERT_EQ(m_output[3], 0x01); // frame type = headers
+    ASSERT_EQ(m_output.size(), headers_frame_length + FRAME_HEADER_LENGTH + std::size(RESPONSE_DATA));
+    ASSERT_EQ(m_output[headers_frame_length + 3], 0x00); // frame type = data
+    ASSERT_TRUE(std::equal(std::begin(RESPONSE_DATA), std::end(RESPONSE_DATA),
+            m_output.end() - ssize_t(std::size(RESPONSE_DATA))));
+    ASSERT_TRUE(m_streams[1].closed);
+}
+
+struct Http2ServerPriorities : public Http2Server {
+    Http2ServerPriorities() {
+        m_settings.extensible_priorities = true;
+    }
+
+    void SetUp() override {
+        // The client settings frame with SETTINGS_NO_RFC7540_PRIORITIES = 1
+        constexpr uint8_t CLIENT_SETTINGS_FRAME[] = {0x00, 0x00, 0x06, // length
+                0x04, 0x00,                                            // frame type = settings, no flags
+                0x00, 0x00, 0x00, 0x00,                                // stream id
+                0x00, 0x09, 0x00, 0x00, 0x00, 0x01};
+
+        ag::Result result = ag::http::Http2Server::make(m_settings, m_callbacks);
+        ASSERT_FALSE(result.has_error()) << result.error()->str();
+        m_server = std::move(result.value());
+
+        ASSERT_NO_FATAL_FAILURE(
+                check_result(m_server->input({(uint8_t *) PREFACE.data(), PREFACE.length()}), PREFACE.length()));
+        ASSERT_NO_FATAL_FAILURE(check_result(m_server->input({CLIENT_SETTINGS_FRAME, std::size(CLIENT_SETTINGS_FRAME)}),
+                std::size(CLIENT_SETTINGS_FRAME)));
+        ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->flush()));
+        m_output.clear();
+    }
+
+    /**
+     * Make a copy of `GET_REQUEST_FRAME_ES` on the specified stream with an optional `priority` header field
+     */
+    static std::vector<uint8_t> make_request_frame(uint32_t stream_id, std::string_view priority = {}) {
+        std::vector<uint8_t> frame(std::begin(GET_REQUEST_FRAME_ES), std::end(GET_REQUEST_FRAME_ES));
+        frame[8] = uint8_t(stream_id);
+        if (!priority.empty()) {
+            // Literal header field without indexing, new name
+            constexpr std::string_view NAME = "priority";
+            frame.insert(frame.end(), {0x00, uint8_t(NAME.size())});
+            frame.insert(frame.end(), NAME.begin(), NAME.end());
+            frame.push_back(uint8_t(priority.size()));
+            frame.insert(frame.end(), priority.begin(), priority.end());
+            frame[2] = uint8_t(frame.size() - FRAME_HEADER_LENGTH);
+        }
+        return frame;
+    }
+};
+
+TEST_F(Http2ServerPriorities, UrgencyOrder) {
+    constexpr uint8_t PRIORITY_UPDATE_FRAME[] = {0x00, 0x00, 0x07, // length
+            0x10, 0x00,                                            // frame type = priority update, no flags
+            0x00, 0x00, 0x00, 0x00,                                // stream id
+            0x00, 0x00, 0x00, 0x05,                                // prioritized stream id
+            'u', '=', '0'};
+
+    std::vector<uint8_t> input = make_request_frame(1, "u=4");
+    std::vector<uint8_t> frame = make_request_frame(3);
+    input.insert(input.end(), frame.begin(), frame.end());
+    frame = make_request_frame(5);
+    input.insert(input.end(), frame.begin(), frame.end());
+    input.insert(input.end(), std::begin(PRIORITY_UPDATE_FRAME), std::end(PRIORITY_UPDATE_FRAME));
+    ASSERT_NO_FATAL_FAILURE(check_result(m_server->input({input.data(), input.size()}), input.size()));
+    ASSERT_EQ(m_streams.size(), 3);
+
+    // Large enough to take several frames per stream
+    std::vector<uint8_t> body(20000); // NOLINT(*-magic-numbers)
+    ag::http::Response resp(ag::http::HTTP_2_0, 200); // NOLINT(*-magic-numbers)
+    for (uint32_t stream_id : {1, 3, 5}) {
+        std::optional<ag::http::Http2Priority> priority;
+        if (stream_id == 3) {
+            priority = ag::http::Http2Priority{.urgency = 5}; // NOLINT(*-magic-numbers)
+        }
+        ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->submit_response(stream_id, resp, false, priority)));
+        ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->submit_body(stream_id, {body.data(), body.size()}, true)));
+    }
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->flush()));
+
+    // The streams are served one by one from the most urgent one
+    std::vector<uint32_t> data_streams;
+    for (size_t offset = 0; offset + FRAME_HEADER_LENGTH <= m_output.size();) {
+        const uint8_t *header = &m_output[offset];
+        size_t length = (header[0] << 16) | (header[1] << 8) | header[2];
+        uint32_t stream_id = (header[5] << 24) | (header[6] << 16) | (header[7] << 8) | header[8];
+        if (header[3] == 0x00 && (data_streams.empty() || data_streams.back() != stream_id)) {
+            data_streams.push_back(stream_id);
+        }
+        offset += FRAME_HEADER_LENGTH + length;
+    }
+    ASSERT_EQ(data_streams, (std::vector<uint32_t>{5, 1, 3}));
+    ASSERT_TRUE(m_streams[1].closed && m_streams[3].closed && m_streams[5].closed);
+}
+
+struct Http2ServerWindowTuning : public Http2Server {
+    Http2ServerWindowTuning() {
+        m_settings.auto_tune_windows = true;
+    }
+};
+
+TEST_F(Http2ServerWindowTuning, GrowsStreamWindow) {
+    constexpr size_t DATA_FRAME_LENGTH = 16000;
+    constexpr size_t DATA_FRAMES_NUM = 6;
+
+    // The server settings must be acknowledged before the client can use the advertised window
+    std::vector<uint8_t> input(std::begin(SETTINGS_ACK_FRAME), std::end(SETTINGS_ACK_FRAME));
+    input.insert(input.end(), std::begin(GET_REQUEST_FRAME_ES), std::end(GET_REQUEST_FRAME_ES));
+    input[FRAME_HEADER_LENGTH + 4] = 0x04; // flags = end headers
+    for (size_t i = 0; i < DATA_FRAMES_NUM; ++i) {
+        const uint8_t header[] = {0x00, uint8_t(DATA_FRAME_LENGTH >> 8), uint8_t(DATA_FRAME_LENGTH), // length
+                0x00, 0x00,                                                                           // type = data
+                0x00, 0x00, 0x00, 0x01};                                                              // stream id
+        input.insert(input.end(), std::begin(header), std::end(header));
+        input.resize(input.size() + DATA_FRAME_LENGTH);
+    }
+    ASSERT_NO_FATAL_FAILURE(check_result(m_server->input({input.data(), input.size()}), input.size()));
+    ASSERT_EQ(m_streams[1].body.size(), DATA_FRAME_LENGTH * DATA_FRAMES_NUM);
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->flush()));
+
+    // A single PING is sent to measure the round trip
+    ag::Uint8View ping = find_output_frame(0x06);
+    ASSERT_EQ(ping.size(), FRAME_HEADER_LENGTH + 8);
+    std::vector<uint8_t> ping_ack(ping.begin(), ping.end());
+    ping_ack[4] = 0x01; // flags = ack
+    m_output.clear();
+
+    ASSERT_NO_FATAL_FAILURE(check_result(m_server->input({ping_ack.data(), ping_ack.size()}), ping_ack.size()));
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->flush()));
+
+    // The whole window has been received during the round trip, so it is grown to the doubled sample
+    constexpr uint32_t EXPECTED_WINDOW = 2 * DATA_FRAME_LENGTH * DATA_FRAMES_NUM;
+    const uint8_t expected_settings[] = {0x00, 0x00, 0x06, // length
+            0x04, 0x00,                                    // frame type = settings, no flags
+            0x00, 0x00, 0x00, 0x00,                        // stream id
+            0x00, 0x04, uint8_t(EXPECTED_WINDOW >> 24), uint8_t(EXPECTED_WINDOW >> 16), uint8_t(EXPECTED_WINDOW >> 8),
+            uint8_t(EXPECTED_WINDOW)};
+    ASSERT_NO_FATAL_FAILURE(check_output_equals({expected_settings, std::size(expected_settings)}));
+}
+
+TEST_F(Http2Server, HpackStats) {
+    ASSERT_NO_FATAL_FAILURE(check_result(
+            m_server->input({GET_REQUEST_FRAME_ES, std::size(GET_REQUEST_FRAME_ES)}), std::size(GET_REQUEST_FRAME_ES)));
+    ag::http::Response resp(ag::http::HTTP_2_0, 200); // NOLINT(*-magic-numbers)
+    for (auto [k, v] : RESPONSE_HEADERS) {
+        resp.headers().put(std::string{k}, std::string{v});
+    }
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->submit_response(1, resp, true)));
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->flush()));
+
+    ag::http::Http2HpackStats stats = m_server->hpack_stats();
+    ASSERT_EQ(stats.received_blocks, 1);
+    ASSERT_EQ(stats.received_encoded_bytes, std::size(GET_REQUEST_FRAME_ES) - FRAME_HEADER_LENGTH);
+    // The names and values of the fields listed in `GET_REQUEST_STR` plus `:method` and `:path`
+    ASSERT_EQ(stats.received_decoded_bytes, 88);
+    // `:authority`, `user-agent` and `accept` are indexed, 32 bytes of overhead per entry
+    ASSERT_EQ(stats.inflate_table_size, 149);
+    ASSERT_EQ(stats.sent_blocks, 1);
+    ASSERT_EQ(stats.sent_encoded_bytes, m_output.size() - FRAME_HEADER_LENGTH);
+    ASSERT_GT(stats.sent_decoded_bytes, stats.sent_encoded_bytes);
+    ASSERT_GT(stats.deflate_table_size, 0);
+}
+
+struct Http2ServerAdaptiveHeaderTable : public Http2Server {
+    Http2ServerAdaptiveHeaderTable() {
+        m_settings.adaptive_header_table_size = true;
+    }
+};
+
+TEST_F(Http2ServerAdaptiveHeaderTable, ShrinksUnusedTable) {
+    constexpr std::string_view NAME = "x-padding";
+    const std::string value(100, 'x'); // NOLINT(*-magic-numbers)
+
+    // The requests carrying a long literal header field without indexing and Huffman coding
+    std::vector<uint8_t> input;
+    for (uint32_t i = 0; i < ag::http::Http2Settings::HEADER_TABLE_SAMPLE_BLOCKS; ++i) {
+        const uint8_t header[] = {0x00, 0x00, 0x00, // length
+                0x01, 0x05,                         // frame type = headers, flags = end headers + end stream
+                0x00, 0x00, 0x00, uint8_t(2 * i + 1)};
+        size_t offset = input.size();
+        input.insert(input.end(), std::begin(header), std::end(header));
+        // GET http://a/, literal field with a new name
+        input.insert(input.end(), {0x82, 0x86, 0x84, 0x01, 0x01, 'a', 0x00, uint8_t(NAME.size())});
+        input.insert(input.end(), NAME.begin(), NAME.end());
+        input.push_back(uint8_t(value.size()));
+        input.insert(input.end(), value.begin(), value.end());
+        input[offset + 2] = uint8_t(input.size() - offset - FRAME_HEADER_LENGTH);
+    }
+    ASSERT_NO_FATAL_FAILURE(check_result(m_server->input({input.data(), input.size()}), input.size()));
+    ASSERT_EQ(m_streams.size(), ag::http::Http2Settings::HEADER_TABLE_SAMPLE_BLOCKS);
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->flush()));
+
+    constexpr uint32_t EXPECTED_SIZE = ag::http::Http2Settings::MIN_HEADER_TABLE_SIZE;
+    const uint8_t expected_settings[] = {0x00, 0x00, 0x06, // length
+            0x04, 0x00,                                    // frame type = settings, no flags
+            0x00, 0x00, 0x00, 0x00,                        // stream id
+            0x00, 0x01, 0x00, 0x00, uint8_t(EXPECTED_SIZE >> 8), uint8_t(EXPECTED_SIZE)};
+    ASSERT_NO_FATAL_FAILURE(check_output_equals({expected_settings, std::size(expected_settings)}));
+}
+
+struct Http2ServerMemoryLimit : public Http2Server {
+    static constexpr size_t MEMORY_LIMIT = 64 * 1024;
+
+    Http2ServerMemoryLimit() {
+        m_settings.max_session_memory = MEMORY_LIMIT;
+    }
+
+    void SetUp() override {
+        ag::Result result = ag::http::Http2Server::make(m_settings, m_callbacks);
+        ASSERT_FALSE(result.has_error()) << result.error()->str();
+        m_server = std::move(result.value());
+
+        ASSERT_NO_FATAL_FAILURE(
+                check_result(m_server->input({(uint8_t *) PREFACE.data(), PREFACE.length()}), PREFACE.length()));
+        ASSERT_NO_FATAL_FAILURE(check_result(
+                m_server->input({INCOMING_CLIENT_SETTINGS_FRAME, std::size(INCOMING_CLIENT_SETTINGS_FRAME)}),
+                std::size(INCOMING_CLIENT_SETTINGS_FRAME)));
+        ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->flush()));
+        // The decoding table may grow to the advertised size once the settings are acknowledged
+        ASSERT_NO_FATAL_FAILURE(check_result(
+                m_server->input({SETTINGS_ACK_FRAME, std::size(SETTINGS_ACK_FRAME)}), std::size(SETTINGS_ACK_FRAME)));
+        ASSERT_NO_FATAL_FAILURE(
+                check_result(m_server->input({SESSION_WINDOW_UPDATE_FRAME, std::size(SESSION_WINDOW_UPDATE_FRAME)}),
+                        std::size(SESSION_WINDOW_UPDATE_FRAME)));
+    }
+};
+
+TEST_F(Http2ServerMemoryLimit, HeaderTableFitsInLimit) {
+    // The advertised header table size is reduced to a quarter of the limit
+    ASSERT_TRUE(std::equal(std::begin(SETTINGS_ACK_FRAME), std::end(SETTINGS_ACK_FRAME), m_output.begin()));
+    m_output.erase(m_output.begin(), m_output.begin() + std::size(SETTINGS_ACK_FRAME));
+    ag::Uint8View settings = find_output_frame(0x04);
+    ASSERT_GE(settings.size(), FRAME_HEADER_LENGTH + 6);
+    const uint8_t header_table_size[] = {0x00, 0x01, 0x00, 0x00, 0x40, 0x00};
+    ASSERT_TRUE(std::equal(std::begin(header_table_size), std::end(header_table_size),
+            settings.begin() + FRAME_HEADER_LENGTH));
+    m_output.clear();
+
+    // A peer filling the whole table isn't misbehaving
+    constexpr size_t VALUE_LENGTH = 1000;
+    for (uint32_t stream_id = 1; stream_id < 2 * 16 * 1024 / VALUE_LENGTH; stream_id += 2) {
+        std::vector<uint8_t> frame = {0x00, 0x00, 0x00, // length
+                0x01, 0x05,                             // frame type = headers, flags = end headers + end stream
+                0x00, 0x00, 0x00, uint8_t(stream_id),
+                // GET http://a/
+                0x82, 0x86, 0x84, 0x01, 0x01, 'a'};
+        if (stream_id == 1) {
+            // Dynamic table size update to 16384, must precede the fields
+            frame.insert(frame.begin() + FRAME_HEADER_LENGTH, {0x3f, 0xe1, 0x7f});
+        }
+        std::string name = AG_FMT("x-{}", stream_id);
+        // Literal field with incremental indexing and a new name, the value length is 127 + 873
+        frame.insert(frame.end(), {0x40, uint8_t(name.size())});
+        frame.insert(frame.end(), name.begin(), name.end());
+        frame.insert(frame.end(), {0x7f, 0xe9, 0x06});
+        frame.resize(frame.size() + VALUE_LENGTH, 'x');
+        size_t length = frame.size() - FRAME_HEADER_LENGTH;
+        frame[1] = uint8_t(length >> 8);
+        frame[2] = uint8_t(length);
+        ASSERT_NO_FATAL_FAILURE(check_result(m_server->input({frame.data(), frame.size()}), frame.size()));
+        ASSERT_TRUE(m_streams[stream_id].request.has_value());
+    }
+}
+
+TEST_F(Http2ServerMemoryLimit, BodyBackpressure) {
+    ASSERT_NO_FATAL_FAILURE(check_result(
+            m_server->input({GET_REQUEST_FRAME_ES, std::size(GET_REQUEST_FRAME_ES)}), std::size(GET_REQUEST_FRAME_ES)));
+    ag::http::Response resp(ag::http::HTTP_2_0, 200); // NOLINT(*-magic-numbers)
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->submit_response(1, resp, false)));
+
+    std::vector<uint8_t> chunk(MEMORY_LIMIT / 2);
+    size_t usage = m_server->memory_usage();
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->submit_body(1, {chunk.data(), chunk.size()}, false)));
+    ASSERT_GE(m_server->memory_usage(), usage + chunk.size());
+    // The buffered data and the session state leave no room for another chunk
+    ASSERT_NE(m_server->submit_body(1, {chunk.data(), chunk.size()}, true), nullptr);
+
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->flush()));
+    ASSERT_LT(m_server->memory_usage(), usage + chunk.size());
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->submit_body(1, {chunk.data(), chunk.size()}, true)));
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->flush()));
+    ASSERT_TRUE(m_streams[1].closed);
+}
+
+TEST_F(Http2ServerMemoryLimit, BufferedBodyDoesNotBlamePeer) {
+    ASSERT_NO_FATAL_FAILURE(check_result(
+            m_server->input({GET_REQUEST_FRAME_ES, std::size(GET_REQUEST_FRAME_ES)}), std::size(GET_REQUEST_FRAME_ES)));
+    ag::http::Response resp(ag::http::HTTP_2_0, 200); // NOLINT(*-magic-numbers)
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->submit_response(1, resp, false)));
+
+    // A chunk larger than the limit is accepted when nothing else is buffered
+    std::vector<uint8_t> chunk(MEMORY_LIMIT);
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->submit_body(1, {chunk.data(), chunk.size()}, true)));
+    ASSERT_GT(m_server->memory_usage(), MEMORY_LIMIT);
+
+    // The peer's harmless frames are accepted
+    ASSERT_NO_FATAL_FAILURE(
+            check_result(m_server->input({SESSION_WINDOW_UPDATE_FRAME, std::size(SESSION_WINDOW_UPDATE_FRAME)}),
+                    std::size(SESSION_WINDOW_UPDATE_FRAME)));
+    constexpr uint8_t REQUEST_FRAME[] = {0x00, 0x00, 0x06, // length
+            0x01, 0x05,                                    // frame type = headers, flags = end headers + end stream
+            0x00, 0x00, 0x00, 0x03,                        // stream id
+            // GET http://a/
+            0x82, 0x86, 0x84, 0x01, 0x01, 'a'};
+    ASSERT_NO_FATAL_FAILURE(
+            check_result(m_server->input({REQUEST_FRAME, std::size(REQUEST_FRAME)}), std::size(REQUEST_FRAME)));
+    ASSERT_TRUE(m_streams[3].request.has_value());
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->flush()));
+    ASSERT_EQ(find_output_frame(0x07).size(), 0);
+}
+
+TEST_F(Http2ServerMemoryLimit, EnhanceYourCalm) {
+    // Each PING makes the session queue an acknowledgement until the output is flushed
+    constexpr uint8_t PING_FRAME[] = {0x00, 0x00, 0x08, // length
+            0x06, 0x00,                                 // frame type = ping, no flags
+            0x00, 0x00, 0x00, 0x00,                     // stream id
+            0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
+    bool limit_exceeded = false;
+    for (size_t i = 0; !limit_exceeded && i < 900; ++i) {
+        limit_exceeded = m_server->input({PING_FRAME, std::size(PING_FRAME)}).has_error();
+    }
+    ASSERT_TRUE(limit_exceeded);
+
+    m_output.clear();
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->flush()));
+    ag::Uint8View goaway = find_output_frame(0x07);
+    ASSERT_EQ(goaway.size(), FRAME_HEADER_LENGTH + 8);
+    ASSERT_EQ(goaway[FRAME_HEADER_LENGTH + 7], NGHTTP2_ENHANCE_YOUR_CALM);
+}
+
+struct Http2ServerExtendedConnect : public Http2Server {
+    Http2ServerExtendedConnect() {
+        m_settings.enable_connect_protocol = true;
+    }
+
+    void SetUp() override {
+        ag::Result result = ag::http::Http2Server::make(m_settings, m_callbacks);
+        ASSERT_FALSE(result.has_error()) << result.error()->str();
+        m_server = std::move(result.value());
+
+        ASSERT_NO_FATAL_FAILURE(
+                check_result(m_server->input({(uint8_t *) PREFACE.data(), PREFACE.length()}), PREFACE.length()));
+        ASSERT_NO_FATAL_FAILURE(check_result(
+                m_server->input({INCOMING_CLIENT_SETTINGS_FRAME, std::size(INCOMING_CLIENT_SETTINGS_FRAME)}),
+                std::size(INCOMING_CLIENT_SETTINGS_FRAME)));
+        ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->flush()));
+    }
+};
+
+TEST_F(Http2ServerExtendedConnect, WebSocketRequest) {
+    constexpr std::string_view EXPECTED_REQUEST_STR = "CONNECT /chat HTTP/2.0\r\n"
+                                                      ":scheme: https\r\n"
+                                                      ":authority: example.com\r\n"
+                                                      ":protocol: websocket\r\n"
+                                                      "sec-websocket-version: 13\r\n"
+                                                      "\r\n";
+    constexpr uint8_t REQUEST_FRAME[] = {0x00, 0x00, 0x4d, // length
+            0x01, 0x04,                                    // frame type = headers, flags = end headers
+            0x00, 0x00, 0x00, 0x01,                        // stream id
+            // :method: CONNECT, :scheme: https, :path: /chat, :authority: example.com
+            0x02, 0x07, 'C', 'O', 'N', 'N', 'E', 'C', 'T', 0x87, 0x04, 0x05, '/', 'c', 'h', 'a', 't', 0x01, 0x0b, 'e',
+            'x', 'a', 'm', 'p', 'l', 'e', '.', 'c', 'o', 'm',
+            // :protocol: websocket
+            0x00, 0x09, ':', 'p', 'r', 'o', 't', 'o', 'c', 'o', 'l', 0x09, 'w', 'e', 'b', 's', 'o', 'c', 'k', 'e',
+            't',
+            // sec-websocket-version: 13
+            0x00, 0x15, 's', 'e', 'c', '-', 'w', 'e', 'b', 's', 'o', 'c', 'k', 'e', 't', '-', 'v', 'e', 'r', 's',
+            'i', 'o', 'n', 0x02, '1', '3'};
+
+    // The server advertises the support in its settings following the acknowledgement of the client ones
+    ASSERT_TRUE(std::equal(std::begin(SETTINGS_ACK_FRAME), std::end(SETTINGS_ACK_FRAME), m_output.begin()));
+    m_output.erase(m_output.begin(), m_output.begin() + std::size(SETTINGS_ACK_FRAME));
+    ag::Uint8View settings = find_output_frame(0x04);
+    ASSERT_EQ(settings.size(), std::size(OUTGOING_SERVER_SETTINGS_FRAME) + 6);
+    const uint8_t enable_connect_protocol[] = {0x00, 0x08, 0x00, 0x00, 0x00, 0x01};
+    ASSERT_TRUE(std::equal(std::begin(enable_connect_protocol), std::end(enable_connect_protocol),
+            settings.end() - ssize_t(std::size(enable_connect_protocol))));
+    m_output.clear();
+
+    // The settings take effect once the client acknowledges them
+    std::vector<uint8_t> input(std::begin(SETTINGS_ACK_FRAME), std::end(SETTINGS_ACK_FRAME));
+    input.insert(input.end(), std::begin(REQUEST_FRAME), std::end(REQUEST_FRAME));
+    ASSERT_NO_FATAL_FAILURE(check_result(m_server->input({input.data(), input.size()}), input.size()));
+    ASSERT_TRUE(m_streams[1].request.has_value());
+    ASSERT_EQ(m_streams[1].request->protocol(), "websocket"); // NOLINT(*-unchecked-optional-access)
+    ASSERT_EQ(m_streams[1].request->str(), EXPECTED_REQUEST_STR); // NOLINT(*-unchecked-optional-access)
+    ASSERT_FALSE(m_streams[1].read_finished);
+
+    // The tunnel is established with a 2xx response, and the stream carries the protocol data
+    ag::http::Response resp(ag::http::HTTP_2_0, 200); // NOLINT(*-magic-numbers)
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->submit_response(1, resp, false)));
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->submit_body(1, {RESPONSE_DATA, std::size(RESPONSE_DATA)}, false)));
+    ASSERT_NO_FATAL_FAILURE(check_no_error(m_server->flush()));
+    ASSERT_FALSE(find_output_frame(0x00).empty());
+    ASSERT_FALSE(m_streams[1].closed);
+}
@@ -22,6 +22,7 @@
 #include <openssl/pem.h>
 #include <openssl/ssl.h>
 #include <openssl/x509.h>
+#include <zlib.h>
 
 #ifdef OPENSSL_IS_BORINGSSL
 #include <ngtcp2/ngtcp2_crypto_boringssl.h>
@@ -170,6 +171,21 @@ static void make_ssl(ag::UniquePtr<SSL, &SSL_free> &ssl) {
     }
 }
 
+static std::vector<uint8_t> make_encoded_body(size_t decoded_size) {
+    std::vector<uint8_t> decoded(decoded_size);
+    for (size_t i = 0; i < decoded.size(); ++i) {
+        decoded[i] = uint8_t(i);
+    }
+    uLongf length = compressBound(decoded.size());
+    std::vector<uint8_t> encoded(length);
+    if (Z_OK != compress2(encoded.data(), &length, decoded.data(), decoded.size(), Z_NO_COMPRESSION)) {
+        errlog(logger, "Couldn't deflate body");
+        abort();
+    }
+    encoded.resize(length);
+    return encoded;
+}
+
 static void on_request(void *arg, uint64_t stream_id, ag::http::Request request) {
     infolog(logger, "[Stream={}] {}", stream_id, request);
     auto *self = (Session *) arg;
@@ -187,6 +203,21 @@ static void on_request(void *arg, uint64_t stream_id, ag::http::Request request)
         response.emplace(ag::http::HTTP_3_0, 200);
         body.emplace(DOWNLOAD_SIZE);
         eof = true;
+    } else if (method == "GET"
+            && (path == ENCODED_DOWNLOAD_REQUEST_PATH || path == LARGE_ENCODED_DOWNLOAD_REQUEST_PATH)) {
+        response.emplace(ag::http::HTTP_3_0, 200);
+        response->headers().put("content-encoding", "deflate");
+        body.emplace(make_encoded_body(
+                (path == ENCODED_DOWNLOAD_REQUEST_PATH) ? ENCODED_DOWNLOAD_SIZE : 2 * ENCODED_DOWNLOAD_SIZE));
+        eof = true;
+    } else if (method == "GET" && path == CORRUPTED_DOWNLOAD_REQUEST_PATH) {
+        response.emplace(ag::http::HTTP_3_0, 200);
+        response->headers().put("content-encoding", "deflate");
+        body.emplace(CORRUPTED_DOWNLOAD_SIZE, 0xff);
+        eof = true;
+    } else if (method == "CONNECT" && path == EXTENDED_CONNECT_REQUEST_PATH) {
+        response.emplace(ag::http::HTTP_3_0, (req.protocol() == EXTENDED_CONNECT_PROTOCOL) ? 200 : 400);
+        eof = true;
     } else if (method == "POST" && path == UPLOAD_REQUEST_PATH) {
         // waiting for eof
     } else if (method == "GET" && path == TRAILER_REQUEST_PATH) {
@@ -374,7 +405,7 @@ static void register_new_session(ServerSide *self, const ag::SocketAddress &peer
             .remote = peer.c_sockaddr(),
             .remote_len = peer.c_socklen(),
     };
-    ag::Result make_result = ag::http::Http3Server::accept(ag::http::Http3Settings{},
+    ag::Result make_result = ag::http::Http3Server::accept(self->settings,
             ag::http::Http3Server::Callbacks{
                     .arg = session,
                     .on_request = on_request,
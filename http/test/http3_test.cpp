@@ -3,6 +3,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <optional>
+#include <utility>
 
 #ifdef _WIN32
 #define NOCRYPT
@@ -306,6 +307,15 @@ protected:
         ag::Error<ag::http::Http3Error> error = session->flush();
         ASSERT_EQ(error, nullptr) << error->str();
     }
+
+    template <typename Predicate>
+    void exchange_until(Predicate &&done) {
+        while (!done()) {
+            ASSERT_NO_FATAL_FAILURE(wait_readable(ag::Secs{5}));
+            ASSERT_NO_FATAL_FAILURE(read_out_socket());
+            ASSERT_NO_FATAL_FAILURE(flush_session());
+        }
+    }
 };
 
 // Runs the client flow with a specific offered QUIC version. Zero uses the library default
@@ -505,6 +515,100 @@ TEST_F(Http3Client, Upload) {
     }
 }
 
+static void on_body_buffer_released(const void *data, size_t length, void *arg) {
+    ((std::vector<ag::Uint8View> *) arg)->emplace_back((const uint8_t *) data, length);
+}
+
+TEST_F(Http3Client, SubmitBodyRef) {
+    ag::Logger::set_log_level(ag::LOG_LEVEL_DEBUG);
+
+    ag::http::Request request(ag::http::HTTP_3_0, "POST", UPLOAD_REQUEST_PATH);
+    request.authority(SERVER_NAME);
+    request.scheme("https");
+    ag::Result request_result = session->submit_request(request, false);
+    ASSERT_TRUE(request_result.has_value()) << request_result.error()->str();
+    uint64_t stream_id = request_result.value();
+    streams[stream_id] = {};
+
+    std::vector<uint8_t> body(UPLOAD_SIZE);
+    std::vector<ag::Uint8View> released;
+    ag::http::BodyBuffer head{
+            .data = {body.data(), body.size() / 2},
+            .arg = &released,
+            .release = on_body_buffer_released,
+    };
+    ag::http::BodyBuffer tail{
+            .data = {body.data() + head.data.size(), body.size() - head.data.size()},
+            .arg = &released,
+            .release = on_body_buffer_released,
+    };
+    // Several chunks may be submitted before flushing
+    ag::Error<ag::http::Http3Error> error = session->submit_body_ref(stream_id, head, false);
+    ASSERT_EQ(error, nullptr) << error->str();
+    error = session->submit_body_ref(stream_id, tail, true);
+    ASSERT_EQ(error, nullptr) << error->str();
+    ASSERT_NO_FATAL_FAILURE(flush_session());
+    // Sent data may need to be retransmitted until the peer acknowledges it
+    ASSERT_TRUE(released.empty());
+
+    ASSERT_NO_FATAL_FAILURE(exchange_until([&]() {
+        return streams[stream_id].response.has_value() && released.size() == 2;
+    }));
+    ASSERT_EQ(streams[stream_id].response->status_code(), 200) << streams[stream_id].response->str();
+    ASSERT_EQ(released[0].data(), head.data.data());
+    ASSERT_EQ(released[0].size(), head.data.size());
+    ASSERT_EQ(released[1].data(), tail.data.data());
+    ASSERT_EQ(released[1].size(), tail.data.size());
+}
+
+TEST_F(Http3Client, SubmitBodyRefReleasedOnStreamClose) {
+    ag::http::Request request(ag::http::HTTP_3_0, "POST", UPLOAD_REQUEST_PATH);
+    request.authority(SERVER_NAME);
+    request.scheme("https");
+    ag::Result request_result = session->submit_request(request, false);
+    ASSERT_TRUE(request_result.has_value()) << request_result.error()->str();
+    uint64_t stream_id = request_result.value();
+    streams[stream_id] = {};
+
+    // Larger than the stream window, so it can't be acknowledged completely until the peer consumes it
+    std::vector<uint8_t> body(UPLOAD_SIZE);
+    std::vector<ag::Uint8View> released;
+    ag::http::BodyBuffer buffer{
+            .data = {body.data(), body.size()},
+            .arg = &released,
+            .release = on_body_buffer_released,
+    };
+    ag::Error<ag::http::Http3Error> error = session->submit_body_ref(stream_id, buffer, false);
+    ASSERT_EQ(error, nullptr) << error->str();
+    ASSERT_NO_FATAL_FAILURE(flush_session());
+
+    error = session->reset_stream(stream_id, NGHTTP3_H3_REQUEST_CANCELLED);
+    ASSERT_EQ(error, nullptr) << error->str();
+    ASSERT_NO_FATAL_FAILURE(flush_session());
+    ASSERT_TRUE(released.empty());
+
+    ASSERT_NO_FATAL_FAILURE(exchange_until([&]() {
+        return streams[stream_id].closed;
+    }));
+    ASSERT_EQ(released.size(), 1);
+    ASSERT_EQ(released[0].data(), body.data());
+    ASSERT_EQ(released[0].size(), body.size());
+}
+
+TEST_F(Http3Client, SubmitBodyRefReleasedOnFailure) {
+    std::vector<uint8_t> body(1);
+    std::vector<ag::Uint8View> released;
+    ag::http::BodyBuffer buffer{
+            .data = {body.data(), body.size()},
+            .arg = &released,
+            .release = on_body_buffer_released,
+    };
+    // An unknown stream
+    ASSERT_NE(session->submit_body_ref(12345678, buffer, true), nullptr);
+    ASSERT_EQ(released.size(), 1);
+    ASSERT_EQ(released[0].data(), body.data());
+}
+
 TEST_F(Http3Client, StreamSendCapacity) {
     // An unknown stream has no send capacity.
     EXPECT_EQ(0u, session->get_stream_send_capacity(12345678));
@@ -640,6 +744,166 @@ TEST_F(Http3Client, UpdateCallbacks) {
     session->update_callbacks(handler);
 }
 
+// Runs an extended CONNECT request against a server with `enable_connect_protocol` set to the parameter.
+// nghttp3 rejects the `:protocol` pseudo-header unless the server has advertised the support.
+class Http3ClientExtendedConnect : public Http3Client, public ::testing::WithParamInterface<bool> {
+protected:
+    void SetUp() override {
+        server_side.settings.enable_connect_protocol = GetParam();
+        Http3Client::SetUp();
+    }
+};
+
+INSTANTIATE_TEST_SUITE_P(ConnectProtocol, Http3ClientExtendedConnect, ::testing::Bool(),
+        [](const ::testing::TestParamInfo<bool> &info) {
+            return info.param ? "Enabled" : "Disabled";
+        });
+
+TEST_P(Http3ClientExtendedConnect, Exchange) {
+    ag::http::Request request(ag::http::HTTP_3_0, "CONNECT", EXTENDED_CONNECT_REQUEST_PATH);
+    request.authority(SERVER_NAME);
+    request.scheme("https");
+    request.protocol(EXTENDED_CONNECT_PROTOCOL);
+    ag::Result request_result = session->submit_request(request, false);
+    ASSERT_TRUE(request_result.has_value()) << request_result.error()->str();
+    uint64_t stream_id = request_result.value();
+    streams[stream_id] = {};
+    ASSERT_NO_FATAL_FAILURE(flush_session());
+
+    if (GetParam()) {
+        ASSERT_NO_FATAL_FAILURE(exchange_until([&]() {
+            return streams[stream_id].response.has_value();
+        }));
+        // The server responds with 400 unless `Request::protocol()` matches
+        ASSERT_EQ(streams[stream_id].response->status_code(), 200) << streams[stream_id].response->str();
+    } else {
+        ASSERT_NO_FATAL_FAILURE(exchange_until([&]() {
+            return streams[stream_id].closed;
+        }));
+        ASSERT_FALSE(streams[stream_id].response.has_value()) << streams[stream_id].response->str();
+    }
+}
+
+// The client decodes the response bodies. Its connection window is as small as the stream one,
+// so any received data which is not returned to the window stalls the following downloads.
+class Http3ClientDecoding : public Http3Client {
+protected:
+    Http3ClientDecoding() {
+        client_settings.decode_content_encoding = true;
+        client_settings.max_decoded_body_size = ENCODED_DOWNLOAD_SIZE;
+        client_settings.initial_max_data = client_settings.initial_max_stream_data_bidi_local;
+        handler.on_body = on_body_deferrable;
+    }
+
+    // If set, the received body is not consumed until the test does it
+    bool defer_consumption = false;
+    size_t unconsumed = 0;
+
+    static void on_body_deferrable(void *arg, uint64_t stream_id, ag::Uint8View chunk) {
+        auto *self = (Http3ClientDecoding *) arg;
+        if (!self->defer_consumption) {
+            on_body(arg, stream_id, chunk);
+            return;
+        }
+        tracelog(logger, "[Stream={}] {} bytes", stream_id, chunk.size());
+        Stream &stream = self->streams[stream_id];
+        stream.body.insert(stream.body.end(), chunk.begin(), chunk.end());
+        self->unconsumed += chunk.size();
+    }
+
+    void submit_get(std::string_view path, uint64_t &stream_id) {
+        ag::http::Request request(ag::http::HTTP_3_0, "GET", std::string{path});
+        request.authority(SERVER_NAME);
+        request.scheme("https");
+        ag::Result request_result = session->submit_request(request, true);
+        ASSERT_TRUE(request_result.has_value()) << request_result.error()->str();
+        stream_id = request_result.value();
+        streams[stream_id] = {};
+        ASSERT_NO_FATAL_FAILURE(flush_session());
+    }
+
+    // The encoded body is several times larger than the windows, so the download completes only if
+    // the consumed decoded data returns the received encoded data to the windows
+    void check_encoded_download() {
+        uint64_t stream_id = 0;
+        ASSERT_NO_FATAL_FAILURE(submit_get(ENCODED_DOWNLOAD_REQUEST_PATH, stream_id));
+        ASSERT_NO_FATAL_FAILURE(exchange_until([&]() {
+            return streams[stream_id].closed;
+        }));
+
+        const Stream &stream = streams[stream_id];
+        ASSERT_TRUE(stream.response.has_value());
+        ASSERT_EQ(stream.response->status_code(), 200) << stream.response->str();
+        ASSERT_FALSE(stream.response->headers().contains("content-encoding")) << stream.response->str();
+        ASSERT_TRUE(stream.read_finished);
+        ASSERT_EQ(stream.body.size(), ENCODED_DOWNLOAD_SIZE);
+        for (size_t i = 0; i < stream.body.size(); ++i) {
+            ASSERT_EQ(stream.body[i], uint8_t(i)) << i;
+        }
+    }
+};
+
+TEST_F(Http3ClientDecoding, Download) {
+    ag::Logger::set_log_level(ag::LOG_LEVEL_DEBUG);
+
+    ASSERT_NO_FATAL_FAILURE(check_encoded_download());
+}
+
+TEST_F(Http3ClientDecoding, CorruptedBodyResetsStream) {
+    ag::Logger::set_log_level(ag::LOG_LEVEL_DEBUG);
+
+    uint64_t stream_id = 0;
+    ASSERT_NO_FATAL_FAILURE(submit_get(CORRUPTED_DOWNLOAD_REQUEST_PATH, stream_id));
+    ASSERT_NO_FATAL_FAILURE(exchange_until([&]() {
+        return streams[stream_id].closed;
+    }));
+    ASSERT_FALSE(streams[stream_id].read_finished);
+    ASSERT_TRUE(streams[stream_id].body.empty());
+
+    // The discarded body is returned to the connection window
+    ASSERT_NO_FATAL_FAILURE(check_encoded_download());
+}
+
+TEST_F(Http3ClientDecoding, TooLargeBodyResetsStream) {
+    ag::Logger::set_log_level(ag::LOG_LEVEL_DEBUG);
+
+    uint64_t stream_id = 0;
+    ASSERT_NO_FATAL_FAILURE(submit_get(LARGE_ENCODED_DOWNLOAD_REQUEST_PATH, stream_id));
+    ASSERT_NO_FATAL_FAILURE(exchange_until([&]() {
+        return streams[stream_id].closed;
+    }));
+    ASSERT_FALSE(streams[stream_id].read_finished);
+    ASSERT_LE(streams[stream_id].body.size(), ENCODED_DOWNLOAD_SIZE);
+
+    ASSERT_NO_FATAL_FAILURE(check_encoded_download());
+}
+
+TEST_F(Http3ClientDecoding, WindowReturnedAfterEarlyClose) {
+    ag::Logger::set_log_level(ag::LOG_LEVEL_DEBUG);
+
+    defer_consumption = true;
+    uint64_t stream_id = 0;
+    ASSERT_NO_FATAL_FAILURE(submit_get(ENCODED_DOWNLOAD_REQUEST_PATH, stream_id));
+    ASSERT_NO_FATAL_FAILURE(exchange_until([&]() {
+        return streams[stream_id].body.size() >= client_settings.initial_max_stream_data_bidi_local / 2;
+    }));
+
+    ag::Error<ag::http::Http3Error> error = session->reset_stream(stream_id, NGHTTP3_H3_REQUEST_CANCELLED);
+    ASSERT_EQ(error, nullptr) << error->str();
+    ASSERT_NO_FATAL_FAILURE(flush_session());
+    ASSERT_NO_FATAL_FAILURE(exchange_until([&]() {
+        return streams[stream_id].closed;
+    }));
+
+    // The decoded body consumed after the stream is closed still returns the encoded data to the connection
+    defer_consumption = false;
+    error = session->consume_stream(stream_id, std::exchange(unconsumed, 0));
+    ASSERT_EQ(error, nullptr) << error->str();
+    ASSERT_NO_FATAL_FAILURE(flush_session());
+
+    ASSERT_NO_FATAL_FAILURE(check_encoded_download());
+}
+
 TEST(Http3FlushImpl, AllInitialPacketsSentWithPqClientHello) {
 #ifdef _WIN32
     WSADATA wsa_data = {};
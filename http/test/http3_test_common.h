@@ -23,6 +23,19 @@ static constexpr const char *DOWNLOAD_REQUEST_PATH = "/download";
 static constexpr uint64_t DOWNLOAD_SIZE = 4 * ag::http::Http3Settings::DEFAULT_INITIAL_MAX_DATA;
 static constexpr const char *UPLOAD_REQUEST_PATH = "/upload";
 static constexpr uint64_t UPLOAD_SIZE = 4 * ag::http::Http3Settings::DEFAULT_INITIAL_MAX_DATA;
+// The response body is deflated without compression, so the encoded body is a bit larger than the decoded one.
+// The decoded body consists of the bytes `uint8_t(i)`.
+static constexpr const char *ENCODED_DOWNLOAD_REQUEST_PATH = "/encoded-download";
+static constexpr uint64_t ENCODED_DOWNLOAD_SIZE =
+        4 * ag::http::Http3Settings::DEFAULT_INITIAL_MAX_STREAM_DATA_BIDI_LOCAL;
+// Same as `ENCODED_DOWNLOAD_REQUEST_PATH`, but the decoded body is twice as large
+static constexpr const char *LARGE_ENCODED_DOWNLOAD_REQUEST_PATH = "/large-encoded-download";
+// The response body claims to be deflated, but it is not
+static constexpr const char *CORRUPTED_DOWNLOAD_REQUEST_PATH = "/corrupted-download";
+static constexpr uint64_t CORRUPTED_DOWNLOAD_SIZE = 64 * 1024;
+// An extended CONNECT request to this path is accepted only if its protocol is `EXTENDED_CONNECT_PROTOCOL`
+static constexpr const char *EXTENDED_CONNECT_REQUEST_PATH = "/tunnel";
+static constexpr const char *EXTENDED_CONNECT_PROTOCOL = "websocket";
 
 struct ServerSide {
     enum State : int;
@@ -61,6 +74,8 @@ struct ServerSide {
     std::thread worker_thread;
     State state = State{};
     ag::SocketAddress bound_addr{"127.0.0.1:0"};
+    // The settings the sessions are accepted with. May be changed before `run()`.
+    ag::http::Http3Settings settings{};
     evutil_socket_t fd = -1;
     std::unordered_map<ag::SocketAddress, std::unique_ptr<Session>> sessions;
     std::unordered_map<ag::SocketAddress, std::unique_ptr<Session>> closing_sessions;
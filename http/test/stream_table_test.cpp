@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "common/http/stream_table.h"
+
+struct Stream {
+    int value = 0;
+    int resets = 0;
+
+    void reset() {
+        value = 0;
+        ++resets;
+    }
+};
+
+// Odd identifiers as in HTTP/2
+using Table = ag::http::StreamTable<uint32_t, Stream, 1>;
+
+TEST(StreamTable, FindAndErase) {
+    Table table(4);
+    ASSERT_TRUE(table.empty());
+    ASSERT_EQ(table.find(1), nullptr);
+
+    table.emplace(1).value = 1;
+    table.emplace(3).value = 3;
+    ASSERT_EQ(&table.emplace(1), table.find(1));
+    ASSERT_EQ(table.size(), 2);
+    ASSERT_EQ(table.find(1)->value, 1);
+    ASSERT_EQ(table.find(3)->value, 3);
+    ASSERT_EQ(table.find(5), nullptr);
+
+    table.erase(1);
+    ASSERT_EQ(table.find(1), nullptr);
+    ASSERT_EQ(table.size(), 1);
+    table.erase(1);
+    ASSERT_EQ(table.size(), 1);
+}
+
+TEST(StreamTable, Overflow) {
+    Table table(4);
+    // Stream 1 stays open while the identifiers go around the ring
+    table.emplace(1).value = 1;
+    for (uint32_t id = 3; id < 100; id += 2) {
+        table.emplace(id).value = int(id);
+        ASSERT_EQ(table.find(1)->value, 1);
+        ASSERT_EQ(table.find(id)->value, int(id));
+        table.erase(id);
+    }
+    table.emplace(9).value = 9;
+    table.emplace(17).value = 17; // Takes the same slot as 1 and 9
+    ASSERT_EQ(table.find(1)->value, 1);
+    ASSERT_EQ(table.find(9)->value, 9);
+    ASSERT_EQ(table.find(17)->value, 17);
+
+    std::vector<uint32_t> ids = table.ids();
+    std::sort(ids.begin(), ids.end());
+    ASSERT_EQ(ids, (std::vector<uint32_t>{1, 9, 17}));
+
+    table.clear();
+    ASSERT_TRUE(table.empty());
+    ASSERT_EQ(table.find(1), nullptr);
+    ASSERT_EQ(table.find(17), nullptr);
+}
+
+TEST(StreamTable, Recycle) {
+    Table table;
+    Stream *stream = &table.emplace(1);
+    stream->value = 1;
+
+    std::unique_ptr<Stream> extracted = table.extract(1);
+    ASSERT_EQ(extracted.get(), stream);
+    ASSERT_EQ(table.find(1), nullptr);
+    ASSERT_EQ(extracted->value, 1);
+    table.recycle(std::move(extracted));
+
+    // The object of the closed stream is reused
+    ASSERT_EQ(&table.emplace(3), stream);
+    ASSERT_EQ(stream->value, 0);
+    ASSERT_EQ(stream->resets, 1);
+}